@@ -260,6 +260,9 @@ void shl_192(int192_v * const a)
 
 #undef DIV_160_96
 
+// the montgomery kernels use only the helpers above
+#if BUILD_FAMILY(FAMILY_BARRETT32)
+
 #if defined USE_DP
 void div_192_96_d(int96_v * const res, __private uint qd5, const int96_v n, const double_v nf   MODBASECASE_PAR_DEF)
 /* res = q / n (integer division) */
@@ -2087,7 +2090,7 @@ __kernel void cl_barrett32_76(__private uint exponent, const int96_t k_base, con
         exponent, bb.d5, bb.d4, bb.d3, bb.d2, bb.d1, bb.d0, k_base.d2, k_base.d1, k_base.d0, V(f.d2), V(f.d1), V(f.d0), shiftcount);
 #endif
 
-  check_barrett32_76(exponent << (32 - shiftcount), f, tid, bb, RES
+  check_barrett32_76(EXP_SHIFTER(exponent, shiftcount), f, tid, bb, RES
                      MODBASECASE_PAR);
 }
 
@@ -2116,7 +2119,7 @@ __kernel void cl_barrett32_77(__private uint exponent, const int96_t k_base, con
         exponent, bb.d5, bb.d4, bb.d3, bb.d2, bb.d1, bb.d0, k_base.d2, k_base.d1, k_base.d0, V(f.d2), V(f.d1), V(f.d0), shiftcount);
 #endif
 
-  check_barrett32_77(exponent << (32 - shiftcount), f, tid, bb, RES
+  check_barrett32_77(EXP_SHIFTER(exponent, shiftcount), f, tid, bb, RES
                      MODBASECASE_PAR);
 }
 
@@ -2145,7 +2148,7 @@ __kernel void cl_barrett32_79(__private uint exponent, const int96_t k_base, con
         exponent, bb.d5, bb.d4, bb.d3, bb.d2, bb.d1, bb.d0, k_base.d2, k_base.d1, k_base.d0, V(f.d2), V(f.d1), V(f.d0), shiftcount);
 #endif
 
-  check_barrett32_79(exponent << (32 - shiftcount), f, tid, bb, RES
+  check_barrett32_79(EXP_SHIFTER(exponent, shiftcount), f, tid, bb, RES
                      MODBASECASE_PAR);
 }
 
@@ -2174,7 +2177,7 @@ __kernel void cl_barrett32_87(__private uint exponent, const int96_t k_base, con
         exponent, bb.d5, bb.d4, bb.d3, bb.d2, bb.d1, bb.d0, k_base.d2, k_base.d1, k_base.d0, V(f.d2), V(f.d1), V(f.d0), shiftcount);
 #endif
 
-  check_barrett32_87(exponent << (32 - shiftcount), f, tid, bb, bit_max65, RES
+  check_barrett32_87(EXP_SHIFTER(exponent, shiftcount), f, tid, bb, bit_max65, RES
                      MODBASECASE_PAR);
 }
 
@@ -2203,7 +2206,7 @@ __kernel void cl_barrett32_88(__private uint exponent, const int96_t k_base, con
         exponent, bb.d5, bb.d4, bb.d3, bb.d2, bb.d1, bb.d0, k_base.d2, k_base.d1, k_base.d0, V(f.d2), V(f.d1), V(f.d0), shiftcount);
 #endif
 
-  check_barrett32_88(exponent << (32 - shiftcount), f, tid, bb, bit_max65, RES
+  check_barrett32_88(EXP_SHIFTER(exponent, shiftcount), f, tid, bb, bit_max65, RES
                      MODBASECASE_PAR);
 }
 
@@ -2231,7 +2234,7 @@ __kernel void cl_barrett32_92(__private uint exponent, const int96_t k_base, con
   if (tid==TRACE_TID) printf((__constant char *)"cl_barrett32_92: exp=%d, b=%x:%x:%x:%x:%x:%x, k_base=%x:%x:%x, f=%x:%x:%x, shift=%d\n",
         exponent, bb.d5, bb.d4, bb.d3, bb.d2, bb.d1, bb.d0, k_base.d2, k_base.d1, k_base.d0, V(f.d2), V(f.d1), V(f.d0), shiftcount);
 #endif
-  check_barrett32_92(exponent << (32 - shiftcount), f, tid, bb, bit_max65, RES
+  check_barrett32_92(EXP_SHIFTER(exponent, shiftcount), f, tid, bb, bit_max65, RES
                      MODBASECASE_PAR);
 }
 
@@ -2291,7 +2294,7 @@ tid = mad24((uint)get_group_id(0), (uint)get_local_size(0), lid);
 // Init some stuff that will be used for all k's tested  <== this makes the OpenCL compiler abort, supposed to be fixed in Cat 13.4
 // Compute factor corresponding to first sieve bit in this block.
 
-  initial_shifter_value = exponent << (32 - shiftcount);	// Initial shifter value
+  initial_shifter_value = EXP_SHIFTER(exponent, shiftcount);	// Initial shifter value
 
 #if (TRACE_KERNEL > 3)
   if (tid==TRACE_TID) printf((__constant char *)"cl_barrett32_76_gs: shift=%d, shifted exp=%#x\n",
@@ -2436,7 +2439,7 @@ tid = mad24((uint)get_group_id(0), (uint)get_local_size(0), lid);
 // Init some stuff that will be used for all k's tested  <== this makes the OpenCL compiler abort, supposed to be fixed in Cat 13.4
 // Compute factor corresponding to first sieve bit in this block.
 
-  initial_shifter_value = exponent << (32 - shiftcount);	// Initial shifter value
+  initial_shifter_value = EXP_SHIFTER(exponent, shiftcount);	// Initial shifter value
 
 #if (TRACE_KERNEL > 3)
   if (tid==TRACE_TID) printf((__constant char *)"cl_barrett32_77_gs: shift=%d, shifted exp=%#x\n",
@@ -2581,7 +2584,7 @@ tid = mad24((uint)get_group_id(0), (uint)get_local_size(0), lid);
 // Init some stuff that will be used for all k's tested  <== this makes the OpenCL compiler abort, supposed to be fixed in Cat 13.4
 // Compute factor corresponding to first sieve bit in this block.
 
-  initial_shifter_value = exponent << (32 - shiftcount);	// Initial shifter value
+  initial_shifter_value = EXP_SHIFTER(exponent, shiftcount);	// Initial shifter value
 
 #if (TRACE_KERNEL > 3)
   if (tid==TRACE_TID) printf((__constant char *)"cl_barrett32_79_gs: shift=%d, shifted exp=%#x\n",
@@ -2726,7 +2729,7 @@ tid = mad24((uint)get_group_id(0), (uint)get_local_size(0), lid);
 // Init some stuff that will be used for all k's tested  <== this makes the OpenCL compiler abort, supposed to be fixed in Cat 13.4
 // Compute factor corresponding to first sieve bit in this block.
 
-  initial_shifter_value = exponent << (32 - shiftcount);	// Initial shifter value
+  initial_shifter_value = EXP_SHIFTER(exponent, shiftcount);	// Initial shifter value
 
 #if (TRACE_KERNEL > 3)
   if (tid==TRACE_TID) printf((__constant char *)"cl_barrett32_87_gs: shift=%d, shifted exp=%#x\n",
@@ -2871,7 +2874,7 @@ tid = mad24((uint)get_group_id(0), (uint)get_local_size(0), lid);
 // Init some stuff that will be used for all k's tested  <== this makes the OpenCL compiler abort, supposed to be fixed in Cat 13.4
 // Compute factor corresponding to first sieve bit in this block.
 
-  initial_shifter_value = exponent << (32 - shiftcount);	// Initial shifter value
+  initial_shifter_value = EXP_SHIFTER(exponent, shiftcount);	// Initial shifter value
 
 #if (TRACE_KERNEL > 3)
   if (tid==TRACE_TID) printf((__constant char *)"cl_barrett32_88_gs: shift=%d, shifted exp=%#x\n",
@@ -3016,7 +3019,7 @@ tid = mad24((uint)get_group_id(0), (uint)get_local_size(0), lid);
 // Init some stuff that will be used for all k's tested  <== this makes the OpenCL compiler abort, supposed to be fixed in Cat 13.4
 // Compute factor corresponding to first sieve bit in this block.
 
-  initial_shifter_value = exponent << (32 - shiftcount);	// Initial shifter value
+  initial_shifter_value = EXP_SHIFTER(exponent, shiftcount);	// Initial shifter value
 
 #if (TRACE_KERNEL > 3)
   if (tid==TRACE_TID) printf((__constant char *)"cl_barrett32_92_gs: shift=%d, shifted exp=%#x\n",
@@ -3115,3 +3118,5 @@ tid = mad24((uint)get_group_id(0), (uint)get_local_size(0), lid);
   }
 }
 #endif
+
+#endif // BUILD_FAMILY(FAMILY_BARRETT32)
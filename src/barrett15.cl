@@ -1795,6 +1795,7 @@ ff = 1/f as float, needed in div_192_96().
                        );
 }
 
+#if BUILD_FAMILY(FAMILY_BARRETT15)   // the montgomery program only needs the functions
 /******
  * now the actual kernels for 5x15 bit calculations
  *
@@ -1818,7 +1819,7 @@ __kernel void cl_barrett15_69(__private uint exponent, const int75_t k_base, con
         V(f.d4), V(f.d3), V(f.d2), V(f.d1), V(f.d0), shiftcount);
 #endif
 
-  check_barrett15_69(exponent << (32 - shiftcount), f, tid, b_in, bit_max65, RES
+  check_barrett15_69(EXP_SHIFTER(exponent, shiftcount), f, tid, b_in, bit_max65, RES
                      MODBASECASE_PAR);
 }
 
@@ -1839,7 +1840,7 @@ __kernel void cl_barrett15_70(__private uint exponent, const int75_t k_base, con
         V(f.d4), V(f.d3), V(f.d2), V(f.d1), V(f.d0), shiftcount);
 #endif
 
-  check_barrett15_70(exponent << (32 - shiftcount), f, tid, b_in, bit_max65, RES
+  check_barrett15_70(EXP_SHIFTER(exponent, shiftcount), f, tid, b_in, bit_max65, RES
                      MODBASECASE_PAR);
 }
 
@@ -1860,7 +1861,7 @@ __kernel void cl_barrett15_71(__private uint exponent, const int75_t k_base, con
         V(f.d4), V(f.d3), V(f.d2), V(f.d1), V(f.d0), shiftcount);
 #endif
 
-  check_barrett15_71(exponent << (32 - shiftcount), f, tid, b_in, bit_max65, RES
+  check_barrett15_71(EXP_SHIFTER(exponent, shiftcount), f, tid, b_in, bit_max65, RES
                      MODBASECASE_PAR);
 }
 
@@ -1881,7 +1882,7 @@ __kernel void cl_barrett15_73(__private uint exponent, const int75_t k_base, con
         V(f.d4), V(f.d3), V(f.d2), V(f.d1), V(f.d0), shiftcount);
 #endif
 
-  check_barrett15_73(exponent << (32 - shiftcount), f, tid, b_in, bit_max65, RES
+  check_barrett15_73(EXP_SHIFTER(exponent, shiftcount), f, tid, b_in, bit_max65, RES
                      MODBASECASE_PAR);
 }
 
@@ -1901,10 +1902,41 @@ __kernel void cl_barrett15_74(__private uint exponent, const int75_t k_base, con
         V(f.d4), V(f.d3), V(f.d2), V(f.d1), V(f.d0), shiftcount);
 #endif
 
-  check_barrett15_74(exponent << (32 - shiftcount), f, tid, b_in, bit_max65, RES
+  check_barrett15_74(EXP_SHIFTER(exponent, shiftcount), f, tid, b_in, bit_max65, RES
                      MODBASECASE_PAR);
 }
 
+/*
+ * bulk mode: the grid contains the candidates of several exponents and
+ * classes. All candidates of a work group belong to the same exponent,
+ * blocks[] has the parameters of each work group. The factors are reported
+ * per exponent, 32 uints of RES for each one.
+ */
+__kernel void cl_barrett15_69_bulk(const __global bulk_block_t * restrict blocks, const __global uint * restrict k_tab,
+                           __global uint * restrict RES
+                           MODBASECASE_PAR_DEF         )
+{
+  __private int75_v f;
+  __private uint tid;
+  const __global bulk_block_t * restrict blk = blocks + get_group_id(0);
+  const int75_t  k_base   = blk->k_base;
+  const uint     exponent = blk->exponent;
+  const uint8    b_in     = vload8(0, blk->b_in);
+
+	tid = mad24((uint)get_group_id(0), (uint)get_local_size(0), (uint)get_local_id(0)) * VECTOR_SIZE;
+
+  calculate_FC75(exponent, tid, k_tab, k_base, &f);
+
+#if (TRACE_KERNEL > 1)
+  if (tid==TRACE_TID) printf((__constant char *)"cl_barrett15_69_bulk: exp=%u, f=%x:%x:%x:%x:%x, shift=%d\n",
+        exponent, V(f.d4), V(f.d3), V(f.d2), V(f.d1), V(f.d0), blk->shiftcount);
+#endif
+
+  check_barrett15_69(exponent << (32 - blk->shiftcount), f, tid, b_in, blk->bit_max65, RES + 32 * blk->res_index
+                     MODBASECASE_PAR);
+}
+#endif
+
 
 /****************************************
  ****************************************
@@ -3486,6 +3518,7 @@ for(;;)
 }
 
 
+#if BUILD_FAMILY(FAMILY_BARRETT15)
 #ifndef CL_GPU_SIEVE
 /****
  * the actual kernels for handling 6x15bit computations
@@ -3506,7 +3539,7 @@ __kernel void cl_barrett15_82(__private uint exponent, const int75_t k_base, con
   if (tid==TRACE_TID) printf((__constant char *)"cl_barrett15_82: tid=%d, f=%x:%x:%x:%x:%x:%x, shift=%d\n",
         tid, V(f.d5), V(f.d4), V(f.d3), V(f.d2), V(f.d1), V(f.d0), shiftcount);
 #endif
-  check_barrett15_82(exponent << (32 - shiftcount), f, tid, b_in, bit_max65, RES
+  check_barrett15_82(EXP_SHIFTER(exponent, shiftcount), f, tid, b_in, bit_max65, RES
                      MODBASECASE_PAR);
 }
 
@@ -3525,7 +3558,7 @@ __kernel void cl_barrett15_83(__private uint exponent, const int75_t k_base, con
   if (tid==TRACE_TID) printf((__constant char *)"cl_barrett15_83: tid=%d, f=%x:%x:%x:%x:%x:%x, shift=%d\n",
         tid, V(f.d5), V(f.d4), V(f.d3), V(f.d2), V(f.d1), V(f.d0), shiftcount);
 #endif
-  check_barrett15_83(exponent << (32 - shiftcount), f, tid, b_in, bit_max65, RES
+  check_barrett15_83(EXP_SHIFTER(exponent, shiftcount), f, tid, b_in, bit_max65, RES
                      MODBASECASE_PAR);
 }
 
@@ -3544,7 +3577,7 @@ __kernel void cl_barrett15_88(__private uint exponent, const int75_t k_base, con
   if (tid==TRACE_TID) printf((__constant char *)"cl_barrett15_88: tid=%d, f=%x:%x:%x:%x:%x:%x, shift=%d\n",
         tid, V(f.d5), V(f.d4), V(f.d3), V(f.d2), V(f.d1), V(f.d0), shiftcount);
 #endif
-  check_barrett15_88(exponent << (32 - shiftcount), f, tid, b_in, bit_max65, RES
+  check_barrett15_88(EXP_SHIFTER(exponent, shiftcount), f, tid, b_in, bit_max65, RES
                      MODBASECASE_PAR);
 }
 
@@ -3589,7 +3622,7 @@ __kernel void __attribute__((reqd_work_group_size(256, 1, 1)))
 // Init some stuff that will be used for all k's tested  <== this makes the OpenCL compiler abort, supposed to be fixed in Cat 13.4
 // Compute factor corresponding to first sieve bit in this block.
 
-  initial_shifter_value = exponent << (32 - shiftcount);	// Initial shifter value
+  initial_shifter_value = EXP_SHIFTER(exponent, shiftcount);	// Initial shifter value
 
   exp75.d2=exponent>>29;exp75.d1=(exponent>>14)&0x7FFF;exp75.d0=(exponent<<1)&0x7FFF;	// exp75 = 2 * exponent  // PERF: exp.d1=amd_bfe(exp, 15, 14)
 
@@ -3725,7 +3758,7 @@ __kernel void __attribute__((reqd_work_group_size(256, 1, 1)))
 // Init some stuff that will be used for all k's tested  <== this makes the OpenCL compiler abort, supposed to be fixed in Cat 13.4
 // Compute factor corresponding to first sieve bit in this block.
 
-  initial_shifter_value = exponent << (32 - shiftcount);	// Initial shifter value
+  initial_shifter_value = EXP_SHIFTER(exponent, shiftcount);	// Initial shifter value
 
   exp75.d2=exponent>>29;exp75.d1=(exponent>>14)&0x7FFF;exp75.d0=(exponent<<1)&0x7FFF;	// exp75 = 2 * exponent  // PERF: exp.d1=amd_bfe(exp, 15, 14)
 
@@ -3861,7 +3894,7 @@ __kernel void __attribute__((reqd_work_group_size(256, 1, 1)))
 // Init some stuff that will be used for all k's tested  <== this makes the OpenCL compiler abort, supposed to be fixed in Cat 13.4
 // Compute factor corresponding to first sieve bit in this block.
 
-  initial_shifter_value = exponent << (32 - shiftcount);	// Initial shifter value
+  initial_shifter_value = EXP_SHIFTER(exponent, shiftcount);	// Initial shifter value
 
   exp75.d2=exponent>>29;exp75.d1=(exponent>>14)&0x7FFF;exp75.d0=(exponent<<1)&0x7FFF;	// exp75 = 2 * exponent  // PERF: exp.d1=amd_bfe(exp, 15, 14)
 
@@ -3997,7 +4030,7 @@ __kernel void __attribute__((reqd_work_group_size(256, 1, 1)))
 // Init some stuff that will be used for all k's tested  <== this makes the OpenCL compiler abort, supposed to be fixed in Cat 13.4
 // Compute factor corresponding to first sieve bit in this block.
 
-  initial_shifter_value = exponent << (32 - shiftcount);	// Initial shifter value
+  initial_shifter_value = EXP_SHIFTER(exponent, shiftcount);	// Initial shifter value
 
   exp75.d2=exponent>>29;exp75.d1=(exponent>>14)&0x7FFF;exp75.d0=(exponent<<1)&0x7FFF;	// exp75 = 2 * exponent  // PERF: exp.d1=amd_bfe(exp, 15, 14)
 
@@ -4128,7 +4161,7 @@ __kernel void __attribute__((reqd_work_group_size(256, 1, 1)))
 // Init some stuff that will be used for all k's tested  <== this makes the OpenCL compiler abort, supposed to be fixed in Cat 13.4
 // Compute factor corresponding to first sieve bit in this block.
 
-  initial_shifter_value = exponent << (32 - shiftcount);	// Initial shifter value
+  initial_shifter_value = EXP_SHIFTER(exponent, shiftcount);	// Initial shifter value
 
   exp75.d2=exponent>>29;exp75.d1=(exponent>>14)&0x7FFF;exp75.d0=(exponent<<1)&0x7FFF;	// exp75 = 2 * exponent  // PERF: exp.d1=amd_bfe(exp, 15, 14)
 
@@ -4272,7 +4305,7 @@ __kernel void __attribute__((reqd_work_group_size(256, 1, 1)))
 // Init some stuff that will be used for all k's tested  <== this makes the OpenCL compiler abort, supposed to be fixed in Cat 13.4
 // Compute factor corresponding to first sieve bit in this block.
 
-  initial_shifter_value = exponent << (32 - shiftcount);	// Initial shifter value
+  initial_shifter_value = EXP_SHIFTER(exponent, shiftcount);	// Initial shifter value
 
   exp75.d2=exponent>>29;exp75.d1=(exponent>>14)&0x7FFF;exp75.d0=(exponent<<1)&0x7FFF;	// exp75 = 2 * exponent  // PERF: exp.d1=amd_bfe(exp, 15, 14)
 
@@ -4412,7 +4445,7 @@ __kernel void __attribute__((reqd_work_group_size(256, 1, 1)))
 // Init some stuff that will be used for all k's tested  <== this makes the OpenCL compiler abort, supposed to be fixed in Cat 13.4
 // Compute factor corresponding to first sieve bit in this block.
 
-  initial_shifter_value = exponent << (32 - shiftcount);	// Initial shifter value
+  initial_shifter_value = EXP_SHIFTER(exponent, shiftcount);	// Initial shifter value
 
   exp75.d2=exponent>>29;exp75.d1=(exponent>>14)&0x7FFF;exp75.d0=(exponent<<1)&0x7FFF;	// exp75 = 2 * exponent  // PERF: exp.d1=amd_bfe(exp, 15, 14)
 
@@ -4552,7 +4585,7 @@ __kernel void __attribute__((reqd_work_group_size(256, 1, 1)))
 // Init some stuff that will be used for all k's tested  <== this makes the OpenCL compiler abort, supposed to be fixed in Cat 13.4
 // Compute factor corresponding to first sieve bit in this block.
 
-  initial_shifter_value = exponent << (32 - shiftcount);	// Initial shifter value
+  initial_shifter_value = EXP_SHIFTER(exponent, shiftcount);	// Initial shifter value
 
   exp75.d2=exponent>>29;exp75.d1=(exponent>>14)&0x7FFF;exp75.d0=(exponent<<1)&0x7FFF;	// exp75 = 2 * exponent  // PERF: exp.d1=amd_bfe(exp, 15, 14)
 
@@ -4660,3 +4693,4 @@ __kernel void __attribute__((reqd_work_group_size(256, 1, 1)))
   }
 }
 #endif
+#endif
@@ -22,7 +22,8 @@ along with mfaktc (mfakto).  If not, see <http://www.gnu.org/licenses/>.
 #include "params.h"
 #include "timer.h"
 #include "my_types.h"
-extern mystuff_t    mystuff;
+#include "threads.h"
+extern THREAD_LOCAL mystuff_t mystuff;
 
 unsigned int checkpoint_checksum(char *string, int chars)
 /* generates a CRC-32 like checksum of the string */
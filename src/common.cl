@@ -98,6 +98,21 @@ uint popcount(uint x)
 #define amd_max3(src0, src1, src2)  max(src0, max(src1, src2))
 #endif
 
+// exponent-specialized kernels (ExponentKernels=1): the host builds the program
+// once more with -DFIXED_EXPONENT=<exp>u -DFIXED_SHIFTCOUNT=<shiftcount> of the
+// current class. The exponent and shifter are then compile-time constants and
+// the compiler can unroll the square-and-shift loops with constant branches.
+// The kernel arguments stay the same, they are just ignored.
+#ifdef FIXED_EXPONENT
+#define KERNEL_EXPONENT(exp)   (FIXED_EXPONENT)
+#define KERNEL_SHIFTCOUNT(sc)  (FIXED_SHIFTCOUNT)
+#else
+#define KERNEL_EXPONENT(exp)   (exp)
+#define KERNEL_SHIFTCOUNT(sc)  (sc)
+#endif
+// the exponent without the bits that were preprocessed into b_in / b_preinit
+#define EXP_SHIFTER(exp, sc)   (KERNEL_EXPONENT(exp) << (32 - KERNEL_SHIFTCOUNT(sc)))
+
 #define EVAL_RES_b(comp) \
   if((a.d2.comp|a.d1.comp)==0 && a.d0.comp==1) \
   { \
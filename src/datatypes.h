@@ -65,6 +65,19 @@ typedef struct _int75_t
   uint d0,d1,d2,d3,d4;
 }int75_t;
 
+/* bulk mode (cl_barrett15_69_bulk): the parameters of one work group,
+   the host version is in my_types.h */
+typedef struct _bulk_block_t
+{
+  uint    exponent;
+  uint    shiftcount;
+  uint    res_index;    // the factors of this exponent go to RES[32*res_index ...]
+  int     bit_max65;
+  int75_t k_base;
+  uint    b_in[8];
+  uint    pad[3];
+}bulk_block_t;
+
 // 10x15bit
 typedef struct _int150_t
 {
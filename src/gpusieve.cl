@@ -236,6 +236,7 @@ __inline void bitOrSometimesIffy (__local uchar *locsieve, uint bclr)
 // OK as it will just cost us some extra testing of candidates which is cheaper than the cost of using
 // atomic operations.
 
+#if BUILD_FAMILY(FAMILY_GPUSIEVE)   // only the sieve program has the sieve kernels, the TF kernels only need extract_bits
 /*
 	Expect as input a set of primes to sieve with, their inverses, and the first bit to clear.
 
@@ -1446,6 +1447,56 @@ if (factor_mod_p != 0)
 }	
 
 
+// Move the bit-to-clear values of all primes forward by "advance" bits (one sieve block): the same
+// result as CalcBitToClear for k_base + advance * NUM_CLASSES, but without the 64-bit modulo operations.
+
+__kernel void __attribute__((reqd_work_group_size(256, 1, 1))) CalcBitToClearAdvance (uint advance, __global int *calc_info, __global uchar *pinfo_dev)
+{
+	uint	index;		// Index for prime data in calc_info
+	uint	mask;		// Mask that tells us what bits must be preserved in pinfo_dev when setting bit-to-clear
+	uint	prime;		// Advance the bit-to-clear of this prime number
+	uint	step;		// advance mod prime
+	uint	bit_to_clear;	// Current bit to clear
+
+// Locate the bit-to-clear of the prime exactly like CalcBitToClear does
+
+	if (get_group_id(0) == 0) {
+		if (get_local_id(0) < primesNotSieved || get_local_id(0) >= primesNotSieved + primesHandledWithSpecialCode) return;
+		pinfo_dev += get_local_id(0) * 2;
+		index = get_local_id(0);
+	}
+	else {
+		pinfo_dev += calc_info[(get_group_id(0) - 1)];
+		pinfo_dev += get_local_id(0) * 4;
+		index = calc_info[MAX_PRIMES_PER_THREAD + (get_group_id(0) - 1)];
+		index += get_local_id(0) * calc_info[MAX_PRIMES_PER_THREAD*2 + (get_group_id(0) - 1)];
+		mask = calc_info[MAX_PRIMES_PER_THREAD*3 + (get_group_id(0) - 1)];
+	}
+
+	prime = calc_info[MAX_PRIMES_PER_THREAD*4 + index * 2];
+	step = advance % prime;
+
+	if (get_group_id(0) == 0) bit_to_clear = *pinfo16;
+	else                      bit_to_clear = *pinfo32 & ~mask;
+
+	// the new bit-to-clear is (bit_to_clear - advance) mod prime
+	bit_to_clear = (bit_to_clear >= step) ? bit_to_clear - step : bit_to_clear + prime - step;
+
+#if (TRACE_SIEVE_KERNEL > 2)
+    if (get_global_id(0) == TRACE_SIEVE_TID) printf((__constant char *)"CalcBitToClearAdvance: prime=%d, advance=%u, bit_to_clear=%d\n", prime, advance, bit_to_clear);
+#endif
+
+	if (get_group_id(0) == 0) {
+		*pinfo16 = bit_to_clear;
+	}
+	else {
+		*pinfo32 = (*pinfo32 & mask) + bit_to_clear;
+	}
+}
+
+#endif
+
+
 /* This function is used at the beginning of each GPU-sieve TF-kernel in order to extract the bits from the sieve.
    returns total number of bits set */
 
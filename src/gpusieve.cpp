@@ -38,12 +38,14 @@ See (http://www.mersenneforum.org/showthread.php?t=11900) for Ben's initial work
 #include "compatibility.h"
 #include "mfakto.h"
 #include "output.h"
+#include "threads.h"
+#include "gpusieve_host.h"
+#include "gpusieve_cache.h"
 
 // valgrind tests complain a lot about the blocks being uninitialized
 #define malloc(x) calloc(x,1)
 
-extern  cl_command_queue    QUEUE;
-extern  mystuff_t           mystuff;
+extern  THREAD_LOCAL cl_command_queue    QUEUE;
 
 #define gen_pinv(p)  (0xFFFFFFFF / (p) + 1)
 #define gen_sloppy_pinv(p)  ((cl_uint) floor (4294967296.0 / (p) - 0.5))
@@ -51,14 +53,18 @@ extern  mystuff_t           mystuff;
 const cl_uint block_size_in_bytes = 8192;    // Size of shared memory array in bytes
 const cl_uint block_size = block_size_in_bytes * 8;  // Number of bits generated by each block
 const cl_uint threadsPerBlock = 256;      // Threads per block
-static    int  gpusieve_initialized = 0;
-static cl_uint last_exponent_initialized = 0;
-static cl_uint last_maxp = 0xFFFFFFFF;  // 0 is a bad choice for "uninitialized" as it can happen for small GPUSievePrimes
+// per device: each device thread has its own GPU sieve
+static THREAD_LOCAL    int  gpusieve_initialized = 0;
+static THREAD_LOCAL cl_uint last_exponent_initialized = 0;
+static THREAD_LOCAL cl_uint last_maxp = 0xFFFFFFFF;  // 0 is a bad choice for "uninitialized" as it can happen for small GPUSievePrimes
+static THREAD_LOCAL cl_uint sieve_info_size = 0, calc_info_size = 0;  // for reading the buffers back with GPUSieveHost=2
+static THREAD_LOCAL     int class_prepared = 0;       // gpusieve_prepare_class has already queued CalcBitToClear for ...
+static THREAD_LOCAL unsigned long long prepared_k_min; // ... this class
 
 
 // Global vars.  These could be moved to mystuff, but no other code needs to know about these internal values.
 
-cl_uint primes_per_thread = 0;    // Number of "rows" in the GPU sieving info array that each thread processes
+THREAD_LOCAL cl_uint primes_per_thread = 0;    // Number of "rows" in the GPU sieving info array that each thread processes
 
 // Various padding required to keep warps accessing primes data on 128-byte boundaries
 
@@ -71,50 +77,178 @@ cl_uint primes_per_thread = 0;    // Number of "rows" in the GPU sieving info ar
 extern "C" {
 #endif
 
-// Simple CPU sieve of erathosthenes for small limits - not efficient for large limits.
+// CPU sieve of Eratosthenes generating the first "limit" primes.
+// Bit-packed (odd numbers only) and segmented: each segment of SOE_SEGMENT_BYTES is sieved with the
+// primes up to the square root of the upper bound of the limit-th prime. Large limits are split
+// between several threads: all threads count the primes of their segments, then sieve them again
+// and store the primes at the positions given by the counts of the segments before.
 
-void tiny_soe (cl_uint limit, cl_uint *primes)
+#define SOE_SEGMENT_BYTES  32768                    // fits into the L1 / L2 cache
+#define SOE_SEGMENT_BITS   (SOE_SEGMENT_BYTES * 8)  // one bit per odd number
+#define SOE_THREAD_SEGMENTS 8                       // use threads only with at least this many segments per thread
+
+typedef struct
 {
-  cl_uchar *flags;
-  cl_ushort prime;
-  cl_uint i, j, sieve_size;
-  cl_uint it;
-
-  // Allocate flags (assume we can generate N primes by sieving up to 40*N.  We only need flags for odd numbers)
-  sieve_size = limit * 40 / 2;
-  flags = (cl_uchar *) malloc (sieve_size);
-  if (flags == NULL) {
-    printf ("error allocating tiny_soe flags\n");
-    exit (1);
-  }
-  memset (flags, 1, sieve_size);
+  cl_uint  *primes;                   // output, primes[0] = 2 is set by tiny_soe
+  cl_uint   limit;                    // number of primes wanted
+  const cl_uint *base;                // odd sieving primes up to sqrt(bound)
+  cl_uint   num_base;
+  cl_uint   first_segment, num_segments;
+  cl_uint  *segment_primes;           // counting pass: primes per segment, store pass: index of the first prime of the segment
+  int       store;                    // 0: count, 1: store
+  thread_t  thread;
+} soe_worker_t;
+
+// Upper bound of the n-th prime: p(n) < n (ln n + ln ln n) for n >= 6 (Rosser)
+
+static cl_ulong soe_bound (cl_uint n)
+{
+  if (n < 6) return 13;
+  return (cl_ulong) (n * (log ((double) n) + log (log ((double) n)))) + 1;
+}
 
-  primes[0] = 2;
-  it = 1;
+static cl_uint soe_popcount (cl_uint x)
+{
+  x = x - ((x >> 1) & 0x55555555);
+  x = (x & 0x33333333) + ((x >> 2) & 0x33333333);
+  x = (x + (x >> 4)) & 0x0F0F0F0F;
+  return (x * 0x01010101) >> 24;
+}
 
-  // sieve using primes less than the sqrt of the desired limit
-  for (i = 1; i < (cl_uint) sqrt ((double) (limit * 40)); i++) {
-    if (flags[i] == 1) {
-      prime = (cl_uint) (2*i + 1);
-      for (j = i + prime; j < sieve_size; j += prime)
-        flags[j] = 0;
+// sieve one segment: bit i stands for the odd number low + 2*i, set bits are primes
 
-      primes[it] = prime;
-      it++;
+static void soe_sieve_segment (cl_uint *bits, cl_uint segment, const cl_uint *base, cl_uint num_base)
+{
+  cl_ulong low = (cl_ulong) segment * SOE_SEGMENT_BITS * 2 + 1;
+  cl_ulong high = low + SOE_SEGMENT_BITS * 2;
+  cl_ulong m;
+  cl_uint  i, p, j;
+
+  memset (bits, 0xFF, SOE_SEGMENT_BYTES);
+  if (segment == 0) bits[0] &= ~1u;   // 1 is not a prime
+  for (i = 0; i < num_base; i++) {
+    p = base[i];
+    m = (cl_ulong) p * p;
+    if (m >= high) break;
+    if (m < low) {
+      m = (low + p - 1) / p * p;
+      if ((m & 1) == 0) m += p;       // odd multiples only
     }
+    for (j = (cl_uint) ((m - low) / 2); j < SOE_SEGMENT_BITS; j += p)
+      bits[j >> 5] &= ~(1u << (j & 31));
   }
+}
 
-  //now find the rest of the prime flags and compute the sieving primes
-  for ( ; it < limit; i++) {
-    if (flags[i] == 1) {
-      primes[it] = (cl_uint) (2*i + 1);
-      it++;
+static void soe_segments (soe_worker_t *w)
+{
+  cl_uint bits[SOE_SEGMENT_BYTES / 4];
+  cl_uint s, i, count, index, word;
+
+  index = w->segment_primes[w->first_segment];
+  for (s = w->first_segment; s < w->first_segment + w->num_segments; s++) {
+    soe_sieve_segment (bits, s, w->base, w->num_base);
+    if (!w->store) {
+      for (count = 0, i = 0; i < SOE_SEGMENT_BYTES / 4; i++) count += soe_popcount (bits[i]);
+      w->segment_primes[s] = count;
+      continue;
     }
+    for (i = 0; i < SOE_SEGMENT_BYTES / 4 && index < w->limit; i++) {
+      for (word = bits[i]; word != 0 && index < w->limit; word &= word - 1) {
+        cl_uint bit = soe_popcount ((word & (0 - word)) - 1);   // index of the lowest set bit
+        w->primes[index++] = (cl_uint) ((cl_ulong) s * SOE_SEGMENT_BITS * 2 + 1 + 2 * (i * 32 + bit));
+      }
+    }
+    if (index >= w->limit) break;
   }
+}
+
+static THREAD_FUNC(soe_thread)
+{
+  soe_segments ((soe_worker_t *) arg);
+  THREAD_RETURN;
+}
+
+// run the workers: worker 0 in this thread, the others in their own threads
 
-  if (i>=sieve_size) fprintf(stderr, "Warning: tiny_soe memory overrun!\n");
+static void soe_run (soe_worker_t *workers, cl_uint num_workers)
+{
+  cl_uint i, started = 0;
 
-  free (flags);
+  for (i = 1; i < num_workers; i++) {
+    if (thread_create (&workers[i].thread, soe_thread, &workers[i])) break;
+    started = i;
+  }
+  soe_segments (&workers[0]);
+  for (i = started + 1; i < num_workers; i++) soe_segments (&workers[i]);  // thread could not be started
+  for (i = 1; i <= started; i++) thread_join (workers[i].thread);
+}
+
+void tiny_soe (cl_uint limit, cl_uint *primes)
+{
+  cl_ulong bound;
+  cl_uint  sqrt_bound, num_base, num_segments, num_workers, i, j, sum;
+  cl_uint *base, *segment_primes;
+  cl_uchar *small;
+  soe_worker_t workers[SIEVE_THREADS_MAX];
+
+  if (limit == 0) return;
+  primes[0] = 2;
+  if (limit == 1) return;
+
+  bound = soe_bound (limit);
+  if (bound > 0xFFFFFFFF) bound = 0xFFFFFFFF;
+  num_segments = (cl_uint) ((bound / 2) / SOE_SEGMENT_BITS + 1);
+
+  // odd sieving primes up to sqrt(bound) (at most 65536) with a simple byte sieve
+  sqrt_bound = (cl_uint) sqrt ((double) bound) + 1;
+  small = (cl_uchar *) malloc (sqrt_bound + 1);
+  base = (cl_uint *) malloc ((sqrt_bound / 2 + 1) * sizeof (cl_uint));
+  segment_primes = (cl_uint *) malloc ((num_segments + 1) * sizeof (cl_uint));
+  if (small == NULL || base == NULL || segment_primes == NULL) {
+    printf ("error allocating tiny_soe memory\n");
+    exit (1);
+  }
+  memset (small, 1, sqrt_bound + 1);
+  for (num_base = 0, i = 3; i <= sqrt_bound; i += 2) {
+    if (!small[i]) continue;
+    base[num_base++] = i;
+    for (j = i * i; j <= sqrt_bound; j += 2 * i) small[j] = 0;
+  }
+  free (small);
+
+  num_workers = thread_num_cpus ();
+  if (num_workers > num_segments / SOE_THREAD_SEGMENTS) num_workers = num_segments / SOE_THREAD_SEGMENTS;
+  if (num_workers > SIEVE_THREADS_MAX) num_workers = SIEVE_THREADS_MAX;
+  if (num_workers == 0) num_workers = 1;
+
+  for (i = 0, j = 0; i < num_workers; i++) {
+    workers[i].primes = primes;
+    workers[i].limit = limit;
+    workers[i].base = base;
+    workers[i].num_base = num_base;
+    workers[i].first_segment = j;
+    workers[i].num_segments = (num_segments - j) / (num_workers - i);
+    workers[i].segment_primes = segment_primes;
+    workers[i].store = (num_workers == 1);
+    j += workers[i].num_segments;
+  }
+
+  // the primes of segment 0 start at primes[1]
+  segment_primes[0] = 1;
+  if (num_workers > 1) {
+    soe_run (workers, num_workers);
+    for (i = 0, sum = 1; i < num_segments; i++) {
+      j = segment_primes[i];
+      segment_primes[i] = sum;
+      sum += j;
+    }
+    if (sum < limit) fprintf(stderr, "Warning: tiny_soe found only %u of %u primes!\n", sum, limit);
+    for (i = 0; i < num_workers; i++) workers[i].store = 1;
+  }
+  soe_run (workers, num_workers);
+
+  free (base);
+  free (segment_primes);
 }
 
 // GPU sieve initialization that only needs to be done one time.
@@ -128,6 +262,7 @@ int gpusieve_init (mystuff_t *mystuff, cl_context context)
   cl_uint  i, j, pinfo_size, rowinfo_size;
   cl_uint  k, loop_count, loop_end;
   cl_int  status;
+  gpusieve_cache_key_t cache_key;
 
   // If we've already allocated GPU memory, return
   if (gpusieve_initialized) return 0;
@@ -169,46 +304,58 @@ int gpusieve_init (mystuff_t *mystuff, cl_context context)
                 // Number of thread loops processing primes below 1M
 
 
-  // Allocate the big sieve array (default is 128M bits)
+  // Allocate the big sieve arrays (default is 128M bits each), GPUSieveBuffers of them:
+  // while the TF kernel reads one, the next sieve block is written to another one
   // checkCudaErrors (cudaMalloc ((void**) &mystuff->d_bitarray, mystuff->gpu_sieve_size / 8));
-  if( (mystuff->h_bitarray = (cl_uint *) malloc(mystuff->gpu_sieve_size / 8)) == NULL )  // host array normally not needed - just for verification of the sieve
-  {
-    printf("ERROR: malloc(h_bitarray, %u bytes) failed\n", mystuff->gpu_sieve_size / 8);
-    return 1;
-  }
-  mystuff->d_bitarray = clCreateBuffer(context,
-                         CL_MEM_READ_WRITE | CL_MEM_USE_HOST_PTR,
-                         mystuff->gpu_sieve_size / 8,
-                         mystuff->h_bitarray,
-                        &status);
-  if(status != CL_SUCCESS)
+  // With GridAdjust, gpu_sieve_size may grow up to gpu_sieve_size_alloc.
+  if (mystuff->gpu_sieve_size_alloc < mystuff->gpu_sieve_size) mystuff->gpu_sieve_size_alloc = mystuff->gpu_sieve_size;
+  for (i=0; i<mystuff->gpu_sieve_buffers; i++)
   {
-    std::cout<<"Error " << status << " (" << ClErrorString(status) << "): clCreateBuffer (d_bitarray)\n";
-    return 1;
+    if( (mystuff->h_bitarrays[i] = (cl_uint *) malloc(mystuff->gpu_sieve_size_alloc / 8)) == NULL )  // host array normally not needed - just for verification of the sieve
+    {
+      printf("ERROR: malloc(h_bitarray, %u bytes) failed\n", mystuff->gpu_sieve_size_alloc / 8);
+      return 1;
+    }
+    mystuff->d_bitarrays[i] = clCreateBuffer(context,
+                           CL_MEM_READ_WRITE | CL_MEM_USE_HOST_PTR,
+                           mystuff->gpu_sieve_size_alloc / 8,
+                           mystuff->h_bitarrays[i],
+                          &status);
+    if(status != CL_SUCCESS)
+    {
+      std::cout<<"Error " << status << " (" << ClErrorString(status) << "): clCreateBuffer (d_bitarray)\n";
+      return 1;
+    }
   }
+  mystuff->gpu_sieve_buffer = 0;
+  mystuff->h_bitarray = mystuff->h_bitarrays[0];
+  mystuff->d_bitarray = mystuff->d_bitarrays[0];
 
 #ifdef DETAILED_INFO
-  printf("gpusieve_init: d/h_bitarray (%d bytes) allocated\n", mystuff->gpu_sieve_size / 8);
+  printf("gpusieve_init: %u d/h_bitarrays (%d bytes each) allocated\n", mystuff->gpu_sieve_buffers, mystuff->gpu_sieve_size_alloc / 8);
 #endif
 
 #ifdef RAW_GPU_BENCH
   // Quick hack to eliminate sieve time from GPU-code benchmarks.  Can also be used
   // to isolate a bug by eliminating the GPU sieving code as a possible cause.
   // checkCudaErrors (cudaMemset (mystuff->d_bitarray, 0xFF, mystuff->gpu_sieve_size / 8));
-  memset (mystuff->h_bitarray, 0xFF, mystuff->gpu_sieve_size / 8);
-  status = clEnqueueWriteBuffer(QUEUE,
-                mystuff->d_bitarray,
-                CL_TRUE,
-                0,
-                SIEVE_PRIMES_MAX * sizeof(cl_uint),
-                mystuff->h_bitarray,
-                0,
-                NULL,
-                NULL);  // primes are written to GPU only once at startup
-  if(status != CL_SUCCESS)
+  for (i=0; i<mystuff->gpu_sieve_buffers; i++)
   {
-    std::cout<<"Error " << status << " (" << ClErrorString(status) << "): clEnqueueWriteBuffer (d_bitarray)\n";
-     return 1;
+    memset (mystuff->h_bitarrays[i], 0xFF, mystuff->gpu_sieve_size_alloc / 8);
+    status = clEnqueueWriteBuffer(QUEUE,
+                  mystuff->d_bitarrays[i],
+                  CL_TRUE,
+                  0,
+                  SIEVE_PRIMES_MAX * sizeof(cl_uint),
+                  mystuff->h_bitarrays[i],
+                  0,
+                  NULL,
+                  NULL);  // primes are written to GPU only once at startup
+    if(status != CL_SUCCESS)
+    {
+      std::cout<<"Error " << status << " (" << ClErrorString(status) << "): clEnqueueWriteBuffer (d_bitarray)\n";
+       return 1;
+    }
   }
 #endif
 
@@ -268,6 +415,26 @@ int gpusieve_init (mystuff_t *mystuff, cl_context context)
   printf("using gpu_sieve_primes=%d\n", mystuff->gpu_sieve_primes);
 #endif
 
+  rowinfo_size = MAX_PRIMES_PER_THREAD*4 * sizeof (cl_uint) + mystuff->gpu_sieve_primes * 8;
+
+  // The tables only depend on the values computed so far: load them from the GPUSieveCacheFile if it matches
+  memset (&cache_key, 0, sizeof (cache_key));
+  cache_key.gpu_sieve_primes = mystuff->gpu_sieve_primes;
+  cache_key.primes_not_sieved = primesNotSieved;
+  cache_key.primes_special = primesHandledWithSpecialCode;
+  cache_key.primes_per_thread = primes_per_thread;
+  cache_key.threads_per_block = threadsPerBlock;
+  cache_key.block_size = block_size;
+  cache_key.pinfo_pad = PINFO_PAD1;
+  cache_key.max_primes_per_thread = MAX_PRIMES_PER_THREAD;
+  primes = NULL;
+  if (mystuff->gpu_sieve_cachefile[0] &&
+      gpusieve_cache_load (mystuff->gpu_sieve_cachefile, &cache_key, &pinfo, &pinfo_size, &rowinfo, rowinfo_size) == 0)
+  {
+    if (mystuff->verbosity >= 2) printf("gpusieve_init: sieve tables loaded from %s\n", mystuff->gpu_sieve_cachefile);
+    goto tables_ready;
+  }
+
   // find seed primes
   primes = (cl_uint *) malloc (mystuff->gpu_sieve_primes * sizeof (cl_uint));
   if (primes == NULL) {
@@ -288,7 +455,6 @@ int gpusieve_init (mystuff_t *mystuff, cl_context context)
 #endif
 
   // allocate memory for info that describes each row of 256 primes AND has the primes and modular inverses
-  rowinfo_size = MAX_PRIMES_PER_THREAD*4 * sizeof (cl_uint) + mystuff->gpu_sieve_primes * 8;
   rowinfo = (cl_uint *) malloc (rowinfo_size);
   if (rowinfo == NULL) {
     printf ("error in malloc rowinfo\n");
@@ -503,6 +669,22 @@ int gpusieve_init (mystuff_t *mystuff, cl_context context)
     rowinfo[MAX_PRIMES_PER_THREAD*4 + 2 * i] = primes[i];
   }
 
+  if (mystuff->gpu_sieve_cachefile[0])
+  {
+    gpusieve_cache_save (mystuff->gpu_sieve_cachefile, &cache_key, pinfo, pinfo_size, rowinfo, rowinfo_size);
+    if (mystuff->verbosity >= 2) printf("gpusieve_init: sieve tables saved to %s\n", mystuff->gpu_sieve_cachefile);
+  }
+
+tables_ready:
+
+  // GPUSieveHost: the host sieve works on its own copy of the pristine arrays
+  sieve_info_size = pinfo_size;
+  calc_info_size = rowinfo_size;
+  if (mystuff->gpu_sieve_host &&
+      gpusieve_host_init(mystuff, pinfo, pinfo_size, rowinfo, rowinfo_size, primesNotSieved, primesHandledWithSpecialCode,
+                         primes_per_thread, threadsPerBlock, block_size))
+    return 1;
+
   // Allocate and copy the device compressed prime sieving info
   // checkCudaErrors (cudaMalloc ((void**) &mystuff->d_sieve_info, pinfo_size));
   // checkCudaErrors (cudaMemcpy (mystuff->d_sieve_info, pinfo, pinfo_size, cudaMemcpyHostToDevice));
@@ -580,6 +762,42 @@ int gpusieve_init (mystuff_t *mystuff, cl_context context)
 }
 
 
+// GPUSieveHost=2: read the device sieve buffers back and compare them with the host sieve.
+// Modular inverses and bit-to-clear values must match exactly. The device bit array may keep
+// more candidates than the host one (SegSieve does not clear bits atomically), but a candidate
+// the host keeps and the device has cleared is an error.
+
+static void gpusieve_verify_modinv (mystuff_t *mystuff)
+{
+  cl_uint diff;
+
+  if (run_gpusieve_read(mystuff->d_calc_bit_to_clear_info, mystuff->h_calc_bit_to_clear_info, calc_info_size)) return;
+  diff = gpusieve_host_compare_modinv(mystuff->h_calc_bit_to_clear_info);
+  if (diff) printf("ERROR: GPU sieve verification: %u modular inverses differ for M%u\n", diff, mystuff->exponent);
+  else if (mystuff->verbosity >= 3) printf("GPU sieve verification: modular inverses OK\n");
+}
+
+static void gpusieve_verify_bit_to_clear (mystuff_t *mystuff, const char *step)
+{
+  cl_uint diff;
+
+  if (run_gpusieve_read(mystuff->d_sieve_info, mystuff->h_sieve_info, sieve_info_size)) return;
+  diff = gpusieve_host_compare_bit_to_clear((cl_uchar *) mystuff->h_sieve_info);
+  if (diff) printf("ERROR: GPU sieve verification: %u sieve info words differ after %s\n", diff, step);
+  else if (mystuff->verbosity >= 3) printf("GPU sieve verification: bit-to-clear values OK after %s\n", step);
+}
+
+static void gpusieve_verify_bits (mystuff_t *mystuff, cl_uint numblocks)
+{
+  cl_uint missing, surplus;
+
+  if (run_gpusieve_read(mystuff->d_bitarray, mystuff->h_bitarray, numblocks * block_size_in_bytes)) return;
+  missing = gpusieve_host_compare_bits(mystuff->h_bitarray, numblocks, &surplus);
+  if (missing) printf("ERROR: GPU sieve verification: %u candidates removed by the GPU sieve but not by the host\n", missing);
+  if (mystuff->verbosity >= 3) printf("GPU sieve verification: %u blocks, %u candidates not removed by the GPU sieve\n", numblocks, surplus);
+}
+
+
 // GPU sieve initialization that needs to be done once for each Mersenne exponent to be factored.
 
 void gpusieve_init_exponent (mystuff_t *mystuff)
@@ -594,11 +812,14 @@ void gpusieve_init_exponent (mystuff_t *mystuff)
   // If we've already initialized this exponent, return
   if (mystuff->exponent == last_exponent_initialized) return;
   last_exponent_initialized = mystuff->exponent;
+  class_prepared = 0;
 
   // Calculate the modular inverses that will be used by each class to calculate initial bit-to-clear for each prime
   // CalcModularInverses<<<primes_per_thread+1, threadsPerBlock>>>(mystuff->exponent, (int *)mystuff->d_calc_bit_to_clear_info);
   // cudaThreadSynchronize ();
-  run_calc_mod_inv(primes_per_thread+1, threadsPerBlock, NULL);
+  if (mystuff->gpu_sieve_host) gpusieve_host_init_exponent(mystuff->exponent, mystuff->num_classes);
+  if (mystuff->gpu_sieve_host != 1) run_calc_mod_inv(primes_per_thread+1, threadsPerBlock, NULL);
+  if (mystuff->gpu_sieve_host == 2) gpusieve_verify_modinv(mystuff);
 }
 
 
@@ -612,10 +833,48 @@ void gpusieve_init_class (mystuff_t *mystuff, unsigned long long k_min)
   return;
 #endif
 
+  // Nothing to do if gpusieve_prepare_class did it already
+  if (class_prepared)
+  {
+    class_prepared = 0;
+    if (prepared_k_min == k_min) return;
+  }
+
   // Calculate the initial bit-to-clear for each prime
   // CalcBitToClear<<<primes_per_thread+1, threadsPerBlock>>>(mystuff->exponent, k_base, (int *)mystuff->d_calc_bit_to_clear_info, (cl_uchar *)mystuff->d_sieve_info);
   // cudaThreadSynchronize ();
-  run_calc_bit_to_clear(primes_per_thread+1, threadsPerBlock, NULL, k_min);
+  if (mystuff->gpu_sieve_host) gpusieve_host_init_class(mystuff->exponent, k_min);
+  if (mystuff->gpu_sieve_host != 1) run_calc_bit_to_clear(primes_per_thread+1, threadsPerBlock, NULL, k_min);
+  if (mystuff->gpu_sieve_host == 2) gpusieve_verify_bit_to_clear(mystuff, "CalcBitToClear");
+}
+
+
+// GPU sieve update for the next chunk of the same class: all bit-to-clear values move forward by
+// gpu_sieve_size bits, which is the same as gpusieve_init_class(k_min + gpu_sieve_size * num_classes).
+
+void gpusieve_advance_class (mystuff_t *mystuff)
+{
+#ifdef RAW_GPU_BENCH
+  // Quick hack (leave bit array set to all ones) to eliminate sieve time from GPU-code benchmarks.
+  return;
+#endif
+
+  // CalcBitToClearAdvance<<<primes_per_thread+1, threadsPerBlock>>>(gpu_sieve_size, (int *)mystuff->d_calc_bit_to_clear_info, (cl_uchar *)mystuff->d_sieve_info);
+  if (mystuff->gpu_sieve_host) gpusieve_host_advance_class(mystuff->gpu_sieve_size);
+  if (mystuff->gpu_sieve_host != 1) run_calc_bit_to_clear_advance(primes_per_thread+1, threadsPerBlock, NULL, mystuff->gpu_sieve_size);
+  if (mystuff->gpu_sieve_host == 2) gpusieve_verify_bit_to_clear(mystuff, "CalcBitToClearAdvance");
+}
+
+
+// Queue the initialization of the next class while the TF kernels of the current class are still
+// running: SegSieve for the last block of the class is already queued before it on the sieve queue.
+// The following gpusieve_init_class for this k_min then has nothing to do.
+
+void gpusieve_prepare_class (mystuff_t *mystuff, unsigned long long k_min)
+{
+  gpusieve_init_class (mystuff, k_min);
+  class_prepared = 1;
+  prepared_k_min = k_min;
 }
 
 
@@ -624,6 +883,7 @@ void gpusieve_init_class (mystuff_t *mystuff, unsigned long long k_min)
 void gpusieve (mystuff_t *mystuff, unsigned long long num_k_remaining)
 {
   cl_uint maxp = 0xFFFFFFFF; // marker to not copy the param to the GPU
+  cl_uint numblocks;
   int  sieve_size;
 
 #ifdef RAW_GPU_BENCH
@@ -637,33 +897,57 @@ void gpusieve (mystuff_t *mystuff, unsigned long long num_k_remaining)
     sieve_size = mystuff->gpu_sieve_size;
   else
     sieve_size = (int) num_k_remaining;
+  numblocks = (sieve_size + block_size - 1) / block_size;
   if (primes_per_thread != last_maxp)
   {
     last_maxp = primes_per_thread;
     maxp = primes_per_thread;
   }
 
+  // Sieve into the next bit array, the TF kernel may still be busy with the previous one
+  mystuff->gpu_sieve_buffer = (mystuff->gpu_sieve_buffer + 1) % mystuff->gpu_sieve_buffers;
+  mystuff->h_bitarray = mystuff->h_bitarrays[mystuff->gpu_sieve_buffer];
+  mystuff->d_bitarray = mystuff->d_bitarrays[mystuff->gpu_sieve_buffer];
+
+  // GPUSieveHost=1: sieve on the CPU and upload the bit array instead
+  if (mystuff->gpu_sieve_host == 1)
+  {
+    run_gpusieve_wait();
+    gpusieve_host_sieve(mystuff->h_bitarray, numblocks);
+    run_gpusieve_upload(numblocks * block_size_in_bytes);
+    return;
+  }
+
   // Do some sieving on the GPU!
   // SegSieve<<<(sieve_size + block_size - 1) / block_size, threadsPerBlock>>>((cl_uchar *)mystuff->d_bitarray, (cl_uchar *)mystuff->d_sieve_info, primes_per_thread);
   // cudaThreadSynchronize ();
-  run_cl_sieve((sieve_size + block_size - 1) / block_size, threadsPerBlock, NULL, maxp);
+  run_cl_sieve(numblocks, threadsPerBlock, NULL, maxp);
+  if (mystuff->gpu_sieve_host == 2) gpusieve_verify_bits(mystuff, numblocks);
 }
 
 int gpusieve_free (mystuff_t *mystuff)
 {
   int status;
+  cl_uint i;
   if (gpusieve_initialized == 0) return 0;
   gpusieve_initialized = 0;
   last_exponent_initialized = 0;
   last_maxp = 0xFFFFFFFF;
+  class_prepared = 0;
+  gpusieve_host_free();
 
-  status = clReleaseMemObject(mystuff->d_bitarray); mystuff->d_bitarray=NULL;
-  if(status != CL_SUCCESS)
+  for (i=0; i<mystuff->gpu_sieve_buffers; i++)
   {
-    std::cerr<<"Error" << status << " (" << ClErrorString(status) << "): clReleaseMemObject (mystuff->d_bitarray)\n";
-    return 1;
+    status = clReleaseMemObject(mystuff->d_bitarrays[i]); mystuff->d_bitarrays[i]=NULL;
+    if(status != CL_SUCCESS)
+    {
+      std::cerr<<"Error" << status << " (" << ClErrorString(status) << "): clReleaseMemObject (mystuff->d_bitarray)\n";
+      return 1;
+    }
+    free(mystuff->h_bitarrays[i]); mystuff->h_bitarrays[i]=NULL;
   }
-  free(mystuff->h_bitarray); mystuff->h_bitarray=NULL;
+  mystuff->d_bitarray=NULL;
+  mystuff->h_bitarray=NULL;
 
   status = clReleaseMemObject(mystuff->d_calc_bit_to_clear_info); mystuff->d_calc_bit_to_clear_info=NULL;
   if(status != CL_SUCCESS)
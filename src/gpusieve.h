@@ -28,6 +28,8 @@ extern "C" {
 int gpusieve_init (mystuff_t *mystuff, cl_context context);
 void gpusieve_init_exponent (mystuff_t *mystuff);
 void gpusieve_init_class (mystuff_t *mystuff, unsigned long long k_min);
+void gpusieve_advance_class (mystuff_t *mystuff);
+void gpusieve_prepare_class (mystuff_t *mystuff, unsigned long long k_min);
 void gpusieve (mystuff_t *mystuff, unsigned long long num_k_remaining);
 int gpusieve_free (mystuff_t *mystuff);
 void tiny_soe (cl_uint limit, cl_uint *primes);
@@ -0,0 +1,232 @@
+/*
+This file is part of mfaktc (mfakto).
+Copyright (C) 2009 - 2014  Oliver Weihe (o.weihe@t-online.de)
+                           Bertram Franz (bertramf@gmx.net)
+
+mfaktc (mfakto) is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+mfaktc (mfakto) is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with mfaktc (mfakto).  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined _MSC_VER || __MINGW32__
+  #include <Windows.h>
+  #include <process.h>
+  #define getpid _getpid
+#else
+  #include <fcntl.h>
+  #include <unistd.h>
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+#endif
+
+#include "my_types.h"
+#include "gpusieve_cache.h"
+
+#define CACHE_MAGIC "mfaktoGS"
+#define CACHE_ALIGN 4096            /* the tables start at page boundaries of the file */
+
+/* file layout: header, pinfo, rowinfo (native byte order) */
+typedef struct
+{
+  char                 magic[8];
+  cl_uint              version;
+  cl_uint              header_size;
+  gpusieve_cache_key_t key;
+  cl_uint              pinfo_offset;
+  cl_uint              pinfo_size;
+  cl_uint              rowinfo_offset;
+  cl_uint              rowinfo_size;
+  cl_uint              checksum;    /* of both tables, a partially written file is not used */
+} cache_header_t;
+
+
+static cl_uint cache_checksum(const cl_uint *data, cl_uint words, cl_uint sum)
+{
+  cl_uint i;
+
+  for(i = 0; i < words; i++) sum = ((sum << 1) | (sum >> 31)) + data[i];
+  return sum;
+}
+
+
+static cl_uint cache_align(cl_uint offset)
+{
+  return (offset + CACHE_ALIGN - 1) & ~(CACHE_ALIGN - 1);
+}
+
+
+static const cl_uchar *cache_map(const char *filename, size_t *size)
+/* maps the whole file read-only, returns NULL if it does not exist or is too small */
+{
+#if defined _MSC_VER || __MINGW32__
+  HANDLE file, mapping;
+  LARGE_INTEGER file_size;
+  void *ptr;
+
+  file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if(file == INVALID_HANDLE_VALUE) return NULL;
+  if(!GetFileSizeEx(file, &file_size) || file_size.QuadPart < (LONGLONG) sizeof(cache_header_t))
+  {
+    CloseHandle(file);
+    return NULL;
+  }
+  mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+  CloseHandle(file);
+  if(mapping == NULL) return NULL;
+  ptr = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+  CloseHandle(mapping);             /* the view keeps the mapping alive */
+  if(ptr == NULL) return NULL;
+  *size = (size_t) file_size.QuadPart;
+  return (const cl_uchar *) ptr;
+#else
+  struct stat st;
+  void *ptr;
+  int fd;
+
+  fd = open(filename, O_RDONLY);
+  if(fd < 0) return NULL;
+  if(fstat(fd, &st) || st.st_size < (off_t) sizeof(cache_header_t))
+  {
+    close(fd);
+    return NULL;
+  }
+  ptr = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if(ptr == MAP_FAILED) return NULL;
+  *size = (size_t) st.st_size;
+  return (const cl_uchar *) ptr;
+#endif
+}
+
+
+static void cache_unmap(const cl_uchar *ptr, size_t size)
+{
+#if defined _MSC_VER || __MINGW32__
+  UnmapViewOfFile(ptr);
+#else
+  munmap((void *) ptr, size);
+#endif
+}
+
+
+int gpusieve_cache_load(const char *filename, const gpusieve_cache_key_t *key, cl_uchar **pinfo, cl_uint *pinfo_size,
+                        cl_uint **rowinfo, cl_uint rowinfo_size)
+/* returns 0 and malloc'ed copies of the tables if the cache file exists and matches key, 1 otherwise */
+{
+  const cl_uchar *file;
+  const cache_header_t *header;
+  size_t size;
+  cl_uint sum;
+  int ret = 1;
+
+  *pinfo = NULL;
+  *rowinfo = NULL;
+
+  file = cache_map(filename, &size);
+  if(file == NULL) return 1;
+  header = (const cache_header_t *) file;
+
+  if(memcmp(header->magic, CACHE_MAGIC, 8) == 0 &&
+     header->version == GPUSIEVE_CACHE_VERSION &&
+     header->header_size == sizeof(cache_header_t) &&
+     memcmp(&header->key, key, sizeof(gpusieve_cache_key_t)) == 0 &&
+     header->rowinfo_size == rowinfo_size &&
+     (header->pinfo_offset | header->pinfo_size | header->rowinfo_offset | header->rowinfo_size) % 4 == 0 &&
+     (size_t) header->pinfo_offset + header->pinfo_size <= size &&
+     (size_t) header->rowinfo_offset + header->rowinfo_size <= size)
+  {
+    sum = cache_checksum((const cl_uint *) (file + header->pinfo_offset), header->pinfo_size / 4, 0);
+    sum = cache_checksum((const cl_uint *) (file + header->rowinfo_offset), header->rowinfo_size / 4, sum);
+    if(sum == header->checksum)
+    {
+      *pinfo = (cl_uchar *) malloc(header->pinfo_size);
+      *rowinfo = (cl_uint *) malloc(rowinfo_size);
+      if(*pinfo != NULL && *rowinfo != NULL)
+      {
+        memcpy(*pinfo, file + header->pinfo_offset, header->pinfo_size);
+        memcpy(*rowinfo, file + header->rowinfo_offset, rowinfo_size);
+        *pinfo_size = header->pinfo_size;
+        ret = 0;
+      }
+      else
+      {
+        free(*pinfo);   *pinfo = NULL;
+        free(*rowinfo); *rowinfo = NULL;
+      }
+    }
+  }
+
+  cache_unmap(file, size);
+  return ret;
+}
+
+
+static int cache_write_padding(FILE *f, cl_uint bytes)
+{
+  static const char zero[CACHE_ALIGN] = { 0 };
+
+  return fwrite(zero, 1, bytes, f) == bytes;
+}
+
+
+void gpusieve_cache_save(const char *filename, const gpusieve_cache_key_t *key, const cl_uchar *pinfo, cl_uint pinfo_size,
+                         const cl_uint *rowinfo, cl_uint rowinfo_size)
+/* writes the tables to a temporary file which then replaces the cache file, so other instances
+   loading the cache at the same time see either the old or the new file */
+{
+  cache_header_t header;
+  char tmpname[80];
+  FILE *f;
+  int ok;
+
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, CACHE_MAGIC, 8);
+  header.version        = GPUSIEVE_CACHE_VERSION;
+  header.header_size    = sizeof(cache_header_t);
+  header.key            = *key;
+  header.pinfo_offset   = cache_align(sizeof(cache_header_t));
+  header.pinfo_size     = pinfo_size;
+  header.rowinfo_offset = cache_align(header.pinfo_offset + pinfo_size);
+  header.rowinfo_size   = rowinfo_size;
+  header.checksum       = cache_checksum(rowinfo, rowinfo_size / 4, cache_checksum((const cl_uint *) pinfo, pinfo_size / 4, 0));
+
+  sprintf(tmpname, "%s.%d.tmp", filename, (int) getpid());
+  f = fopen(tmpname, "wb");
+  if(f == NULL)
+  {
+    printf("WARNING: cannot write the GPU sieve cache file %s\n", tmpname);
+    return;
+  }
+  ok = fwrite(&header, sizeof(cache_header_t), 1, f) == 1 &&
+       cache_write_padding(f, header.pinfo_offset - sizeof(cache_header_t)) &&
+       fwrite(pinfo, 1, pinfo_size, f) == pinfo_size &&
+       cache_write_padding(f, header.rowinfo_offset - header.pinfo_offset - pinfo_size) &&
+       fwrite(rowinfo, 1, rowinfo_size, f) == rowinfo_size;
+  if(fclose(f)) ok = 0;
+
+  if(ok)
+  {
+#if defined _MSC_VER || __MINGW32__
+    remove(filename);               /* rename() does not replace existing files on Windows */
+#endif
+    ok = (rename(tmpname, filename) == 0);
+  }
+  if(!ok)
+  {
+    printf("WARNING: cannot write the GPU sieve cache file %s\n", filename);
+    remove(tmpname);
+  }
+}
@@ -0,0 +1,58 @@
+/*
+This file is part of mfaktc (mfakto).
+Copyright (C) 2009 - 2014  Oliver Weihe (o.weihe@t-online.de)
+                           Bertram Franz (bertramf@gmx.net)
+
+mfaktc (mfakto) is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+mfaktc (mfakto) is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with mfaktc (mfakto).  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* GPUSieveCacheFile: the pinfo (d_sieve_info) and rowinfo
+   (d_calc_bit_to_clear_info) tables built by gpusieve_init are stored in a
+   file and memory mapped by the next start of any mfakto instance using the
+   same file. The file is only used if all values of the key match, else it
+   is rebuilt. */
+
+#ifndef GPUSIEVE_CACHE_H_
+#define GPUSIEVE_CACHE_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "my_types.h"
+
+/* increase when the layout of pinfo or rowinfo changes */
+#define GPUSIEVE_CACHE_VERSION 1
+
+typedef struct
+{
+  cl_uint gpu_sieve_primes;       /* number of sieve primes, after gpusieve_init rounded it */
+  cl_uint primes_not_sieved;      /* 4: 420 classes, 5: 4620 classes */
+  cl_uint primes_special;         /* primes with a 16-bit bit-to-clear (handled with special code) */
+  cl_uint primes_per_thread;      /* "rows" of threads_per_block primes */
+  cl_uint threads_per_block;
+  cl_uint block_size;
+  cl_uint pinfo_pad;
+  cl_uint max_primes_per_thread;
+} gpusieve_cache_key_t;
+
+int  gpusieve_cache_load(const char *filename, const gpusieve_cache_key_t *key, cl_uchar **pinfo, cl_uint *pinfo_size,
+                         cl_uint **rowinfo, cl_uint rowinfo_size);
+void gpusieve_cache_save(const char *filename, const gpusieve_cache_key_t *key, const cl_uchar *pinfo, cl_uint pinfo_size,
+                         const cl_uint *rowinfo, cl_uint rowinfo_size);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,394 @@
+/*
+This file is part of mfaktc (mfakto).
+Copyright (C) 2009 - 2014  Oliver Weihe (o.weihe@t-online.de)
+                           Bertram Franz (bertramf@gmx.net)
+
+mfaktc (mfakto) is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+mfaktc (mfakto) is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with mfaktc (mfakto).  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+Host (CPU) version of the GPU sieve in gpusieve.cl.
+
+The pinfo and rowinfo arrays built by gpusieve_init are copied once, and
+all later steps update these copies the same way the kernels update the
+device buffers. Each sieve prime gets a "slot": the pinfo location of its
+bit-to-clear (16 bits for the specially handled primes, a masked 32-bit
+word in the rows) and its index into the prime / modular inverse table.
+SegSieve is sloppy on purpose (non-atomic bit clears in local memory may
+get lost), the host sieve clears every bit. So a device bit array is a
+superset of the host result.
+*/
+
+#include <cstdlib>
+#include "CL/cl.h"
+#include <string.h>
+#include <stdio.h>
+#include "my_types.h"
+#include "compatibility.h"
+#include "mfakto.h"
+#include "params.h"
+#include "threads.h"
+#include "gpusieve_host.h"
+
+#define HOST_SLOT_16BIT 0xFFFFFFFF  // mask marker: bit-to-clear is a 16-bit value (primes handled with special code)
+
+typedef struct
+{
+  cl_uint offset;                   // byte offset of the bit-to-clear in pinfo
+  cl_uint mask;                     // bits of the pinfo word to preserve when setting bit-to-clear
+  cl_uint index;                    // index of prime and modinv in rowinfo
+} host_slot_t;
+
+typedef struct
+{
+  cl_uint  *bits;                   // bit array of the whole sieve call
+  cl_uint   first_block, num_blocks;
+  const cl_uint *primes, *bclr;     // sieve primes and their bit-to-clear, primes below block_size first
+  cl_uint   num_small, num_primes, block_size;
+  thread_t  thread;
+} host_worker_t;
+
+// per device: each device thread has its own copy
+static THREAD_LOCAL cl_uchar      *host_pinfo = NULL;
+static THREAD_LOCAL cl_uint       *host_rowinfo = NULL;
+static THREAD_LOCAL cl_uint        host_pinfo_size, host_rowinfo_size;
+static THREAD_LOCAL host_slot_t   *host_slots = NULL;
+static THREAD_LOCAL cl_uint       *host_primes = NULL, *host_bclr = NULL;
+static THREAD_LOCAL cl_uint        host_num_slots = 0, host_num_small = 0;
+static THREAD_LOCAL cl_uint        host_block_size, host_threads;
+static THREAD_LOCAL cl_uint       *host_verify = NULL;  // GPUSieveHost=2: the host bit array to compare with
+static THREAD_LOCAL host_worker_t  host_workers[SIEVE_THREADS_MAX];
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Same extended Euclid as modularinverse() in gpusieve.cl
+
+static cl_uint host_modularinverse (cl_uint n, cl_uint orig_d)
+{
+  cl_uint d = orig_d;
+  int  x, lastx, q, t;
+  x = 0;
+  lastx = 1;
+  while (d != 0)
+  {
+    q = n / d;
+    t = d; d = n - q * d; n = t;
+    t = x; x = lastx - q * x; lastx = t;
+  }
+  return (lastx < 0) ? (lastx + orig_d) : lastx;
+}
+
+static cl_uint host_popcount (cl_uint x)
+{
+  x = x - ((x >> 1) & 0x55555555);
+  x = (x & 0x33333333) + ((x >> 2) & 0x33333333);
+  x = (x + (x >> 4)) & 0x0F0F0F0F;
+  return (x * 0x01010101) >> 24;
+}
+
+static cl_uint host_get_bit_to_clear (const host_slot_t *slot)
+{
+  if (slot->mask == HOST_SLOT_16BIT) return *(cl_ushort *)(host_pinfo + slot->offset);
+  return *(cl_uint *)(host_pinfo + slot->offset) & ~slot->mask;
+}
+
+static void host_set_bit_to_clear (const host_slot_t *slot, cl_uint bit_to_clear)
+{
+  cl_uint *pinfo32;
+
+  if (slot->mask == HOST_SLOT_16BIT)
+  {
+    *(cl_ushort *)(host_pinfo + slot->offset) = (cl_ushort) bit_to_clear;
+  }
+  else
+  {
+    pinfo32 = (cl_uint *)(host_pinfo + slot->offset);
+    *pinfo32 = (*pinfo32 & slot->mask) + bit_to_clear;
+  }
+}
+
+int gpusieve_host_init(mystuff_t *mystuff, const cl_uchar *pinfo, cl_uint pinfo_size, const cl_uint *rowinfo, cl_uint rowinfo_size,
+                       cl_uint primes_not_sieved, cl_uint primes_special, cl_uint rows, cl_uint row_length, cl_uint block_size)
+/* copies the sieve info arrays and builds the slot table, primes below block_size are placed first */
+{
+  cl_uint i, j, r, n, small, large;
+  host_slot_t slot;
+
+  gpusieve_host_free();
+
+  host_pinfo_size   = pinfo_size;
+  host_rowinfo_size = rowinfo_size;
+  host_block_size   = block_size;
+  host_num_slots    = primes_special + rows * row_length;
+
+  host_pinfo   = (cl_uchar *) malloc(pinfo_size);
+  host_rowinfo = (cl_uint *)  malloc(rowinfo_size);
+  host_slots   = (host_slot_t *) malloc(host_num_slots * sizeof(host_slot_t));
+  host_primes  = (cl_uint *)  malloc(host_num_slots * sizeof(cl_uint));
+  host_bclr    = (cl_uint *)  malloc(host_num_slots * sizeof(cl_uint));
+  if (mystuff->gpu_sieve_host == 2) host_verify = (cl_uint *) malloc(mystuff->gpu_sieve_size_alloc / 8);
+  if (host_pinfo == NULL || host_rowinfo == NULL || host_slots == NULL || host_primes == NULL || host_bclr == NULL ||
+      (mystuff->gpu_sieve_host == 2 && host_verify == NULL))
+  {
+    printf("ERROR: malloc for the host GPU sieve failed\n");
+    gpusieve_host_free();
+    return 1;
+  }
+  memcpy(host_pinfo, pinfo, pinfo_size);
+  memcpy(host_rowinfo, rowinfo, rowinfo_size);
+
+  // two passes: count the small primes, then fill both partitions
+  small = 0;
+  for (n = 0; n < 2; n++)
+  {
+    large = small;
+    small = 0;
+    for (i = 0; i < primes_special + rows * row_length; i++)
+    {
+      if (i < primes_special)
+      {
+        j = primes_not_sieved + i;
+        slot.offset = j * 2;
+        slot.mask   = HOST_SLOT_16BIT;
+        slot.index  = j;
+      }
+      else
+      {
+        r = (i - primes_special) / row_length;
+        j = (i - primes_special) % row_length;
+        slot.offset = rowinfo[r] + j * 4;
+        slot.mask   = rowinfo[MAX_PRIMES_PER_THREAD*3 + r];
+        slot.index  = rowinfo[MAX_PRIMES_PER_THREAD + r] + j * rowinfo[MAX_PRIMES_PER_THREAD*2 + r];
+      }
+      if (rowinfo[MAX_PRIMES_PER_THREAD*4 + slot.index * 2] < block_size)
+      {
+        if (n) { host_slots[small] = slot; host_primes[small] = rowinfo[MAX_PRIMES_PER_THREAD*4 + slot.index * 2]; }
+        small++;
+      }
+      else
+      {
+        if (n) { host_slots[large] = slot; host_primes[large] = rowinfo[MAX_PRIMES_PER_THREAD*4 + slot.index * 2]; }
+        large++;
+      }
+    }
+  }
+  host_num_small = small;
+
+  host_threads = mystuff->gpu_sieve_host_threads;
+  if (host_threads == 0) host_threads = thread_num_cpus();
+  if (host_threads > SIEVE_THREADS_MAX) host_threads = SIEVE_THREADS_MAX;
+  if (host_threads == 0) host_threads = 1;
+
+  if (mystuff->verbosity >= 2)
+    printf("gpusieve_host_init: %u primes (%u below %u) sieved on %u CPU thread(s)%s\n", host_num_slots, host_num_small,
+           block_size, host_threads, mystuff->gpu_sieve_host == 2 ? ", verifying the GPU sieve" : "");
+  return 0;
+}
+
+void gpusieve_host_free(void)
+{
+  if (host_pinfo)   free(host_pinfo);
+  if (host_rowinfo) free(host_rowinfo);
+  if (host_slots)   free(host_slots);
+  if (host_primes)  free(host_primes);
+  if (host_bclr)    free(host_bclr);
+  if (host_verify)  free(host_verify);
+  host_pinfo = NULL; host_rowinfo = NULL; host_slots = NULL;
+  host_primes = NULL; host_bclr = NULL; host_verify = NULL;
+  host_num_slots = host_num_small = 0;
+}
+
+// CalcModularInverses
+
+void gpusieve_host_init_exponent(cl_uint exponent, cl_uint num_classes)
+{
+  cl_ulong facdist = (cl_ulong) (2 * num_classes) * exponent;
+  cl_uint  i, index, prime;
+
+  for (i = 0; i < host_num_slots; i++)
+  {
+    index = host_slots[i].index;
+    prime = host_rowinfo[MAX_PRIMES_PER_THREAD*4 + index * 2];
+    host_rowinfo[MAX_PRIMES_PER_THREAD*4 + index * 2 + 1] = host_modularinverse ((cl_uint) (facdist % prime), prime);
+  }
+}
+
+// CalcBitToClear
+
+void gpusieve_host_init_class(cl_uint exponent, cl_ulong k_min)
+{
+  cl_uint  i, index, prime, modinv;
+  cl_ulong k_mod_p, factor_mod_p;
+
+  for (i = 0; i < host_num_slots; i++)
+  {
+    index  = host_slots[i].index;
+    prime  = host_rowinfo[MAX_PRIMES_PER_THREAD*4 + index * 2];
+    modinv = host_rowinfo[MAX_PRIMES_PER_THREAD*4 + index * 2 + 1];
+
+    k_mod_p = k_min % prime;
+    factor_mod_p = (2 * k_mod_p * exponent + 1) % prime;
+    host_set_bit_to_clear (&host_slots[i], (cl_uint) (((cl_ulong) prime - factor_mod_p) * modinv % prime));
+  }
+}
+
+// CalcBitToClearAdvance
+
+void gpusieve_host_advance_class(cl_uint advance)
+{
+  cl_uint i, prime, step, bit_to_clear;
+
+  for (i = 0; i < host_num_slots; i++)
+  {
+    prime = host_primes[i];
+    step = advance % prime;
+    bit_to_clear = host_get_bit_to_clear (&host_slots[i]);
+    bit_to_clear = (bit_to_clear >= step) ? bit_to_clear - step : bit_to_clear + prime - step;
+    host_set_bit_to_clear (&host_slots[i], bit_to_clear);
+  }
+}
+
+// SegSieve for the blocks first_block .. first_block+num_blocks-1. Bit i of the array stands for
+// k_min + i * num_classes, a prime p clears all bits i with i mod p == bit-to-clear.
+
+static void host_sieve_blocks(host_worker_t *w)
+{
+  cl_uint  words = w->block_size / 32;
+  cl_uint  start = w->first_block * w->block_size;
+  cl_uint  len = w->num_blocks * w->block_size;
+  cl_uint *bits = w->bits + w->first_block * words;
+  cl_uint *offs;
+  cl_uint  b, i, p, off;
+  cl_ulong j;
+
+  memset(bits, 0xFF, len / 8);
+
+  // primes below block_size: carry the offset of the next bit to clear from block to block
+  offs = (cl_uint *) malloc((w->num_small + 1) * sizeof(cl_uint));
+  if (offs == NULL)
+  {
+    printf("ERROR: malloc for the host GPU sieve failed\n");
+    exit(1);
+  }
+  for (i = 0; i < w->num_small; i++)
+  {
+    p = w->primes[i];
+    off = start % p;
+    offs[i] = (w->bclr[i] >= off) ? w->bclr[i] - off : w->bclr[i] + p - off;
+  }
+  for (b = 0; b < w->num_blocks; b++)
+  {
+    cl_uint *block = bits + b * words;
+    for (i = 0; i < w->num_small; i++)
+    {
+      p = w->primes[i];
+      for (off = offs[i]; off < w->block_size; off += p) block[off >> 5] &= ~(1u << (off & 31));
+      offs[i] = off - w->block_size;
+    }
+  }
+  free(offs);
+
+  // larger primes hit a block at most once, sieve them over the whole range
+  for (i = w->num_small; i < w->num_primes; i++)
+  {
+    p = w->primes[i];
+    off = start % p;
+    off = (w->bclr[i] >= off) ? w->bclr[i] - off : w->bclr[i] + p - off;
+    for (j = off; j < len; j += p) bits[j >> 5] &= ~(1u << (j & 31));
+  }
+}
+
+static THREAD_FUNC(host_sieve_thread)
+{
+  host_sieve_blocks((host_worker_t *) arg);
+  THREAD_RETURN;
+}
+
+void gpusieve_host_sieve(cl_uint *bitarray, cl_uint numblocks)
+/* sieves numblocks blocks into bitarray, the blocks are split evenly between the threads */
+{
+  cl_uint i, n, first, started = 0;
+
+  for (i = 0; i < host_num_slots; i++) host_bclr[i] = host_get_bit_to_clear (&host_slots[i]);
+
+  n = (host_threads < numblocks) ? host_threads : numblocks;
+  first = 0;
+  for (i = 0; i < n; i++)
+  {
+    host_workers[i].bits        = bitarray;
+    host_workers[i].first_block = first;
+    host_workers[i].num_blocks  = (numblocks - first) / (n - i);
+    host_workers[i].primes      = host_primes;
+    host_workers[i].bclr        = host_bclr;
+    host_workers[i].num_small   = host_num_small;
+    host_workers[i].num_primes  = host_num_slots;
+    host_workers[i].block_size  = host_block_size;
+    first += host_workers[i].num_blocks;
+  }
+
+  for (i = 1; i < n; i++)
+  {
+    if (thread_create(&host_workers[i].thread, host_sieve_thread, &host_workers[i])) break;
+    started = i;
+  }
+  host_sieve_blocks(&host_workers[0]);
+  for (i = started + 1; i < n; i++) host_sieve_blocks(&host_workers[i]);  // thread could not be started: do it here
+  for (i = 1; i <= started; i++) thread_join(host_workers[i].thread);
+}
+
+// Verification of the device buffers (GPUSieveHost=2), each returns the number of mismatching words or bits
+
+cl_uint gpusieve_host_compare_modinv(const cl_uint *rowinfo)
+{
+  cl_uint i, index, diff = 0;
+
+  for (i = 0; i < host_num_slots; i++)
+  {
+    index = MAX_PRIMES_PER_THREAD*4 + host_slots[i].index * 2 + 1;
+    if (rowinfo[index] != host_rowinfo[index]) diff++;
+  }
+  return diff;
+}
+
+cl_uint gpusieve_host_compare_bit_to_clear(const cl_uchar *pinfo)
+{
+  cl_uint i, diff = 0;
+
+  for (i = 0; i < host_pinfo_size / 4; i++)
+    if (((const cl_uint *) pinfo)[i] != ((cl_uint *) host_pinfo)[i]) diff++;
+  return diff;
+}
+
+cl_uint gpusieve_host_compare_bits(const cl_uint *bitarray, cl_uint numblocks, cl_uint *surplus)
+/* returns the number of candidates the device has cleared but the host did not (real errors),
+   *surplus gets the number of candidates the device left set that the host sieve removed */
+{
+  cl_uint i, missing = 0;
+
+  *surplus = 0;
+  if (host_verify == NULL) return 0;
+  gpusieve_host_sieve(host_verify, numblocks);
+  for (i = 0; i < numblocks * (host_block_size / 32); i++)
+  {
+    missing  += host_popcount(host_verify[i] & ~bitarray[i]);
+    *surplus += host_popcount(bitarray[i] & ~host_verify[i]);
+  }
+  return missing;
+}
+
+#ifdef __cplusplus
+}
+#endif
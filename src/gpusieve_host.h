@@ -0,0 +1,49 @@
+/*
+This file is part of mfaktc (mfakto).
+Copyright (C) 2009 - 2014  Oliver Weihe (o.weihe@t-online.de)
+                           Bertram Franz (bertramf@gmx.net)
+
+mfaktc (mfakto) is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+mfaktc (mfakto) is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with mfaktc (mfakto).  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* host implementation of the GPU sieve (GPUSieveHost=1/2): works on copies of
+   the pinfo (d_sieve_info) and rowinfo (d_calc_bit_to_clear_info) arrays that
+   gpusieve_init builds and does the same steps as the CalcModularInverses,
+   CalcBitToClear, CalcBitToClearAdvance and SegSieve kernels. The bit array is
+   sieved exactly, by several threads. */
+
+#ifndef GPUSIEVE_HOST_H_
+#define GPUSIEVE_HOST_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "my_types.h"
+
+int  gpusieve_host_init(mystuff_t *mystuff, const cl_uchar *pinfo, cl_uint pinfo_size, const cl_uint *rowinfo, cl_uint rowinfo_size,
+                        cl_uint primes_not_sieved, cl_uint primes_special, cl_uint rows, cl_uint row_length, cl_uint block_size);
+void gpusieve_host_free(void);
+void gpusieve_host_init_exponent(cl_uint exponent, cl_uint num_classes);
+void gpusieve_host_init_class(cl_uint exponent, cl_ulong k_min);
+void gpusieve_host_advance_class(cl_uint advance);
+void gpusieve_host_sieve(cl_uint *bitarray, cl_uint numblocks);
+cl_uint gpusieve_host_compare_modinv(const cl_uint *rowinfo);
+cl_uint gpusieve_host_compare_bit_to_clear(const cl_uchar *pinfo);
+cl_uint gpusieve_host_compare_bits(const cl_uint *bitarray, cl_uint numblocks, cl_uint *surplus);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
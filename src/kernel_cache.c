@@ -0,0 +1,233 @@
+/*
+This file is part of mfaktc (mfakto).
+Copyright (C) 2009 - 2014  Oliver Weihe (o.weihe@t-online.de)
+                           Bertram Franz (bertramf@gmx.net)
+
+mfaktc (mfakto) is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+mfaktc (mfakto) is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with mfaktc (mfakto).  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined _MSC_VER || __MINGW32__
+  #include <Windows.h>
+  #include <direct.h>
+  #include <process.h>
+  #define getpid _getpid
+#else
+  #include <unistd.h>
+  #include <sys/stat.h>
+  #include <sys/types.h>
+#endif
+
+#include "my_types.h"
+#include "kernel_cache.h"
+
+#define CACHE_MAGIC "mfaktoKB"
+#define CACHE_HASH_INIT 0xcbf29ce484222325ULL
+#define INCLUDE_DEPTH_MAX 8           /* nesting of #include "..." in the kernel sources */
+
+/* file layout: header, key text (without the terminating 0), binary */
+typedef struct
+{
+  char     magic[8];
+  cl_uint  version;
+  cl_uint  header_size;
+  cl_uint  key_size;
+  cl_uint  binary_size;
+  cl_ulong checksum;                  /* of key text and binary, a partially written file is not used */
+} cache_header_t;
+
+
+static cl_ulong cache_hash(const unsigned char *data, size_t size, cl_ulong hash)
+/* 64-bit FNV-1a */
+{
+  size_t i;
+
+  for(i = 0; i < size; i++) hash = (hash ^ data[i]) * 0x100000001b3ULL;
+  return hash;
+}
+
+
+static int cache_hash_source(const char *filename, cl_ulong *hash, int depth)
+/* adds the file and all files it includes with #include "..." to hash,
+   returns 1 if the file cannot be read */
+{
+  FILE *f;
+  char *text, *line;
+  char name[256];
+  long size;
+
+  f = fopen(filename, "rb");
+  if(f == NULL) return 1;
+  fseek(f, 0, SEEK_END);
+  size = ftell(f);
+  fseek(f, 0, SEEK_SET);
+  text = (char *) malloc(size + 1);
+  if(text == NULL || size < 0 || fread(text, 1, size, f) != (size_t) size)
+  {
+    free(text);
+    fclose(f);
+    return 1;
+  }
+  fclose(f);
+  text[size] = '\0';
+
+  *hash = cache_hash((const unsigned char *) filename, strlen(filename), *hash);
+  *hash = cache_hash((const unsigned char *) text, size, *hash);
+
+  line = text;
+  while(line != NULL && depth < INCLUDE_DEPTH_MAX)
+  {
+    while(*line == ' ' || *line == '\t') line++;
+    /* a missing include file is left to the compiler: it is hashed by its name only */
+    if(strncmp(line, "#include", 8) == 0 && sscanf(line + 8, " \"%255[^\"]\"", name) == 1)
+      cache_hash_source(name, hash, depth + 1);
+    line = strchr(line, '\n');
+    if(line != NULL) line++;
+  }
+  free(text);
+  return 0;
+}
+
+
+static void cache_filename(char *filename, const char *dir, const char *name)
+{
+  sprintf(filename, "%.50s/%s", dir, name);
+}
+
+
+int kernel_cache_key(kernel_cache_key_t *key, const char *device, const char *driver, const char *options,
+                     const char *kernel_file)
+/* returns 0 and fills key, or 1 if kernel_file cannot be read */
+{
+  cl_ulong source_hash = CACHE_HASH_INIT;
+
+  if(cache_hash_source(kernel_file, &source_hash, 0)) return 1;
+
+  sprintf(key->text, "device: %.255s\ndriver: %.255s\noptions: %.255s\nsources: %016llx\n",
+    device, driver, options, (unsigned long long int) source_hash);
+  sprintf(key->name, "%016llx.bin",
+    (unsigned long long int) cache_hash((const unsigned char *) key->text, strlen(key->text), CACHE_HASH_INIT));
+  return 0;
+}
+
+
+int kernel_cache_load(const char *dir, const kernel_cache_key_t *key, unsigned char **binary, size_t *size)
+/* returns 0 and a malloc'ed copy of the binary if the cache has an entry for key, 1 otherwise */
+{
+  cache_header_t header;
+  char filename[80];
+  char *text = NULL;
+  unsigned char *bin = NULL;
+  size_t key_size = strlen(key->text);
+  FILE *f;
+  int ret = 1;
+
+  *binary = NULL;
+  cache_filename(filename, dir, key->name);
+  f = fopen(filename, "rb");
+  if(f == NULL) return 1;
+
+  if(fread(&header, sizeof(cache_header_t), 1, f) == 1 &&
+     memcmp(header.magic, CACHE_MAGIC, 8) == 0 &&
+     header.version == KERNEL_CACHE_VERSION &&
+     header.header_size == sizeof(cache_header_t) &&
+     header.key_size == key_size &&
+     header.binary_size > 0)
+  {
+    text = (char *) malloc(key_size);
+    bin  = (unsigned char *) malloc(header.binary_size);
+    if(text != NULL && bin != NULL &&
+       fread(text, 1, key_size, f) == key_size &&
+       fread(bin, 1, header.binary_size, f) == header.binary_size &&
+       memcmp(text, key->text, key_size) == 0 &&
+       cache_hash(bin, header.binary_size, cache_hash((const unsigned char *) text, key_size, CACHE_HASH_INIT)) == header.checksum)
+    {
+      *binary = bin;
+      *size   = header.binary_size;
+      bin     = NULL;
+      ret     = 0;
+    }
+    free(text);
+    free(bin);
+  }
+  fclose(f);
+  return ret;
+}
+
+
+int kernel_cache_save(const char *dir, const kernel_cache_key_t *key, const unsigned char *binary, size_t size)
+/* writes the binary to a temporary file which then replaces the cache entry, so other
+   instances loading the same entry at the same time see either the old or the new file.
+   Returns 0 on success. */
+{
+  cache_header_t header;
+  char filename[80], tmpname[100];
+  size_t key_size = strlen(key->text);
+  FILE *f;
+  int ok;
+
+#if defined _MSC_VER || __MINGW32__
+  _mkdir(dir);                      /* fails if it exists already, which is fine */
+#else
+  mkdir(dir, 0777);
+#endif
+
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, CACHE_MAGIC, 8);
+  header.version     = KERNEL_CACHE_VERSION;
+  header.header_size = sizeof(cache_header_t);
+  header.key_size    = (cl_uint) key_size;
+  header.binary_size = (cl_uint) size;
+  header.checksum    = cache_hash(binary, size, cache_hash((const unsigned char *) key->text, key_size, CACHE_HASH_INIT));
+
+  cache_filename(filename, dir, key->name);
+  sprintf(tmpname, "%s.%d.tmp", filename, (int) getpid());
+  f = fopen(tmpname, "wb");
+  if(f == NULL)
+  {
+    printf("WARNING: cannot write the kernel cache file %s\n", tmpname);
+    return 1;
+  }
+  ok = fwrite(&header, sizeof(cache_header_t), 1, f) == 1 &&
+       fwrite(key->text, 1, key_size, f) == key_size &&
+       fwrite(binary, 1, size, f) == size;
+  if(fclose(f)) ok = 0;
+
+  if(ok)
+  {
+#if defined _MSC_VER || __MINGW32__
+    ok = MoveFileExA(tmpname, filename, MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+    ok = (rename(tmpname, filename) == 0);
+#endif
+  }
+  if(!ok)
+  {
+    printf("WARNING: cannot write the kernel cache file %s\n", filename);
+    remove(tmpname);
+  }
+  return !ok;
+}
+
+
+void kernel_cache_remove(const char *dir, const kernel_cache_key_t *key)
+{
+  char filename[80];
+
+  cache_filename(filename, dir, key->name);
+  remove(filename);
+}
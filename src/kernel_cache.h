@@ -0,0 +1,56 @@
+/*
+This file is part of mfaktc (mfakto).
+Copyright (C) 2009 - 2014  Oliver Weihe (o.weihe@t-online.de)
+                           Bertram Franz (bertramf@gmx.net)
+
+mfaktc (mfakto) is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+mfaktc (mfakto) is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with mfaktc (mfakto).  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* KernelCacheDir: a directory of compiled kernel binaries, one file per
+   combination of device name, driver version, build options and kernel
+   sources (the kernel file and all files it includes). The file name is a
+   hash of these, the complete key is stored in the file and compared when
+   loading. Files are written under a temporary name and then renamed, so
+   several mfakto instances can share the directory. */
+
+#ifndef KERNEL_CACHE_H_
+#define KERNEL_CACHE_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "my_types.h"
+
+/* increase when the file layout changes */
+#define KERNEL_CACHE_VERSION 1
+
+#define KERNEL_CACHE_KEY_MAX 1024
+
+typedef struct
+{
+  char text[KERNEL_CACHE_KEY_MAX]; /* device, driver, options and source hash, one per line */
+  char name[24];                   /* file name in the cache directory: <hash of text>.bin */
+} kernel_cache_key_t;
+
+int  kernel_cache_key(kernel_cache_key_t *key, const char *device, const char *driver, const char *options,
+                      const char *kernel_file);
+int  kernel_cache_load(const char *dir, const kernel_cache_key_t *key, unsigned char **binary, size_t *size);
+int  kernel_cache_save(const char *dir, const kernel_cache_key_t *key, const unsigned char *binary, size_t size);
+void kernel_cache_remove(const char *dir, const kernel_cache_key_t *key);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
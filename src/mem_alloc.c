@@ -0,0 +1,171 @@
+/*
+This file is part of mfaktc (mfakto).
+Copyright (C) 2009 - 2014  Oliver Weihe (o.weihe@t-online.de)
+                           Bertram Franz (bertramf@gmx.net)
+
+mfaktc (mfakto) is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+mfaktc (mfakto) is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with mfaktc (mfakto).  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined _MSC_VER || __MINGW32__
+  #include <Windows.h>
+#else
+  #include <sys/mman.h>
+#endif
+
+#include "mem_alloc.h"
+
+#define MEM_HUGEPAGE_SIZE (2*1024*1024)   /* x86 huge page, smaller tables are not worth one */
+
+#define MEM_KIND_MALLOC  0
+#define MEM_KIND_MMAP    1              /* MAP_HUGETLB */
+#define MEM_KIND_VIRTUAL 2              /* VirtualAlloc(MEM_LARGE_PAGES) */
+#define MEM_KIND_MEMALIGN 3             /* posix_memalign() + madvise() */
+
+/* stored in front of each buffer, at most 2 * MEM_ALIGN bytes after base */
+typedef struct
+{
+  void  *base;
+  size_t size;
+  int    kind;
+  int    huge;                          /* counted in hugepage_allocs */
+} mem_header_t;
+
+static int hugepages_mode = MEM_HUGEPAGES_OFF;
+static unsigned int hugepage_allocs;    /* buffers currently on huge pages, only allocated during init */
+
+
+int mem_set_hugepages(int mode)
+/* selects how mem_alloc(size, 1) uses huge pages, returns the mode which
+   can be used on this OS */
+{
+  if(mode < MEM_HUGEPAGES_OFF || mode > MEM_HUGEPAGES_EXPLICIT) mode = MEM_HUGEPAGES_OFF;
+#if defined _MSC_VER || __MINGW32__
+  if(mode == MEM_HUGEPAGES_TRANSPARENT) mode = MEM_HUGEPAGES_OFF;   /* no transparent huge pages on Windows */
+#elif !defined MADV_HUGEPAGE
+  if(mode == MEM_HUGEPAGES_TRANSPARENT) mode = MEM_HUGEPAGES_OFF;
+#endif
+  hugepages_mode = mode;
+  return mode;
+}
+
+
+int mem_get_hugepages(void)
+{
+  return hugepages_mode;
+}
+
+
+unsigned int mem_hugepage_allocs(void)
+{
+  return hugepage_allocs;
+}
+
+
+static void *mem_alloc_huge(size_t *total, int *kind)
+/* tries to get *total bytes on huge pages, rounds *total up to the page size */
+{
+  void *base = NULL;
+#if defined _MSC_VER || __MINGW32__
+  SIZE_T large = GetLargePageMinimum();
+
+  if(hugepages_mode == MEM_HUGEPAGES_EXPLICIT && large > 0)
+  {
+    *total = (*total + large - 1) & ~(large - 1);
+    /* needs the "Lock pages in memory" privilege, else NULL */
+    base = VirtualAlloc(NULL, *total, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+    if(base != NULL) *kind = MEM_KIND_VIRTUAL;
+  }
+#else
+  *total = (*total + MEM_HUGEPAGE_SIZE - 1) & ~((size_t) MEM_HUGEPAGE_SIZE - 1);
+#ifdef MAP_HUGETLB
+  if(hugepages_mode == MEM_HUGEPAGES_EXPLICIT)
+  {
+    /* needs reserved pages in /proc/sys/vm/nr_hugepages, else MAP_FAILED */
+    base = mmap(NULL, *total, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if(base == MAP_FAILED) base = NULL;
+    else *kind = MEM_KIND_MMAP;
+  }
+#endif
+#ifdef MADV_HUGEPAGE
+  if(base == NULL)
+  {
+    if(posix_memalign(&base, MEM_HUGEPAGE_SIZE, *total) != 0) return NULL;
+    if(madvise(base, *total, MADV_HUGEPAGE) != 0)
+    {
+      free(base);
+      return NULL;
+    }
+    memset(base, 0, *total);
+    *kind = MEM_KIND_MEMALIGN;
+  }
+#endif
+#endif
+  return base;
+}
+
+
+void *mem_alloc(size_t size, int hugepages)
+/* returns size bytes of zeroed memory, aligned to MEM_ALIGN. With hugepages != 0
+   and a huge page mode set by mem_set_hugepages() large buffers are placed on
+   huge pages if the OS has some available. NULL if out of memory. */
+{
+  mem_header_t *header;
+  unsigned char *base = NULL, *ptr;
+  size_t total = size + MEM_ALIGN;
+  int kind = MEM_KIND_MALLOC;
+
+  if(hugepages && hugepages_mode != MEM_HUGEPAGES_OFF && total >= MEM_HUGEPAGE_SIZE / 2)
+  {
+    base = (unsigned char *) mem_alloc_huge(&total, &kind);
+  }
+  if(base == NULL)
+  {
+    total = size + 2 * MEM_ALIGN;
+    base = (unsigned char *) calloc(total, 1);
+    if(base == NULL) return NULL;
+    kind = MEM_KIND_MALLOC;
+  }
+
+  ptr = (unsigned char *) (((size_t) base + sizeof(mem_header_t) + MEM_ALIGN - 1) & ~((size_t) MEM_ALIGN - 1));
+  header = (mem_header_t *) ptr - 1;
+  header->base = base;
+  header->size = total;
+  header->kind = kind;
+  header->huge = (kind != MEM_KIND_MALLOC);
+  if(header->huge) hugepage_allocs++;
+  return ptr;
+}
+
+
+void mem_free(void *ptr)
+{
+  mem_header_t *header;
+
+  if(ptr == NULL) return;
+  header = (mem_header_t *) ptr - 1;
+  if(header->huge) hugepage_allocs--;
+  switch(header->kind)
+  {
+#if defined _MSC_VER || __MINGW32__
+    case MEM_KIND_VIRTUAL:  VirtualFree(header->base, 0, MEM_RELEASE); break;
+#else
+    case MEM_KIND_MMAP:     munmap(header->base, header->size); break;
+#endif
+    default:                free(header->base); break;
+  }
+}
@@ -0,0 +1,49 @@
+/*
+This file is part of mfaktc (mfakto).
+Copyright (C) 2009 - 2014  Oliver Weihe (o.weihe@t-online.de)
+                           Bertram Franz (bertramf@gmx.net)
+
+mfaktc (mfakto) is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+mfaktc (mfakto) is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with mfaktc (mfakto).  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* cache line aligned, zero filled buffers for the CPU sieve and the k_tab.
+   Large tables (the sieve primes and their offsets) can be requested on huge
+   pages, which saves TLB misses when the sieve walks through them once per
+   segment. HugePages selects how: */
+
+#ifndef MEM_ALLOC_H_
+#define MEM_ALLOC_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+
+#define MEM_ALIGN 64                    /* cache line size */
+
+#define MEM_HUGEPAGES_OFF         0     /* only aligned to MEM_ALIGN */
+#define MEM_HUGEPAGES_TRANSPARENT 1     /* Linux: 2 MiB aligned plus madvise(MADV_HUGEPAGE) */
+#define MEM_HUGEPAGES_EXPLICIT    2     /* Linux: MAP_HUGETLB, Windows: MEM_LARGE_PAGES; falls back to 1 */
+
+void *mem_alloc(size_t size, int hugepages);
+void  mem_free(void *ptr);
+int   mem_set_hugepages(int mode);
+int   mem_get_hugepages(void);
+unsigned int mem_hugepage_allocs(void);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
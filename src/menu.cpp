@@ -285,8 +285,17 @@ void check_and_do_reinit(mystuff_t *saved_mystuff, mystuff_t *mystuff)
 #endif
       )
     {
+      if (dev_count > 1)
+      {
+        // the sieve tables are shared by the CPU sieves of all devices
+        printf("The CPU sieve cannot be reinitialized while %u devices use it, keeping the old values\n", dev_count);
+        mystuff->sieve_primes = saved_mystuff->sieve_primes;
+        mystuff->sieve_size   = saved_mystuff->sieve_size;
+        return;
+      }
       if (mystuff->verbosity > 0)
         printf("Reinitializing CPU sieve\n");
+      tf_class_opencl_flush(mystuff); // the class started ahead is sieved with the old tables
       sieve_free();
 #ifdef SIEVE_SIZE_LIMIT
       sieve_init();
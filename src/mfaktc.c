@@ -43,12 +43,14 @@ along with mfaktc (mfakto).  If not, see <http://www.gnu.org/licenses/>.
 #include "perftest.h"
 #include "gpusieve.h"
 #include "output.h"
+#include "threads.h"
+#include "mem_alloc.h"
 
 
-mystuff_t mystuff;
+THREAD_LOCAL mystuff_t mystuff;   /* one per device thread, see device_thread() */
 
-extern OpenCL_deviceinfo_t deviceinfo;
-extern kernel_info_t       kernel_info[];
+extern THREAD_LOCAL OpenCL_deviceinfo_t deviceinfo;
+extern THREAD_LOCAL kernel_info_t       kernel_info[];
 GPU_type gpu_types[]={
   {GPU_AUTO,     0,  "AUTO"},
   {GPU_VLIW4,   64,  "VLIW4"},
@@ -102,7 +104,7 @@ The variables exp, bit_min and bit_max must be a valid assignment! */
   // if GPU-sieving: check that we have an appropriate kernel
   if (mystuff->gpu_sieving == 1)
   {
-    if ((kernel >= BARRETT79_MUL32) && (kernel <= BARRETT74_MUL15))
+    if ((kernel >= BARRETT79_MUL32) && (kernel <= MG96))
       kernel += BARRETT79_MUL32_GS - BARRETT79_MUL32;  // adjust: if asked for the CPU version, check the GPU one
     if ((kernel < BARRETT79_MUL32_GS) || (kernel >= UNKNOWN_GS_KERNEL))
       return 0;  // no GPU version available
@@ -166,6 +168,7 @@ GPUKernels find_fastest_kernel(mystuff_t *mystuff)
       BARRETT92_MUL32,  // "cl_barrett32_92" (216.10 M/s)
       _63BIT_MUL24,     // "mfakto_cl_63"    (200.56 M/s)
       MG62,             // "cl_mg_62"        (158.62 M/s)
+      MG96,             // "cl_mg96"         (fallback for 93-95 bits only)
       UNKNOWN_KERNEL,   //
       UNKNOWN_KERNEL,   //
       UNKNOWN_KERNEL,
@@ -189,6 +192,7 @@ GPUKernels find_fastest_kernel(mystuff_t *mystuff)
       _63BIT_MUL24,     // "mfakto_cl_63"    (212.98 M/s)
 //      BARRETT70_MUL24,  // "cl_barrett24_70" (202.59 M/s)
       BARRETT92_MUL32,  // "cl_barrett32_92" (190.36 M/s)
+      MG96,             // "cl_mg96"         (fallback for 93-95 bits only)
       UNKNOWN_KERNEL,   //
       UNKNOWN_KERNEL,   //
       UNKNOWN_KERNEL,
@@ -212,6 +216,7 @@ GPUKernels find_fastest_kernel(mystuff_t *mystuff)
       BARRETT92_MUL32,  // "cl_barrett32_92" (155.52 M/s)  v=2: (169.63 M/s)
       _63BIT_MUL24,     // "mfakto_cl_63"    (141.31 M/s)
       MG88,             // "cl_mg88"         (110.75 M/s) //new with 0.15
+      MG96,             // "cl_mg96"         (fallback for 93-95 bits only)
       UNKNOWN_KERNEL,   //
       UNKNOWN_KERNEL,   //
       UNKNOWN_KERNEL },
@@ -235,6 +240,7 @@ GPUKernels find_fastest_kernel(mystuff_t *mystuff)
       _63BIT_MUL24,     // "mfakto_cl_63"    (200.56 M/s) / (132.38 M/s)
       MG62,             // "cl_mg_62"        (158.62 M/s) / (104.55 M/s)
       MG88,             // "cl_mg88"          167.88
+      MG96,             // "cl_mg96"         (fallback for 93-95 bits only)
       UNKNOWN_KERNEL,
       UNKNOWN_KERNEL,
       UNKNOWN_KERNEL },
@@ -257,6 +263,7 @@ GPUKernels find_fastest_kernel(mystuff_t *mystuff)
       _63BIT_MUL24,     // "mfakto_cl_63"    344.40  / 362.55
       MG62,             // "cl_mg_62"        367.04  / 323.39
       MG88,             // "cl_mg88"                 / 305.38
+      MG96,             // "cl_mg96"         (fallback for 93-95 bits only)
       UNKNOWN_KERNEL,
       UNKNOWN_KERNEL,
       UNKNOWN_KERNEL },
@@ -280,6 +287,7 @@ GPUKernels find_fastest_kernel(mystuff_t *mystuff)
       _63BIT_MUL24,     // "mfakto_cl_63"     586.10
       _71BIT_MUL24,     // "mfakto_cl_71"     571.66
       MG88,             // "cl_mg88"          428.96
+      MG96,             // "cl_mg96"         (fallback for 93-95 bits only)
       UNKNOWN_KERNEL,
       UNKNOWN_KERNEL },
     {
@@ -301,6 +309,7 @@ GPUKernels find_fastest_kernel(mystuff_t *mystuff)
       BARRETT88_MUL15,  // "cl_barrett15_88" (47.64 M/s)
       BARRETT92_MUL32,  // "cl_barrett32_92" (44.43 M/s)
       _63BIT_MUL24,     // "mfakto_cl_63"    (42.09 M/s)
+      MG96,             // "cl_mg96"         (fallback for 93-95 bits only)
       UNKNOWN_KERNEL,   //
       UNKNOWN_KERNEL,
       UNKNOWN_KERNEL,
@@ -324,6 +333,7 @@ GPUKernels find_fastest_kernel(mystuff_t *mystuff)
       BARRETT83_MUL15,  // "cl_barrett15_83" (2.65 M/s)
       _63BIT_MUL24,     // "mfakto_cl_63"    (2.59 M/s)
       BARRETT88_MUL15,  // "cl_barrett15_88" (2.43 M/s)
+      MG96,             // "cl_mg96"         (fallback for 93-95 bits only)
       UNKNOWN_KERNEL,   //
       UNKNOWN_KERNEL,
       UNKNOWN_KERNEL,
@@ -347,6 +357,7 @@ GPUKernels find_fastest_kernel(mystuff_t *mystuff)
       BARRETT82_MUL15,  // "cl_barrett15_82" (2.72 M/s)
       BARRETT83_MUL15,  // "cl_barrett15_83" (2.65 M/s)
       BARRETT88_MUL15,  // "cl_barrett15_88" (2.43 M/s)
+      MG96,             // "cl_mg96"         (fallback for 93-95 bits only)
       UNKNOWN_KERNEL,   //
       UNKNOWN_KERNEL,
       UNKNOWN_KERNEL,
@@ -370,6 +381,7 @@ GPUKernels find_fastest_kernel(mystuff_t *mystuff)
       BARRETT83_MUL15,  // "cl_barrett15_83" (13.00 M/s)
       BARRETT88_MUL15,  // "cl_barrett15_88" (12.05 M/s)
       _63BIT_MUL24,     // "mfakto_cl_63"    (?)
+      MG96,             // "cl_mg96"         (fallback for 93-95 bits only)
       UNKNOWN_KERNEL,   //
       UNKNOWN_KERNEL,
       UNKNOWN_KERNEL,
@@ -393,6 +405,7 @@ GPUKernels find_fastest_kernel(mystuff_t *mystuff)
       BARRETT92_MUL32,  // "cl_barrett32_92" (216.10 M/s)
       _63BIT_MUL24,     // "mfakto_cl_63"    (200.56 M/s)
       MG62,             // "cl_mg_62"        (158.62 M/s)
+      MG96,             // "cl_mg96"         (fallback for 93-95 bits only)
       UNKNOWN_KERNEL,   //
       UNKNOWN_KERNEL,
       UNKNOWN_KERNEL,
@@ -422,6 +435,253 @@ GPUKernels find_fastest_kernel(mystuff_t *mystuff)
 }
 
 
+/*
+Multiple devices (-d with a list of devices, or SplitDevice): the classes of an
+assignment are handed out to the main thread and one device thread for each
+additional device. Each device thread has its own mystuff (THREAD_LOCAL), the
+job parameters are copied from the main thread's one. The classes finish out
+of order, so a checkpoint covers only the classes below done_upto, which are
+all finished.
+*/
+static struct
+{
+  thread_mutex_t mutex;
+  thread_cond_t  start_cond;      /* new job or shutdown, for the device threads */
+  thread_cond_t  done_cond;       /* a device thread is ready or finished its job */
+  thread_t       threads[NUM_DEVICES_MAX];
+  mystuff_t     *main;            /* the main thread's mystuff, NULL if no device threads are running */
+  unsigned int   generation;      /* incremented for each job */
+  unsigned int   ready, busy;     /* device threads initialized / still working on the job */
+  int            shutdown, error, quit;
+  GPUKernels     use_kernel;
+  unsigned long long int k_min, k_max;
+  unsigned int   next_class, max_class, done_upto, class_counter;
+  int            factorsfound, factors_done, do_checkpoint;
+  time_t         time_last_checkpoint;
+  double         ghzdays;
+  unsigned char  class_done[NUM_CLASSES];
+  int            class_factors[NUM_CLASSES];
+} job;
+
+/* process classes of the current job until there are none left, called by
+   the main thread and all device threads */
+static void tf_run_classes(mystuff_t *my)
+{
+  unsigned int cur_class;
+  int numfactors, add_file_exists = 0, do_checkpoint;
+  time_t now, time_add_file_check = 0;
+
+  for(;;)
+  {
+    thread_mutex_lock(&job.mutex);
+    while(job.next_class <= job.max_class && !class_needed(my->exponent, job.k_min, job.next_class)) job.next_class++;
+    if(job.main->quit && job.next_class <= job.max_class) job.quit = 1;
+    if(job.next_class > job.max_class || job.error || job.quit)
+    {
+      thread_mutex_unlock(&job.mutex);
+      break;
+    }
+    cur_class = job.next_class++;
+    my->stats.class_number  = cur_class;
+    my->stats.class_counter = ++job.class_counter;
+    thread_mutex_unlock(&job.mutex);
+
+    if (my->gpu_sieving == 1)
+    {
+      gpusieve_init_class(my, job.k_min + cur_class);
+    }
+    numfactors = tf_class_opencl(job.k_min + cur_class, job.k_max, my, job.use_kernel, 0);
+
+    thread_mutex_lock(&job.mutex);
+    if(numfactors == RET_ERROR)
+    {
+      printf("ERROR from tf_class (device %u).\n", my->dev_index + 1);
+      job.error = 1;
+      thread_mutex_unlock(&job.mutex);
+      break;
+    }
+    job.class_done[cur_class]    = 1;
+    job.class_factors[cur_class] = numfactors;
+    job.factorsfound            += numfactors;
+    if(numfactors > 0) job.ghzdays = my->stats.ghzdays;
+    while(job.done_upto <= job.max_class &&
+          (job.class_done[job.done_upto] || !class_needed(my->exponent, job.k_min, job.done_upto)))
+    {
+      job.factors_done += job.class_factors[job.done_upto];
+      job.done_upto++;
+    }
+
+    now = time(NULL);
+    if(my->checkpoints > 0)
+    {
+      do_checkpoint = ((my->checkpoints > 1) && (--job.do_checkpoint <= 0)) ||
+                      ((my->checkpoints == 1) && (now - job.time_last_checkpoint > (time_t) my->checkpointdelay)) ||
+                        job.main->quit;
+      if(do_checkpoint && job.done_upto > 0)
+      {
+        checkpoint_write(my->exponent, my->bit_min, my->bit_max_stage, job.done_upto - 1, job.factors_done);
+        job.do_checkpoint        = my->checkpoints;
+        job.time_last_checkpoint = now;
+      }
+    }
+    if((my->stopafterfactor >= 2) && (job.factorsfound > 0)) job.next_class = job.max_class + 1;
+    thread_mutex_unlock(&job.mutex);
+
+    if(my->dev_index == 0) /* the worktodo file is handled by the main thread only */
+    {
+      if (add_file_exists)
+      {
+        if (now > time_add_file_check + 300)   // do not process the add file until it is 5 minutes old
+        {
+          process_add_file(my->workfile);
+          add_file_exists = 0;
+        }
+      }
+      else
+      {
+        add_file_exists = add_file_available(my->workfile);
+        time_add_file_check = now;
+      }
+    }
+    fflush(NULL);
+  }
+}
+
+/* tf() for several devices, returns the number of factors found (including
+   the initial factorsfound), RET_QUIT or RET_ERROR */
+static int tf_multi_device(mystuff_t *mystuff, unsigned int cur_class, unsigned int max_class,
+                           unsigned long long int k_min, unsigned long long int k_max,
+                           GPUKernels use_kernel, int factorsfound)
+{
+  int retval;
+
+  thread_mutex_lock(&job.mutex);
+  job.use_kernel           = use_kernel;
+  job.k_min                = k_min;
+  job.k_max                = k_max;
+  job.next_class           = cur_class;
+  job.done_upto            = cur_class;
+  job.max_class            = max_class;
+  job.class_counter        = mystuff->stats.class_counter;
+  job.factorsfound         = factorsfound;
+  job.factors_done         = factorsfound;
+  job.do_checkpoint        = mystuff->checkpoints;
+  job.time_last_checkpoint = time(NULL);
+  job.ghzdays              = mystuff->stats.ghzdays;
+  job.error                = 0;
+  job.quit                 = 0;
+  memset(job.class_done, 0, sizeof(job.class_done));
+  memset(job.class_factors, 0, sizeof(job.class_factors));
+  job.busy = dev_count - 1;
+  job.generation++;
+  thread_cond_broadcast(&job.start_cond);
+  thread_mutex_unlock(&job.mutex);
+
+  tf_run_classes(mystuff);
+
+  thread_mutex_lock(&job.mutex);
+  while(job.busy > 0) thread_cond_wait(&job.done_cond, &job.mutex);
+  mystuff->stats.class_counter = job.class_counter;
+  mystuff->stats.ghzdays       = job.ghzdays;
+  if     (job.error) retval = RET_ERROR;
+  else if(job.quit)  retval = RET_QUIT;
+  else               retval = job.factorsfound;
+  thread_mutex_unlock(&job.mutex);
+
+  return retval;
+}
+
+int selftest(mystuff_t *mystuff, enum MODES type);
+
+static THREAD_FUNC(device_thread)
+{
+  cl_uint dev = (cl_uint)(size_t) arg;
+  unsigned int generation = 0;
+  int error;
+
+  thread_mutex_lock(&job.mutex);
+  mystuff = *job.main; /* the configuration, the buffers are allocated by init_CL_worker() */
+  thread_mutex_unlock(&job.mutex);
+  mystuff.dev_index = dev;
+  mystuff.mode      = MODE_SELFTEST_SHORT;
+
+  error = init_CL_worker(dev);
+  if(!error) error = selftest(&mystuff, MODE_SELFTEST_SHORT);
+  if(error) printf("ERROR: initialization or selftest of device %u failed\n", dev + 1);
+
+  thread_mutex_lock(&job.mutex);
+  job.ready++;
+  if(error) job.error = 1;
+  thread_cond_broadcast(&job.done_cond);
+  while(!error)
+  {
+    while(job.generation == generation && !job.shutdown) thread_cond_wait(&job.start_cond, &job.mutex);
+    if(job.shutdown) break;
+    generation                 = job.generation;
+    mystuff.mode               = job.main->mode;
+    mystuff.exponent           = job.main->exponent;
+    mystuff.bit_min            = job.main->bit_min;
+    mystuff.bit_max_assignment = job.main->bit_max_assignment;
+    mystuff.bit_max_stage      = job.main->bit_max_stage;
+    mystuff.stats              = job.main->stats;
+    thread_mutex_unlock(&job.mutex);
+
+    if (mystuff.gpu_sieving == 1)
+    {
+      gpusieve_init_exponent(&mystuff);
+    }
+    tf_run_classes(&mystuff);
+
+    thread_mutex_lock(&job.mutex);
+    job.busy--;
+    thread_cond_broadcast(&job.done_cond);
+  }
+  thread_mutex_unlock(&job.mutex);
+
+  cleanup_CL_worker();
+  THREAD_RETURN;
+}
+
+/* start the threads for dev_list[1 ... dev_count-1], one after the other */
+static int start_device_threads(void)
+{
+  cl_uint i;
+
+  thread_mutex_init(&job.mutex);
+  thread_cond_init(&job.start_cond);
+  thread_cond_init(&job.done_cond);
+  job.main = &mystuff;
+
+  for(i = 1; i < dev_count; i++)
+  {
+    if(thread_create(&job.threads[i], device_thread, (void *)(size_t) i))
+    {
+      printf("ERROR: cannot start the thread for device %u\n", i + 1);
+      return 1;
+    }
+    thread_mutex_lock(&job.mutex);
+    while(job.ready < i) thread_cond_wait(&job.done_cond, &job.mutex);
+    thread_mutex_unlock(&job.mutex);
+    if(job.error) return 1;
+  }
+  if(mystuff.verbosity >= 1) printf("Using %u devices\n", dev_count);
+  return 0;
+}
+
+static void stop_device_threads(void)
+{
+  cl_uint i;
+
+  if(job.main == NULL) return;
+  thread_mutex_lock(&job.mutex);
+  job.shutdown = 1;
+  thread_cond_broadcast(&job.start_cond);
+  thread_mutex_unlock(&job.mutex);
+  for(i = 1; i < dev_count; i++) thread_join(job.threads[i]);
+  job.main = NULL;
+}
+
+
 int tf(mystuff_t *mystuff, int class_hint, cl_ulong k_hint, GPUKernels use_kernel)
 /*
 tf M<mystuff->exponent> from 2^<mystuff->bit_min> to 2^<mystuff->mystuff->bit_max_stage>
@@ -445,7 +705,7 @@ other return value
 -1 unknown mode
 */
 {
-  unsigned int cur_class, max_class, i, count = 0;
+  unsigned int cur_class, max_class, next_class, i, count = 0;
   unsigned long long int k_min, k_max, k_range, tmp;
   unsigned int f_hi, f_med, f_low;
   struct timeval timer;
@@ -550,7 +810,13 @@ other return value
     gpusieve_init_exponent(mystuff);
   }
 
-  for(; cur_class <= max_class; cur_class++)
+  if(mystuff->mode == MODE_NORMAL && dev_count > 1)
+  {
+    factorsfound = tf_multi_device(mystuff, cur_class, max_class, k_min, k_max, use_kernel, factorsfound);
+    if(factorsfound == RET_QUIT && mystuff->printmode == 1) printf("\n");
+    if(factorsfound == RET_ERROR || factorsfound == RET_QUIT) return factorsfound;
+  }
+  else for(; cur_class <= max_class; cur_class++)
   {
     if(class_needed(mystuff->exponent, k_min, cur_class))
     {
@@ -562,6 +828,7 @@ other return value
    finished. The signal handler which sets mystuff->quit not active during
    selftests so we need to check for RET_QUIT only when doing real work. */
         if(mystuff->printmode == 1)printf("\n");
+        tf_class_opencl_flush(mystuff);
         return RET_QUIT;
       }
       else
@@ -569,12 +836,15 @@ other return value
         count++;
         mystuff->stats.class_counter++;
 
+        /* tf_class_opencl() starts the next class while the last grids (CPU sieve) or the
+           last TF kernel (GPU sieve) of this one are running */
+        for(next_class = cur_class + 1; (next_class <= max_class) && !class_needed(mystuff->exponent, k_min, next_class); next_class++);
         if (mystuff->gpu_sieving == 1)
         {
-          gpusieve_init_class(mystuff, k_min+cur_class);
+          gpusieve_init_class(mystuff, k_min+cur_class); // nothing to do if tf_class_opencl() has prepared it
           if ((use_kernel >= BARRETT79_MUL32_GS) && (use_kernel < UNKNOWN_GS_KERNEL))
           {
-            numfactors = tf_class_opencl (k_min+cur_class, k_max, mystuff, use_kernel);
+            numfactors = tf_class_opencl (k_min+cur_class, k_max, mystuff, use_kernel, (next_class <= max_class) ? k_min+next_class : 0);
           }
           else
           {
@@ -583,10 +853,10 @@ other return value
         }
         else
         {
-          sieve_init_class(mystuff->exponent, k_min+cur_class, mystuff->sieve_primes);
+          /* tf_class_opencl() initializes the sieve for this class */
           if ((use_kernel >= _71BIT_MUL24) && (use_kernel < UNKNOWN_KERNEL))
           {
-            numfactors = tf_class_opencl (k_min+cur_class, k_max, mystuff, use_kernel);
+            numfactors = tf_class_opencl (k_min+cur_class, k_max, mystuff, use_kernel, (next_class <= max_class) ? k_min+next_class : 0);
           }
           else
           {
@@ -635,6 +905,7 @@ other return value
       fflush(NULL);
     }
   }
+  tf_class_opencl_flush(mystuff); /* StopAfterFactor may have skipped a class that was already started */
   if(mystuff->mode != MODE_SELFTEST_SHORT && mystuff->printmode == 1)printf("\n");
   print_result_line(mystuff, factorsfound);
 
@@ -751,6 +1022,69 @@ k_max and k_min are used as 64bit temporary integers here...
 }
 
 
+static int tf_bulk(mystuff_t *mystuff)
+/*
+bulk mode (BulkExponents in mfakto.ini): trial factors the next assignments
+of the worktodo file which start at the same low bit level together, one bit
+level per call, and updates the worktodo file.
+
+return value:
+number of assignments processed, 0 if bulk mode does not apply to the next
+assignments (e.g. bit level out of range, only one assignment)
+RET_ERROR any CL function returned an error
+RET_QUIT if early exit was requested by SIGINT
+*/
+{
+  static struct ASSIGNMENT list[BULK_EXPONENTS_MAX];
+  static bulk_exponent_t   bulk[BULK_EXPONENTS_MAX];
+  static int gpu_sieve_noticed = 0;
+  enum ASSIGNMENT_ERRORS parse_ret;
+  int count, i, bit_min, ret;
+
+  if(mystuff->gpu_sieving)
+  {
+    if(!gpu_sieve_noticed)printf("bulk mode: BulkExponents=%u needs SieveOnGPU=0, processing the assignments one at a time\n", mystuff->bulk_exponents);
+    gpu_sieve_noticed = 1;
+    return 0;
+  }
+  if(get_bulk_assignments(mystuff->workfile, list, mystuff->bulk_exponents, &count, 0) != OK) return 0;
+  if(count < 2) return 0;
+  bit_min = list[0].bit_min;
+  if((bit_min < kernel_info[BARRETT69_MUL15_BULK].bit_min) || (bit_min + 1 > kernel_info[BARRETT69_MUL15_BULK].bit_max))
+  {
+    printf("bulk mode: M%u from 2^%d is outside of %d to %d bits, processing it on its own\n", list[0].exponent, bit_min,
+           kernel_info[BARRETT69_MUL15_BULK].bit_min, kernel_info[BARRETT69_MUL15_BULK].bit_max);
+    return 0;
+  }
+
+  for(i = 0; i < count; i++)
+  {
+    bulk[i].exponent     = list[i].exponent;
+    bulk[i].bit_min      = bit_min;
+    bulk[i].k_min        = calculate_k(list[i].exponent, bit_min);
+    bulk[i].k_min       -= bulk[i].k_min % mystuff->num_classes;  /* k_min is now 0 mod NUM_CLASSES */
+    bulk[i].k_max        = calculate_k(list[i].exponent, bit_min + 1);
+    bulk[i].factorsfound = 0;
+  }
+  if(mystuff->verbosity >= 1)printf("bulk mode: %d assignments from 2^%d to 2^%d (first: M%u, last: M%u)\n",
+                                      count, bit_min, bit_min + 1, list[0].exponent, list[count-1].exponent);
+
+  ret = tf_bulk_opencl(bulk, count, mystuff);
+  if(ret == RET_QUIT && mystuff->printmode == 1) printf("\n");
+  if(ret == RET_ERROR || ret == RET_QUIT) return ret;
+
+  for(i = 0; i < count; i++)
+  {
+    if((bit_min + 1 == list[i].bit_max) || ((mystuff->stopafterfactor > 0) && (bulk[i].factorsfound > 0)))
+      parse_ret = clear_assignment(mystuff->workfile, list[i].exponent, bit_min, list[i].bit_max, 0);
+    else
+      parse_ret = clear_assignment(mystuff->workfile, list[i].exponent, bit_min, list[i].bit_max, bit_min + 1);
+    if(parse_ret != OK) printf("ERROR: clear_assignment() / modify_assignment(): failed for M%u (%d)\n", list[i].exponent, parse_ret);
+  }
+  return count;
+}
+
+
 int selftest(mystuff_t *mystuff, enum MODES type)
 /*
 type = 1: small selftest (this is executed EACH time mfakto is started)
@@ -780,6 +1114,16 @@ RET_ERROR we might have a serios problem
                          };
   // save the SievePrimes ini value as the selftest may lower it to fit small test-exponents
   unsigned int sieve_primes_save = mystuff->sieve_primes;
+  // save the GPUSieveSize ini value: the selftest uses the smallest GPU sieve so that each class needs
+  // several sieve blocks and the bit-to-clear advance (gpusieve_advance_class) is tested as well
+  unsigned int gpu_sieve_size_save = mystuff->gpu_sieve_size;
+
+  if (mystuff->gpu_sieving)
+  {
+    mystuff->gpu_sieve_size = GPU_SIEVE_SIZE_MIN * 1024 * 1024;
+    while (mystuff->gpu_sieve_size % mystuff->gpu_sieve_processing_size != 0)
+      mystuff->gpu_sieve_size += 1024 * 1024;   // sieve_size must be a multiple of sieve_processing_size
+  }
 
   register_signal_handler(mystuff);
 
@@ -869,8 +1213,9 @@ RET_ERROR we might have a serios problem
   if(st_unknown > 0)    printf("  unknown return value      %d\n", st_unknown);
   printf("\n");
 
-  // restore SievePrimes ini value
+  // restore SievePrimes and GPUSieveSize ini values
   mystuff->sieve_primes = sieve_primes_save;
+  mystuff->gpu_sieve_size = gpu_sieve_size_save;
 
   if(st_success == num_selftests)
   {
@@ -891,6 +1236,7 @@ int main(int argc, char **argv)
   int bit_min = -1, bit_max = -1;
   int parse_ret = -1;
   int devicenumber = 0;
+  int extra_devices[NUM_DEVICES_MAX], num_extra_devices = 0;
 
   int i = 1, tmp = 0;
   char *ptr;
@@ -903,6 +1249,20 @@ int main(int argc, char **argv)
   mystuff.bit_max_assignment = -1;
   mystuff.bit_max_stage = -1;
   mystuff.gpu_sieving = 0;
+  mystuff.sieve_threads = 1;
+  mystuff.sieve_producer = 1;
+  mystuff.wait_spin = STREAM_WAIT_SPIN_DEFAULT;
+  mystuff.zero_copy = 0;
+  mystuff.split_device = 0;
+  mystuff.dev_index = 0;
+  mystuff.bulk_exponents = 0;
+  mystuff.copy_queue = 0;
+  mystuff.gpu_sieve_buffers = GPU_SIEVE_BUFFERS_DEFAULT;
+  mystuff.gpu_sieve_host = 0;
+  mystuff.gpu_sieve_host_threads = 0;
+  mystuff.grid_adjust = 0;
+  mystuff.grid_time = GRID_TIME_DEFAULT;
+  mystuff.queue_time = QUEUE_TIME_DEFAULT;
   mystuff.gpu_sieve_size = GPU_SIEVE_SIZE_DEFAULT * 1024 * 1024;		/* Size (in bits) of the GPU sieve.  Default is 64M bits. */
   mystuff.gpu_sieve_primes = GPU_SIEVE_PRIMES_DEFAULT;				/* Default to sieving primes below about 1.05M */
   mystuff.gpu_sieve_processing_size = GPU_SIEVE_PROCESS_SIZE_DEFAULT * 1024;	/* Default to 16K bits processed by each block in a Barrett kernel. */
@@ -959,6 +1319,10 @@ int main(int argc, char **argv)
       else
       {
         devicenumber = strtol(argv[i+1],&ptr,10);
+        while(*ptr == ',' && num_extra_devices < NUM_DEVICES_MAX - 1)  // -d 1,2,...: several devices
+        {
+          extra_devices[num_extra_devices++] = strtol(ptr+1,&ptr,10);
+        }
         if(*ptr || errno || devicenumber != strtol(argv[i+1],&ptr,10) )
         {
           printf("ERROR: can't parse <device number> for option \"-d\"\n");
@@ -1063,6 +1427,7 @@ int main(int argc, char **argv)
   }
 
   read_config(&mystuff);
+  mystuff.huge_pages = mem_set_hugepages(mystuff.huge_pages);
 
 /* print current configuration */
   if(mystuff.verbosity >= 1)
@@ -1116,6 +1481,14 @@ int main(int argc, char **argv)
     printf("ERROR: init_CL(%d, %d) failed\n", mystuff.num_streams, devicenumber);
     return ERR_INIT;
   }
+  for(tmp = 0; tmp < num_extra_devices; tmp++)
+  {
+    if(add_CL_device(extra_devices[tmp]) != CL_SUCCESS)
+    {
+      printf("ERROR: add_CL_device(%d) failed\n", extra_devices[tmp]);
+      return ERR_INIT;
+    }
+  }
 
   set_gpu_type();
 
@@ -1129,6 +1502,17 @@ int main(int argc, char **argv)
     // threads_per_grid is the number of FC's per kernel invocation. It must be divisible by the vectorsize
     // as only threads_per_grid / vectorsize threads will actually be started.
     mystuff.threads_per_grid -= mystuff.threads_per_grid % (mystuff.vectorsize * deviceinfo.maxThreadsPerBlock);
+    mystuff.threads_per_grid_alloc = mystuff.threads_per_grid;
+    if(mystuff.grid_adjust)
+    {
+      /* the grid may grow up to GRID_ADJUST_MAX, GridSize is just the start */
+      mystuff.threads_per_grid_alloc = GRID_ADJUST_MAX;
+      if(mystuff.threads_per_grid_alloc > deviceinfo.maxThreadsPerGrid)
+      {
+        mystuff.threads_per_grid_alloc = (cl_uint)deviceinfo.maxThreadsPerGrid;
+      }
+      mystuff.threads_per_grid_alloc -= mystuff.threads_per_grid_alloc % (mystuff.vectorsize * deviceinfo.maxThreadsPerBlock);
+    }
   }
   else
   {
@@ -1139,6 +1523,8 @@ int main(int argc, char **argv)
       printf("ERROR: device only supports %u threads per grid. A minimum of 256 is required for GPU sieving.\n", (unsigned int) deviceinfo.maxThreadsPerGrid);
       return ERR_MEM;
     }
+    /* GridAdjust: the GPU sieve size may grow up to GPU_SIEVE_SIZE_MAX, GPUSieveSize is just the start */
+    if(mystuff.grid_adjust) mystuff.gpu_sieve_size_alloc = GPU_SIEVE_SIZE_MAX * 1024 * 1024;
   }
 
   if (load_kernels(&devicenumber)!=CL_SUCCESS)
@@ -1166,11 +1552,19 @@ int main(int argc, char **argv)
       sched_setaffinity(0, sizeof(mystuff.cpu_mask), (cpu_set_t *)&(mystuff.cpu_mask));
 #endif
     }
+    sieve_set_threads(mystuff.sieve_threads);
 #ifdef SIEVE_SIZE_LIMIT
     sieve_init();
 #else
     sieve_init(mystuff.sieve_size, mystuff.sieve_primes_max);
+    if(mystuff.verbosity >= 1 && !strcmp(sieve_segment_name(), "generic"))
+    {
+      printf("CPU sieve: no optimized code for SieveSize %u bits, using the generic sieve (up to 3%% slower),\n", mystuff.sieve_size);
+      printf("           see SieveSizeLimit in %s for the optimized sizes\n", mystuff.inifile);
+    }
 #endif
+    if(mystuff.verbosity >= 2) printf("CPU sieve bit extraction: %s\n", sieve_extract_name());
+    if(mystuff.verbosity >= 2) printf("CPU sieve segment code: %s, %u buffers on huge pages\n", sieve_segment_name(), mem_hugepage_allocs());
     mystuff.sieve_primes_upper_limit = mystuff.sieve_primes_max;
   }
 
@@ -1182,11 +1576,23 @@ int main(int argc, char **argv)
     if(mystuff.verbosity >= 1) printf("Started a simple selftest ...\n");
     if (selftest(&mystuff, MODE_SELFTEST_SHORT) != 0) return ERR_SELFTEST; /* selftest failed :( */
     mystuff.mode = MODE_NORMAL;
+    /* the device threads run their own short selftest */
+    if (dev_count > 1 && start_device_threads()) return ERR_SELFTEST;
     /* allow for ^C */
     register_signal_handler(&mystuff);
 
     do
     {
+      if (use_worktodo && (mystuff.bulk_exponents > 1))
+      {
+        tmp = tf_bulk(&mystuff);
+        if(tmp == RET_ERROR) return ERR_RUNTIME;
+        if(tmp != 0)  /* processed a bit level of several assignments, or RET_QUIT */
+        {
+          parse_ret = OK;
+          continue;
+        }
+      }
       if (use_worktodo) parse_ret = get_next_assignment(mystuff.workfile, &(mystuff.exponent), &(mystuff.bit_min),
                                                             &(mystuff.bit_max_assignment), NULL, mystuff.verbosity);
       else
@@ -1265,6 +1671,7 @@ int main(int argc, char **argv)
     }
   }
 
+  stop_device_threads();
   cleanup_CL();
 
   sieve_free();
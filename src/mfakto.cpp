@@ -27,12 +27,16 @@ along with mfaktc (mfakto).  If not, see <http://www.gnu.org/licenses/>.
 #include "read_config.h"
 #include "parse.h"
 #include "sieve.h"
+#include "sieve_producer.h"
+#include "threads.h"
+#include "mem_alloc.h"
 #include "timer.h"
 #include "checkpoint.h"
 #include "filelocking.h"
 #include "perftest.h"
 #include "output.h"
 #include "gpusieve.h"
+#include "kernel_cache.h"
 #include "menu.h"
 #ifndef _MSC_VER
 #include <sys/time.h>
@@ -48,12 +52,81 @@ along with mfaktc (mfakto).  If not, see <http://www.gnu.org/licenses/>.
 
 /* Global variables */
 
-cl_uint             new_class=1;
 cl_device_id        *devices;
 cl_program          program = NULL;
 
 cl_context          context=NULL;
-cl_command_queue    commandQueue, commandQueuePrf=NULL;
+
+/* the devices driven by this process: dev_list[0] by the main thread, the
+   others by their own device thread (mfaktc.c). The kernels are built for
+   build_list[], which differs from dev_list[] for sub-devices. */
+cl_device_id        dev_list[NUM_DEVICES_MAX];
+cl_uint             dev_count = 1;
+static cl_device_id build_list[NUM_DEVICES_MAX];
+static cl_uint      build_count = 1;
+static thread_mutex_t output_mutex;  // with several devices: keeps the lines of the status and the factors together
+
+/* the kernels are built as one program per family (-DKERNEL_FAMILY, the same
+   numbers as in mfakto_Kernels.cl). load_kernels() starts the builds of the
+   families the sieve can use in parallel threads, load_kernel() creates a
+   kernel when it is first needed and waits for its family if necessary. */
+enum {FAMILY_NONE, FAMILY_GPUSIEVE, FAMILY_BARRETT15, FAMILY_BARRETT32, FAMILY_MUL24, FAMILY_MONTGOMERY, NUM_FAMILIES};
+static const char *family_names[NUM_FAMILIES] = {"", "gpusieve", "barrett15", "barrett32", "mul24", "montgomery"};
+typedef struct
+{
+  cl_program program;     // NULL while building or if the build failed
+  thread_t   thread;
+  int        started;     // the build was started
+  int        joined;      // ... and is finished, program is valid
+} family_program_t;
+static family_program_t family_programs[NUM_FAMILIES];
+static thread_mutex_t   family_mutex;
+
+/* ExponentKernels=1: programs built with the exponent and shiftcount as
+   constants (-DFIXED_EXPONENT, -DFIXED_SHIFTCOUNT), shared by all devices.
+   exp_build_thread() builds one of them at a time while the generic kernels
+   keep running, exp_kernel_select() switches to it once it is ready. */
+enum {EXP_PROGRAM_FREE, EXP_PROGRAM_BUILDING, EXP_PROGRAM_READY, EXP_PROGRAM_FAILED};
+typedef struct
+{
+  cl_uint    exponent;
+  cl_uint    shiftcount;
+  int        family;      // FAMILY_*, of the kernel it was built for
+  cl_program program;
+  cl_uint    state;       // EXP_PROGRAM_*, protected by exp_program_mutex
+  cl_uint    last_used;   // for replacing the least recently used entry
+} exp_program_t;
+static exp_program_t  exp_programs[EXP_PROGRAM_CACHE];
+static cl_uint        exp_program_clock = 0;
+static thread_mutex_t exp_program_mutex;
+static thread_t       exp_build_handle;
+static int            exp_build_started = 0;   // exp_build_handle needs to be joined
+static volatile cl_uint exp_build_done = 0;
+/* copies of the settings for the build threads, which have no mystuff of their own */
+static char           build_options[300];       // the build options of the generic programs
+static char           build_cache_dir[51];
+static char           build_binfile[51];
+static int            build_force_rebuild;
+static int            build_verbosity;
+
+/* per device (thread) */
+THREAD_LOCAL cl_uint          new_class=1;
+THREAD_LOCAL cl_command_queue commandQueue, commandQueuePrf=NULL;
+THREAD_LOCAL cl_command_queue copyQueue=NULL;  // CopyQueue=1: the k_tab transfers, see KTAB_QUEUE
+THREAD_LOCAL cl_command_queue sieveQueue=NULL; // GPUSieveBuffers>1: the GPU sieve kernels, see SIEVE_QUEUE
+/* GPU sieve: for each bit array the SegSieve that filled it last and the TF kernel
+   that read it last, the TF kernel waits for the former, the next SegSieve for the latter */
+static THREAD_LOCAL cl_event sieve_events[GPU_SIEVE_BUFFERS_MAX], tf_events[GPU_SIEVE_BUFFERS_MAX];
+static THREAD_LOCAL cl_uint  tf_event_size[GPU_SIEVE_BUFFERS_MAX]; // GridAdjust: bits of the TF kernel of tf_events[], 0 once measured
+/* ExponentKernels=1: the kernel_info[] entry that currently holds a kernel of
+   an exponent-specialized program, and the generic kernel it replaced */
+static THREAD_LOCAL struct
+{
+  int       index;        // -1: none
+  cl_kernel generic;
+  cl_uint   exponent;
+  cl_uint   shiftcount;
+} exp_kernel = {-1, NULL, 0, 0};
 
 #ifdef __cplusplus
 extern "C"
@@ -61,10 +134,10 @@ extern "C"
 #endif
 
 #include "signal_handler.h"
-extern mystuff_t    mystuff;
+extern THREAD_LOCAL mystuff_t mystuff;
 extern GPU_type     gpu_types[];
-OpenCL_deviceinfo_t deviceinfo={{0}};
-kernel_info_t       kernel_info[] = {
+THREAD_LOCAL OpenCL_deviceinfo_t deviceinfo={{0}};
+THREAD_LOCAL kernel_info_t       kernel_info[] = {
   /*   kernel (in sequence) | kernel function name | bit_min | bit_max | stages? | loaded kernel pointer */
      {   AUTOSELECT_KERNEL,   "auto",                  0,      0,         0,      NULL},
      {   _TEST_MOD_,          "test_k",                0,      0,         0,      NULL}, // used for various tests
@@ -84,14 +157,17 @@ kernel_info_t       kernel_info[] = {
      {   BARRETT83_MUL15,     "cl_barrett15_83",      60,     83,         0,      NULL},
      {   BARRETT82_MUL15,     "cl_barrett15_82",      60,     82,         0,      NULL},
      {   BARRETT74_MUL15,     "cl_barrett15_74",      60,     74,         0,      NULL},
+     {   MG96,                "cl_mg96",              63,     95,         1,      NULL}, // fallback for 93-95 bits; before MG62: the _gs kernels are found by offset
      {   MG62,                "cl_mg62",              58,     62,         1,      NULL},
      {   MG88,                "cl_mg88",              73,     88,         1,      NULL},
      {   UNKNOWN_KERNEL,      "UNKNOWN kernel",        0,      0,         0,      NULL}, // end of automatic loading
      {   _64BIT_64_OpenCL,    "mfakto_cl_64",          0,     64,         0,      NULL}, // slow shift-cmp-sub kernel: removed
      {   BARRETT92_64_OpenCL, "cl_barrett32_92",      64,     92,         0,      NULL}, // mapped to 32-bit barrett so far
+     {   BARRETT69_MUL15_BULK, "cl_barrett15_69_bulk", 60,     69,         0,      NULL}, // bulk mode, see tf_bulk_opencl
      {   CL_CALC_BIT_TO_CLEAR, "CalcBitToClear",       0,      0,         0,      NULL}, // called by gpusieve_init_class
      {   CL_CALC_MOD_INV,     "CalcModularInverses",   0,      0,         0,      NULL}, // called by gpusieve_init_exponent
      {   CL_SIEVE,            "SegSieve",              0,      0,         0,      NULL}, // GPU sieve
+     {   CL_CALC_BIT_TO_CLEAR_ADV, "CalcBitToClearAdvance", 0,   0,         0,      NULL}, // called by gpusieve_advance_class
      {   BARRETT79_MUL32_GS,  "cl_barrett32_79_gs",   64,     79,         1,      NULL}, // keep the GPU-sieve-based kernels in the same order as their CPU-sieve versions
      {   BARRETT77_MUL32_GS,  "cl_barrett32_77_gs",   64,     77,         1,      NULL},
      {   BARRETT76_MUL32_GS,  "cl_barrett32_76_gs",   64,     76,         1,      NULL},
@@ -106,15 +182,227 @@ kernel_info_t       kernel_info[] = {
      {   BARRETT83_MUL15_GS,  "cl_barrett15_83_gs",   60,     83,         0,      NULL},
      {   BARRETT82_MUL15_GS,  "cl_barrett15_82_gs",   60,     82,         0,      NULL},
      {   BARRETT74_MUL15_GS,  "cl_barrett15_74_gs",   60,     74,         0,      NULL},
+     {   MG96_GS,             "cl_mg96_gs",           63,     95,         1,      NULL},
      {   UNKNOWN_GS_KERNEL,   "UNKNOWN GS kernel",     0,      0,         0,      NULL}, // delimiter
 };
 
+/* completion of the stream kernels (CPU sieve): the OpenCL runtime calls
+   stream_complete_cb() from its own thread when the kernel of a stream has
+   finished. Each device has its own set of flags, the callback gets the device
+   and the stream as user_data = STREAM_ID(dev, i). streams->done[] is polled
+   by tf_class_opencl(), see wait_for_stream() for waiting on it. */
+#define STREAM_SLOTS (NUM_STREAMS_MAX+2)
+#define STREAM_ID(dev, i) ((void *)(size_t)((dev) * STREAM_SLOTS + (i)))
+
+typedef struct
+{
+  volatile cl_uint done[STREAM_SLOTS];
+  cl_int           exec_status[STREAM_SLOTS]; // valid once done[] is set
+  thread_mutex_t   mutex;
+  thread_cond_t    cond;
+  int              initialized;
+} stream_wait_t;
+
+static stream_wait_t              stream_wait[NUM_DEVICES_MAX];
+static THREAD_LOCAL stream_wait_t *streams;   // of this device, set by stream_wait_init()
+
+static void stream_wait_init(void)
+{
+  streams = &stream_wait[mystuff.dev_index];
+  if (streams->initialized) return;
+  thread_mutex_init(&streams->mutex);
+  thread_cond_init(&streams->cond);
+  streams->initialized = 1;
+}
+
+static void CL_CALLBACK stream_complete_cb(cl_event event, cl_int exec_status, void *user_data)
+{
+  stream_wait_t *sw = &stream_wait[(size_t) user_data / STREAM_SLOTS];
+  cl_uint i = (cl_uint)((size_t) user_data % STREAM_SLOTS);
+
+  thread_mutex_lock(&sw->mutex);
+  sw->exec_status[i] = exec_status; // CL_COMPLETE or an error code
+  thread_atomic_store(&sw->done[i], 1);
+  thread_cond_broadcast(&sw->cond);
+  thread_mutex_unlock(&sw->mutex);
+}
+
+/* waits until the kernel of stream i has finished: spin for up to
+   mystuff.wait_spin microseconds (lowest latency, costs CPU), then sleep until
+   stream_complete_cb() wakes us up */
+static void wait_for_stream(cl_uint i)
+{
+  struct timeval timer;
+
+  timer_init(&timer);
+  while (!thread_atomic_load(&streams->done[i]))
+  {
+    if (timer_diff(&timer) >= mystuff.wait_spin)
+    {
+      thread_mutex_lock(&streams->mutex);
+      while (!thread_atomic_load(&streams->done[i])) thread_cond_wait(&streams->cond, &streams->mutex);
+      thread_mutex_unlock(&streams->mutex);
+      break;
+    }
+  }
+}
+
+/* continuous pipeline for the CPU sieve: once all grids of a class are
+   submitted, tf_class_opencl() starts the next class while the last grids are
+   still running. The read-back of the results is queued behind the last
+   kernel of the class, its completion is signalled like a stream in
+   streams->done[RES_SLOT(parity)]. The next class uses d_RES_next/h_RES_next,
+   they are swapped with d_RES/h_RES when it becomes the current class. */
+#define RES_SLOT(parity) (NUM_STREAMS_MAX + (parity))
+
+static THREAD_LOCAL cl_uint  stream_seq;                     // grids submitted so far, h_ktab[stream_seq % num_streams] is the next one
+static THREAD_LOCAL cl_ulong k_min_grid[NUM_STREAMS_MAX];    // k_min_grid[N] contains the k_min for h_ktab[N], only valid for preprocessed h_ktab[]s
+static THREAD_LOCAL cl_uint  res_parity;                     // RES_SLOT() of the current class
+static THREAD_LOCAL cl_uint  grid_size_next;                 // GridAdjust: threads_per_grid (GPU sieve: gpu_sieve_size) from the next class on, 0 = no change
+static THREAD_LOCAL cl_uint  grid_threads[NUM_STREAMS_MAX];  // GridAdjust: threads_per_grid of h_ktab[N]
+static THREAD_LOCAL cl_ulong grid_exec_time, grid_exec_size; // GridAdjust: kernel runtime (ns) and k's of the grids measured since the last grid_adjust()
+
+/* the CPU sieve of this device: the device threads have a sieve context of
+   their own (created by init_CL_worker()), the main thread uses the one of
+   sieve_init(). producer is created on first use. */
+static THREAD_LOCAL sieve_ctx_t      *cpu_sieve;
+static THREAD_LOCAL sieve_producer_t *producer;
+
+static void cpu_sieve_init_class(cl_uint exp, cl_ulong k_start, cl_uint sieve_limit)
+{
+  if (cpu_sieve) sieve_ctx_init_class(cpu_sieve, exp, k_start, sieve_limit);
+  else           sieve_init_class(exp, k_start, sieve_limit);
+}
+
+static void cpu_sieve_candidates(cl_uint ktab_size, cl_uint *ktab, cl_uint sieve_limit)
+{
+  if (cpu_sieve) sieve_ctx_candidates(cpu_sieve, ktab_size, ktab, sieve_limit);
+  else           sieve_candidates(ktab_size, ktab, sieve_limit);
+}
+
+static void grid_time_add(cl_event event, cl_uint size)
+/* GridAdjust: adds the kernel runtime of a finished grid of size k's from its
+   profiling info, see grid_adjust() */
+{
+  cl_ulong start, end;
+
+  if (!mystuff.grid_adjust || (mystuff.mode == MODE_SELFTEST_SHORT) || (size == 0)) return;
+  if (clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_START, sizeof(cl_ulong), &start, NULL) != CL_SUCCESS) return;
+  if (clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_END,   sizeof(cl_ulong), &end,   NULL) != CL_SUCCESS) return;
+  if (end <= start) return;
+  grid_exec_time += end - start;
+  grid_exec_size += size;
+}
+
+static THREAD_LOCAL struct
+{
+  int      active;      // started by the previous call of tf_class_opencl()
+  cl_ulong k_class;     // the k_min this class will be called with
+  cl_ulong k_min;       // next k to submit
+  cl_uint  count;       // grids submitted so far
+  cl_uint  sieve_limit; // SievePrimes at the start of the class
+  cl_uint  grid_size;   // threads_per_grid at the start of the class
+  cl_event init_event;  // zeroing of d_RES_next
+  cl_event read_event;  // read-back of d_RES_next, NULL if not all grids are submitted
+} next_class;
+
+/* memory type of the k_tabs (CPU sieve), see ZeroCopyKtab in mfakto.ini
+   KTAB_COPY:   h_ktab[] is from mem_alloc() (cache line aligned), uploaded to d_ktab[] for each grid
+   KTAB_MAPPED: d_ktab[] is CL_MEM_ALLOC_HOST_PTR, h_ktab[] is its mapping. It is
+                unmapped while its kernel runs and mapped again afterwards,
+                h_ktab[i] may change then.
+   KTAB_SVM:    h_ktab[] is fine-grained SVM wrapped by d_ktab[], no upload at all */
+static THREAD_LOCAL enum {KTAB_COPY, KTAB_MAPPED, KTAB_SVM} ktab_mem = KTAB_COPY;
+
+/* the queue for the k_tab transfers: with CopyQueue=1 they run on their own
+   queue so that they can overlap the kernels, which wait for copy_events[] */
+#define KTAB_QUEUE (copyQueue ? copyQueue : QUEUE)
+
+#ifdef CL_PERFORMANCE_INFO
+/* copy/compute overlap (CPU sieve): the last kernel of each stream and the
+   copy time of the class so far that ran at the same time as a kernel */
+static THREAD_LOCAL cl_ulong prf_exec_start[NUM_STREAMS_MAX], prf_exec_end[NUM_STREAMS_MAX];
+static THREAD_LOCAL cl_ulong prf_copy_time, prf_overlap_time;
+#endif
+
+static cl_int ktab_map(cl_uint i)
+/* KTAB_MAPPED: give d_ktab[i] back to the host once its kernel has finished */
+{
+  cl_int status;
+
+  mystuff.h_ktab[i] = (cl_uint *) clEnqueueMapBuffer(KTAB_QUEUE,
+                    mystuff.d_ktab[i],
+                    CL_TRUE,
+                    CL_MAP_WRITE,
+                    0,
+                    mystuff.threads_per_grid_alloc * sizeof(cl_uint),
+                    0,
+                    NULL,
+                    NULL,
+                    &status);
+  if(status != CL_SUCCESS)
+  {
+    std::cerr<<"Error " << status << " (" << ClErrorString(status) << "): Mapping d_ktab[" << i << "] (clEnqueueMapBuffer)\n";
+  }
+  return status;
+}
+
+static cl_int ktab_upload(cl_uint i, cl_uint num_wait, const cl_event *wait_list)
+/* make h_ktab[i] available to the kernel, copy_events[i] is set to the event
+   the kernel has to wait for */
+{
+  cl_int status;
+
+  switch (ktab_mem)
+  {
+    case KTAB_MAPPED:
+      status = clEnqueueUnmapMemObject(KTAB_QUEUE,
+                    mystuff.d_ktab[i],
+                    mystuff.h_ktab[i],
+                    num_wait,
+                    wait_list,
+                    &mystuff.copy_events[i]);
+      break;
+    case KTAB_SVM:
+      // nothing to transfer, but the kernel may have to wait for the events
+      if (num_wait)
+      {
+        mystuff.copy_events[i] = wait_list[0];
+        status = clRetainEvent(mystuff.copy_events[i]);
+      }
+      else
+      {
+        mystuff.copy_events[i] = clCreateUserEvent(context, &status);
+        if (status == CL_SUCCESS) status = clSetUserEventStatus(mystuff.copy_events[i], CL_COMPLETE);
+      }
+      break;
+    default:
+      status = clEnqueueWriteBuffer(KTAB_QUEUE,
+                    mystuff.d_ktab[i],
+                    CL_FALSE,
+                    0,
+                    mystuff.threads_per_grid * sizeof(cl_uint),
+                    mystuff.h_ktab[i],
+                    num_wait,
+                    wait_list,
+                    &mystuff.copy_events[i]);
+  }
+  if(status != CL_SUCCESS)
+  {
+    std::cout<<"Error " << status << " (" << ClErrorString(status) << "): Copying h_ktab(clEnqueueWriteBuffer)\n";
+  }
+  else if (copyQueue && (ktab_mem != KTAB_SVM)) clFlush(copyQueue); // the kernel on QUEUE waits for it
+  return status;
+}
+
 /* allocate memory buffer arrays, test a small kernel */
 int init_CLstreams(int gs_reinit_only)
 {
   cl_uint i;
   cl_int status;
 
+  stream_wait_init();
+
   if (context==NULL)
   {
     fprintf(stderr, "invalid context.\n");
@@ -123,17 +411,57 @@ int init_CLstreams(int gs_reinit_only)
 
   if (!gs_reinit_only)
   {
+    if (mystuff.threads_per_grid_alloc < mystuff.threads_per_grid) mystuff.threads_per_grid_alloc = mystuff.threads_per_grid;
+    mystuff.num_streams_active = mystuff.num_streams;
+    ktab_mem = KTAB_COPY;
+    if (mystuff.zero_copy && !mystuff.gpu_sieving)
+    {
+      ktab_mem = KTAB_MAPPED;
+#ifdef CL_VERSION_2_0
+      if (deviceinfo.svm_caps & CL_DEVICE_SVM_FINE_GRAIN_BUFFER) ktab_mem = KTAB_SVM;
+#endif
+      if (mystuff.verbosity > 1)
+        printf("k_tabs: zero-copy using %s\n", (ktab_mem == KTAB_SVM) ? "fine-grained SVM" : "mapped CL_MEM_ALLOC_HOST_PTR buffers");
+    }
     for(i=0;i<(mystuff.num_streams);i++)
     {
       mystuff.stream_status[i] = UNUSED;
-      if( (mystuff.h_ktab[i] = (cl_uint *) malloc( mystuff.threads_per_grid * sizeof(cl_uint) + 4)) == NULL )
+      if (ktab_mem == KTAB_MAPPED)
+      {
+        mystuff.d_ktab[i] = clCreateBuffer(context,
+                          CL_MEM_READ_ONLY | CL_MEM_ALLOC_HOST_PTR,
+                          mystuff.threads_per_grid_alloc * sizeof(cl_uint),
+                          NULL,
+                          &status);
+        if(status != CL_SUCCESS)
+        {
+          std::cout<<"Error " << status << " (" << ClErrorString(status) << "): clCreateBuffer (h_ktab[" << i << "]) \n";
+          return 1;
+        }
+        if (ktab_map(i) != CL_SUCCESS) return 1;
+        continue;
+      }
+#ifdef CL_VERSION_2_0
+      if (ktab_mem == KTAB_SVM)
+      {
+        mystuff.h_ktab[i] = (cl_uint *) clSVMAlloc(context, CL_MEM_READ_ONLY | CL_MEM_SVM_FINE_GRAIN_BUFFER,
+                                                   mystuff.threads_per_grid_alloc * sizeof(cl_uint) + 4, 0);
+        if (mystuff.h_ktab[i] == NULL)
+        {
+          printf("ERROR: clSVMAlloc(h_ktab[%d]) failed\n", i);
+          return 1;
+        }
+      }
+      else
+#endif
+      if( (mystuff.h_ktab[i] = (cl_uint *) mem_alloc( mystuff.threads_per_grid_alloc * sizeof(cl_uint) + 4, 0)) == NULL )
       {
-        printf("ERROR: malloc(h_ktab[%d]) failed\n", i);
+        printf("ERROR: mem_alloc(h_ktab[%d]) failed\n", i);
         return 1;
       }
       mystuff.d_ktab[i] = clCreateBuffer(context,
-                        CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR,
-                        mystuff.threads_per_grid * sizeof(cl_uint),
+                        CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR,   // for SVM, the buffer uses the SVM allocation
+                        mystuff.threads_per_grid_alloc * sizeof(cl_uint),
                         mystuff.h_ktab[i],
                         &status);
       if(status != CL_SUCCESS)
@@ -157,6 +485,21 @@ int init_CLstreams(int gs_reinit_only)
       std::cout<<"Error " << status << " (" << ClErrorString(status) << "): clCreateBuffer (d_RES)\n";
       return 1;
     }
+    if( (mystuff.h_RES_next = (cl_uint *) malloc(32 * sizeof(cl_uint) + 48)) == NULL )
+    {
+      printf("ERROR: malloc(h_RES_next) failed\n");
+      return 1;
+    }
+    mystuff.d_RES_next = clCreateBuffer(context,
+                      CL_MEM_READ_WRITE | CL_MEM_USE_HOST_PTR,
+                      32 * sizeof(cl_uint),
+                      mystuff.h_RES_next,
+                      &status);
+    if(status != CL_SUCCESS)
+    {
+      std::cout<<"Error " << status << " (" << ClErrorString(status) << "): clCreateBuffer (d_RES_next)\n";
+      return 1;
+    }
   #ifdef CHECKS_MODBASECASE
     if( (mystuff.h_modbasecase_debug = (cl_uint *) malloc(32 * sizeof(cl_uint) + 4)) == NULL )
     {
@@ -238,11 +581,260 @@ int init_CLstreams(int gs_reinit_only)
       return 1;
     }
     // param 2 (primes_per_thread) is variable, can't set it now.
+
+    // CL_CALC_BIT_TO_CLEAR_ADV
+    // CalcBitToClearAdvance<<<primes_per_thread+1, threadsPerBlock>>>(gpu_sieve_size, (int *)mystuff->d_calc_bit_to_clear_info, (cl_uchar *)mystuff->d_sieve_info);
+    status = clSetKernelArg(kernel_info[CL_CALC_BIT_TO_CLEAR_ADV].kernel,
+                      1,
+                      sizeof(cl_mem),
+                      (void *)&mystuff.d_calc_bit_to_clear_info);
+    if(status != CL_SUCCESS)
+    {
+      std::cout<<"Error " << status << " (" << ClErrorString(status) << "): Setting kernel argument. (d_calc_bit_to_clear_info)\n";
+      return 1;
+    }
+    status = clSetKernelArg(kernel_info[CL_CALC_BIT_TO_CLEAR_ADV].kernel,
+                      2,
+                      sizeof(cl_mem),
+                      (void *)&mystuff.d_sieve_info);
+    if(status != CL_SUCCESS)
+    {
+      std::cout<<"Error " << status << " (" << ClErrorString(status) << "): Setting kernel argument. (d_sieve_info)\n";
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+
+/* query the properties of device into deviceinfo, i/num: for the output only */
+static int get_device_info(cl_device_id device, cl_uint i, cl_uint num_devices)
+{
+  cl_int status;
+
+  status = clGetDeviceInfo(device, CL_DEVICE_NAME, sizeof(deviceinfo.d_name), deviceinfo.d_name, NULL);
+  if(status != CL_SUCCESS)
+  {
+    std::cerr << "Error " << status << " (" << ClErrorString(status) << "): clGetContextInfo(CL_DEVICE_NAME)\n";
+    return 1;
+  }
+  status = clGetDeviceInfo(device, CL_DEVICE_VERSION, sizeof(deviceinfo.d_ver), deviceinfo.d_ver, NULL);
+  if(status != CL_SUCCESS)
+  {
+    std::cerr << "Error " << status << " (" << ClErrorString(status) << "): clGetContextInfo(CL_DEVICE_VERSION)\n";
+    return 1;
+  }
+  status = clGetDeviceInfo(device, CL_DEVICE_VENDOR, sizeof(deviceinfo.v_name), deviceinfo.v_name, NULL);
+  if(status != CL_SUCCESS)
+  {
+    std::cerr << "Error " << status << " (" << ClErrorString(status) << "): clGetContextInfo(CL_DEVICE_VENDOR)\n";
+    return 1;
+  }
+  status = clGetDeviceInfo(device, CL_DRIVER_VERSION, sizeof(deviceinfo.dr_version), deviceinfo.dr_version, NULL);
+  if(status != CL_SUCCESS)
+  {
+    std::cerr << "Error " << status << " (" << ClErrorString(status) << "): clGetContextInfo(CL_DRIVER_VERSION)\n";
+    return 1;
+  }
+  status = clGetDeviceInfo(device, CL_DEVICE_EXTENSIONS, sizeof(deviceinfo.exts), deviceinfo.exts, NULL);
+  if(status != CL_SUCCESS)
+  {
+    std::cerr << "Error " << status << " (" << ClErrorString(status) << "): clGetContextInfo(CL_DEVICE_EXTENSIONS)\n";
+    return 1;
+  }
+  status = clGetDeviceInfo(device, CL_DEVICE_GLOBAL_MEM_CACHE_SIZE, sizeof(deviceinfo.gl_cache), &deviceinfo.gl_cache, NULL);
+  if(status != CL_SUCCESS)
+  {
+    std::cerr << "Error " << status << " (" << ClErrorString(status) << "): clGetContextInfo(CL_DEVICE_GLOBAL_MEM_CACHE_SIZE)\n";
+    return 1;
+  }
+  status = clGetDeviceInfo(device, CL_DEVICE_GLOBAL_MEM_SIZE, sizeof(deviceinfo.gl_mem), &deviceinfo.gl_mem, NULL);
+  if(status != CL_SUCCESS)
+  {
+    std::cerr << "Error " << status << " (" << ClErrorString(status) << "): clGetContextInfo(CL_DEVICE_GLOBAL_MEM_SIZE)\n";
+    return 1;
+  }
+  status = clGetDeviceInfo(device, CL_DEVICE_MAX_CLOCK_FREQUENCY, sizeof(deviceinfo.max_clock), &deviceinfo.max_clock, NULL);
+  if(status != CL_SUCCESS)
+  {
+    std::cerr << "Error " << status << " (" << ClErrorString(status) << "): clGetContextInfo(CL_DEVICE_MAX_CLOCK_FREQUENCY)\n";
+    return 1;
+  }
+  status = clGetDeviceInfo(device, CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(deviceinfo.units), &deviceinfo.units, NULL);
+  if(status != CL_SUCCESS)
+  {
+    std::cerr << "Error " << status << " (" << ClErrorString(status) << "): clGetContextInfo(CL_DEVICE_MAX_COMPUTE_UNITS)\n";
+    return 1;
+  }
+  status = clGetDeviceInfo(device, CL_DEVICE_MAX_WORK_GROUP_SIZE, sizeof(deviceinfo.wg_size), &deviceinfo.wg_size, NULL);
+  if(status != CL_SUCCESS)
+  {
+    std::cerr << "Error " << status << " (" << ClErrorString(status) << "): clGetContextInfo(CL_DEVICE_MAX_WORK_GROUP_SIZE)\n";
+    return 1;
+  }
+  status = clGetDeviceInfo(device, CL_DEVICE_MAX_WORK_ITEM_DIMENSIONS, sizeof(deviceinfo.w_dim), &deviceinfo.w_dim, NULL);
+  if(status != CL_SUCCESS)
+  {
+    std::cerr << "Error " << status << " (" << ClErrorString(status) << "): clGetContextInfo(CL_DEVICE_MAX_WORK_ITEM_DIMENSIONS)\n";
+    return 1;
+  }
+  status = clGetDeviceInfo(device, CL_DEVICE_MAX_WORK_ITEM_SIZES, sizeof(deviceinfo.wi_sizes), deviceinfo.wi_sizes, NULL);
+  if(status != CL_SUCCESS)
+  {
+    std::cerr << "Error " << status << " (" << ClErrorString(status) << "): clGetContextInfo(CL_DEVICE_MAX_WORK_ITEM_SIZES)\n";
+    return 1;
+  }
+  status = clGetDeviceInfo(device, CL_DEVICE_LOCAL_MEM_SIZE, sizeof(deviceinfo.l_mem), &deviceinfo.l_mem, NULL);
+  if(status != CL_SUCCESS)
+  {
+    std::cerr << "Error " << status << " (" << ClErrorString(status) << "): clGetContextInfo(CL_DEVICE_LOCAL_MEM_SIZE)\n";
+    return 1;
+  }
+  // these two are optional: only used to choose the k_tab memory type (ZeroCopyKtab)
+  status = clGetDeviceInfo(device, CL_DEVICE_HOST_UNIFIED_MEMORY, sizeof(deviceinfo.host_unified), &deviceinfo.host_unified, NULL);
+  if(status != CL_SUCCESS) deviceinfo.host_unified = CL_FALSE;
+  deviceinfo.svm_caps = 0;
+#ifdef CL_VERSION_2_0
+  {
+    cl_device_svm_capabilities svm_caps;
+    status = clGetDeviceInfo(device, CL_DEVICE_SVM_CAPABILITIES, sizeof(svm_caps), &svm_caps, NULL);
+    if(status == CL_SUCCESS) deviceinfo.svm_caps = svm_caps;
+  }
+#endif
+
+  if (mystuff.verbosity > 1)
+    std::cout << "Device " << (i+1)  << "/" << num_devices << ": " << deviceinfo.d_name << " (" << deviceinfo.v_name << "),\ndevice version: "
+      << deviceinfo.d_ver << ", driver version: " << deviceinfo.dr_version << "\nExtensions: " << deviceinfo.exts
+      << "\nGlobal memory:" << deviceinfo.gl_mem << ", Global memory cache: " << deviceinfo.gl_cache
+      << ", local memory: " << deviceinfo.l_mem << ", workgroup size: " << deviceinfo.wg_size << ", Work dimensions: " << deviceinfo.w_dim
+      << "[" << deviceinfo.wi_sizes[0] << ", " << deviceinfo.wi_sizes[1] << ", " << deviceinfo.wi_sizes[2] << ", " << deviceinfo.wi_sizes[3] << ", " << deviceinfo.wi_sizes[4]
+      << "] , Max clock speed:" << deviceinfo.max_clock << ", compute units:" << deviceinfo.units
+      << ", unified host memory:" << (deviceinfo.host_unified ? "yes" : "no") << ", SVM capabilities:" << deviceinfo.svm_caps << std::endl;
+
+  deviceinfo.maxThreadsPerBlock = deviceinfo.wi_sizes[0];
+  deviceinfo.maxThreadsPerGrid  = deviceinfo.wi_sizes[0];
+  for (i=1; i<deviceinfo.w_dim && i<5; i++)
+  {
+    if (deviceinfo.wi_sizes[i])
+      deviceinfo.maxThreadsPerGrid *= deviceinfo.wi_sizes[i];
+  }
+  return 0;
+}
+
+/* the command queues of the calling device thread */
+static int create_queues(cl_device_id device)
+{
+  cl_int status;
+
+  cl_command_queue_properties props = 0;             // GPU sieve is started without synchronization events
+  if (mystuff.gpu_sieving == 0)                      // but CPU sieve can run out-of-order, if possible
+    props = CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE;  // kernels and copy-jobs are queued with event dependencies, so this should work ...
+                                                     // but so far the GPU driver does not support that anyway (as of Catalyst 12.9)
+  if (mystuff.grid_adjust)                           // GridAdjust measures the kernel runtime
+    props |= CL_QUEUE_PROFILING_ENABLE;
+
+  commandQueue = clCreateCommandQueue(context, device, props, &status);
+  if(status != CL_SUCCESS)
+  {
+    props &= ~CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE; // Intel HD does not support out-of-order
+    commandQueue = clCreateCommandQueue(context, device, props, &status);
+    if(status != CL_SUCCESS)
+    {
+      std::cerr << "Error " << status << " (" << ClErrorString(status) << "): clCreateCommandQueue\n";
+      return 1;
+    }
+    else
+    {
+      printf("\nINFO: Device does not support out-of-order operations. Fallback to in-order queues.\n");
+    }
+  }
+
+  props |= CL_QUEUE_PROFILING_ENABLE;
+
+  commandQueuePrf = clCreateCommandQueue(context, device, props, &status);
+  if(status != CL_SUCCESS)
+  {
+    std::cerr << "Error " << status << " (" << ClErrorString(status) << "): clCreateCommandQueuePrf\n";
+    return 1;
+  }
+
+  copyQueue = NULL;
+  if (mystuff.copy_queue && (mystuff.gpu_sieving == 0))
+  {
+#ifdef CL_PERFORMANCE_INFO
+    props = CL_QUEUE_PROFILING_ENABLE;
+#else
+    props = 0;
+#endif
+    copyQueue = clCreateCommandQueue(context, device, props, &status);
+    if(status != CL_SUCCESS)
+    {
+      printf("\nWARNING: Cannot create the copy queue (%s), the k_tabs are copied on the kernel queue.\n", ClErrorString(status));
+      copyQueue = NULL;
+    }
+    else if (mystuff.verbosity > 1)
+      printf("k_tabs: copied on a separate command queue\n");
   }
 
+  sieveQueue = NULL;
+  if ((mystuff.gpu_sieving == 1) && (mystuff.gpu_sieve_buffers > 1))
+  {
+#ifdef CL_PERFORMANCE_INFO
+    props = CL_QUEUE_PROFILING_ENABLE;
+#else
+    props = 0;
+#endif
+    sieveQueue = clCreateCommandQueue(context, device, props, &status);
+    if(status != CL_SUCCESS)
+    {
+      printf("\nWARNING: Cannot create the sieve queue (%s), GPU sieving and TF will not overlap.\n", ClErrorString(status));
+      sieveQueue = NULL;
+    }
+    else if (mystuff.verbosity > 1)
+      printf("GPU sieve: %u bit arrays, sieving on a separate command queue\n", mystuff.gpu_sieve_buffers);
+  }
   return 0;
 }
 
+/*
+ * split_device: partition dev into parts sub-devices of equal size and put
+ * them in dev_list. The kernels are still built for dev (build_list).
+ * Mainly for testing the multi-device code on CPU runtimes.
+ */
+static int split_device(cl_device_id dev, cl_uint parts)
+{
+#ifdef CL_VERSION_1_2
+  cl_int  status;
+  cl_uint units, num_sub;
+
+  if (parts > NUM_DEVICES_MAX) parts = NUM_DEVICES_MAX;
+  status = clGetDeviceInfo(dev, CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(units), &units, NULL);
+  if (status != CL_SUCCESS || units < parts)
+  {
+    fprintf(stderr, "Error: Device has only %u compute units, cannot split it into %u sub-devices (SplitDevice).\n", units, parts);
+    return 1;
+  }
+
+  cl_device_partition_property props[NUM_DEVICES_MAX+3];
+  props[0] = CL_DEVICE_PARTITION_BY_COUNTS;
+  for (num_sub = 0; num_sub < parts; num_sub++) props[num_sub+1] = units / parts;
+  props[parts+1] = CL_DEVICE_PARTITION_BY_COUNTS_LIST_END;
+  props[parts+2] = 0;
+  status = clCreateSubDevices(dev, props, parts, dev_list, &num_sub);
+  if (status != CL_SUCCESS)
+  {
+    std::cerr << "Error " << status << " (" << ClErrorString(status) << "): clCreateSubDevices\n";
+    return 1;
+  }
+  dev_count = num_sub;
+  if (mystuff.verbosity > 0) printf("Split device into %u sub-devices of %u compute units.\n", dev_count, units / parts);
+  return 0;
+#else
+  fprintf(stderr, "Error: SplitDevice requires OpenCL 1.2 headers.\n");
+  return 1;
+#endif
+}
 
 /*
  * init_CL: all OpenCL-related one-time inits:
@@ -427,92 +1019,7 @@ int init_CL(int num_streams, cl_int *devnumber)
 
   for (i=dev_from; i<dev_to; i++)
   {
-    status = clGetDeviceInfo(devices[i], CL_DEVICE_NAME, sizeof(deviceinfo.d_name), deviceinfo.d_name, NULL);
-    if(status != CL_SUCCESS)
-    {
-      std::cerr << "Error " << status << " (" << ClErrorString(status) << "): clGetContextInfo(CL_DEVICE_NAME)\n";
-      return 1;
-    }
-    status = clGetDeviceInfo(devices[i], CL_DEVICE_VERSION, sizeof(deviceinfo.d_ver), deviceinfo.d_ver, NULL);
-    if(status != CL_SUCCESS)
-    {
-      std::cerr << "Error " << status << " (" << ClErrorString(status) << "): clGetContextInfo(CL_DEVICE_VERSION)\n";
-      return 1;
-    }
-    status = clGetDeviceInfo(devices[i], CL_DEVICE_VENDOR, sizeof(deviceinfo.v_name), deviceinfo.v_name, NULL);
-    if(status != CL_SUCCESS)
-    {
-      std::cerr << "Error " << status << " (" << ClErrorString(status) << "): clGetContextInfo(CL_DEVICE_VENDOR)\n";
-      return 1;
-    }
-    status = clGetDeviceInfo(devices[i], CL_DRIVER_VERSION, sizeof(deviceinfo.dr_version), deviceinfo.dr_version, NULL);
-    if(status != CL_SUCCESS)
-    {
-      std::cerr << "Error " << status << " (" << ClErrorString(status) << "): clGetContextInfo(CL_DRIVER_VERSION)\n";
-      return 1;
-    }
-    status = clGetDeviceInfo(devices[i], CL_DEVICE_EXTENSIONS, sizeof(deviceinfo.exts), deviceinfo.exts, NULL);
-    if(status != CL_SUCCESS)
-    {
-      std::cerr << "Error " << status << " (" << ClErrorString(status) << "): clGetContextInfo(CL_DEVICE_EXTENSIONS)\n";
-      return 1;
-    }
-    status = clGetDeviceInfo(devices[i], CL_DEVICE_GLOBAL_MEM_CACHE_SIZE, sizeof(deviceinfo.gl_cache), &deviceinfo.gl_cache, NULL);
-    if(status != CL_SUCCESS)
-    {
-      std::cerr << "Error " << status << " (" << ClErrorString(status) << "): clGetContextInfo(CL_DEVICE_GLOBAL_MEM_CACHE_SIZE)\n";
-      return 1;
-    }
-    status = clGetDeviceInfo(devices[i], CL_DEVICE_GLOBAL_MEM_SIZE, sizeof(deviceinfo.gl_mem), &deviceinfo.gl_mem, NULL);
-    if(status != CL_SUCCESS)
-    {
-      std::cerr << "Error " << status << " (" << ClErrorString(status) << "): clGetContextInfo(CL_DEVICE_GLOBAL_MEM_SIZE)\n";
-      return 1;
-    }
-    status = clGetDeviceInfo(devices[i], CL_DEVICE_MAX_CLOCK_FREQUENCY, sizeof(deviceinfo.max_clock), &deviceinfo.max_clock, NULL);
-    if(status != CL_SUCCESS)
-    {
-      std::cerr << "Error " << status << " (" << ClErrorString(status) << "): clGetContextInfo(CL_DEVICE_MAX_CLOCK_FREQUENCY)\n";
-      return 1;
-    }
-    status = clGetDeviceInfo(devices[i], CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(deviceinfo.units), &deviceinfo.units, NULL);
-    if(status != CL_SUCCESS)
-    {
-      std::cerr << "Error " << status << " (" << ClErrorString(status) << "): clGetContextInfo(CL_DEVICE_MAX_COMPUTE_UNITS)\n";
-      return 1;
-    }
-    status = clGetDeviceInfo(devices[i], CL_DEVICE_MAX_WORK_GROUP_SIZE, sizeof(deviceinfo.wg_size), &deviceinfo.wg_size, NULL);
-    if(status != CL_SUCCESS)
-    {
-      std::cerr << "Error " << status << " (" << ClErrorString(status) << "): clGetContextInfo(CL_DEVICE_MAX_WORK_GROUP_SIZE)\n";
-      return 1;
-    }
-    status = clGetDeviceInfo(devices[i], CL_DEVICE_MAX_WORK_ITEM_DIMENSIONS, sizeof(deviceinfo.w_dim), &deviceinfo.w_dim, NULL);
-    if(status != CL_SUCCESS)
-    {
-      std::cerr << "Error " << status << " (" << ClErrorString(status) << "): clGetContextInfo(CL_DEVICE_MAX_WORK_ITEM_DIMENSIONS)\n";
-      return 1;
-    }
-    status = clGetDeviceInfo(devices[i], CL_DEVICE_MAX_WORK_ITEM_SIZES, sizeof(deviceinfo.wi_sizes), deviceinfo.wi_sizes, NULL);
-    if(status != CL_SUCCESS)
-    {
-      std::cerr << "Error " << status << " (" << ClErrorString(status) << "): clGetContextInfo(CL_DEVICE_MAX_WORK_ITEM_SIZES)\n";
-      return 1;
-    }
-    status = clGetDeviceInfo(devices[i], CL_DEVICE_LOCAL_MEM_SIZE, sizeof(deviceinfo.l_mem), &deviceinfo.l_mem, NULL);
-    if(status != CL_SUCCESS)
-    {
-      std::cerr << "Error " << status << " (" << ClErrorString(status) << "): clGetContextInfo(CL_DEVICE_LOCAL_MEM_SIZE)\n";
-      return 1;
-    }
-
-    if (mystuff.verbosity > 1)
-      std::cout << "Device " << (i+1)  << "/" << num_devices << ": " << deviceinfo.d_name << " (" << deviceinfo.v_name << "),\ndevice version: "
-        << deviceinfo.d_ver << ", driver version: " << deviceinfo.dr_version << "\nExtensions: " << deviceinfo.exts
-        << "\nGlobal memory:" << deviceinfo.gl_mem << ", Global memory cache: " << deviceinfo.gl_cache
-        << ", local memory: " << deviceinfo.l_mem << ", workgroup size: " << deviceinfo.wg_size << ", Work dimensions: " << deviceinfo.w_dim
-        << "[" << deviceinfo.wi_sizes[0] << ", " << deviceinfo.wi_sizes[1] << ", " << deviceinfo.wi_sizes[2] << ", " << deviceinfo.wi_sizes[3] << ", " << deviceinfo.wi_sizes[4]
-        << "] , Max clock speed:" << deviceinfo.max_clock << ", compute units:" << deviceinfo.units << std::endl;
+    if (get_device_info(devices[i], i, num_devices)) return 1;
   }
 
   if (strstr(deviceinfo.exts, "global_int32_base_atomics") == NULL)
@@ -537,44 +1044,69 @@ int init_CL(int num_streams, cl_int *devnumber)
     kernel_info[BARRETT88_MUL15_GS].bit_max = 0;
   }
   */
-  deviceinfo.maxThreadsPerBlock = deviceinfo.wi_sizes[0];
-  deviceinfo.maxThreadsPerGrid  = deviceinfo.wi_sizes[0];
-  for (i=1; i<deviceinfo.w_dim && i<5; i++)
+  // sub-devices for testing on CPU runtimes, or several devices given by -d
+  dev_list[0]   = devices[*devnumber];
+  build_list[0] = devices[*devnumber];
+  dev_count     = build_count = 1;
+  if (mystuff.split_device > 1)
   {
-    if (deviceinfo.wi_sizes[i])
-      deviceinfo.maxThreadsPerGrid *= deviceinfo.wi_sizes[i];
+    if (split_device(devices[*devnumber], mystuff.split_device)) return 1;
+    if (get_device_info(dev_list[0], 0, dev_count)) return 1;
   }
+  thread_mutex_init(&output_mutex);
+  thread_mutex_init(&exp_program_mutex);
+  thread_mutex_init(&family_mutex);
 
-  cl_command_queue_properties props = 0;             // GPU sieve is started without synchronization events
-  if (mystuff.gpu_sieving == 0)                      // but CPU sieve can run out-of-order, if possible
-    props = CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE;  // kernels and copy-jobs are queued with event dependencies, so this should work ...
-                                                     // but so far the GPU driver does not support that anyway (as of Catalyst 12.9)
+  if (create_queues(dev_list[0])) return 1;
+  return CL_SUCCESS;
+}
 
-  commandQueue = clCreateCommandQueue(context, devices[*devnumber], props, &status);
-  if(status != CL_SUCCESS)
+/*
+ * add_CL_device: use one more device of the context selected by init_CL(),
+ *   devnumber as for -d (only the last digit counts, the platform is that of
+ *   the first device). Needs to be called before load_kernels().
+ */
+int add_CL_device(cl_int devnumber)
+{
+  cl_int status;
+  cl_uint num_devices, i;
+
+  if (dev_list[0] != build_list[0])
   {
-    props = 0; // Intel HD does not support out-of-order
-    commandQueue = clCreateCommandQueue(context, devices[*devnumber], props, &status);
-    if(status != CL_SUCCESS)
-    {
-      std::cerr << "Error " << status << " (" << ClErrorString(status) << "): clCreateCommandQueue(dev#" << (*devnumber+1) << ")\n";
-      return 1;
-    }
-    else
-    {
-      printf("\nINFO: Device does not support out-of-order operations. Fallback to in-order queues.\n");
-    }
+    fprintf(stderr, "Error: SplitDevice cannot be combined with a list of devices for -d.\n");
+    return 1;
+  }
+  if (dev_count >= NUM_DEVICES_MAX)
+  {
+    fprintf(stderr, "Error: Too many devices for -d, the maximum is %d.\n", NUM_DEVICES_MAX);
+    return 1;
   }
 
-  props |= CL_QUEUE_PROFILING_ENABLE;
-
-  commandQueuePrf = clCreateCommandQueue(context, devices[*devnumber], props, &status);
+  status = clGetContextInfo(context, CL_CONTEXT_NUM_DEVICES, sizeof(num_devices), &num_devices, NULL);
   if(status != CL_SUCCESS)
   {
-    std::cerr << "Error " << status << " (" << ClErrorString(status) << "): clCreateCommandQueuePrf(dev#" << (*devnumber+1) << ")\n";
+    std::cerr << "Error " << status << " (" << ClErrorString(status) << "): clGetContextInfo(CL_CONTEXT_NUM_DEVICES)\n";
     return 1;
   }
-  return CL_SUCCESS;
+  devnumber %= 10;
+  if (devnumber < 1 || (cl_uint)devnumber > num_devices)
+  {
+    fprintf(stderr, "Error: Only %d devices found. Cannot use device %d (bad parameter to option -d).\n", num_devices, devnumber);
+    return 1;
+  }
+  for (i=0; i<dev_count; i++)
+  {
+    if (dev_list[i] == devices[devnumber-1])
+    {
+      fprintf(stderr, "Error: Device %d was specified twice for option -d.\n", devnumber);
+      return 1;
+    }
+  }
+  dev_list[dev_count]     = devices[devnumber-1];
+  build_list[build_count] = devices[devnumber-1];
+  dev_count++;
+  build_count++;
+  return 0;
 }
 
 /*
@@ -710,17 +1242,472 @@ void set_gpu_type()
   
 /*
  * load_kernels
- * compile cl files or load the precompiled binary, and load all kernels
+ * start building the kernel families from the cl files or the precompiled
+ * binaries, the kernels are created by load_kernel() when first needed
  */
 
-int load_kernels(cl_int *devnumber)
+static int create_kernels(void);
+
+/* KernelCacheDir: the cache key for a program built with options for build_list[] */
+static int kernel_cache_key_for(kernel_cache_key_t *key, const char *options)
+{
+  char device[256], driver[256];
+
+  if (clGetDeviceInfo(build_list[0], CL_DEVICE_NAME, sizeof(device), device, NULL) != CL_SUCCESS ||
+      clGetDeviceInfo(build_list[0], CL_DRIVER_VERSION, sizeof(driver), driver, NULL) != CL_SUCCESS)
+    return 1;
+  return kernel_cache_key(key, device, driver, options, KERNEL_FILE);
+}
+
+/* create a program from the cached binary for key, NULL if there is none or the
+   driver rejects it. It still needs clBuildProgram. */
+static cl_program kernel_cache_program(const char *dir, const kernel_cache_key_t *key)
+{
+  cl_program cached;
+  cl_int errcode, status = CL_SUCCESS;
+  unsigned char *binary;
+  size_t size, sizes[NUM_DEVICES_MAX];
+  const unsigned char *binaries[NUM_DEVICES_MAX];
+  cl_int bin_status[NUM_DEVICES_MAX];
+  cl_uint i;
+
+  if (kernel_cache_load(dir, key, &binary, &size)) return NULL;
+
+  for (i=0; i<build_count; i++)  // the same binary for all devices
+  {
+    sizes[i]    = size;
+    binaries[i] = binary;
+  }
+  cached = clCreateProgramWithBinary(context, build_count, build_list, sizes, binaries, bin_status, &errcode);
+  for (i=0; i<build_count && errcode == CL_SUCCESS && status == CL_SUCCESS; i++) status = bin_status[i];
+  free(binary);
+  if (status != CL_SUCCESS || errcode != CL_SUCCESS)
+  {
+    fprintf(stderr, "Cannot use cached kernel %s/%s: binary status=%d (%s), error code=%d (%s)\n",
+      dir, key->name, status, ClErrorString(status), errcode, ClErrorString(errcode));
+    if (cached) clReleaseProgram(cached);
+    kernel_cache_remove(dir, key);
+    return NULL;
+  }
+  return cached;
+}
+
+/* the binary of the built program p (of the first device) in a malloc'ed buffer, NULL on errors */
+static unsigned char *program_binary(cl_program p, size_t *size)
+{
+  cl_uint num = 0;
+  size_t sizes[NUM_DEVICES_MAX];
+  unsigned char *binaries[NUM_DEVICES_MAX] = {NULL};  // NULL: the driver skips that device
+
+  if (clGetProgramInfo(p, CL_PROGRAM_NUM_DEVICES, sizeof(num), &num, NULL) != CL_SUCCESS || num == 0 || num > NUM_DEVICES_MAX ||
+      clGetProgramInfo(p, CL_PROGRAM_BINARY_SIZES, sizeof(size_t) * num, sizes, NULL) != CL_SUCCESS || sizes[0] == 0)
+    return NULL;
+  binaries[0] = (unsigned char *) malloc(sizes[0]);
+  if (binaries[0] == NULL) return NULL;
+  if (clGetProgramInfo(p, CL_PROGRAM_BINARIES, sizeof(unsigned char *) * num, binaries, NULL) != CL_SUCCESS)
+  {
+    free(binaries[0]);
+    return NULL;
+  }
+  *size = sizes[0];
+  return binaries[0];
+}
+
+/* store the binary of the built program p in the cache, returns 0 on success */
+static int kernel_cache_store(cl_program p, const char *dir, const kernel_cache_key_t *key)
 {
+  int ret;
+  size_t size;
+  unsigned char *binary = program_binary(p, &size);
+
+  if (binary == NULL)
+  {
+    std::cerr << "Cannot get the binary of the kernels, not writing " << dir << "/" << key->name << ".\n";
+    return 1;
+  }
+  ret = kernel_cache_save(dir, key, binary, size);
+  free(binary);
+  return ret;
+}
+
+/* UseBinfile: create a program from binfile if it was built with options, NULL
+   otherwise. The binary follows a line "Compile options: <options>". */
+static cl_program binfile_program(const char *binfile, const char *options)
+{
+  cl_program p;
+  cl_int errcode, status = CL_SUCCESS;
+  char *source, source_options[350] = "";
+  size_t size, len, sizes[NUM_DEVICES_MAX];
+  const unsigned char *binaries[NUM_DEVICES_MAX];
+  cl_int bin_status[NUM_DEVICES_MAX];
+  cl_uint i;
+
+  if (!file_exists((char *) binfile)) return NULL;
+  if (build_verbosity > 0) printf("Loading binary kernel file %s\n", binfile);
+
+  std::fstream f(binfile, (std::fstream::in | std::fstream::binary));
+  if(!f.is_open())
+  {
+    fprintf(stderr, "\nBinary kernel file \"%s\" not readable, check permissions.\n", binfile);
+    return NULL;
+  }
+  f.seekg(0, std::fstream::end);
+  size = (size_t)f.tellg();
+  f.seekg(0, std::fstream::beg);
+
+  source = (char *) malloc(size+1);
+  if(!source)
+  {
+    f.close();
+    std::cerr << "\noom\n";
+    return NULL;
+  }
+  f.read(source, size);
+  f.close();
+  source[size] = '\0';
+
+  sscanf(source, "Compile options: %349[^\r\n]\n", source_options);
+  len = strlen(source_options) + 18; // fix text part
+  if (strcmp(source_options, options) != 0 || len > size)
+  {
+    printf("\nCannot use binary kernel: its build options (%s) are different than the current build options (%s). Rebuilding kernels.\n", source_options, options);
+    free(source);
+    return NULL;
+  }
+
+  for (i=0; i<build_count; i++)  // the same binary for all devices
+  {
+    sizes[i]    = size - len;
+    binaries[i] = (const unsigned char *)source + len;
+  }
+  p = clCreateProgramWithBinary(context, build_count, build_list, sizes, binaries, bin_status, &errcode);
+  for (i=0; i<build_count && errcode == CL_SUCCESS && status == CL_SUCCESS; i++) status = bin_status[i];
+  free(source);
+  if (status != CL_SUCCESS || errcode != CL_SUCCESS)
+  {
+    // not successful: the caller uses the source
+    fprintf(stderr, "Cannot use binary kernel: binary status=%d (%s), error code=%d (%s)\n",
+      status, ClErrorString(status), errcode, ClErrorString(errcode));
+    if (p) clReleaseProgram(p);
+    return NULL;
+  }
+  return p;
+}
+
+/* UseBinfile: write the binary of the built program p to binfile, after its build options */
+static void binfile_store(cl_program p, const char *binfile, const char *options)
+{
+  size_t size;
+  unsigned char *binary = program_binary(p, &size);
+
+  if (binary == NULL)
+  {
+    printf("binary kernel(%s) : Skipping as there is no binary data to write.\n", binfile);
+    remove(binfile);
+    return;
+  }
+  if (build_count > 1)
+  {
+    std::cout << "Warning: Dumping only the first of " << build_count <<
+      " binary formats - if loading the binary file " << binfile <<  " fails, delete it and specify the -d <n> option for mfakto.\n";
+  }
+
+  std::fstream f(binfile, (std::fstream::out | std::fstream::binary | std::fstream::trunc));
+  if(f.is_open())
+  {
+    f << "Compile options: " << options << "\n";
+    f.write((const char *)binary, size);
+    f.close();
+    if (build_verbosity > 1) printf("Wrote binary kernel to \"%s\".\n", binfile);
+  }
+  else
+  {
+    std::cerr << "Failed to open binary file " << binfile << " to save kernel.\n";
+  }
+  free(binary);
+}
+
+/* create a program from the .cl sources, NULL on errors */
+static cl_program source_program(void)
+{
+  cl_program p;
   cl_int status;
-  size_t i = 0;
+  char *source;
   size_t size;
-  char*  source = NULL;
-  int binary_loaded = 0;
-  char program_options[150];
+  std::fstream f(KERNEL_FILE, (std::fstream::in | std::fstream::binary));
+
+  if(!f.is_open())
+  {
+    std::cerr << "\nKernel file \""KERNEL_FILE"\" not found, it needs to be in the same directory as the executable.\n";
+    return NULL;
+  }
+  f.seekg(0, std::fstream::end);
+  size = (size_t)f.tellg();
+  f.seekg(0, std::fstream::beg);
+
+  source = (char *) malloc(size+1);
+  if(!source)
+  {
+    f.close();
+    std::cerr << "\noom\n";
+    return NULL;
+  }
+  f.read(source, size);
+  f.close();
+  source[size] = '\0';
+
+  p = clCreateProgramWithSource(context, 1, (const char **)&source, &size, &status);
+  free(source);
+  if(status != CL_SUCCESS)
+  {
+    std::cerr << "Error " << status << " (" << ClErrorString(status) << "): clCreateProgramWithSource\n";
+    return NULL;
+  }
+  return p;
+}
+
+/* print the build log of p for the first device */
+static void print_build_log(cl_program p)
+{
+  cl_int logstatus;
+  char *buildLog;
+  size_t buildLogSize = 0;
+
+  logstatus = clGetProgramBuildInfo(p, build_list[0], CL_PROGRAM_BUILD_LOG, 0, NULL, &buildLogSize);
+  if(logstatus != CL_SUCCESS)
+  {
+    std::cerr << "Error " << logstatus << " (" << ClErrorString(logstatus) << "): clGetProgramBuildInfo failed.\n";
+    return;
+  }
+  if (buildLogSize == 0)
+  {
+    printf("No build log available.\n");
+    return;
+  }
+  buildLog = (char*)calloc(buildLogSize,1);
+  if(buildLog == NULL)
+  {
+    std::cerr << "\noom\n";
+    return;
+  }
+  logstatus = clGetProgramBuildInfo(p, build_list[0], CL_PROGRAM_BUILD_LOG, buildLogSize, buildLog, NULL);
+  if(logstatus != CL_SUCCESS)
+  {
+    std::cerr << "Error " << logstatus << " (" << ClErrorString(logstatus) << "): clGetProgramBuildInfo failed.\n";
+  }
+  else
+  {
+    thread_mutex_lock(&output_mutex);  // keep the logs of parallel builds apart
+    fflush(NULL);
+    std::cout << " \n\tBUILD OUTPUT\n";
+    std::cout << buildLog << std::endl;
+    std::cout << " \tEND OF BUILD OUTPUT\n";
+    thread_mutex_unlock(&output_mutex);
+  }
+  free(buildLog);
+}
+
+/*
+ * build_program: build the program of KERNEL_FILE with options for build_list[].
+ * With KernelCacheDir (or UseBinfile: binfile) the binary is loaded from there
+ * if possible and stored there after building from the sources. Returns NULL
+ * if the build failed. Runs in the build threads, uses only the build_* copies
+ * of the settings.
+ */
+static cl_program build_program(const char *options, const char *binfile)
+{
+  cl_program p = NULL;
+  cl_int status = CL_SUCCESS;
+  kernel_cache_key_t cache_key;
+  int use_cache = 0, binary_loaded = 0;
+
+  if (build_cache_dir[0])  // replaces UseBinfile
+  {
+    use_cache = (kernel_cache_key_for(&cache_key, options) == 0);
+    if (use_cache && !build_force_rebuild)
+    {
+      p = kernel_cache_program(build_cache_dir, &cache_key);
+      if (p && build_verbosity > 1) printf("Loading binary kernel %s/%s\n", build_cache_dir, cache_key.name);
+    }
+  }
+  else if (binfile[0])
+  {
+    if (build_force_rebuild) remove(binfile);
+    p = binfile_program(binfile, options);
+  }
+
+  if (p)
+  {
+    status = clBuildProgram(p, build_count, build_list, options, NULL, NULL);
+    if (status == CL_SUCCESS)
+    {
+      binary_loaded = 1;
+    }
+    else
+    {
+      // e.g. a binary for a different platform: remove it and use the sources
+      if (build_verbosity > 2) print_build_log(p);
+      fprintf(stderr, "Cannot use binary kernel (%d: %s), removing it. Rebuilding kernels.\n", status, ClErrorString(status));
+      clReleaseProgram(p);
+      p = NULL;
+      if (use_cache) kernel_cache_remove(build_cache_dir, &cache_key);
+      else           remove(binfile);
+    }
+  }
+
+  if (p == NULL)
+  {
+    p = source_program();
+    if (p == NULL) return NULL;
+
+    // options can be overridden by setting en environment variable AMD_OCL_BUILD_OPTIONS
+    status = clBuildProgram(p, build_count, build_list, options, NULL, NULL);
+    if((status == CL_BUILD_PROGRAM_FAILURE) || (build_verbosity > 2)) print_build_log(p);
+    if (status != CL_SUCCESS)
+    {
+      std::cerr<<"Error " << status << " (" << ClErrorString(status) << "): clBuildProgram\n";
+      clReleaseProgram(p);
+      return NULL;
+    }
+  }
+
+  if (!binary_loaded && use_cache)
+  {
+    if (kernel_cache_store(p, build_cache_dir, &cache_key) == 0 && build_verbosity > 1)
+      printf("Wrote binary kernel to \"%s/%s\".\n", build_cache_dir, cache_key.name);
+  }
+  else if (!binary_loaded && binfile[0])
+  {
+    binfile_store(p, binfile, options);
+  }
+  return p;
+}
+
+/* the family of the program that contains kernel */
+static int kernel_family(int kernel)
+{
+  switch (kernel)
+  {
+    case _71BIT_MUL24:
+    case _63BIT_MUL24:
+    case _64BIT_64_OpenCL:
+      return FAMILY_MUL24;
+    case BARRETT79_MUL32:
+    case BARRETT77_MUL32:
+    case BARRETT76_MUL32:
+    case BARRETT92_MUL32:
+    case BARRETT88_MUL32:
+    case BARRETT87_MUL32:
+    case BARRETT92_64_OpenCL:
+    case BARRETT79_MUL32_GS:
+    case BARRETT77_MUL32_GS:
+    case BARRETT76_MUL32_GS:
+    case BARRETT92_MUL32_GS:
+    case BARRETT88_MUL32_GS:
+    case BARRETT87_MUL32_GS:
+      return FAMILY_BARRETT32;
+    case MG96:
+    case MG62:
+    case MG88:
+    case MG96_GS:
+      return FAMILY_MONTGOMERY;
+    case CL_CALC_BIT_TO_CLEAR:
+    case CL_CALC_MOD_INV:
+    case CL_SIEVE:
+    case CL_CALC_BIT_TO_CLEAR_ADV:
+      return FAMILY_GPUSIEVE;
+    default:  // test_k, the 15-bit barrett kernels and the bulk kernel
+      return FAMILY_BARRETT15;
+  }
+}
+
+/* UseBinfile: the file of a family, e.g. mfakto_Kernels.barrett15.elf for mfakto_Kernels.elf */
+static void family_binfile(char *name, int family)
+{
+  const char *ext = strrchr(build_binfile, '.');
+  int len;
+
+  if (ext && (strchr(ext, '/') || strchr(ext, '\\'))) ext = NULL;  // a dot in a directory name
+  len = ext ? (int)(ext - build_binfile) : (int)strlen(build_binfile);
+  sprintf(name, "%.*s.%s%s", len, build_binfile, family_names[family], ext ? ext : "");
+}
+
+/* build the program of one family_programs[] entry, started by family_build_start() */
+static THREAD_FUNC(family_build_thread)
+{
+  family_program_t *fp = (family_program_t *) arg;
+  int family = (int)(fp - family_programs);
+  char options[350], binfile[80] = "";
+
+  sprintf(options, "%s -DKERNEL_FAMILY=%d", build_options, family);
+  if (build_binfile[0]) family_binfile(binfile, family);
+
+  fp->program = build_program(options, binfile);
+  if (fp->program == NULL)
+    printf("ERROR: building the %s kernels failed.\n", family_names[family]);
+  else if (build_verbosity > 1)
+    printf("The %s kernels are ready.\n", family_names[family]);
+  THREAD_RETURN;
+}
+
+/* start building the program of family unless that is done already, family_mutex must be held */
+static void family_build_start(int family)
+{
+  family_program_t *fp = &family_programs[family];
+
+  if (fp->started) return;
+  fp->started = 1;
+  if (thread_create(&fp->thread, family_build_thread, fp))
+  {
+    family_build_thread(fp);  // no thread: build it right away
+    fp->joined = 1;
+  }
+}
+
+/* the program of family, waits for its build. NULL if the build failed. */
+static cl_program family_program(int family)
+{
+  family_program_t *fp = &family_programs[family];
+
+  thread_mutex_lock(&family_mutex);
+  family_build_start(family);
+  if (!fp->joined)
+  {
+    thread_join(fp->thread);
+    fp->joined = 1;
+  }
+  thread_mutex_unlock(&family_mutex);
+  return fp->program;
+}
+
+/*
+ * load_kernel: create kernel for the calling device thread unless it exists
+ * already. Waits for the build of its family if that is still running.
+ */
+int load_kernel(int kernel)
+{
+  cl_program p;
+  cl_int status;
+
+  if (kernel_info[kernel].kernel) return 0;
+
+  p = family_program(kernel_family(kernel));
+  if (p == NULL) return 1;  // reported by family_build_thread()
+
+  kernel_info[kernel].kernel = clCreateKernel(p, kernel_info[kernel].kernelname, &status);
+  if(status != CL_SUCCESS)
+  {
+    std::cerr<<"Error " << status << " (" << ClErrorString(status) << "): Creating Kernel " << kernel_info[kernel].kernelname << " from program. (clCreateKernel)\n";
+    kernel_info[kernel].kernel = NULL;
+    return 1;
+  }
+  return 0;
+}
+
+int load_kernels(cl_int *devnumber)
+{
+  char program_options[300];
+  int family;
 
   // so far use the same vector size for all kernels ...
   if (mystuff.CompileOptions[0] && mystuff.CompileOptions[0] != '+')  // if mfakto.ini defined compile options, override the default with them
@@ -753,373 +1740,215 @@ int load_kernels(cl_int *devnumber)
       strcat(program_options, mystuff.CompileOptions+1);
   }
 
-  if (mystuff.binfile[0])
-  {
-    if (mystuff.force_rebuild == 1) remove(mystuff.binfile);
-
-    // check if binfile exists
-    if (file_exists(mystuff.binfile))
-    {
-      if (mystuff.verbosity > 0) printf("Loading binary kernel file %s\n", mystuff.binfile);
-      std::fstream f(mystuff.binfile, (std::fstream::in | std::fstream::binary));
-
-      if(f.is_open())
-      {
-        f.seekg(0, std::fstream::end);
-        size = (size_t)f.tellg();
-        f.seekg(0, std::fstream::beg);
+  strcpy(build_options, program_options);
+  strcpy(build_cache_dir, mystuff.kernel_cache_dir);
+  strcpy(build_binfile, mystuff.binfile);
+  build_force_rebuild = (mystuff.force_rebuild == 1);
+  build_verbosity     = mystuff.verbosity;
 
-        source = (char *) malloc(size+1);
-        if(!source)
-        {
-          f.close();
-          std::cerr << "\noom\n";
-          return 1;
-        }
-
-        f.read(source, size);
-        f.close();
-        source[size] = '\0';
-        char source_options[150];
-        sscanf(source, "Compile options: %149[^\r\n]\n", source_options);
-        if (strcmp(source_options, program_options) != 0)
-        {
-          printf("\nCannot use binary kernel: its build options (%s) are different than the current build options (%s). Rebuilding kernels.\n", source_options, program_options);
-          free(source);
-          source = NULL;
-        }
-        else
-        {
-          // locate the binary and load it
-          size_t len=strlen(source_options) + 18; // fix text part
-          memmove(source, source+len, size-len);
-          size -= len;
-        }
-      }
-      else
-      {
-        fprintf(stderr, "\nBinary kernel file \"%s\" not readable, check permissions.\n", mystuff.binfile);
-      }
-
-      if (source)
-      {
-        // load and build it. If not successful, use the .cl sources.
-        cl_int errcode;
+  if (mystuff.verbosity > 1)
+    printf("Compiling kernels (build options: \"%s\").\n", program_options);
+  else if (mystuff.verbosity > 0)
+    printf("Compiling kernels.\n");
 
-        program = clCreateProgramWithBinary(context, 1, &devices[*devnumber], &size, (const unsigned char **)&source, &status, &errcode);
-        if (status != CL_SUCCESS || errcode != 0)
-        {
-          // not successful: try the source
-          fprintf(stderr, "Cannot use binary kernel: binary status=%d (%s), error code=%d (%s)\n",
-            status, ClErrorString(status), errcode, ClErrorString(errcode));
-          free(source); source = NULL;
-          status = clReleaseProgram(program); program = NULL;
-          if(status != CL_SUCCESS)
-          {
-            std::cerr<<"Error" << status << " (" << ClErrorString(status) << "): clReleaseProgram\n";
-          }
-        }
-        else
-        {
-          binary_loaded = 1;
-        }
-      }
-    }
+  // all families the sieve can use are built in parallel, a class only waits for the one of its kernel
+  thread_mutex_lock(&family_mutex);
+  for (family = FAMILY_GPUSIEVE; family < NUM_FAMILIES; family++)
+  {
+    if (mystuff.gpu_sieving == 1 ? family != FAMILY_MUL24 : family != FAMILY_GPUSIEVE)
+      family_build_start(family);
   }
+  thread_mutex_unlock(&family_mutex);
 
-  if (!program) // load binary failed or is not enabled
-  {
-    std::fstream f(KERNEL_FILE, (std::fstream::in | std::fstream::binary));
+  return create_kernels();
+}
 
-    if(f.is_open())
+/*
+ * init_CL_worker: per-device inits for the thread driving dev_list[dev]:
+ *   device info, command queues, kernels, buffers and the CPU sieve. The
+ *   context, the programs and the sieve tables are shared, init_CL(),
+ *   load_kernels() and sieve_init() set them up.
+ */
+int init_CL_worker(cl_uint dev)
+{
+  if (mystuff.gpu_sieving == 0)
+  {
+    cpu_sieve = sieve_ctx_create();
+    if (cpu_sieve == NULL)
     {
-      f.seekg(0, std::fstream::end);
-      size = (size_t)f.tellg();
-      f.seekg(0, std::fstream::beg);
+      printf("ERROR: could not create the CPU sieve of device %u\n", dev + 1);
+      return 1;
+    }
+  }
+  if (get_device_info(dev_list[dev], dev, dev_count)) return 1;
+  if (create_queues(dev_list[dev])) return 1;
+  if (create_kernels()) return 1;
+  return init_CLstreams(0);
+}
 
-      source = (char *) malloc(size+1);
-      if(!source)
-      {
-        f.close();
-        std::cerr << "\noom\n";
-        return 1;
-      }
+/* create the kernels that are needed right away for the calling device thread,
+   the TF kernels are created by load_kernel() when a class first needs them */
+static int create_kernels(void)
+{
+  int i;
 
-      f.read(source, size);
-      f.close();
-      source[size] = '\0';
-    }
-    else
+  if (mystuff.gpu_sieving == 0)
+  {
+    if (mystuff.bulk_exponents > 1 && load_kernel(BARRETT69_MUL15_BULK))
     {
-      std::cerr << "\nKernel file \""KERNEL_FILE"\" not found, it needs to be in the same directory as the executable.\n";
-      return 1;
+      std::cerr<<"Warning: Creating Kernel " << kernel_info[BARRETT69_MUL15_BULK].kernelname << " failed, bulk mode disabled.\n";
+      mystuff.bulk_exponents = 0;
     }
-
-    program = clCreateProgramWithSource(context, 1, (const char **)&source, &size, &status);
-    if(status != CL_SUCCESS)
+  }
+  else
+  {
+    for (i=CL_CALC_BIT_TO_CLEAR; i<=CL_CALC_BIT_TO_CLEAR_ADV; i++)
     {
-      std::cerr << "Error " << status << " (" << ClErrorString(status) << "): clCreateProgramWithSource\n";
-      return 1;
+      if (load_kernel(i)) return 1;
     }
   }
-  if (source) free(source);
+  return 0;
+}
 
-  if (mystuff.verbosity > 1)
-    printf("Compiling kernels (build options: \"%s\").", program_options);
-  else if (mystuff.verbosity > 0)
-    printf("Compiling kernels.\n");
 
-  // program_options can be overridden by setting en environment variable AMD_OCL_BUILD_OPTIONS
+/* build the program of one exp_programs[] entry, started by exp_kernel_select() */
+static THREAD_FUNC(exp_build_thread)
+{
+  exp_program_t *entry = (exp_program_t *) arg;
+  cl_program exp_program;
+  char       options[400];
 
-  status = clBuildProgram(program, 1, &devices[*devnumber], program_options, NULL, NULL);
-  if((status != CL_SUCCESS) || (mystuff.verbosity > 2))
-  {
-    if((status == CL_BUILD_PROGRAM_FAILURE) || (mystuff.verbosity > 2))
-    {
-      cl_int logstatus;
-      char *buildLog = NULL;
-      size_t buildLogSize = 0;
-      logstatus = clGetProgramBuildInfo (program, devices[*devnumber], CL_PROGRAM_BUILD_LOG,
-                buildLogSize, buildLog, &buildLogSize);
-      if(logstatus != CL_SUCCESS)
-      {
-        std::cerr << "Error " << logstatus << " (" << ClErrorString(logstatus) << "): clGetProgramBuildInfo failed.";
-        return 1;
-      }
-      if (buildLogSize >0)
-      {
-        buildLog = (char*)calloc(buildLogSize,1);
-        if(buildLog == NULL)
-        {
-          std::cerr << "\noom\n";
-          return 1;
-        }
-        fflush(NULL);
-        logstatus = clGetProgramBuildInfo (program, devices[*devnumber], CL_PROGRAM_BUILD_LOG,
-                  buildLogSize, buildLog, NULL);
-        if(logstatus != CL_SUCCESS)
-        {
-          std::cerr << "Error " << logstatus << " (" << ClErrorString(logstatus) << "): clGetProgramBuildInfo failed.";
-          free(buildLog);
-          return 1;
-        }
+  sprintf(options, "%s -DKERNEL_FAMILY=%d -DFIXED_EXPONENT=%uu -DFIXED_SHIFTCOUNT=%u",
+    build_options, entry->family, entry->exponent, entry->shiftcount);
 
-        std::cout << " \n\tBUILD OUTPUT\n";
-        std::cout << buildLog << std::endl;
-        std::cout << " \tEND OF BUILD OUTPUT\n";
-        if (strstr(buildLog, " not for the target") && binary_loaded)
-        {
-          printf("Removing binary kernel file %s as it seems to be for a different platform.\nPlease restart mfakto.", mystuff.binfile);
-          remove (mystuff.binfile);
-        }
-        free(buildLog);
-      }
-      else
-      {
-        printf("No build log available.\n");
-      }
-    }
-    std::cerr<<"Error " << status << " (" << ClErrorString(status) << "): clBuildProgram\n";
-    if (status != CL_SUCCESS) return 1;
-  }
+  // KernelCacheDir: the specialized programs are cached like the generic ones, UseBinfile keeps only those
+  exp_program = build_program(options, "");
+
+  thread_mutex_lock(&exp_program_mutex);
+  entry->program = exp_program;
+  entry->state   = exp_program ? EXP_PROGRAM_READY : EXP_PROGRAM_FAILED;
+  thread_mutex_unlock(&exp_program_mutex);
+
+  if (exp_program == NULL)
+    printf("WARNING: building the kernels for M%u failed, using the generic kernels.\n", entry->exponent);
+  else if (build_verbosity > 1)
+    printf("Kernels for M%u (shiftcount %u) are ready.\n", entry->exponent, entry->shiftcount);
+
+  thread_atomic_store(&exp_build_done, 1);
+  THREAD_RETURN;
+}
+
+
+/* put the generic kernel back that an exponent-specialized kernel replaced */
+static void exp_kernel_restore(void)
+{
+  if (exp_kernel.index < 0) return;
+
+  clReleaseKernel(kernel_info[exp_kernel.index].kernel);
+  kernel_info[exp_kernel.index].kernel = exp_kernel.generic;
+  exp_kernel.index   = -1;
+  exp_kernel.generic = NULL;
+}
+
+
+/*
+ * exp_kernel_select (ExponentKernels=1): at the start of a class, use the
+ * kernel of the program specialized for exponent and shiftcount if it is
+ * built already. Otherwise start its build in the background (if no other
+ * build is running) and keep using the generic kernel in the meantime.
+ */
+static void exp_kernel_select(int use_kernel, cl_uint exponent, cl_uint shiftcount)
+{
+  cl_int status;
+  cl_kernel kernel;
+  exp_program_t *entry = NULL;
+  int family = kernel_family(use_kernel);
+  cl_uint i;
 
-  size_t numDevices=0;
-  char **binaries=NULL;
-  size_t *binarySizes=NULL;
-  while (!binary_loaded && mystuff.binfile[0]) // should be an if, but I want to use break on errors
+  if (exp_kernel.index == use_kernel && exp_kernel.exponent == exponent && exp_kernel.shiftcount == shiftcount) return;
+  exp_kernel_restore();
+
+  thread_mutex_lock(&exp_program_mutex);
+  for (i=0; i<EXP_PROGRAM_CACHE; i++)
   {
-    // write the binary file if we did not load from there
-    status = clGetProgramInfo(
-                 program,
-                 CL_PROGRAM_NUM_DEVICES,
-                 sizeof(numDevices),
-                 &numDevices,
-                 NULL );
-    if(status != CL_SUCCESS || numDevices == 0)
-    {
-      std::cerr << "clGetProgramInfo(CL_PROGRAM_NUM_DEVICES) failed. Cannot save binary kernel.\n";
-      break;
-    }
+    if (exp_programs[i].state != EXP_PROGRAM_FREE && exp_programs[i].exponent == exponent && exp_programs[i].shiftcount == shiftcount &&
+        exp_programs[i].family == family)
+      entry = &exp_programs[i];
+  }
 
-    cl_device_id *devices = (cl_device_id *)malloc( sizeof(cl_device_id) *
-                            numDevices );
-    if(!devices)
-    {
-      std::cerr << "Failed to allocate host memory.(devices, " << sizeof(cl_device_id) << " bytes)\n";
-      break;
-    }
-    /* grab the handles to all of the devices in the program. */
-    status = clGetProgramInfo(
-                 program,
-                 CL_PROGRAM_DEVICES,
-                 sizeof(cl_device_id) * numDevices,
-                 devices,
-                 NULL );
-    if(status != CL_SUCCESS)
-    {
-      std::cerr << "clGetProgramInfo(CL_PROGRAM_DEVICES) failed.";
-      break;
-    }
-    /* figure out the sizes of each of the binaries. */
-    binarySizes = (size_t*)malloc( sizeof(size_t) * numDevices );
-    if (!binarySizes)
-    {
-      std::cerr << "Failed to allocate host memory.(binarySizes, " << (sizeof(size_t) * numDevices) << " bytes)\n";
-      break;
-    }
-    status = clGetProgramInfo(
-                 program,
-                 CL_PROGRAM_BINARY_SIZES,
-                 sizeof(size_t) * numDevices,
-                 binarySizes,
-                 NULL);
-    if(status != CL_SUCCESS)
-    {
-      std::cerr << "clGetProgramInfo(CL_PROGRAM_BINARY_SIZES) failed.";
-      break;
-    }
-    // we copy only the first binary, but numDevices is usually 1 anyway
-    binaries = (char **)calloc( sizeof(char *), numDevices );
-    if (!binaries)
+  if (entry == NULL)
+  {
+    if (exp_build_started && thread_atomic_load(&exp_build_done))
     {
-      std::cerr << "Failed to allocate host memory.(binaries, " << (sizeof(char *) * numDevices) << " bytes)\n";
-      break;
+      thread_join(exp_build_handle);
+      exp_build_started = 0;
     }
-    for(i = 0; i < numDevices; i++)
+    if (!exp_build_started)
     {
-      if(binarySizes[i] != 0)
+      // a free entry, else the least recently used one that is not being built
+      for (i=0; i<EXP_PROGRAM_CACHE; i++)
       {
-        binaries[i] = (char *)malloc( sizeof(char) * binarySizes[i]);
-        if(!binaries[i])
-        {
-          std::cerr << "Failed to allocate host memory.(binaries[i], " << (sizeof(char) * binarySizes[i]) << " bytes)\n";
-          break;
-        }
+        if (exp_programs[i].state == EXP_PROGRAM_BUILDING) continue;
+        if (entry == NULL || exp_programs[i].state == EXP_PROGRAM_FREE ||
+            (entry->state != EXP_PROGRAM_FREE && exp_programs[i].last_used < entry->last_used))
+          entry = &exp_programs[i];
+      }
+      if (entry->program) clReleaseProgram(entry->program); // its kernels keep it alive as long as they are used
+      entry->program    = NULL;
+      entry->exponent   = exponent;
+      entry->shiftcount = shiftcount;
+      entry->family     = family;
+      entry->state      = EXP_PROGRAM_BUILDING;
+      entry->last_used  = ++exp_program_clock;
+      thread_atomic_store(&exp_build_done, 0);
+      if (thread_create(&exp_build_handle, exp_build_thread, entry))
+      {
+        printf("WARNING: cannot start the kernel build for M%u, using the generic kernels.\n", exponent);
+        entry->state = EXP_PROGRAM_FAILED;
       }
       else
       {
-        binaries[i] = NULL;
+        exp_build_started = 1;
+        if (mystuff.verbosity > 0) printf("Compiling kernels for M%u in the background.\n", exponent);
       }
     }
-    status = clGetProgramInfo(
-                 program,
-                 CL_PROGRAM_BINARIES,
-                 sizeof(char *) * numDevices,
-                 binaries,
-                 NULL);
-    if(status != CL_SUCCESS)
-    {
-       std::cerr << "clGetProgramInfo(CL_PROGRAM_BINARIES) failed.";
-       break;
-    }
-    /* dump out each binary into its own separate file. */
-    if (1 < numDevices)
-    {
-      std::cout << "Warning: Dumping only the first of " << numDevices <<
-        " binary formats - if loading the binary file " << mystuff.binfile <<  " fails, delete it and specify the -d <n> option for mfakto.\n";
-    }
-    if(binarySizes[0] != 0)
-    {
-        char deviceName[1024];
-        status = clGetDeviceInfo(
-                     devices[0],
-                     CL_DEVICE_NAME,
-                     sizeof(deviceName),
-                     deviceName,
-                     NULL);
-        if(status != CL_SUCCESS)
-        {
-          std::cerr << "clGetProgramInfo(CL_DEVICE_NAME) failed.";
-          break;
-        }
-
-        std::fstream f(mystuff.binfile, (std::fstream::out | std::fstream::binary | std::fstream::trunc));
-        if(f.is_open())
-        {
-          char header[180];
-          sprintf(header, "Compile options: %s\n", program_options);
-          f.write(header, strlen(header));
-          f.write(binaries[0], binarySizes[0]);
-          f.close();
-          if (mystuff.verbosity > 1) printf("Wrote binary kernel for \"%s\" to \"%s\".\n", deviceName, mystuff.binfile);
-        }
-        else
-        {
-          std::cerr << "Failed to open binary file " << mystuff.binfile << "to save kernel.\n";
-        }
-    }
-    else
-    {
-        printf(
-            "binary kernel(%s) : %s\n",
-            mystuff.binfile,
-            "Skipping as there is no binary data to write.\n");
-        remove(mystuff.binfile);
-    }
-    break;
-  }
-  // Release all resouces and memory
-  for(i = 0; i < numDevices; i++)
-  {
-    if(binaries != NULL && binaries[i] != NULL)
-    {
-      free(binaries[i]);
-      binaries[i] = NULL;
-    }
-  }
-  if(binaries != NULL)
-  {
-    free(binaries);
-    binaries = NULL;
-  }
-  if(binarySizes != NULL)
-  {
-    free(binarySizes);
-    binarySizes = NULL;
-  }
-  if(devices != NULL)
-  {
-    free(devices);
-    devices = NULL;
+    thread_mutex_unlock(&exp_program_mutex);
+    return;
   }
 
-  /* get kernels by name */
-  if (mystuff.gpu_sieving == 0)
+  if (entry->state == EXP_PROGRAM_READY)
   {
-    for (i=_TEST_MOD_; i<UNKNOWN_KERNEL; i++)
+    entry->last_used = ++exp_program_clock;
+    kernel = clCreateKernel(entry->program, kernel_info[use_kernel].kernelname, &status);
+    if (status == CL_SUCCESS)
     {
-      kernel_info[i].kernel = clCreateKernel(program, kernel_info[i].kernelname, &status);
-      if(status != CL_SUCCESS)
-      {
-        std::cerr<<"Error " << status << " (" << ClErrorString(status) << "): Creating Kernel " << kernel_info[i].kernelname << " from program. (clCreateKernel)\n";
-        return 1;
-      }
+      exp_kernel.index      = use_kernel;
+      exp_kernel.generic    = kernel_info[use_kernel].kernel;
+      exp_kernel.exponent   = exponent;
+      exp_kernel.shiftcount = shiftcount;
+      kernel_info[use_kernel].kernel = kernel;
+      if (mystuff.verbosity > 1) printf("Using the %s kernel built for M%u.\n", kernel_info[use_kernel].kernelname, exponent);
     }
-  }
-  else
-  {
-    for (i=CL_CALC_BIT_TO_CLEAR; i<UNKNOWN_GS_KERNEL; i++)
+    else
     {
-      kernel_info[i].kernel = clCreateKernel(program, kernel_info[i].kernelname, &status);
-      if(status != CL_SUCCESS)
-      {
-        std::cerr<<"Error " << status << " (" << ClErrorString(status) << "): Creating Kernel " << kernel_info[i].kernelname << " from program. (clCreateKernel)\n";
-        return 1;
-      }
+      std::cerr<<"Warning " << status << " (" << ClErrorString(status) << "): Creating Kernel " << kernel_info[use_kernel].kernelname << " for M" << exponent << " failed, using the generic kernel.\n";
+      entry->state = EXP_PROGRAM_FAILED;
     }
   }
-
-  if (mystuff.verbosity > 1)
-    printf("\n");
-  return 0;
+  thread_mutex_unlock(&exp_program_mutex);
 }
 
 
-int cleanup_CL(void)
+/* release the kernels, buffers, queues and the CPU sieve of the calling device thread */
+int cleanup_CL_worker(void)
 {
   cl_int status;
   cl_uint i;
 
+  sieve_producer_destroy(producer); producer=NULL; // stops its thread before the k_tabs are freed
+  if (cpu_sieve) sieve_ctx_destroy(cpu_sieve);
+  cpu_sieve=NULL;
+  exp_kernel_restore();
   for (i=0; i<NUM_KERNELS; i++)
   {
     if (kernel_info[i].kernel)
@@ -1130,24 +1959,29 @@ int cleanup_CL(void)
         fprintf(stderr, "Error %d: clReleaseKernel(%d)\n", status, i);
         return 1;
       }
-    }
-  }
-
-  status = clReleaseProgram(program); program=NULL;
-  if(status != CL_SUCCESS)
-  {
-    std::cerr<<"Error" << status << " (" << ClErrorString(status) << "): clReleaseProgram\n";
-    return 1;
+    }
   }
+
   for (i=0; i<mystuff.num_streams; i++)
   {
+    if (ktab_mem == KTAB_MAPPED)
+    {
+      // all streams are unused: mapped
+      clEnqueueUnmapMemObject(KTAB_QUEUE, mystuff.d_ktab[i], mystuff.h_ktab[i], 0, NULL, NULL);
+      clFinish(KTAB_QUEUE);
+    }
     status = clReleaseMemObject(mystuff.d_ktab[i]); mystuff.d_ktab[i]=NULL;
     if(status != CL_SUCCESS)
     {
       std::cerr<<"Error" << status << " (" << ClErrorString(status) << "): clReleaseMemObject (d_ktab" << i << ")\n";
       return 1;
     }
-    free(mystuff.h_ktab[i]); mystuff.h_ktab[i]=NULL;
+#ifdef CL_VERSION_2_0
+    if (ktab_mem == KTAB_SVM) clSVMFree(context, mystuff.h_ktab[i]);
+    else
+#endif
+    if (ktab_mem == KTAB_COPY) mem_free(mystuff.h_ktab[i]);
+    mystuff.h_ktab[i]=NULL;
   }
   status = clReleaseMemObject(mystuff.d_RES); mystuff.d_RES=NULL;
   if(status != CL_SUCCESS)
@@ -1156,6 +1990,13 @@ int cleanup_CL(void)
     return 1;
   }
   free(mystuff.h_RES); mystuff.h_RES=NULL;
+  status = clReleaseMemObject(mystuff.d_RES_next); mystuff.d_RES_next=NULL;
+  if(status != CL_SUCCESS)
+  {
+    std::cerr<<"Error" << status << " (" << ClErrorString(status) << "): clReleaseMemObject (d_RES_next)\n";
+    return 1;
+  }
+  free(mystuff.h_RES_next); mystuff.h_RES_next=NULL;
 #ifdef CHECKS_MODBASECASE
   status = clReleaseMemObject(mystuff.d_modbasecase_debug); mystuff.d_modbasecase_debug=NULL;
   if(status != CL_SUCCESS)
@@ -1181,13 +2022,71 @@ int cleanup_CL(void)
   {
     std::cerr<<"Error" << status << " (" << ClErrorString(status) << "): clReleaseCommandQueuePrf\n";
     return 1;
-    status = clReleaseContext(context);
   }
+  if (copyQueue) status = clReleaseCommandQueue(copyQueue);
+  copyQueue = NULL;
+  if(status != CL_SUCCESS)
+  {
+    std::cerr<<"Error" << status << " (" << ClErrorString(status) << "): clReleaseCommandQueue (copy queue)\n";
+    return 1;
+  }
+  for (i=0; i<GPU_SIEVE_BUFFERS_MAX; i++)
+  {
+    if (sieve_events[i]) clReleaseEvent(sieve_events[i]);
+    if (tf_events[i])    clReleaseEvent(tf_events[i]);
+    sieve_events[i] = tf_events[i] = NULL;
+  }
+  if (sieveQueue) status = clReleaseCommandQueue(sieveQueue);
+  sieveQueue = NULL;
   if(status != CL_SUCCESS)
   {
-    std::cerr<<"Error" << status << " (" << ClErrorString(status) << "): clReleaseContext\n";
+    std::cerr<<"Error" << status << " (" << ClErrorString(status) << "): clReleaseCommandQueue (sieve queue)\n";
     return 1;
   }
+  return 0;
+}
+
+int cleanup_CL(void)
+{
+  cl_int status;
+
+  if (cleanup_CL_worker()) return 1;
+
+  if (exp_build_started) thread_join(exp_build_handle); // a running build cannot be cancelled
+  exp_build_started = 0;
+  for (cl_uint i=0; i<EXP_PROGRAM_CACHE; i++)
+  {
+    if (exp_programs[i].program) clReleaseProgram(exp_programs[i].program);
+    exp_programs[i].program = NULL;
+    exp_programs[i].state   = EXP_PROGRAM_FREE;
+  }
+
+  for (int family=FAMILY_GPUSIEVE; family<NUM_FAMILIES; family++)
+  {
+    family_program_t *fp = &family_programs[family];
+    if (fp->started && !fp->joined) thread_join(fp->thread);
+    if (fp->program) clReleaseProgram(fp->program);
+    fp->program = NULL;
+    fp->started = fp->joined = 0;
+  }
+
+  if (program) // perftest's own program
+  {
+    status = clReleaseProgram(program); program=NULL;
+    if(status != CL_SUCCESS)
+    {
+      std::cerr<<"Error" << status << " (" << ClErrorString(status) << "): clReleaseProgram\n";
+      return 1;
+    }
+  }
+#ifdef CL_VERSION_1_2
+  if (dev_list[0] != build_list[0])  // sub-devices of SplitDevice
+  {
+    cl_uint i;
+    for (i=0; i<dev_count; i++) clReleaseDevice(dev_list[i]);
+  }
+#endif
+  dev_count = 1;
   if(devices != NULL)
   {
       free(devices);
@@ -1244,7 +2143,7 @@ cl_int run_calc_mod_inv(cl_uint numblocks, size_t localThreads, cl_event *run_ev
   if (run_event == NULL) run_event = &mystuff.copy_events[0]; // When checking performance, we need an event to monitor.
 #endif
 
-  status = clEnqueueNDRangeKernel(QUEUE,
+  status = clEnqueueNDRangeKernel(SIEVE_QUEUE,
                  kernel_info[CL_CALC_MOD_INV].kernel,
                  1,
                  NULL,
@@ -1259,7 +2158,7 @@ cl_int run_calc_mod_inv(cl_uint numblocks, size_t localThreads, cl_event *run_ev
     return 1;
   }
 #ifdef CL_PERFORMANCE_INFO
-  clFinish(QUEUE);
+  clFinish(SIEVE_QUEUE);
   cl_ulong startTime=0;
   cl_ulong endTime=1000;
   /* Get kernel profiling info */
@@ -1291,7 +2190,7 @@ cl_int run_calc_mod_inv(cl_uint numblocks, size_t localThreads, cl_event *run_ev
   // get mystuff.d_calc_bit_to_clear_info and print it
   cl_uint rowinfo_size = MAX_PRIMES_PER_THREAD*4 * sizeof (cl_uint) + mystuff.gpu_sieve_primes * 8;
 
-  status = clEnqueueReadBuffer(QUEUE,     // only for tracing/verification - not needed later.
+  status = clEnqueueReadBuffer(SIEVE_QUEUE,     // only for tracing/verification - not needed later.
                 mystuff.d_calc_bit_to_clear_info,
                 CL_TRUE,
                 0,
@@ -1322,7 +2221,7 @@ __kernel void __attribute__((reqd_work_group_size(256, 1, 1))) CalcBitToClear (u
 */
 cl_int run_calc_bit_to_clear(cl_uint numblocks, size_t localThreads, cl_event *run_event, cl_ulong k_min)
 {
-  static cl_uint last_exponent = 0;
+  static THREAD_LOCAL cl_uint last_exponent = 0;
   cl_int   status;
   size_t   globalThreads = numblocks * localThreads;
 
@@ -1359,7 +2258,7 @@ cl_int run_calc_bit_to_clear(cl_uint numblocks, size_t localThreads, cl_event *r
   if (run_event == NULL) run_event = &mystuff.copy_events[0];  // When checking performance, we need an event to monitor.
 #endif
 
-  status = clEnqueueNDRangeKernel(QUEUE,
+  status = clEnqueueNDRangeKernel(SIEVE_QUEUE,
                  kernel_info[CL_CALC_BIT_TO_CLEAR].kernel,
                  1,
                  NULL,
@@ -1375,7 +2274,7 @@ cl_int run_calc_bit_to_clear(cl_uint numblocks, size_t localThreads, cl_event *r
   }
 
 #ifdef CL_PERFORMANCE_INFO
-  clFinish(QUEUE);
+  clFinish(SIEVE_QUEUE);
   cl_ulong startTime=0;
   cl_ulong endTime=1000;
   /* Get kernel profiling info */
@@ -1407,7 +2306,7 @@ cl_int run_calc_bit_to_clear(cl_uint numblocks, size_t localThreads, cl_event *r
 #ifdef DETAILED_INFO
     // get mystuff.d_calc_bit_to_clear_info and d_sieve_info and print it
   cl_uint info_size = MAX_PRIMES_PER_THREAD*4 * sizeof (cl_uint) + mystuff.gpu_sieve_primes * 8;
-  status = clEnqueueReadBuffer(QUEUE,     // only for tracing/verification - not needed later.
+  status = clEnqueueReadBuffer(SIEVE_QUEUE,     // only for tracing/verification - not needed later.
                 mystuff.d_calc_bit_to_clear_info,
                 CL_TRUE,
                 0,
@@ -1427,7 +2326,7 @@ cl_int run_calc_bit_to_clear(cl_uint numblocks, size_t localThreads, cl_event *r
 
   info_size = mystuff.sieve_size;
 
-  status = clEnqueueReadBuffer(QUEUE,     // only for tracing/verification - not needed later.
+  status = clEnqueueReadBuffer(SIEVE_QUEUE,     // only for tracing/verification - not needed later.
                 mystuff.d_sieve_info,
                 CL_TRUE,
                 0,
@@ -1450,6 +2349,85 @@ cl_int run_calc_bit_to_clear(cl_uint numblocks, size_t localThreads, cl_event *r
   return 0;
 }
 
+/* Run the CalcBitToClearAdvance kernel
+__kernel void __attribute__((reqd_work_group_size(256, 1, 1))) CalcBitToClearAdvance (uint advance, __global int *calc_info, __global uchar *pinfo_dev)
+
+   numblocks and localThreads: same as for run_calc_bit_to_clear,
+   run_event:                  can be used to synchronize the following calls.
+   advance:                    number of sieve bits to move the bit-to-clear values forward
+*/
+cl_int run_calc_bit_to_clear_advance(cl_uint numblocks, size_t localThreads, cl_event *run_event, cl_uint advance)
+{
+  cl_int   status;
+  size_t   globalThreads = numblocks * localThreads;
+
+#ifdef DETAILED_INFO
+    printf("run_calc_bit_to_clear_advance: %d x %d = %d threads, advance=%u\n",
+        (int) numblocks, (int) localThreads, (int) globalThreads, advance);
+#endif
+
+  status = clSetKernelArg(kernel_info[CL_CALC_BIT_TO_CLEAR_ADV].kernel,
+                    0,
+                    sizeof(cl_uint),
+                    (void *)&advance);
+  if(status != CL_SUCCESS)
+  {
+    std::cout<<"Error " << status << " (" << ClErrorString(status) << "): Setting kernel argument. (advance)\n";
+    return 1;
+  }
+
+#ifdef CL_PERFORMANCE_INFO
+  if (run_event == NULL) run_event = &mystuff.copy_events[0];  // When checking performance, we need an event to monitor.
+#endif
+
+  status = clEnqueueNDRangeKernel(SIEVE_QUEUE,
+                 kernel_info[CL_CALC_BIT_TO_CLEAR_ADV].kernel,
+                 1,
+                 NULL,
+                 &globalThreads,
+                 &localThreads,
+                 0,
+                 NULL,
+                 run_event);
+  if(status != CL_SUCCESS)
+  {
+    std::cerr<< "Error " << status << " (" << ClErrorString(status) << "): Enqueuing kernel(clEnqueueNDRangeKernel) " << kernel_info[CL_CALC_BIT_TO_CLEAR_ADV].kernelname << "\n";
+    return 1;
+  }
+
+#ifdef CL_PERFORMANCE_INFO
+  clFinish(SIEVE_QUEUE);
+  cl_ulong startTime=0;
+  cl_ulong endTime=1000;
+  /* Get kernel profiling info */
+  status = clGetEventProfilingInfo(*run_event,
+                                CL_PROFILING_COMMAND_START,
+                                sizeof(cl_ulong),
+                                &startTime,
+                                0);
+  if(status != CL_SUCCESS)
+   {
+    std::cerr<< "Error " << status << " (" << ClErrorString(status) << "): in clGetEventProfilingInfo.(startTime)\n";
+    return RET_ERROR;
+  }
+  status = clGetEventProfilingInfo(*run_event,
+                                CL_PROFILING_COMMAND_END,
+                                sizeof(cl_ulong),
+                                &endTime,
+                                0);
+  if(status != CL_SUCCESS)
+   {
+    std::cerr<< "Error " << status << " (" << ClErrorString(status) << "): in clGetEventProfilingInfo.(endTime)\n";
+    return RET_ERROR;
+  }
+  std::cout<< "CalcBitToClearAdvance " << globalThreads << " primes: " << (endTime - startTime)/1e3 << " us ("
+                       << globalThreads * 1e3 / (endTime - startTime) << " M/s)\n" ;
+  clReleaseEvent(mystuff.copy_events[0]); // ignore errors: we may have use a different event
+#endif
+
+  return 0;
+}
+
 /* Run the SegSieve kernel
 __kernel void __attribute__((reqd_work_group_size(256, 1, 1))) SegSieve (__global uchar *big_bit_array_dev, __global uchar *pinfo_dev, uint maxp)
 
@@ -1461,6 +2439,7 @@ cl_int run_cl_sieve(cl_uint numblocks, size_t localThreads, cl_event *run_event,
 {
   cl_int         status;
   size_t         globalThreads = numblocks * localThreads;
+  cl_uint        buf = mystuff.gpu_sieve_buffer;
 
 #ifdef DETAILED_INFO
     printf("run_cl_sieve: %d x %d = %d threads, exp=%u, maxp=%d\n",
@@ -1480,32 +2459,52 @@ cl_int run_cl_sieve(cl_uint numblocks, size_t localThreads, cl_event *run_event,
     }
   }
 
-#ifdef CL_PERFORMANCE_INFO
-  if (run_event == NULL) run_event = &mystuff.copy_events[0];  // When checking performance, we need an event to monitor.
-#endif
+  // gpusieve() has selected the bit array for this block
+  status = clSetKernelArg(kernel_info[CL_SIEVE].kernel,
+                  0,
+                  sizeof(cl_mem),
+                  (void *)&mystuff.d_bitarray);
+  if(status != CL_SUCCESS)
+  {
+    std::cout<<"Error " << status << " (" << ClErrorString(status) << "): Setting kernel argument. (d_bitarray)\n";
+    return 1;
+  }
 
-  status = clEnqueueNDRangeKernel(QUEUE,
+  if (sieve_events[buf] != NULL)
+  {
+    clReleaseEvent(sieve_events[buf]);
+    sieve_events[buf] = NULL;
+  }
+
+  // the bit array must not be overwritten before the TF kernel that read it last is done
+  status = clEnqueueNDRangeKernel(SIEVE_QUEUE,
                  kernel_info[CL_SIEVE].kernel,
                  1,
                  NULL,
                  &globalThreads,
                  &localThreads,
-                 0,
-                 NULL,
-                 run_event);
+                 tf_events[buf] ? 1 : 0,
+                 tf_events[buf] ? &tf_events[buf] : NULL,
+                 &sieve_events[buf]);
   if(status != CL_SUCCESS)
   {
     std::cerr<< "Error " << status << " (" << ClErrorString(status) << "): Enqueuing kernel (clEnqueueNDRangeKernel) " << kernel_info[CL_SIEVE].kernelname << "\n";
     return 1;
   }
+  if (sieveQueue) clFlush(sieveQueue); // the TF kernel on QUEUE waits for it
+  if (run_event != NULL)
+  {
+    *run_event = sieve_events[buf];
+    clRetainEvent(*run_event);
+  }
 
 /////////////////////////////////////////////////
 #ifdef CL_PERFORMANCE_INFO
-  clFinish(QUEUE);
+  clFinish(SIEVE_QUEUE);
   cl_ulong startTime=0;  // device time in nanosecs
   cl_ulong endTime=1000;
   /* Get kernel profiling info */
-  status = clGetEventProfilingInfo(*run_event,
+  status = clGetEventProfilingInfo(sieve_events[buf],
                                 CL_PROFILING_COMMAND_START,
                                 sizeof(cl_ulong),
                                 &startTime,
@@ -1515,7 +2514,7 @@ cl_int run_cl_sieve(cl_uint numblocks, size_t localThreads, cl_event *run_event,
     std::cerr<< "Error " << status << " (" << ClErrorString(status) << "): in clGetEventProfilingInfo.(startTime)\n";
     return RET_ERROR;
   }
-  status = clGetEventProfilingInfo(*run_event,
+  status = clGetEventProfilingInfo(sieve_events[buf],
                                 CL_PROFILING_COMMAND_END,
                                 sizeof(cl_ulong),
                                 &endTime,
@@ -1528,14 +2527,13 @@ cl_int run_cl_sieve(cl_uint numblocks, size_t localThreads, cl_event *run_event,
   std::cout<< "sieve using " << globalThreads << " threads: " << (endTime - startTime)/1e6 << " ms ("
                        << globalThreads * 1e3 / (endTime - startTime) << " M/s), " <<
                        mystuff.gpu_sieve_size * 1e3 / (endTime - startTime) << " M FCs/s sieved\n";
-  clReleaseEvent(mystuff.copy_events[0]);
 #endif
 
 #ifdef DETAILED_INFO
   //mystuff->d_bitarray, (cl_uchar *)mystuff->d_sieve_info
   cl_uint info_size = mystuff.sieve_size;
 
-  status = clEnqueueReadBuffer(QUEUE,     // only for tracing/verification - not needed later.
+  status = clEnqueueReadBuffer(SIEVE_QUEUE,     // only for tracing/verification - not needed later.
                 mystuff.d_sieve_info,
                 CL_TRUE,
                 0,
@@ -1555,7 +2553,7 @@ cl_int run_cl_sieve(cl_uint numblocks, size_t localThreads, cl_event *run_event,
 
   info_size = mystuff.gpu_sieve_size / 8;
 
-  status = clEnqueueReadBuffer(QUEUE,     // only for tracing/verification - not needed later.
+  status = clEnqueueReadBuffer(SIEVE_QUEUE,     // only for tracing/verification - not needed later.
                 mystuff.d_bitarray,
                 CL_TRUE,
                 0,
@@ -1577,6 +2575,75 @@ cl_int run_cl_sieve(cl_uint numblocks, size_t localThreads, cl_event *run_event,
   return 0;
 }
 
+/* GPUSieveHost=1: wait until the current bit array is no longer read by a TF kernel,
+   the host can then sieve into h_bitarray */
+cl_int run_gpusieve_wait()
+{
+  cl_int status;
+  cl_uint buf = mystuff.gpu_sieve_buffer;
+
+  if (tf_events[buf] == NULL) return 0;
+  status = clWaitForEvents(1, &tf_events[buf]);
+  if(status != CL_SUCCESS)
+  {
+    std::cerr<< "Error " << status << " (" << ClErrorString(status) << "): clWaitForEvents (tf_event)\n";
+    return 1;
+  }
+  return 0;
+}
+
+/* GPUSieveHost=1: upload the bit array the host has sieved, in place of SegSieve. The TF kernel waits
+   for the upload the same way it waits for SegSieve */
+cl_int run_gpusieve_upload(size_t size)
+{
+  cl_int status;
+  cl_uint buf = mystuff.gpu_sieve_buffer;
+
+  if (sieve_events[buf] != NULL)
+  {
+    clReleaseEvent(sieve_events[buf]);
+    sieve_events[buf] = NULL;
+  }
+  status = clEnqueueWriteBuffer(SIEVE_QUEUE,
+                mystuff.d_bitarray,
+                CL_FALSE,
+                0,
+                size,
+                mystuff.h_bitarray,
+                0,
+                NULL,
+                &sieve_events[buf]);
+  if(status != CL_SUCCESS)
+  {
+    std::cerr<< "Error " << status << " (" << ClErrorString(status) << "): clEnqueueWriteBuffer (d_bitarray)\n";
+    return 1;
+  }
+  if (sieveQueue) clFlush(sieveQueue);
+  return 0;
+}
+
+/* GPUSieveHost=2: read a GPU sieve buffer back after the sieve kernels are done */
+cl_int run_gpusieve_read(cl_mem buffer, void *ptr, size_t size)
+{
+  cl_int status;
+
+  status = clEnqueueReadBuffer(SIEVE_QUEUE,
+                buffer,
+                CL_TRUE,
+                0,
+                size,
+                ptr,
+                0,
+                NULL,
+                NULL);
+  if(status != CL_SUCCESS)
+  {
+    std::cerr<< "Error " << status << " (" << ClErrorString(status) << "): clEnqueueReadBuffer (GPU sieve verification)\n";
+    return 1;
+  }
+  return 0;
+}
+
 int run_mod_kernel(cl_ulong hi, cl_ulong lo, cl_ulong q, cl_float qr, cl_ulong *res_hi, cl_ulong *res_lo)
 {
 /* __kernel void mod_128_64_k(const ulong hi, const ulong lo, const ulong q, const float qr, __global ulong *res
@@ -1589,6 +2656,7 @@ int run_mod_kernel(cl_ulong hi, cl_ulong lo, cl_ulong q, cl_float qr, cl_ulong *
   cl_event mod_evt;
 
   *res_hi = *res_lo = 0;
+  if (load_kernel(_TEST_MOD_)) return 1;
 
   status = clSetKernelArg(kernel_info[_TEST_MOD_].kernel,
                     0,
@@ -2221,9 +3289,11 @@ __kernel void cl_barrett32_77_gs(__private uint exp, const int96_t k_base, const
   cl_int   status;
   size_t   globalThreads=numblocks*256;
   size_t   localThreads=256;
-  static cl_event run_event = NULL;
+  static THREAD_LOCAL cl_event run_event = NULL;
+  cl_event tf_event;
+  cl_uint  buf = mystuff.gpu_sieve_buffer;
 #ifndef CL_PERFORMANCE_INFO
-  static cl_uint flush_counter=1;
+  static THREAD_LOCAL cl_uint flush_counter=1;
   static cl_uint event_step = max(1, mystuff.flush / 2); // When to set the event for waiting
   cl_event  *p_event = NULL;
 #endif
@@ -2254,16 +3324,6 @@ __kernel void cl_barrett32_77_gs(__private uint exp, const int96_t k_base, const
       return 1;
     }
 
-    status = clSetKernelArg(kernel,
-                    2,
-                    sizeof(cl_mem),
-                    (void *)&mystuff.d_bitarray);
-    if(status != CL_SUCCESS)
-    {
-      std::cerr<< "Error " << status << " (" << ClErrorString(status) << "): Setting kernel argument. (d_bitarray)\n";
-      return 1;
-    }
-
     status = clSetKernelArg(kernel,
                     3,
                     sizeof(cl_uint),
@@ -2339,6 +3399,17 @@ __kernel void cl_barrett32_77_gs(__private uint exp, const int96_t k_base, const
 #endif
   }
 
+  // the bit array that gpusieve() has just filled, it changes with each call
+  status = clSetKernelArg(kernel,
+                  2,
+                  sizeof(cl_mem),
+                  (void *)&mystuff.d_bitarray);
+  if(status != CL_SUCCESS)
+  {
+    std::cerr<< "Error " << status << " (" << ClErrorString(status) << "): Setting kernel argument. (d_bitarray)\n";
+    return 1;
+  }
+
 #ifndef CL_PERFORMANCE_INFO
   // in PI mode, each kernel invocation gets an event and is immediately finished
   if (mystuff.flush > 0 && flush_counter == event_step && run_event == NULL)
@@ -2361,20 +3432,31 @@ __kernel void cl_barrett32_77_gs(__private uint exp, const int96_t k_base, const
                  NULL,
                  &globalThreads,
                  &localThreads,
-                 0,
-                 NULL,
-#ifdef CL_PERFORMANCE_INFO
-                 &run_event
-#else
-                 p_event
-#endif
-                 ); // no need to wait for anything - they will be processed serially, and we read the results synchronously.
+                 sieve_events[buf] ? 1 : 0,
+                 sieve_events[buf] ? &sieve_events[buf] : NULL,
+                 &tf_event
+                 ); // only the sieving may run on a different queue - the TF kernels are processed serially, and we read the results synchronously.
 
   if(status != CL_SUCCESS)
   {
     std::cerr<< "Error " << status << " (" << ClErrorString(status) << "): Enqueuing kernel(clEnqueueNDRangeKernel)\n";
     return 1;
   }
+  // the next SegSieve into this bit array waits for this kernel
+  if (tf_events[buf] != NULL) clReleaseEvent(tf_events[buf]);
+  tf_events[buf]     = tf_event;
+  tf_event_size[buf] = numblocks * mystuff.gpu_sieve_processing_size;
+  if (sieveQueue) clFlush(QUEUE);
+#ifdef CL_PERFORMANCE_INFO
+  run_event = tf_event;
+  clRetainEvent(run_event);
+#else
+  if (p_event != NULL)
+  {
+    *p_event = tf_event;
+    clRetainEvent(*p_event);
+  }
+#endif
 
 #ifndef CL_PERFORMANCE_INFO
   if (flush_counter == event_step) clFlush(QUEUE);
@@ -2437,12 +3519,155 @@ __kernel void cl_barrett32_77_gs(__private uint exp, const int96_t k_base, const
 }
 
 
-int tf_class_opencl(cl_ulong k_min, cl_ulong k_max, mystuff_t *mystuff, enum GPUKernels use_kernel)
+static cl_int enqueue_res_read(mystuff_t *mystuff, cl_mem d_res, cl_uint *h_res, cl_uint slot, cl_event *event)
+/* queues the read-back of d_res behind all running kernels (the queue may be
+   out-of-order), its completion is reported in streams->done[slot] */
+{
+  cl_event running_events[NUM_STREAMS_MAX];
+  cl_uint  i, n = 0;
+  cl_int   status;
+
+  for(i=0; i<mystuff->num_streams; i++)
+  {
+    if (mystuff->stream_status[i] == RUNNING) running_events[n++] = mystuff->exec_events[i];
+  }
+
+  thread_atomic_store(&streams->done[slot], 0);
+  status = clEnqueueReadBuffer(QUEUE,
+                d_res,
+                CL_FALSE,
+                0,
+                32 * sizeof(int),
+                h_res,
+                n,
+                n ? running_events : NULL,
+                event);
+  if(status != CL_SUCCESS)
+  {
+    std::cerr<< "Error " << status << " (" << ClErrorString(status) << "): Queueing the read of the results. (clEnqueueReadBuffer)\n";
+    return status;
+  }
+  clFlush(QUEUE);
+  status = clSetEventCallback(*event, CL_COMPLETE, stream_complete_cb, STREAM_ID(mystuff->dev_index, slot));
+  if(status != CL_SUCCESS)
+  {
+    std::cerr<< "Error " << status << " (" << ClErrorString(status) << "): Registering the completion of the results read. (clSetEventCallback)\n";
+  }
+  return status;
+}
+
+static void grid_adjust(mystuff_t *mystuff)
+/* GridAdjust: sets the grid size for the next classes from the measured
+   kernel runtime of the grids (profiling info, see grid_time_add()) so that a
+   grid takes about GridTime ms. The grid is threads_per_grid with the CPU
+   sieve, which also gets as many active streams as needed to queue QueueTime
+   ms of work, and the gpu_sieve_size bits of one TF kernel with the GPU sieve.
+   The new size takes effect when the next class is started (grid_size_next). */
+{
+  cl_uint cur, size, step, lo, hi, streams;
+  double  t_k, t_grid, target;
+
+  if (grid_exec_size == 0) return; // nothing measured
+  t_k = (double) grid_exec_time / 1e6 / (double) grid_exec_size; // ms per k
+  grid_exec_time = 0;
+  grid_exec_size = 0;
+
+  if (mystuff->gpu_sieving)
+  {
+    cur  = mystuff->gpu_sieve_size;
+    step = 1024*1024;
+    while (step % mystuff->gpu_sieve_processing_size) step += 1024*1024; // GPUSieveSize rules
+    lo   = GPU_SIEVE_SIZE_MIN * 1024*1024;
+    hi   = mystuff->gpu_sieve_size_alloc;
+  }
+  else
+  {
+    cur  = mystuff->threads_per_grid;
+    step = mystuff->vectorsize * (cl_uint) deviceinfo.maxThreadsPerBlock;
+    lo   = GRID_ADJUST_MIN;
+    hi   = mystuff->threads_per_grid_alloc;
+  }
+
+  target = (double) mystuff->grid_time / t_k;
+  if (target > 2.0 * cur) target = 2.0 * cur;
+  if (target < 0.5 * cur) target = 0.5 * cur;
+
+  lo += step - 1;
+  lo -= lo % step;
+  if (target < lo) target = lo;
+  if (target > hi) target = hi;
+  size = (cl_uint) target;
+  size -= size % step;
+  if (size == 0) size = step;
+
+  if ((size > cur + cur / GRID_ADJUST_STEP) || (size < cur - cur / GRID_ADJUST_STEP)) grid_size_next = size;
+  else size = cur;
+  t_grid = t_k * size; // expected time per grid
+
+  streams = mystuff->num_streams_active;
+  if (!mystuff->gpu_sieving)
+  {
+    streams = (cl_uint) ceil(mystuff->queue_time / t_grid);
+    if (streams < 2) streams = 2;                      // at least one grid queued behind the running one
+    if (streams > mystuff->num_streams) streams = mystuff->num_streams;
+  }
+
+  if ((mystuff->verbosity > 1) && ((size != cur) || (streams != mystuff->num_streams_active)))
+  {
+    if (mystuff->gpu_sieving)
+      printf("GridAdjust: %.2f ms per TF kernel, GPU sieve bits %uM -> %uM\n",
+             t_k * cur, cur / (1024*1024), size / (1024*1024));
+    else
+      printf("GridAdjust: %.2f ms per grid, threads per grid %u -> %u, active streams %u -> %u\n",
+             t_k * cur, cur, size, mystuff->num_streams_active, streams);
+  }
+  mystuff->num_streams_active = streams;
+}
+
+void tf_class_opencl_flush(mystuff_t *mystuff)
+/* drops the class that tf_class_opencl() has started ahead, needed when it
+   will not be called for that class (quit, StopAfterFactor, ...): waits for
+   its grids and frees the streams */
+{
+  cl_uint i;
+
+  if (!next_class.active) return;
+
+  if (producer) sieve_producer_stop(producer);
+  for(i=0; i<mystuff->num_streams; i++)
+  {
+    if (mystuff->stream_status[i] == RUNNING)
+    {
+      wait_for_stream(i);
+      clReleaseEvent(mystuff->exec_events[i]);
+      clReleaseEvent(mystuff->copy_events[i]);
+      if (ktab_mem == KTAB_MAPPED) ktab_map(i);
+    }
+    mystuff->stream_status[i] = UNUSED;
+    if (producer) sieve_producer_release(producer, i);
+  }
+  if (next_class.read_event)
+  {
+    wait_for_stream(RES_SLOT(res_parity ^ 1));
+    clReleaseEvent(next_class.read_event);
+  }
+  clReleaseEvent(next_class.init_event);
+  next_class.active = 0;
+}
+
+
+int tf_class_opencl(cl_ulong k_min, cl_ulong k_max, mystuff_t *mystuff, enum GPUKernels use_kernel, cl_ulong k_min_next)
+/*
+k_min_next: the k_min of the class that will be processed next (0 if none).
+CPU sieve: it is sieved and submitted while the last grids of this class are
+running. GPU sieve with a sieve queue: its bit-to-clear values are calculated
+while the last TF kernel is running. The results returned are always those of
+this class.
+*/
 {
-  size_t size = mystuff->threads_per_grid * sizeof(int);
   int status, wait = 0;
   struct timeval timer, timer2;
-  cl_ulong twait=0;
+  cl_ulong twait=0, twait1;
   cl_uint cwait=0, i;
 // for TF_72BIT
   int72  k_base;
@@ -2456,9 +3681,17 @@ int tf_class_opencl(cl_ulong k_min, cl_ulong k_max, mystuff_t *mystuff, enum GPU
   cl_ulong k_diff, k_remaining;
   char string[50];
   int running=0;
+  int use_producer = (mystuff->gpu_sieving == 0) && mystuff->sieve_producer;
+  int pipelined = (mystuff->gpu_sieving == 0);
+  int adopted = pipelined && next_class.active && (next_class.k_class == k_min);
+  int next_started = 0, last_stream = -1;
+  cl_uint sieve_limit = mystuff->sieve_primes, next_count = 0, grid_size;
+  cl_mem d_res = mystuff->d_RES;     // result buffer of the grids being submitted
+  cl_event init_event = NULL;        // zeroing of d_res, if it is still pending
+  cl_event read_event = NULL;        // read-back of this class's results
+  cl_event *wait_list = NULL;        // for the k_tab uploads, points to the pending init_event
 
   int h_ktab_index = 0;
-  unsigned long long int k_min_grid[NUM_STREAMS_MAX];  // k_min_grid[N] contains the k_min for h_ktab[N], only valid for preprocessed h_ktab[]s
 
   timer_init(&timer);
 #ifdef DETAILED_INFO
@@ -2468,24 +3701,67 @@ int tf_class_opencl(cl_ulong k_min, cl_ulong k_max, mystuff_t *mystuff, enum GPU
 
   //  mystuff->exponent=51152869; k_min=20582854459640ULL; k_max=20582854459641ULL;  // test test test
 
+  if (load_kernel(use_kernel)) return RET_ERROR;  // created by the first class that uses it
+  if (use_producer && producer == NULL)
+  {
+    producer = sieve_producer_create(cpu_sieve);
+    if (producer == NULL)
+    {
+      printf("ERROR: could not create the sieve producer\n");
+      return RET_ERROR;
+    }
+  }
+
   new_class=1; // tell run_kernel to re-submit the one-time kernel arguments
   if ( k_max <= k_min) k_max = k_min + 1;  // otherwise it would skip small bit ranges
 
-  /* set result array to 0 */
-  memset(mystuff->h_RES,0,32 * sizeof(int));
-  status = clEnqueueWriteBuffer(QUEUE,
-                mystuff->d_RES,
-                CL_TRUE,          // Wait for completion; it's fast to copy 128 bytes ;-)
-                0,
-                32 * sizeof(int),
-                mystuff->h_RES,
-                0,
-                NULL,
-                NULL);
-  if(status != CL_SUCCESS)
+  if (adopted)
   {
-    std::cout<<"Error " << status << " (" << ClErrorString(status) << "): Copying h_RES(clEnqueueWriteBuffer)\n";
-    return RET_ERROR; // # factors found ;-)
+    // this class was started by the previous call: its grids use d_RES_next
+    cl_mem   tmp_mem = mystuff->d_RES;
+    cl_uint *tmp_res = mystuff->h_RES;
+    mystuff->d_RES      = mystuff->d_RES_next;
+    mystuff->h_RES      = mystuff->h_RES_next;
+    mystuff->d_RES_next = tmp_mem;
+    mystuff->h_RES_next = tmp_res;
+    res_parity ^= 1;
+    d_res       = mystuff->d_RES;
+    sieve_limit = next_class.sieve_limit;
+    grid_size   = next_class.grid_size;
+    init_event  = next_class.init_event;
+    read_event  = next_class.read_event;
+    if (init_event) wait_list = &init_event;
+    next_class.active = 0;
+  }
+  else
+  {
+    tf_class_opencl_flush(mystuff); // only if a different class was started ahead
+
+    if (grid_size_next) // GridAdjust, no grids are in flight now
+    {
+      if (pipelined) mystuff->threads_per_grid = grid_size_next;
+      else           mystuff->gpu_sieve_size   = grid_size_next;
+      grid_size_next = 0;
+    }
+    grid_size = mystuff->threads_per_grid;
+    if (pipelined) cpu_sieve_init_class(mystuff->exponent, k_min, sieve_limit);
+
+    /* set result array to 0 */
+    memset(mystuff->h_RES,0,32 * sizeof(int));
+    status = clEnqueueWriteBuffer(QUEUE,
+                  mystuff->d_RES,
+                  CL_TRUE,          // Wait for completion; it's fast to copy 128 bytes ;-)
+                  0,
+                  32 * sizeof(int),
+                  mystuff->h_RES,
+                  0,
+                  NULL,
+                  NULL);
+    if(status != CL_SUCCESS)
+    {
+      std::cout<<"Error " << status << " (" << ClErrorString(status) << "): Copying h_RES(clEnqueueWriteBuffer)\n";
+      return RET_ERROR; // # factors found ;-)
+    }
   }
 #ifdef CHECKS_MODBASECASE
   /* set modbasecase_debug array to 0 */
@@ -2508,8 +3784,14 @@ int tf_class_opencl(cl_ulong k_min, cl_ulong k_max, mystuff_t *mystuff, enum GPU
 
   for(i=0; i<mystuff->num_streams; i++)
   {
-    mystuff->stream_status[i] = UNUSED;
-    k_min_grid[i] = 0;
+    if (!adopted)
+    {
+      mystuff->stream_status[i] = UNUSED;
+      k_min_grid[i] = 0;
+    }
+    else if (mystuff->stream_status[i] != UNUSED) running++; // grids of this class, or the last ones of the previous class
+    mystuff->stats.stream_wait_time[i] = 0;
+    mystuff->stats.stream_wait_count[i] = 0;
   }
 
   shiftcount=10;  // no exp below 2^10 ;-)
@@ -2532,6 +3814,8 @@ int tf_class_opencl(cl_ulong k_min, cl_ulong k_max, mystuff_t *mystuff, enum GPU
 #ifdef DETAILED_INFO
   printf("remaining shiftcount = %d, ln2b = %d\n", shiftcount, ln2b);
 #endif
+  if (mystuff->exponent_kernels && mystuff->mode == MODE_NORMAL)
+    exp_kernel_select(use_kernel, mystuff->exponent, shiftcount);
   b_preinit_hi=0;b_preinit_mid=0;b_preinit_lo=0;
   count=0;
 // set the pre-initriables in all sizes for all possible kernels
@@ -2590,12 +3874,25 @@ int tf_class_opencl(cl_ulong k_min, cl_ulong k_max, mystuff_t *mystuff, enum GPU
 #endif
   shared_mem_required = mystuff->gpu_sieve_processing_size * sizeof (short) * shared_mem_required / 100;
 
-  while((k_min <= k_max) || (running > 0))
+  if (adopted)
+  {
+    k_min = next_class.k_min;
+    count = next_class.count;
+  }
+  // the producer thread sieves the h_ktab[]s in the same order as they are used below
+  else if (use_producer && sieve_producer_start(producer, mystuff->h_ktab, mystuff->num_streams, stream_seq % mystuff->num_streams,
+                                                mystuff->threads_per_grid, sieve_limit, k_min, k_max))
+  {
+    return RET_ERROR;
+  }
+
+  // with the next class started, stop as soon as the results of this class are back
+  while(((k_min <= k_max) || (running > 0)) && !(next_started && thread_atomic_load(&streams->done[RES_SLOT(res_parity)])))
   {
-    h_ktab_index = count % mystuff->num_streams;
+    h_ktab_index = stream_seq % mystuff->num_streams;
 
 /* preprocessing: calculate a ktab (factor table) */
-    if((mystuff->stream_status[h_ktab_index] == UNUSED) && (k_min <= k_max))  // if we have an empty h_ktab we can preprocess another one
+    if((mystuff->stream_status[h_ktab_index] == UNUSED) && (k_min <= k_max) && (running < (int)mystuff->num_streams_active))  // if we have an empty h_ktab we can preprocess another one
     {
 #ifdef DEBUG_STREAM_SCHEDULE
       printf(" STREAM_SCHEDULE: preprocessing on h_ktab[%d]\n", h_ktab_index);
@@ -2603,26 +3900,29 @@ int tf_class_opencl(cl_ulong k_min, cl_ulong k_max, mystuff_t *mystuff, enum GPU
 
       if (mystuff->gpu_sieving == 0)
       {
-        sieve_candidates(mystuff->threads_per_grid, mystuff->h_ktab[h_ktab_index], mystuff->sieve_primes);
-        k_diff=mystuff->h_ktab[h_ktab_index][mystuff->threads_per_grid-1]+1;
-        k_diff*=NUM_CLASSES;        /* NUM_CLASSES because classes are mod NUM_CLASSES */
+        if (use_producer)
+        {
+          // waits only if the CPU sieve is the bottleneck, not counted as CPU wait
+          if (sieve_producer_get(producer, h_ktab_index, &k_diff))
+          {
+            fprintf(stderr, "Programming error: sieve producer finished before k_max, h_ktab[%d] not filled\n", h_ktab_index);
+            return RET_ERROR;
+          }
+        }
+        else
+        {
+          cpu_sieve_candidates(mystuff->threads_per_grid, mystuff->h_ktab[h_ktab_index], sieve_limit);
+          k_diff=mystuff->h_ktab[h_ktab_index][mystuff->threads_per_grid-1]+1;
+          k_diff*=NUM_CLASSES;        /* NUM_CLASSES because classes are mod NUM_CLASSES */
+        }
 
-        k_min_grid[h_ktab_index] = k_min;
+        k_min_grid[h_ktab_index]   = k_min;
+        grid_threads[h_ktab_index] = mystuff->threads_per_grid;
         /* try upload ktab*/
 
-        status = clEnqueueWriteBuffer(QUEUE,
-                  mystuff->d_ktab[h_ktab_index],
-                  CL_FALSE,
-                  0,
-                  size,
-                  mystuff->h_ktab[h_ktab_index],
-                  0,
-                  NULL,
-                  &mystuff->copy_events[h_ktab_index]);
-
-        if(status != CL_SUCCESS)
+        // the kernel must not start before d_res is cleared
+        if (ktab_upload(h_ktab_index, wait_list ? 1 : 0, wait_list) != CL_SUCCESS)
         {
-            std::cout<<"Error " << status << " (" << ClErrorString(status) << "): Copying h_ktab(clEnqueueWriteBuffer)\n";
             return RET_ERROR; // # factors found ;-)
         }
       }
@@ -2694,7 +3994,7 @@ int tf_class_opencl(cl_ulong k_min, cl_ulong k_max, mystuff_t *mystuff, enum GPU
           k_base.d4 =  k_min >> 60;
           status = run_gs_kernel15(kernel_info[use_kernel].kernel, numblocks, shared_mem_required, k_base, b_in, shiftcount);
         }
-        else if (use_kernel >= BARRETT79_MUL32_GS && use_kernel <= BARRETT87_MUL32_GS)
+        else if ((use_kernel >= BARRETT79_MUL32_GS && use_kernel <= BARRETT87_MUL32_GS) || (use_kernel == MG96_GS))
         {
           int96 k_base;
           k_base.d0 = (cl_uint) k_min;
@@ -2712,12 +4012,16 @@ int tf_class_opencl(cl_ulong k_min, cl_ulong k_max, mystuff_t *mystuff, enum GPU
 
         // Move to next batch of k's
         k_min += (cl_ulong) mystuff->gpu_sieve_size * mystuff->num_classes;
-        if (k_min > k_max) break;
+        if (k_min > k_max)
+        {
+          // the bit-to-clear values of the next class can be calculated while the last TF kernels run
+          if (k_min_next && sieveQueue) gpusieve_prepare_class (mystuff, k_min_next);
+          break;
+        }
 
-        //BUG - we should call a different routine to advance the bit-to-clear values by gpusieve_size bits
-        // This will be cheaper than recomputing the bit-to-clears from scratch
-        // HOWEVER, the self-test code will not check this new code unless we make the gpusieve_size much smaller
-        gpusieve_init_class (mystuff, k_min);
+        // Move the bit-to-clear values forward by gpu_sieve_size bits - cheaper than recomputing them from scratch.
+        // The selftest uses a small GPUSieveSize so that this path is checked as well.
+        gpusieve_advance_class (mystuff);
         continue; // don't go to the stream-scheduling code below - the GPU sieve runs the TF kernels all in one stream
       }
       mystuff->stream_status[h_ktab_index] = PREPARED;
@@ -2727,8 +4031,11 @@ int tf_class_opencl(cl_ulong k_min, cl_ulong k_max, mystuff_t *mystuff, enum GPU
       printArray("ktab", mystuff->h_ktab[h_ktab_index], mystuff->threads_per_grid, 0);
 #endif
 
-      count++;
+      if (next_started) next_count++;
+      else              count++;
+      stream_seq++;
       k_min += (unsigned long long int)k_diff;
+      if (k_min > k_max) last_stream = h_ktab_index; // the results can be read once this one is started
     }
 
     wait = 1;
@@ -2739,7 +4046,7 @@ int tf_class_opencl(cl_ulong k_min, cl_ulong k_max, mystuff_t *mystuff, enum GPU
       {
         case UNUSED:
           {
-            if (k_min <= k_max)
+            if ((k_min <= k_max) && (running < (int)mystuff->num_streams_active))
             {
               wait = 0;
             }
@@ -2748,12 +4055,13 @@ int tf_class_opencl(cl_ulong k_min, cl_ulong k_max, mystuff_t *mystuff, enum GPU
           }
         case PREPARED:                   // start the calculation of a preprocessed dataset on the device
           {
+            thread_atomic_store(&streams->done[i], 0);
             if ((use_kernel == _71BIT_MUL24) || (use_kernel == _63BIT_MUL24))
             {
               k_base.d0 =  k_min_grid[i] & 0xFFFFFF;
               k_base.d1 = (k_min_grid[i] >> 24) & 0xFFFFFF;
               k_base.d2 =  k_min_grid[i] >> 48;
-              status = run_kernel24(kernel_info[use_kernel].kernel, mystuff->exponent, k_base, i, b_preinit, mystuff->d_RES, shiftcount, mystuff->bit_min-63);
+              status = run_kernel24(kernel_info[use_kernel].kernel, mystuff->exponent, k_base, i, b_preinit, d_res, shiftcount, mystuff->bit_min-63);
             }
             else if (((use_kernel >= BARRETT73_MUL15) && (use_kernel <= BARRETT74_MUL15)) || (use_kernel == MG88))
             {
@@ -2763,139 +4071,162 @@ int tf_class_opencl(cl_ulong k_min, cl_ulong k_max, mystuff_t *mystuff, enum GPU
               k_base.d2 = (k_min_grid[i] >> 30) & 0x7FFF;
               k_base.d3 = (k_min_grid[i] >> 45) & 0x7FFF;
               k_base.d4 =  k_min_grid[i] >> 60;
-              status = run_kernel15(kernel_info[use_kernel].kernel, mystuff->exponent, k_base, i, b_in, mystuff->d_RES, shiftcount, mystuff->bit_max_stage-65);
+              status = run_kernel15(kernel_info[use_kernel].kernel, mystuff->exponent, k_base, i, b_in, d_res, shiftcount, mystuff->bit_max_stage-65);
             }
-            else if (((use_kernel >= BARRETT79_MUL32) && (use_kernel <= BARRETT87_MUL32)) || (use_kernel == MG62))
+            else if (((use_kernel >= BARRETT79_MUL32) && (use_kernel <= BARRETT87_MUL32)) || (use_kernel == MG62) || (use_kernel == MG96))
             {
               int96 k;
               k.d0 = (cl_uint) k_min_grid[i];
               k.d1 = k_min_grid[i] >> 32;
               k.d2 = 0;
-              status = run_barrett_kernel32(kernel_info[use_kernel].kernel, mystuff->exponent, k, i, b_192, mystuff->d_RES, shiftcount, mystuff->bit_max_stage-65);
+              status = run_barrett_kernel32(kernel_info[use_kernel].kernel, mystuff->exponent, k, i, b_192, d_res, shiftcount, mystuff->bit_max_stage-65);
             }
             else
             {
-              status = run_kernel64(kernel_info[use_kernel].kernel, mystuff->exponent, k_min_grid[i], i, b_preinit4, mystuff->d_RES, mystuff->bit_min-63);
+              status = run_kernel64(kernel_info[use_kernel].kernel, mystuff->exponent, k_min_grid[i], i, b_preinit4, d_res, mystuff->bit_min-63);
             }
             if(status != CL_SUCCESS)
             {
               std::cerr<< "Error " << status << " (" << ClErrorString(status) << "): Starting kernel " << kernel_info[use_kernel].kernelname << ". (run_kernel)\n";
               return RET_ERROR;
             }
+            // the kernel was flushed by run_kernel*, so the callback will come
+            status = clSetEventCallback(mystuff->exec_events[i], CL_COMPLETE, stream_complete_cb, STREAM_ID(mystuff->dev_index, i));
+            if(status != CL_SUCCESS)
+            {
+              std::cerr<< "Error " << status << " (" << ClErrorString(status) << "): Registering the completion of stream " << i << ". (clSetEventCallback)\n";
+              return RET_ERROR;
+            }
 
 #ifdef DEBUG_STREAM_SCHEDULE
             printf(" STREAM_SCHEDULE: started GPU kernel using h_ktab[%d] (%s, %u, %llu, ...)\n", i, kernel_info[use_kernel].kernelname, mystuff->exponent, k_min_grid[i]);
 #endif
             mystuff->stream_status[i] = RUNNING;
+            if ((int)i == last_stream)
+            {
+              if (next_started) status = enqueue_res_read(mystuff, d_res, mystuff->h_RES_next, RES_SLOT(res_parity ^ 1), &next_class.read_event);
+              else              status = enqueue_res_read(mystuff, d_res, mystuff->h_RES, RES_SLOT(res_parity), &read_event);
+              if (status != CL_SUCCESS) return RET_ERROR;
+              last_stream = -1;
+            }
             break;
             // continue; // examine the next stream
           }
         case RUNNING:                    // check if it really is still running
           {
             cl_int event_status;
-            status = clGetEventInfo(mystuff->exec_events[i],
-                         CL_EVENT_COMMAND_EXECUTION_STATUS,
-                         sizeof(cl_int),
-                         &event_status,
-                         NULL);
-#ifdef DEBUG_STREAM_SCHEDULE
-            std::cout<<  " STREAM_SCHEDULE: Querying event " << i << " = " << event_status << "\n";
-#endif
-            if(status != CL_SUCCESS)
-            {
-              std::cerr<< "Error " << status << " (" << ClErrorString(status) << "): Querying event " << i << ". (clGetEventInfo)\n";
-              return RET_ERROR;
-            }
-            if (event_status > CL_COMPLETE) /* still running: CL_QUEUED=3 (command has been enqueued in the command-queue),
-                                               CL_SUBMITTED=2 (enqueued command has been submitted by the host to the
-                                               device associated with the command-queue),
-                                               CL_RUNNING=1 (device is currently executing this command), CL_COMPLETE=0,
-                                               any error: <0 */
+            if (!thread_atomic_load(&streams->done[i])) /* still queued or running: stream_complete_cb() not yet called */
             {
               break;
               // continue; // examine the next stream
             }
-            else // finished
-            {
+            event_status = streams->exec_status[i]; /* CL_COMPLETE=0, any error: <0 */
+#ifdef DEBUG_STREAM_SCHEDULE
+            std::cout<<  " STREAM_SCHEDULE: Stream " << i << " completed, status " << event_status << "\n";
+#endif
 #ifdef CL_PERFORMANCE_INFO
-              cl_ulong startTime=0;
-              cl_ulong endTime=1000;
-              /* Get kernel profiling info */
-              if (!mystuff->gpu_sieving)
-              {
-                status = clGetEventProfilingInfo(mystuff->copy_events[i],
-                                  CL_PROFILING_COMMAND_START,
-                                  sizeof(cl_ulong),
-                                  &startTime,
-                                  0);
-                if(status != CL_SUCCESS)
-                {
-                  std::cerr<< "Error " << status << " (" << ClErrorString(status) << "): in clGetEventProfilingInfo.(startTime)\n";
-                  return RET_ERROR;
-                }
-                status = clGetEventProfilingInfo(mystuff->copy_events[i],
-                                  CL_PROFILING_COMMAND_END,
-                                  sizeof(cl_ulong),
-                                  &endTime,
-                                  0);
-                if(status != CL_SUCCESS)
-                {
-                  std::cerr<< "Error " << status << " (" << ClErrorString(status) << "): in clGetEventProfilingInfo.(endTime)\n";
-                  return RET_ERROR;
-                }
-                printf("%d FCs copied in %2.2f ms (%4.2f MB/s), ", mystuff->threads_per_grid, (endTime - startTime)/1e6,
-                        size * 1e3 / (endTime - startTime) );
-              }
-              status = clGetEventProfilingInfo(mystuff->exec_events[i],
+            cl_ulong startTime=0;
+            cl_ulong endTime=1000;
+            cl_ulong copyStart=0, copyEnd=0;
+            /* Get kernel profiling info */
+            if (!mystuff->gpu_sieving && (ktab_mem != KTAB_SVM)) // no profiling info for user events
+            {
+              status = clGetEventProfilingInfo(mystuff->copy_events[i],
                                 CL_PROFILING_COMMAND_START,
                                 sizeof(cl_ulong),
                                 &startTime,
                                 0);
               if(status != CL_SUCCESS)
-               {
+              {
                 std::cerr<< "Error " << status << " (" << ClErrorString(status) << "): in clGetEventProfilingInfo.(startTime)\n";
                 return RET_ERROR;
               }
-              status = clGetEventProfilingInfo(mystuff->exec_events[i],
+              status = clGetEventProfilingInfo(mystuff->copy_events[i],
                                 CL_PROFILING_COMMAND_END,
                                 sizeof(cl_ulong),
                                 &endTime,
                                 0);
               if(status != CL_SUCCESS)
-               {
+              {
                 std::cerr<< "Error " << status << " (" << ClErrorString(status) << "): in clGetEventProfilingInfo.(endTime)\n";
                 return RET_ERROR;
               }
-              printf("proc'd in %2.2f ms (%3.2f M/s)\n", (endTime - startTime)/1e6, double(mystuff->threads_per_grid) *1e3/ (endTime - startTime));
-#endif
-              status = clReleaseEvent(mystuff->exec_events[i]);
-              if(status != CL_SUCCESS)
+              printf("%d FCs copied in %2.2f ms (%4.2f MB/s), ", mystuff->threads_per_grid, (endTime - startTime)/1e6,
+                      mystuff->threads_per_grid * sizeof(int) * 1e3 / (endTime - startTime) );
+              copyStart = startTime;
+              copyEnd   = endTime;
+            }
+            status = clGetEventProfilingInfo(mystuff->exec_events[i],
+                              CL_PROFILING_COMMAND_START,
+                              sizeof(cl_ulong),
+                              &startTime,
+                              0);
+            if(status != CL_SUCCESS)
+             {
+              std::cerr<< "Error " << status << " (" << ClErrorString(status) << "): in clGetEventProfilingInfo.(startTime)\n";
+              return RET_ERROR;
+            }
+            status = clGetEventProfilingInfo(mystuff->exec_events[i],
+                              CL_PROFILING_COMMAND_END,
+                              sizeof(cl_ulong),
+                              &endTime,
+                              0);
+            if(status != CL_SUCCESS)
+             {
+              std::cerr<< "Error " << status << " (" << ClErrorString(status) << "): in clGetEventProfilingInfo.(endTime)\n";
+              return RET_ERROR;
+            }
+            if (copyEnd > copyStart)
+            {
+              // the part of the copy that ran while a kernel of another stream was running
+              cl_ulong overlap = 0, lo, hi;
+              cl_uint  j;
+              for (j=0; j<mystuff->num_streams; j++)
               {
-                 std::cerr<< "Error " << status << " (" << ClErrorString(status) << "): Release exec event object. (clReleaseEvent)\n";
-                 return RET_ERROR;
-               }
-              if (!mystuff->gpu_sieving) status = clReleaseEvent(mystuff->copy_events[i]);
-               if(status != CL_SUCCESS)
-               {
-                std::cerr<< "Error " << status << " (" << ClErrorString(status) << "): Release copy event object. (clReleaseEvent)\n";
-                 return RET_ERROR;
+                if (j == i) continue;
+                lo = (copyStart > prf_exec_start[j]) ? copyStart : prf_exec_start[j];
+                hi = (copyEnd   < prf_exec_end[j])   ? copyEnd   : prf_exec_end[j];
+                if (hi > lo) overlap += hi - lo;
               }
+              if (overlap > copyEnd - copyStart) overlap = copyEnd - copyStart;
+              prf_copy_time    += copyEnd - copyStart;
+              prf_overlap_time += overlap;
+              printf("%3.0f%% overlapped, ", overlap * 100.0 / (copyEnd - copyStart));
+            }
+            prf_exec_start[i] = startTime;
+            prf_exec_end[i]   = endTime;
+            printf("proc'd in %2.2f ms (%3.2f M/s)\n", (endTime - startTime)/1e6, double(mystuff->threads_per_grid) *1e3/ (endTime - startTime));
+#endif
+            if (event_status == CL_COMPLETE) grid_time_add(mystuff->exec_events[i], grid_threads[i]);
+            status = clReleaseEvent(mystuff->exec_events[i]);
+            if(status != CL_SUCCESS)
+            {
+               std::cerr<< "Error " << status << " (" << ClErrorString(status) << "): Release exec event object. (clReleaseEvent)\n";
+               return RET_ERROR;
+             }
+            if (!mystuff->gpu_sieving) status = clReleaseEvent(mystuff->copy_events[i]);
+             if(status != CL_SUCCESS)
+             {
+              std::cerr<< "Error " << status << " (" << ClErrorString(status) << "): Release copy event object. (clReleaseEvent)\n";
+               return RET_ERROR;
+            }
 
-              if (event_status < CL_COMPLETE) // error
-              {
-                std::cerr<< "Error " << event_status << " (" << ClErrorString(status) << "): during execution of block " << count << " in h_ktab[" << i << "]\n";
-                return RET_ERROR;
-              }
-              else
-              {
-                mystuff->stream_status[i] = DONE;
-                /* no break to fall through to process the DONE value */
-              }
+            if (event_status < CL_COMPLETE) // error
+            {
+              std::cerr<< "Error " << event_status << " (" << ClErrorString(status) << "): during execution of block " << count << " in h_ktab[" << i << "]\n";
+              return RET_ERROR;
+            }
+            else
+            {
+              mystuff->stream_status[i] = DONE;
+              /* no break to fall through to process the DONE value */
             }
           }
         case DONE:                       // get the results
           {                              // or maybe not; wait until the class is done.
             mystuff->stream_status[i] = UNUSED;
+            if ((ktab_mem == KTAB_MAPPED) && (ktab_map(i) != CL_SUCCESS)) return RET_ERROR;
+            if (use_producer) sieve_producer_release(producer, i); // after ktab_map(): h_ktab[i] may have moved
             --running;
             if ((k_min <= k_max) || (running==0))
             {
@@ -2908,6 +4239,55 @@ int tf_class_opencl(cl_ulong k_min, cl_ulong k_max, mystuff_t *mystuff, enum GPU
      // break; // out of the loop as we can process another stream (shortcut: don't check the other streams now)
     }
 
+    if (pipelined && k_min_next && !next_started && read_event)
+    {
+      // all grids of this class are started: sieve and submit the next class
+      // while they are running, its results go to d_RES_next
+#ifdef DEBUG_STREAM_SCHEDULE
+      printf(" STREAM_SCHEDULE: starting the next class, k_min=%llu\n", (long long unsigned int) k_min_next);
+#endif
+      if (use_producer) sieve_producer_stop(producer); // it has finished this class
+      if (grid_size_next) // GridAdjust: all grids of this class are started
+      {
+        mystuff->threads_per_grid = grid_size_next;
+        grid_size_next = 0;
+      }
+      next_class.grid_size   = mystuff->threads_per_grid;
+      next_class.sieve_limit = mystuff->sieve_primes;
+      cpu_sieve_init_class(mystuff->exponent, k_min_next, next_class.sieve_limit);
+
+      memset(mystuff->h_RES_next,0,32 * sizeof(int));
+      status = clEnqueueWriteBuffer(QUEUE,
+                    mystuff->d_RES_next,
+                    CL_FALSE,
+                    0,
+                    32 * sizeof(int),
+                    mystuff->h_RES_next,
+                    0,
+                    NULL,
+                    &next_class.init_event);
+      if(status != CL_SUCCESS)
+      {
+        std::cout<<"Error " << status << " (" << ClErrorString(status) << "): Copying h_RES_next(clEnqueueWriteBuffer)\n";
+        return RET_ERROR;
+      }
+      if ( k_max <= k_min_next) k_max = k_min_next + 1;  // same as the next call will do
+      if (use_producer && sieve_producer_start(producer, mystuff->h_ktab, mystuff->num_streams, stream_seq % mystuff->num_streams,
+                                               mystuff->threads_per_grid, next_class.sieve_limit, k_min_next, k_max))
+      {
+        return RET_ERROR;
+      }
+      next_class.k_class    = k_min_next;
+      next_class.read_event = NULL;
+      next_started = 1;
+      k_min        = k_min_next;
+      sieve_limit  = next_class.sieve_limit;
+      d_res        = mystuff->d_RES_next;
+      wait_list    = &next_class.init_event;
+      new_class    = 1; // d_res has changed
+      wait         = 0;
+    }
+
     if(wait > 0)
     {
       /* no unused h_ktab for preprocessing.
@@ -2920,11 +4300,11 @@ int tf_class_opencl(cl_ulong k_min, cl_ulong k_max, mystuff_t *mystuff, enum GPU
 
       if (k_min >= k_max)
       {
-        i = count % mystuff->num_streams; // at the end of the class: just wait for the last stream
+        i = stream_seq % mystuff->num_streams; // at the end of the class: just wait for the last stream
       }
       else
       {
-        i = (count - running) % mystuff->num_streams;  // the oldest still running stream
+        i = (stream_seq - running) % mystuff->num_streams;  // the oldest still running stream
       }
 
       if (mystuff->stream_status[i] != RUNNING)     // if that one is not running, take the first running one
@@ -2937,11 +4317,15 @@ int tf_class_opencl(cl_ulong k_min, cl_ulong k_max, mystuff_t *mystuff, enum GPU
 #ifdef DEBUG_STREAM_SCHEDULE
         printf(" STREAM_SCHEDULE: Wait for stream %d, already waited %" PRIu64 "us, %d times of %d blocks\n", i, twait, cwait, count);
 #endif
-        status = clWaitForEvents(1, &mystuff->exec_events[i]); // wait for completion
-        if(status != CL_SUCCESS)
+        wait_for_stream(i);
+        // don't count the waiting period at the end of the class (nothing left
+        // to submit) as this is unavoidable
+        if (k_min <= k_max)
         {
-          std::cerr<< "Error " << status << " (" << ClErrorString(status) << "): Waiting for kernel call to finish. (clWaitForEvents)\n";
-          return RET_ERROR;
+          twait1 = timer_diff(&timer2);
+          mystuff->stats.stream_wait_time[i] += twait1;
+          mystuff->stats.stream_wait_count[i]++;
+          twait += twait1;
         }
       }
       else
@@ -2953,11 +4337,7 @@ int tf_class_opencl(cl_ulong k_min, cl_ulong k_max, mystuff_t *mystuff, enum GPU
       }
 
 #ifdef DEBUG_STREAM_SCHEDULE
-      unsigned long long twait1 = timer_diff(&timer2);
-      printf(" STREAM_SCHEDULE: Waited %" PRIu64 "us, %d blocks running.\n", twait1, running);
-      if (running > 1) twait += twait1;  // don't count the waiting period for the last block as this is unavoidable
-#else
-      if (running > 1) twait += timer_diff(&timer2); // see above. Note this would not work for num_streams=1, and not reliably for num_streams=2
+      printf(" STREAM_SCHEDULE: Waited %" PRIu64 "us, %d blocks running.\n", timer_diff(&timer2), running);
 #endif
 
       cwait++;
@@ -2967,8 +4347,9 @@ int tf_class_opencl(cl_ulong k_min, cl_ulong k_max, mystuff_t *mystuff, enum GPU
   }
 
   // all done?
+  if (use_producer && !next_started) sieve_producer_stop(producer);
 
-  for(i=0; i<mystuff->num_streams; i++)
+  for(i=0; (i<mystuff->num_streams) && !next_started; i++)
   {
     if (mystuff->stream_status[i] != UNUSED)
     { // should not happen
@@ -2976,15 +4357,42 @@ int tf_class_opencl(cl_ulong k_min, cl_ulong k_max, mystuff_t *mystuff, enum GPU
     }
   }
 
-  status = clEnqueueReadBuffer(QUEUE,
-                mystuff->d_RES,
-                CL_TRUE,
-                0,
-                32 * sizeof(int),
-                mystuff->h_RES,
-                0,
-                NULL,
-                NULL);
+  if (pipelined)
+  {
+    if (read_event == NULL)
+    {
+      fprintf(stderr, "Programming error: results of the class were not read back\n");
+      return RET_ERROR;
+    }
+    wait_for_stream(RES_SLOT(res_parity));
+    status = streams->exec_status[RES_SLOT(res_parity)];
+    clReleaseEvent(read_event);
+    if (init_event) clReleaseEvent(init_event);
+    if (next_started)
+    {
+      next_class.active = 1;
+      next_class.k_min  = k_min;
+      next_class.count  = next_count;
+    }
+  }
+  else
+  {
+    status = clEnqueueReadBuffer(QUEUE,
+                  mystuff->d_RES,
+                  CL_TRUE,
+                  0,
+                  32 * sizeof(int),
+                  mystuff->h_RES,
+                  0,
+                  NULL,
+                  NULL);
+    // the TF kernels are finished now (in-order queue), measure the last ones
+    for (i=0; i<mystuff->gpu_sieve_buffers; i++)
+    {
+      if (tf_events[i] != NULL) grid_time_add(tf_events[i], tf_event_size[i]);
+      tf_event_size[i] = 0;
+    }
+  }
 
   if(status != CL_SUCCESS)
   {
@@ -2995,7 +4403,23 @@ int tf_class_opencl(cl_ulong k_min, cl_ulong k_max, mystuff_t *mystuff, enum GPU
   if (mystuff->verbosity > 2)
   {
     printArray("RES", mystuff->h_RES, 32, 0);
+    if (!mystuff->gpu_sieving)
+    {
+      printf("CPU wait per stream:");
+      for(i=0; i<mystuff->num_streams; i++)
+        printf(" %u: %" PRIu64 "us (%ux)", i, mystuff->stats.stream_wait_time[i], mystuff->stats.stream_wait_count[i]);
+      printf("\n");
+    }
+  }
+#ifdef CL_PERFORMANCE_INFO
+  if (prf_copy_time > 0)
+  {
+    printf("copy/compute overlap: %.2f ms of %.2f ms k_tab copy time (%.1f%%), %s\n",
+           prf_overlap_time/1e6, prf_copy_time/1e6, prf_overlap_time * 100.0 / prf_copy_time,
+           copyQueue ? "separate copy queue" : "single queue");
+    prf_copy_time = prf_overlap_time = 0;
   }
+#endif
 #ifdef CHECKS_MODBASECASE
   status = clEnqueueReadBuffer(QUEUE,
                 mystuff->d_modbasecase_debug,
@@ -3020,6 +4444,7 @@ int tf_class_opencl(cl_ulong k_min, cl_ulong k_max, mystuff_t *mystuff, enum GPU
 #endif
 
   mystuff->stats.grid_count = count;
+  mystuff->stats.grid_size  = grid_size;
   mystuff->stats.class_time = timer_diff(&timer)/1000;
 /* prevent division by zero if timer resolution is too low */
   if(mystuff->stats.class_time == 0)mystuff->stats.class_time = 1;
@@ -3028,10 +4453,13 @@ int tf_class_opencl(cl_ulong k_min, cl_ulong k_max, mystuff_t *mystuff, enum GPU
   if(mystuff->stats.grid_count > 2 * mystuff->num_streams)mystuff->stats.cpu_wait = (float)twait / ((float)mystuff->stats.class_time * 10);
   else                                mystuff->stats.cpu_wait = -1.0f;
 
+  if (dev_count > 1) thread_mutex_lock(&output_mutex);
   print_status_line(mystuff);
+  if (dev_count > 1) thread_mutex_unlock(&output_mutex);
 
-  /* only adjust sieve_primes if there was no keyboard input handled */
-  if(handle_kb_input(mystuff) == 0 && mystuff->stats.cpu_wait >= 0.0f)
+  /* only adjust sieve_primes if there was no keyboard input handled,
+     the keyboard belongs to the main thread */
+  if((mystuff->dev_index > 0 || handle_kb_input(mystuff) == 0) && mystuff->stats.cpu_wait >= 0.0f)
   {
 /* if SievePrimesAdjust is enable lets try to get 2 % < CPU wait < 6% */
     if(mystuff->sieve_primes_adjust == 1 && mystuff->stats.cpu_wait > 6.0f && mystuff->sieve_primes < mystuff->sieve_primes_upper_limit && (mystuff->mode != MODE_SELFTEST_SHORT))
@@ -3047,7 +4475,9 @@ int tf_class_opencl(cl_ulong k_min, cl_ulong k_max, mystuff_t *mystuff, enum GPU
       if(mystuff->sieve_primes < mystuff->sieve_primes_min) mystuff->sieve_primes = mystuff->sieve_primes_min;
     }
   }
+  if(mystuff->grid_adjust && (mystuff->mode != MODE_SELFTEST_SHORT)) grid_adjust(mystuff);
 
+  if (dev_count > 1) thread_mutex_lock(&output_mutex);
   factorsfound = mystuff->h_RES[0];
   for(i=0; (i<factorsfound) && (i<10); i++)
   {
@@ -3109,6 +4539,312 @@ int tf_class_opencl(cl_ulong k_min, cl_ulong k_max, mystuff_t *mystuff, enum GPU
   {
     print_factor(mystuff, factorsfound, NULL, 0.0);
   }
+  if (dev_count > 1) thread_mutex_unlock(&output_mutex);
 
   return factorsfound;
 }
+
+
+/* bulk mode (BulkExponents in mfakto.ini): many exponents per kernel launch */
+
+static int bulk_launch(cl_uint i, cl_uint numblocks, cl_mem d_blocks, const bulk_block_t *h_blocks, cl_mem d_res)
+/* start cl_barrett15_69_bulk on the first numblocks blocks of h_ktab[i] */
+{
+  cl_kernel kernel = kernel_info[BARRETT69_MUL15_BULK].kernel;
+  cl_event  wait_list[2];
+  size_t    localThreads  = deviceinfo.maxThreadsPerBlock;
+  size_t    globalThreads = numblocks * localThreads;
+  cl_int    status;
+
+  if (ktab_upload(i, 0, NULL) != CL_SUCCESS) return 1;
+  status = clEnqueueWriteBuffer(KTAB_QUEUE,
+                d_blocks,
+                CL_FALSE,
+                0,
+                numblocks * sizeof(bulk_block_t),
+                h_blocks,
+                0,
+                NULL,
+                &wait_list[1]);
+  if(status != CL_SUCCESS)
+  {
+    std::cerr<< "Error " << status << " (" << ClErrorString(status) << "): Copying the block table (clEnqueueWriteBuffer)\n";
+    return 1;
+  }
+  if (copyQueue) clFlush(copyQueue);
+  wait_list[0] = mystuff.copy_events[i];
+
+  status  = clSetKernelArg(kernel, 0, sizeof(cl_mem), (void *)&d_blocks);
+  status |= clSetKernelArg(kernel, 1, sizeof(cl_mem), (void *)&mystuff.d_ktab[i]);
+  status |= clSetKernelArg(kernel, 2, sizeof(cl_mem), (void *)&d_res);
+#ifdef CHECKS_MODBASECASE
+  status |= clSetKernelArg(kernel, 3, sizeof(cl_mem), (void *)&mystuff.d_modbasecase_debug);
+#endif
+  if(status != CL_SUCCESS)
+  {
+    std::cerr<< "Error " << status << " (" << ClErrorString(status) << "): Setting kernel arguments of " << kernel_info[BARRETT69_MUL15_BULK].kernelname << "\n";
+    clReleaseEvent(wait_list[1]);
+    return 1;
+  }
+
+  thread_atomic_store(&streams->done[i], 0);
+  status = clEnqueueNDRangeKernel(QUEUE,
+                 kernel,
+                 1,
+                 NULL,
+                 &globalThreads,
+                 &localThreads,
+                 2,
+                 wait_list,
+                 &mystuff.exec_events[i]);
+  clReleaseEvent(wait_list[1]);
+  if(status != CL_SUCCESS)
+  {
+    std::cerr<< "Error " << status << " (" << ClErrorString(status) << "): Enqueuing kernel(clEnqueueNDRangeKernel), stream " << i << "\n";
+    return 1;
+  }
+  clFlush(QUEUE);
+  status = clSetEventCallback(mystuff.exec_events[i], CL_COMPLETE, stream_complete_cb, STREAM_ID(mystuff.dev_index, i));
+  if(status != CL_SUCCESS)
+  {
+    std::cerr<< "Error " << status << " (" << ClErrorString(status) << "): Registering the completion of stream " << i << ". (clSetEventCallback)\n";
+    return 1;
+  }
+  mystuff.stream_status[i] = RUNNING;
+  return 0;
+}
+
+static int bulk_finish(cl_uint i)
+/* wait for the grid of stream i (if any) and make h_ktab[i] available again */
+{
+  cl_int event_status;
+
+  if (mystuff.stream_status[i] != RUNNING) return 0;
+
+  wait_for_stream(i);
+  event_status = streams->exec_status[i];
+  clReleaseEvent(mystuff.exec_events[i]);
+  clReleaseEvent(mystuff.copy_events[i]);
+  mystuff.stream_status[i] = UNUSED;
+  if ((ktab_mem == KTAB_MAPPED) && (ktab_map(i) != CL_SUCCESS)) return 1;
+  if (event_status < CL_COMPLETE)
+  {
+    std::cerr<< "Error " << event_status << " (" << ClErrorString(event_status) << "): during execution of stream " << i << "\n";
+    return 1;
+  }
+  return 0;
+}
+
+int tf_bulk_opencl(bulk_exponent_t *bulk, cl_uint num, mystuff_t *mystuff)
+/*
+trial factors bulk[0 .. num-1] from 2^bit_min to 2^(bit_min+1), 60 <= bit_min <= 68.
+The grids of cl_barrett15_69_bulk are filled class by class, exponent by
+exponent. Each work group processes one block of candidates of one class,
+so only the last block of a class is tested beyond k_max. The factors are
+returned per exponent (RES[32*e ...]), the factors and the result lines are
+printed here, bulk[].factorsfound is set.
+
+return value: 0, RET_ERROR or RET_QUIT
+*/
+{
+  cl_uint   block_size = (cl_uint) deviceinfo.maxThreadsPerBlock * mystuff->vectorsize;
+  cl_uint   blocks_per_grid = mystuff->threads_per_grid / block_size;
+  cl_uint   stream = 0, numblocks = 0, e, c, i, shiftcount, ln2b, sieve_limit, factorsfound;
+  cl_uint  *ktab, *h_res = NULL;
+  cl_ulong  k;
+  cl_mem    d_res = NULL, d_blocks[NUM_STREAMS_MAX];
+  bulk_block_t *h_blocks[NUM_STREAMS_MAX], blk;
+  int96     factor, prev_factor;
+  double    bits;
+  char      string[50];
+  cl_int    status;
+  int       retval = RET_ERROR;
+  struct timeval timer;
+
+  timer_init(&timer);
+  tf_class_opencl_flush(mystuff); // the streams must be idle
+  for (i=0; i<mystuff->num_streams; i++)
+  {
+    d_blocks[i] = NULL;
+    h_blocks[i] = NULL;
+  }
+
+  h_res = (cl_uint *) calloc(32 * num, sizeof(cl_uint));
+  if (h_res == NULL)
+  {
+    printf("ERROR: malloc(h_res) failed\n");
+    return RET_ERROR;
+  }
+  d_res = clCreateBuffer(context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, 32 * num * sizeof(cl_uint), h_res, &status);
+  if(status != CL_SUCCESS)
+  {
+    std::cerr<< "Error " << status << " (" << ClErrorString(status) << "): clCreateBuffer (bulk RES)\n";
+    d_res = NULL;
+    goto cleanup;
+  }
+  for (i=0; i<mystuff->num_streams; i++)
+  {
+    h_blocks[i] = (bulk_block_t *) malloc(blocks_per_grid * sizeof(bulk_block_t));
+    d_blocks[i] = clCreateBuffer(context, CL_MEM_READ_ONLY, blocks_per_grid * sizeof(bulk_block_t), NULL, &status);
+    if((h_blocks[i] == NULL) || (status != CL_SUCCESS))
+    {
+      std::cerr<< "Error " << status << ": allocating the block table of stream " << i << "\n";
+      if (status != CL_SUCCESS) d_blocks[i] = NULL;
+      goto cleanup;
+    }
+  }
+#ifdef CHECKS_MODBASECASE
+  memset(mystuff->h_modbasecase_debug, 0, 32 * sizeof(int));
+  status = clEnqueueWriteBuffer(QUEUE, mystuff->d_modbasecase_debug, CL_TRUE, 0, 32 * sizeof(int),
+                                mystuff->h_modbasecase_debug, 0, NULL, NULL);
+  if(status != CL_SUCCESS)
+  {
+    std::cout<<"Error " << status << " (" << ClErrorString(status) << "): Copying h_modbasecase_debug(clEnqueueWriteBuffer)\n";
+    goto cleanup;
+  }
+#endif
+
+  memset(&blk, 0, sizeof(blk));
+  for (e=0; (e<num) && !mystuff->quit; e++)
+  {
+    // the same preprocessing as tf_class_opencl(), for bit_max = bit_min+1
+    shiftcount=10;
+    while((1ULL<<shiftcount) < (unsigned long long int)bulk[e].exponent)shiftcount++;
+    shiftcount -= 6;
+    ln2b = bulk[e].exponent >> shiftcount;
+    while (ln2b < (cl_uint)bulk[e].bit_min + 1)
+    {
+      shiftcount--;
+      ln2b = bulk[e].exponent >> shiftcount;
+    }
+    if ((ln2b < 60) || (ln2b >= 75))
+    {
+      fprintf(stderr, "Pre-init (%u) out of range for the bulk kernel\n", ln2b); // should not happen
+      goto cleanup;
+    }
+    memset(blk.b_in, 0, sizeof(blk.b_in));
+    blk.b_in[0]    = 1 << (ln2b - 60);
+    blk.exponent   = bulk[e].exponent;
+    blk.shiftcount = shiftcount;
+    blk.res_index  = e;
+    blk.bit_max65  = bulk[e].bit_min + 1 - 65;
+    sieve_limit    = sieve_sieve_primes_max(bulk[e].exponent, mystuff->sieve_primes);
+
+    for (c=0; (c<mystuff->num_classes) && !mystuff->quit; c++)
+    {
+      if (!class_needed(bulk[e].exponent, bulk[e].k_min, c)) continue;
+
+      k = bulk[e].k_min + c;
+      cpu_sieve_init_class(bulk[e].exponent, k, sieve_limit);
+      while (k <= bulk[e].k_max)
+      {
+        if ((numblocks == 0) && bulk_finish(stream)) goto cleanup; // h_ktab[stream] is free again
+        ktab = mystuff->h_ktab[stream] + numblocks * block_size;
+        cpu_sieve_candidates(block_size, ktab, sieve_limit);
+
+        blk.k_base.d0 =  k & 0x7FFF;
+        blk.k_base.d1 = (k >> 15) & 0x7FFF;
+        blk.k_base.d2 = (k >> 30) & 0x7FFF;
+        blk.k_base.d3 = (k >> 45) & 0x7FFF;
+        blk.k_base.d4 =  k >> 60;
+        h_blocks[stream][numblocks++] = blk;
+        k += ((cl_ulong) ktab[block_size-1] + 1) * NUM_CLASSES;
+
+        if (numblocks == blocks_per_grid)
+        {
+          if (bulk_launch(stream, numblocks, d_blocks[stream], h_blocks[stream], d_res)) goto cleanup;
+          stream = (stream + 1) % mystuff->num_streams;
+          numblocks = 0;
+        }
+      }
+    }
+  }
+  if ((numblocks > 0) && bulk_launch(stream, numblocks, d_blocks[stream], h_blocks[stream], d_res)) goto cleanup;
+  for (i=0; i<mystuff->num_streams; i++)
+  {
+    if (bulk_finish(i)) goto cleanup;
+  }
+  if (mystuff->quit)
+  {
+    retval = RET_QUIT; // bulk jobs are not checkpointed: the bit level starts over
+    goto cleanup;
+  }
+
+  status = clEnqueueReadBuffer(QUEUE, d_res, CL_TRUE, 0, 32 * num * sizeof(cl_uint), h_res, 0, NULL, NULL);
+  if(status != CL_SUCCESS)
+  {
+    std::cout << "Error " << status << " (" << ClErrorString(status) << "): clEnqueueReadBuffer RES failed.\n";
+    goto cleanup;
+  }
+#ifdef CHECKS_MODBASECASE
+  status = clEnqueueReadBuffer(QUEUE, mystuff->d_modbasecase_debug, CL_TRUE, 0, 32 * sizeof(int),
+                               mystuff->h_modbasecase_debug, 0, NULL, NULL);
+  if(status == CL_SUCCESS)
+  {
+    for(i=0;i<32;i++)if(mystuff->h_modbasecase_debug[i] != 0)printf("h_modbasecase_debug[%2d] = %u\n", i, mystuff->h_modbasecase_debug[i]);
+  }
+#endif
+  if (mystuff->verbosity > 1)
+    printf("bulk mode: %u exponents from 2^%d to 2^%d done in %" PRIu64 " ms\n",
+           num, bulk[0].bit_min, bulk[0].bit_min + 1, timer_diff(&timer)/1000);
+
+  // the results, reported like tf() does for a single exponent
+  snprintf(mystuff->stats.kernelname, sizeof(mystuff->stats.kernelname), "%s_%d", kernel_info[BARRETT69_MUL15_BULK].kernelname, mystuff->vectorsize);
+  mystuff->stats.class_counter = mystuff->more_classes ? 960 : 96; // all classes are done
+  if (dev_count > 1) thread_mutex_lock(&output_mutex);
+  for (e=0; e<num; e++)
+  {
+    cl_uint *res = h_res + 32 * e;
+
+    mystuff->exponent      = bulk[e].exponent;
+    mystuff->bit_min       = bulk[e].bit_min;
+    mystuff->bit_max_stage = bulk[e].bit_min + 1;
+    factorsfound = res[0];
+    prev_factor.d0 = prev_factor.d1 = prev_factor.d2 = 0;
+    for(i=0; (i<factorsfound) && (i<10); i++)
+    {
+      factor.d2 = res[i*3 + 1];
+      factor.d1 = res[i*3 + 2];
+      factor.d0 = res[i*3 + 3];
+      factor.d0 = (factor.d1 << 30) +  factor.d0;
+      factor.d1 = (factor.d2 << 28) + (factor.d1 >> 2);
+      factor.d2 =                      factor.d2 >> 4;
+
+      // exclude duplicates and the trivial "factor" 1
+      if ((factor.d2 == prev_factor.d2 && factor.d1 == prev_factor.d1 && factor.d0 == prev_factor.d0) ||
+          (factor.d2 == 0 && factor.d1 == 0 && factor.d0 == 1))
+      {
+        if (factorsfound > i) memmove(&res[i*3 + 1], &res[i*3 + 4], 3*sizeof(int)*(factorsfound-i));
+        res[0] = --factorsfound;
+        --i;
+        continue;
+      }
+      print_dez96(factor, string);
+      if (factor.d2 > 0) bits = log(((double)factor.d2 * 4294967296.0 + factor.d1) * 4294967296.0) / log(2.0);
+      else               bits = log((double)(((cl_ulong)factor.d1 << 32) + factor.d0)) / log(2.0);
+      mystuff->stats.ghzdays = primenet_ghzdays(bulk[e].exponent, bulk[e].bit_min, bulk[e].bit_min + 1) * (bits - floor(bits));
+      print_factor(mystuff, i, string, bits);
+      prev_factor = factor;
+    }
+    if(factorsfound>=10)
+    {
+      print_factor(mystuff, factorsfound, NULL, 0.0);
+    }
+    mystuff->stats.ghzdays = primenet_ghzdays(bulk[e].exponent, bulk[e].bit_min, bulk[e].bit_min + 1);
+    print_result_line(mystuff, factorsfound);
+    bulk[e].factorsfound = factorsfound;
+  }
+  if (dev_count > 1) thread_mutex_unlock(&output_mutex);
+  retval = 0;
+
+cleanup:
+  for (i=0; i<mystuff->num_streams; i++)
+  {
+    if (mystuff->stream_status[i] == RUNNING) bulk_finish(i);
+    if (d_blocks[i]) clReleaseMemObject(d_blocks[i]);
+    free(h_blocks[i]);
+  }
+  if (d_res) clReleaseMemObject(d_res);
+  free(h_res);
+  return retval;
+}
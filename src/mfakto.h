@@ -31,18 +31,31 @@ extern "C"
 {
 #endif
 
+extern cl_uint dev_count;  /* number of devices driven by this process */
+
 int init_CL(int num_streams, cl_int *devicenumber);
+int add_CL_device(cl_int devnumber);
 int load_kernels(cl_int *devnumber);
+int load_kernel(int kernel);
 void set_gpu_type();
 int init_CLstreams(int gs_reinit_only);
+int init_CL_worker(cl_uint dev);
+int cleanup_CL_worker(void);
 int cleanup_CL(void);
 void CL_test(cl_int devicenumber);
-int tf_class_opencl(cl_ulong k_min, cl_ulong k_max, mystuff_t *mystuff, enum GPUKernels use_kernel);
+int tf_class_opencl(cl_ulong k_min, cl_ulong k_max, mystuff_t *mystuff, enum GPUKernels use_kernel, cl_ulong k_min_next);
+void tf_class_opencl_flush(mystuff_t *mystuff);
+int tf_bulk_opencl(bulk_exponent_t *bulk, cl_uint num, mystuff_t *mystuff);
 cl_int run_calc_mod_inv(cl_uint numblocks, size_t localThreads, cl_event *run_event);
 cl_int run_calc_bit_to_clear(cl_uint numblocks, size_t localThreads, cl_event *run_event, cl_ulong k_min);
+cl_int run_calc_bit_to_clear_advance(cl_uint numblocks, size_t localThreads, cl_event *run_event, cl_uint advance);
 cl_int run_cl_sieve(cl_uint numblocks, size_t localThreads, cl_event *run_event, cl_uint maxp);
+cl_int run_gpusieve_wait();
+cl_int run_gpusieve_upload(size_t size);
+cl_int run_gpusieve_read(cl_mem buffer, void *ptr, size_t size);
 int run_gs_kernel(cl_kernel kernel, cl_uint numblocks, cl_uint shared_mem_required, cl_uint shiftcount);
 int kernel_possible(int kernel, mystuff_t *mystuff);
+int class_needed(unsigned int expo, unsigned long long int k_min, int c);
 
 #ifdef __cplusplus
 }
@@ -78,24 +78,56 @@ Version 0.15
 #include "datatypes.h"
 #include "common.cl"
 
+// the host builds one program per kernel family (-DKERNEL_FAMILY=n, see
+// kernel_family() in mfakto.cpp), without it all kernels are built
+#define FAMILY_GPUSIEVE   1
+#define FAMILY_BARRETT15  2
+#define FAMILY_BARRETT32  3
+#define FAMILY_MUL24      4
+#define FAMILY_MONTGOMERY 5
+#ifdef KERNEL_FAMILY
+  #define BUILD_FAMILY(f) (KERNEL_FAMILY == (f))
+#else
+  #define BUILD_FAMILY(f) 1
+#endif
+
 // for the GPU sieve, we don't implement some kernels
 #ifdef CL_GPU_SIEVE
-  #include "gpusieve.cl"
-  #include "barrett15.cl"  // mul24-based barrett kernels using a word size of 15 bit
-  #include "barrett.cl"   // one kernel file for 32-bit-barrett of different vector sizes (1, 2, 4, 8, 16)
+  #include "gpusieve.cl"  // the GS kernels of all families need its extract_bits
+  #if BUILD_FAMILY(FAMILY_BARRETT15)
+    #include "barrett15.cl"  // mul24-based barrett kernels using a word size of 15 bit
+  #endif
+  #if BUILD_FAMILY(FAMILY_BARRETT32) || BUILD_FAMILY(FAMILY_MONTGOMERY)
+    #include "barrett.cl"   // one kernel file for 32-bit-barrett of different vector sizes (1, 2, 4, 8, 16), montgomery uses its 96-bit functions
+  #endif
+  #if BUILD_FAMILY(FAMILY_MONTGOMERY)
+    #include "montgomery.cl"  // montgomery kernels
+  #endif
 #else
   #define EVAL_RES(x) EVAL_RES_b(x)  // no check for f==1 if running the "big" version
 
-  #include "barrett15.cl"  // mul24-based barrett kernels using a word size of 15 bit
-  #include "barrett.cl"   // one kernel file for 32-bit-barrett of different vector sizes (1, 2, 4, 8, 16)
-
-  #include "mul24.cl" // one kernel file for 24-bit-kernels of different vector sizes (1, 2, 4, 8, 16)
-  #include "montgomery.cl"  // montgomery kernels
-
-  #define _63BIT_MUL24_K
-  #include "mul24.cl" // include again, now for small factors < 64 bit
+  #if BUILD_FAMILY(FAMILY_BARRETT15) || BUILD_FAMILY(FAMILY_MONTGOMERY)
+    #include "barrett15.cl"  // mul24-based barrett kernels using a word size of 15 bit, montgomery uses its 90-bit functions
+  #endif
+  #if BUILD_FAMILY(FAMILY_BARRETT32) || BUILD_FAMILY(FAMILY_MONTGOMERY)
+    #include "barrett.cl"   // one kernel file for 32-bit-barrett of different vector sizes (1, 2, 4, 8, 16), montgomery uses its 96-bit functions
+  #endif
+
+  #if BUILD_FAMILY(FAMILY_MUL24)
+    #include "mul24.cl" // one kernel file for 24-bit-kernels of different vector sizes (1, 2, 4, 8, 16)
+  #endif
+  #if BUILD_FAMILY(FAMILY_MONTGOMERY)
+    #include "montgomery.cl"  // montgomery kernels
+  #endif
+
+  #if BUILD_FAMILY(FAMILY_MUL24)
+    #define _63BIT_MUL24_K
+    #include "mul24.cl" // include again, now for small factors < 64 bit
+  #endif
 #endif
 
+#if BUILD_FAMILY(FAMILY_BARRETT15)
+
 // this kernel is only used for a quick test at startup - no need to be correct ;-)
 // currently this kernel is used for testing what happens without atomics when multiple factors are found
 __kernel void test_k(const ulong hi, const ulong lo, const ulong q,
@@ -348,3 +380,4 @@ __kernel void test_k(const ulong hi, const ulong lo, const ulong q,
     }
   }
 }
+#endif
@@ -20,6 +20,7 @@ Version 0.15
 
 */
 
+#ifndef CL_GPU_SIEVE
 /*
 The Montgomery reduction algorithm Redc(T) calculates TR^{-1} mod{N} as follows:
 
@@ -219,6 +220,7 @@ bit_max64 is bit_max - 64!
    */
 // second case
 //   while ((exp&0x80000000) == 0) exp<<=1; // shift exp to the very left of the 32 bits
+   exponent = KERNEL_EXPONENT(exponent);   // a constant in the exponent-specialized kernels
    exponent <<= clz(exponent); // shift exp to the very left of the 32 bits
    As = (0 - f) % f;
 
@@ -759,6 +761,7 @@ bit_max64 is bit_max - 64!
 
   ff = as_float(0x3f7ffffd) / ff;
 
+  exponent = KERNEL_EXPONENT(exponent);   // a constant in the exponent-specialized kernels
   exponent <<= clz(exponent); // shift exp to the very left of the 32 bits
 
 #ifndef CHECKS_MODBASECASE
@@ -866,3 +869,322 @@ bit_max64 is bit_max - 64!
   EVAL_RES_90(sf)
 #endif
 }
+
+#endif // CL_GPU_SIEVE
+
+/*
+96-bit impl. (3x32 bit): R = 2^96, for factors below 2^95 so that 2f < R and all
+intermediate values fit into 3 words. The same code runs for CPU and GPU sieve.
+It is slower than the barrett32 kernels, it is only used for 93-95 bit factors
+where no other kernel applies.
+*/
+
+uint_v neginvmod2pow32(const uint_v n)
+/* -1/n mod 2^32 for odd n */
+{
+  uint_v r;
+  // (3*n) XOR 2 is the correct inverse modulo 32 (5 bits),
+  // then run 3 Newton iterations, the last one also negates the result.
+  r = (n * 3u) ^ 2;
+
+  r = r * (2 - r * n);
+  r = r * (2 - r * n);
+  return r * (r * n - 2);
+}
+
+int96_v sub_if_gte_96(const int96_v a, const int96_v b)
+/* return (a>=b)?a-b:a */
+{
+  __private int96_v tmp;
+  __private uint_v  borrow;
+
+  tmp.d0 = a.d0 - b.d0;
+  borrow = AS_UINT_V(b.d0 > a.d0);
+  tmp.d1 = a.d1 - b.d1 + borrow;
+  borrow = AS_UINT_V((tmp.d1 > a.d1) || (borrow && AS_UINT_V(tmp.d1 == a.d1)));
+  tmp.d2 = a.d2 - b.d2 + borrow;
+  borrow = AS_UINT_V((tmp.d2 > a.d2) || (borrow && AS_UINT_V(tmp.d2 == a.d2)));  // -1 if a < b
+
+  tmp.d0 = (borrow) ? a.d0 : tmp.d0;
+  tmp.d1 = (borrow) ? a.d1 : tmp.d1;
+  tmp.d2 = (borrow) ? a.d2 : tmp.d2;
+
+  return tmp;
+}
+
+int96_v shl_mod_96(int96_v a, const int96_v f)
+/* 2a mod f for a < f < 2^95 (mul by 2 in montgomery representation) */
+{
+  shl_96(&a);
+  return sub_if_gte_96(a, f);
+}
+
+void redc_step_96(int192_v * const t, const int96_v f, const uint_v f_inv)
+/* one word of the montgomery reduction: t = (t + m*f) / 2^32 with m = t.d0 * f_inv mod 2^32.
+   m is chosen so that the lowest word of the sum is 0, the result is shifted down one word. */
+{
+  __private uint_v m, tmp, carry;
+
+  m      = t->d0 * f_inv;
+
+  // t.d0 + m*f.d0 = 0 mod 2^32: this carries unless t.d0 is 0
+  tmp    = mul_hi(m, f.d0) - AS_UINT_V(t->d0 != 0);  // mul_hi(m, f.d0) <= 2^32-2: no overflow
+  t->d0  = t->d1 + tmp;
+  carry  = 0 - AS_UINT_V(tmp > t->d0);
+  tmp    = m * f.d1;
+  t->d0 += tmp;
+  carry -= AS_UINT_V(tmp > t->d0);
+
+  t->d1  = t->d2 + carry;
+  carry  = 0 - AS_UINT_V(carry > t->d1);
+  tmp    = mul_hi(m, f.d1);
+  t->d1 += tmp;
+  carry -= AS_UINT_V(tmp > t->d1);
+  tmp    = m * f.d2;
+  t->d1 += tmp;
+  carry -= AS_UINT_V(tmp > t->d1);
+
+  t->d2  = t->d3 + carry;
+  carry  = 0 - AS_UINT_V(carry > t->d2);
+  tmp    = mul_hi(m, f.d2);
+  t->d2 += tmp;
+  carry -= AS_UINT_V(tmp > t->d2);
+
+  t->d3  = t->d4 + carry;
+  carry  = 0 - AS_UINT_V(carry > t->d3);
+  t->d4  = t->d5 + carry;
+  t->d5  = 0;
+}
+
+int96_v squaremod_REDC96(const int96_v x, const int96_v f, const uint_v f_inv)
+/* x^2 / R mod f for x < f < 2^95 */
+{
+  __private int192_v t;
+  __private int96_v  r;
+
+  square_96_192(&t, x);
+  redc_step_96(&t, f, f_inv);
+  redc_step_96(&t, f, f_inv);
+  redc_step_96(&t, f, f_inv);
+
+  // t = (x^2 + m*f) / R < (f^2 + R*f) / R < 2f < R: fits into 3 words
+  r.d0 = t.d0;
+  r.d1 = t.d1;
+  r.d2 = t.d2;
+
+  return sub_if_gte_96(r, f);
+}
+
+int96_v mod_REDC96(const int96_v x, const int96_v f, const uint_v f_inv)
+/* x / R mod f, converts x back from montgomery representation */
+{
+  __private int192_v t = {x.d0, x.d1, x.d2, 0, 0, 0};
+  __private int96_v  r;
+
+  redc_step_96(&t, f, f_inv);
+  redc_step_96(&t, f, f_inv);
+  redc_step_96(&t, f, f_inv);
+
+  // t = (x + m*f) / R < (f + R*f) / R: t <= f, t == f only for x == 0 mod f, which can't happen here
+  r.d0 = t.d0;
+  r.d1 = t.d1;
+  r.d2 = t.d2;
+
+  return r;
+}
+
+void check_mg96(uint exponent, const int96_v f, const uint tid, __global uint * restrict RES)
+/* calculates 2^exponent mod f using montgomery multiplication and reports f if the result is 1 */
+{
+  __private int96_v As, a;
+  __private uint_v  f_inv;
+  __private uint    i;
+
+  f_inv = neginvmod2pow32(f.d0);
+
+  exponent = KERNEL_EXPONENT(exponent);   // a constant in the exponent-specialized kernels
+  exponent <<= clz(exponent);             // shift exp to the very left of the 32 bits
+
+  /* the leading 4 bits of the exponent (8..15, no exp below 2^10) are handled by the start value
+     As = 2^(exp>>28) * R mod f, which is calculated by doubling 2^62 (less than any factor
+     tested by this kernel) 34 + (exp>>28) times. This saves the first 3 squarings. */
+  As.d0 = 0;
+  As.d1 = 0x40000000;
+  As.d2 = 0;
+  for (i = (exponent >> 28) + 34; i > 0; i--)
+  {
+    As = shl_mod_96(As, f);
+  }
+  exponent <<= 4;
+
+  while(exponent)                         // the exponent is odd: this processes all remaining bits
+  {
+    As = squaremod_REDC96(As, f, f_inv);  // square
+    if (exponent & 0x80000000) As = shl_mod_96(As, f);  // mul by 2
+    exponent <<= 1;
+  }
+
+  a = mod_REDC96(As, f, f_inv);
+
+#if (TRACE_KERNEL > 1)
+  if (tid==TRACE_TID) printf((__constant char *)"check_mg96: f=%x:%x:%x, f_inv=%x, As=%x:%x:%x, a=%x:%x:%x\n",
+        V(f.d2), V(f.d1), V(f.d0), V(f_inv), V(As.d2), V(As.d1), V(As.d0), V(a.d2), V(a.d1), V(a.d0));
+#endif
+
+  check_big_factor96(f, a, RES);
+}
+
+#ifndef CL_GPU_SIEVE
+__kernel void __attribute__((work_group_size_hint(256, 1, 1))) cl_mg96(__private uint exponent, const int96_t k_base, const __global uint * restrict k_tab, const int shiftcount,
+#ifdef WA_FOR_CATALYST11_10_BUG
+                           const uint8 b_in,
+#else
+                           __private int192_t bb,
+#endif
+                           __global uint * restrict RES, const int bit_max65
+                           MODBASECASE_PAR_DEF         )
+/*
+shiftcount, bb and bit_max65 are set up by the host for the barrett kernels, they are not needed here:
+the montgomery kernel starts with the full exponent
+*/
+{
+  __private int96_v f;
+  __private uint    tid;
+
+	tid = mad24((uint)get_group_id(0), (uint)get_local_size(0), (uint)get_local_id(0)) * VECTOR_SIZE;
+
+  calculate_FC32(exponent, tid, k_tab, k_base, &f);
+
+#if (TRACE_KERNEL > 1)
+  if (tid==TRACE_TID) printf((__constant char *)"cl_mg96: exp=%d, f=%x:%x:%x\n",
+        exponent, V(f.d2), V(f.d1), V(f.d0));
+#endif
+
+  check_mg96(exponent, f, tid, RES);
+}
+
+#else
+
+__kernel void cl_mg96_gs(__private uint exponent, const int96_t k_base,
+                                 const __global uint * restrict bit_array,
+                                 const uint bits_to_process, __local ushort *smem,
+                                 const int shiftcount,
+#ifdef WA_FOR_CATALYST11_10_BUG
+                                 const uint8 b_in,
+#else
+                                 __private int192_t bb,
+#endif
+                                 __global uint * restrict RES, const int bit_max65,
+                                 const uint shared_mem_allocated // only used to verify assumptions
+                                 MODBASECASE_PAR_DEF         )
+/*
+shiftcount, bb and bit_max65 are set up by the host for the barrett kernels, they are not needed here
+*/
+{
+  __private uint     i, total_bit_count;
+  __local   ushort   bitcount[256];	// Each thread of our block puts bit-counts here
+  __private int96_v  my_k_base, f;
+  __private uint     tid, lid=get_local_id(0);
+  __private uint_v   tmp_v;
+#ifdef INTEL
+  // WA for another bug
+  uint num_c;
+#endif
+
+tid = mad24((uint)get_group_id(0), (uint)get_local_size(0), lid);
+
+#if (TRACE_SIEVE_KERNEL > 0)
+    if (lid==TRACE_SIEVE_TID) printf((__constant char *)"cl_mg96_gs: exp=%d=%#x, k=%x:%x:%x, bits=%d, base addr=%#x\n",
+        exponent, exponent, k_base.d2, k_base.d1, k_base.d0, bits_to_process, bit_array);
+#endif
+
+  // extract the bits set in bit_array into smem and get the total count (call to gpusieve.cl)
+  total_bit_count = extract_bits(bits_to_process, tid, lid, bitcount, smem, bit_array);
+
+#ifdef INTEL
+  // WA for another bug
+  num_c = NUM_CLASSES % (total_bit_count + 1000000);
+#endif
+
+  for (i = lid*VECTOR_SIZE; i < total_bit_count; i += 256*VECTOR_SIZE) // VECTOR_SIZE*THREADS_PER_BLOCK
+  {
+    // if i == total_bit_count-1, then we may read up to VECTOR_SIZE-1 elements beyond the array (uninitialized).
+    // this can result in the same factor being reported up to VECTOR_SIZE times.
+
+    uint_v k_delta;
+
+// Get the (k - k_base) value to test
+
+#if (VECTOR_SIZE == 1)
+    k_delta = mad24(bits_to_process, (uint)get_group_id(0), (uint)(smem[i]));
+#elif (VECTOR_SIZE == 2)
+    k_delta.s0 = mad24(bits_to_process, (uint)get_group_id(0), (uint)(smem[i]));
+    k_delta.s1 = mad24(bits_to_process, (uint)get_group_id(0), (uint)(smem[i+1]));
+#elif (VECTOR_SIZE == 3)
+    k_delta.s0 = mad24(bits_to_process, (uint)get_group_id(0), (uint)(smem[i]));
+    k_delta.s1 = mad24(bits_to_process, (uint)get_group_id(0), (uint)(smem[i+1]));
+    k_delta.s2 = mad24(bits_to_process, (uint)get_group_id(0), (uint)(smem[i+2]));
+#elif (VECTOR_SIZE == 4)
+    k_delta.s0 = mad24(bits_to_process, (uint)get_group_id(0), (uint)(smem[i]));
+    k_delta.s1 = mad24(bits_to_process, (uint)get_group_id(0), (uint)(smem[i+1]));
+    k_delta.s2 = mad24(bits_to_process, (uint)get_group_id(0), (uint)(smem[i+2]));
+    k_delta.s3 = mad24(bits_to_process, (uint)get_group_id(0), (uint)(smem[i+3]));
+#elif (VECTOR_SIZE == 8)
+    k_delta.s0 = mad24(bits_to_process, (uint)get_group_id(0), (uint)(smem[i]));
+    k_delta.s1 = mad24(bits_to_process, (uint)get_group_id(0), (uint)(smem[i+1]));
+    k_delta.s2 = mad24(bits_to_process, (uint)get_group_id(0), (uint)(smem[i+2]));
+    k_delta.s3 = mad24(bits_to_process, (uint)get_group_id(0), (uint)(smem[i+3]));
+    k_delta.s4 = mad24(bits_to_process, (uint)get_group_id(0), (uint)(smem[i+4]));
+    k_delta.s5 = mad24(bits_to_process, (uint)get_group_id(0), (uint)(smem[i+5]));
+    k_delta.s6 = mad24(bits_to_process, (uint)get_group_id(0), (uint)(smem[i+6]));
+    k_delta.s7 = mad24(bits_to_process, (uint)get_group_id(0), (uint)(smem[i+7]));
+#elif (VECTOR_SIZE == 16)
+    k_delta.s0 = mad24(bits_to_process, (uint)get_group_id(0), (uint)(smem[i]));
+    k_delta.s1 = mad24(bits_to_process, (uint)get_group_id(0), (uint)(smem[i+1]));
+    k_delta.s2 = mad24(bits_to_process, (uint)get_group_id(0), (uint)(smem[i+2]));
+    k_delta.s3 = mad24(bits_to_process, (uint)get_group_id(0), (uint)(smem[i+3]));
+    k_delta.s4 = mad24(bits_to_process, (uint)get_group_id(0), (uint)(smem[i+4]));
+    k_delta.s5 = mad24(bits_to_process, (uint)get_group_id(0), (uint)(smem[i+5]));
+    k_delta.s6 = mad24(bits_to_process, (uint)get_group_id(0), (uint)(smem[i+6]));
+    k_delta.s7 = mad24(bits_to_process, (uint)get_group_id(0), (uint)(smem[i+7]));
+    k_delta.s8 = mad24(bits_to_process, (uint)get_group_id(0), (uint)(smem[i+8]));
+    k_delta.s9 = mad24(bits_to_process, (uint)get_group_id(0), (uint)(smem[i+9]));
+    k_delta.sa = mad24(bits_to_process, (uint)get_group_id(0), (uint)(smem[i+10]));
+    k_delta.sb = mad24(bits_to_process, (uint)get_group_id(0), (uint)(smem[i+11]));
+    k_delta.sc = mad24(bits_to_process, (uint)get_group_id(0), (uint)(smem[i+12]));
+    k_delta.sd = mad24(bits_to_process, (uint)get_group_id(0), (uint)(smem[i+13]));
+    k_delta.se = mad24(bits_to_process, (uint)get_group_id(0), (uint)(smem[i+14]));
+    k_delta.sf = mad24(bits_to_process, (uint)get_group_id(0), (uint)(smem[i+15]));
+#endif
+
+// Compute new f.  This is computed as f = f_base + 2 * (k - k_base) * exp.
+
+#ifdef INTEL
+  // WA for another bug
+    my_k_base.d0 = k_base.d0 + num_c * k_delta;  // k_delta can exceed 2^24: don't use mul24/mad24 for it
+    my_k_base.d1 = k_base.d1 + mul_hi(num_c, k_delta) - AS_UINT_V(k_base.d0 > my_k_base.d0);	/* k is limited to 2^64 -1 so there is no need for k.d2 */
+#else
+    my_k_base.d0 = k_base.d0 + NUM_CLASSES * k_delta;  // k_delta can exceed 2^24: don't use mul24/mad24 for it
+    my_k_base.d1 = k_base.d1 + mul_hi(NUM_CLASSES, k_delta) - AS_UINT_V(k_base.d0 > my_k_base.d0);	/* k is limited to 2^64 -1 so there is no need for k.d2 */
+#endif
+
+    f.d0   = my_k_base.d0 * exponent;
+    tmp_v  = mul_hi(my_k_base.d0, exponent);
+    f.d1   = my_k_base.d1 * exponent + tmp_v;
+    f.d2   = mul_hi(my_k_base.d1, exponent) - AS_UINT_V(f.d1 < tmp_v);
+
+    // Compute f = 2 * k * exp + 1
+    f.d2 = amd_bitalign(f.d2, f.d1, 31);
+    f.d1 = amd_bitalign(f.d1, f.d0, 31);
+    f.d0 = (f.d0 << 1) + 1;
+
+#if (TRACE_KERNEL > 1)
+    if (tid==TRACE_TID)
+       printf((__constant char *)"cl_mg96_gs: lid=%u, tid=%u, gid=%u, smem[%u]=%u, k_delta=%u, f=%x:%x:%x\n",
+        lid, tid, get_group_id(0), i, smem[i], V(k_delta), V(f.d2), V(f.d1), V(f.d0));
+#endif
+
+    check_mg96(exponent, f, tid, RES);
+  }
+}
+#endif
@@ -750,7 +750,7 @@ Precalculated here since it is the same for all steps in the following loop */
                    , modbasecase_debug
 #endif
                    );			// a = b mod f
-  exp<<= 32 - shiftcount;
+  exp = EXP_SHIFTER(exp, shiftcount);
   while(exp)
   {
     if(exp&0x80000000)square_72_144_shl(&b,a);	// b = 2 * a^2 ("optional multiply by 2" in Prime 95 documentation)
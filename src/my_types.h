@@ -129,14 +129,17 @@ enum GPUKernels
   BARRETT83_MUL15,
   BARRETT82_MUL15,
   BARRETT74_MUL15,
+  MG96,                  // last one with a GPU-sieve version
   MG62,
   MG88,
   UNKNOWN_KERNEL, /* what comes after this one will not be loaded automatically*/
   _64BIT_64_OpenCL,
   BARRETT92_64_OpenCL,
+  BARRETT69_MUL15_BULK,  // loaded if bulk mode (BulkExponents) is enabled
   CL_CALC_BIT_TO_CLEAR,  // loaded if GPU sieving enabled
   CL_CALC_MOD_INV,       // loaded if GPU sieving enabled
   CL_SIEVE,              // loaded if GPU sieving enabled
+  CL_CALC_BIT_TO_CLEAR_ADV, // loaded if GPU sieving enabled
   BARRETT79_MUL32_GS,
   BARRETT77_MUL32_GS,
   BARRETT76_MUL32_GS,
@@ -151,6 +154,7 @@ enum GPUKernels
   BARRETT83_MUL15_GS,
   BARRETT82_MUL15_GS,
   BARRETT74_MUL15_GS,
+  MG96_GS,
   UNKNOWN_GS_KERNEL  /* not yet there */
 };
 
@@ -215,8 +219,11 @@ typedef struct _stats_t
   char     progressformat[256];       /* userconfigureable progress line */
   cl_uint  class_number;              /* the number of the last processed class */
   cl_uint  grid_count;                /* number of grids processed in the last processed class */
+  cl_uint  grid_size;                 /* CPU sieve: threads per grid of the last processed class */
   cl_ulong class_time;                /* time (in ms) needed to process the last processed class */
   cl_ulong cpu_wait_time;             /* time (ms) CPU was waiting for the GPU */
+  cl_ulong stream_wait_time[NUM_STREAMS_MAX];  /* time (us) CPU was waiting for each stream */
+  cl_uint  stream_wait_count[NUM_STREAMS_MAX]; /* number of those waits */
   float    cpu_wait;                  /* percentage CPU was waiting for the GPU */
   cl_uint  output_counter;            /* count how often the status line was written since last headline */
   cl_uint  class_counter;             /* number of finished classes of the current job */
@@ -232,11 +239,16 @@ typedef struct _mystuff_t
   cl_mem   d_ktab[NUM_STREAMS_MAX];
   cl_uint *h_RES;
   cl_mem   d_RES;
+  cl_uint *h_RES_next;                      /* CPU sieve: results of the class started ahead */
+  cl_mem   d_RES_next;
   enum STREAM_STATUS stream_status[NUM_STREAMS_MAX];
   enum GPU_types gpu_type;
   /* for GPU sieving: */
-  cl_uint *h_bitarray;
-  cl_mem   d_bitarray;
+  cl_uint *h_bitarray;                      /* the bit array of the current sieve block, */
+  cl_mem   d_bitarray;                      /* one of the following: */
+  cl_uint *h_bitarrays[GPU_SIEVE_BUFFERS_MAX];
+  cl_mem   d_bitarrays[GPU_SIEVE_BUFFERS_MAX];
+  cl_uint  gpu_sieve_buffer;                /* index of the current bit array */
   cl_uint *h_sieve_info;
   cl_mem   d_sieve_info;
   cl_uint *h_calc_bit_to_clear_info;
@@ -255,18 +267,35 @@ typedef struct _mystuff_t
   cl_uint  sieve_primes_upper_limit;        /* the upper limit of sieve_primes for the current exponent */
   cl_uint  sieve_primes_min, sieve_primes_max; /* user configureable sieve_primes min/max */
   cl_uint  sieve_size;
+  cl_uint  sieve_threads;                   /* number of CPU threads for the CPU sieve */
+  cl_uint  sieve_producer;                  /* 1: the CPU sieve runs in its own thread, see sieve_producer.c */
+  cl_uint  huge_pages;                      /* HugePages: 0 off, 1 transparent, 2 explicit, see mem_alloc.h */
 
   cl_uint  gpu_sieving;			             /* TRUE if we're letting the GPU do the sieving */
   cl_uint  gpu_sieve_size;			         /* Size (in bits) of the GPU sieve.  4..128M bits. */
+  cl_uint  gpu_sieve_size_alloc;         /* size of the bit arrays, >= gpu_sieve_size (GridAdjust) */
   cl_uint  gpu_sieve_primes;             /* the actual number of primes using for sieving */
   cl_uint  gpu_sieve_processing_size;	   /* The number of GPU sieve bits each thread in a kernel will process.  8,16,24,32K bits. */
+  cl_uint  gpu_sieve_buffers;            /* number of GPU sieve bit arrays, >1: sieve the next block during TF */
+  cl_uint  gpu_sieve_host;               /* 0: GPU sieve kernels, 1: sieve on the host and upload, 2: verify the GPU sieve on the host */
+  cl_uint  gpu_sieve_host_threads;       /* CPU threads of the host GPU sieve, 0: one per CPU */
 
   cl_uint  flush;                        /* GPU sieving only: flush the queue after # kernels, 0=off */
   cl_uint  num_streams;
+  cl_uint  num_streams_active;           /* CPU sieve: max. number of busy streams, <= num_streams (GridAdjust) */
+  cl_uint  grid_adjust;                  /* 1: adjust threads_per_grid (gpu_sieve_size) and num_streams_active between classes (GridAdjust) */
+  cl_uint  grid_time, queue_time;        /* GridAdjust targets: ms per grid, ms of queued GPU work */
+  cl_uint  wait_spin;                    /* us to spin on a busy stream before blocking (StreamWaitSpin) */
+  cl_uint  zero_copy;                    /* 1: h_ktab[] is device-accessible host memory, no upload (ZeroCopyKtab) */
+  cl_uint  copy_queue;                   /* 1: the k_tab uploads use their own command queue (CopyQueue) */
+  cl_uint  split_device;                 /* >1: split the device into this many sub-devices (SplitDevice) */
+  cl_uint  dev_index;                    /* index into the list of devices, 0 for the main thread */
+  cl_uint  bulk_exponents;               /* >1: trial factor up to this many assignments together (BulkExponents) */
   
   enum MODES mode;
   cl_uint checkpoints, checkpointdelay, stages, stopafterfactor;
   cl_uint threads_per_grid_max, threads_per_grid;
+  cl_uint threads_per_grid_alloc;        /* size of the k_tabs, >= threads_per_grid */
 
 #ifdef CHECKS_MODBASECASE
   cl_mem   d_modbasecase_debug;
@@ -277,6 +306,7 @@ typedef struct _mystuff_t
   cl_uint  printmode;
 //  cl_uint  allowsleep;    // not used in mfakto (yet)
   cl_uint  small_exp;
+  cl_uint  exponent_kernels; /* 1: build kernels specialized for the current exponent (ExponentKernels) */
   cl_uint  print_timestamp;
   cl_uint  quit;
   cl_ulong cpu_mask;         /* CPU affinity mask for the siever thread */
@@ -293,6 +323,8 @@ typedef struct _mystuff_t
   char ComputerID[51];       /* currently only used for screen/result output */
   char CompileOptions[151];  /* additional compile options */
   char binfile[51];          /* compiled kernels file to use, empty if not desired */
+  char gpu_sieve_cachefile[51]; /* GPU sieve tables cache file, empty if not desired */
+  char kernel_cache_dir[51];  /* directory of compiled kernel binaries (KernelCacheDir), empty if not desired */
 
 }mystuff_t;			/* FIXME: proper name needed */
 
@@ -300,10 +332,34 @@ typedef struct
 {
     char d_name[128], d_ver[128], v_name[128], dr_version[128], exts[2048];
     cl_ulong gl_cache, gl_mem, l_mem;
+    cl_ulong svm_caps;                   /* CL_DEVICE_SVM_CAPABILITIES, 0 for OpenCL < 2.0 */
+    cl_bool  host_unified;               /* CL_DEVICE_HOST_UNIFIED_MEMORY */
     cl_uint max_clock, units, w_dim;
     size_t wg_size, wi_sizes[10], maxThreadsPerBlock, maxThreadsPerGrid;
 } OpenCL_deviceinfo_t;
 
+/* bulk mode: the parameters of one work group of cl_barrett15_69_bulk,
+   must match bulk_block_t in datatypes.h */
+typedef struct _bulk_block_t
+{
+  cl_uint exponent;
+  cl_uint shiftcount;
+  cl_uint res_index;       /* the factors are reported in RES[32*res_index ...] */
+  cl_int  bit_max65;
+  int75   k_base;
+  cl_uint b_in[8];
+  cl_uint pad[3];
+} bulk_block_t;
+
+/* bulk mode: one exponent, trial factored from 2^bit_min to 2^(bit_min+1) */
+typedef struct _bulk_exponent_t
+{
+  cl_uint  exponent;
+  cl_int   bit_min;
+  cl_ulong k_min, k_max;   /* k_min is in class 0 */
+  cl_uint  factorsfound;
+} bulk_exponent_t;
+
 typedef struct _kernel_info
 {
   enum GPUKernels kernel_id;
@@ -43,6 +43,7 @@ void print_help(char *string)
   printf("  -h|--help              display this help\n");
   printf("  -d <xy>                specify to use OpenCL platform number x and\n");
   printf("                         device number y in this program\n");
+  printf("  -d <xy>,<z>,...        use several devices of platform x (needs SieveOnGPU=1)\n");
   printf("  -d c                   force using all CPUs\n");
   printf("  -d g                   force using the first GPU\n");
   printf("  -v <n>                 verbosity level: 0=terse, 1=normal, 2=verbose, 3=debug\n");
@@ -260,10 +261,10 @@ void print_status_line(mystuff_t *mystuff)
           else
             index += sprintf(buffer + index, "%6.2fG", (double)mystuff->stats.grid_count * mystuff->gpu_sieve_processing_size / 1000000000.0);
         } else {					// CPU sieving
-          if(((unsigned long long int)mystuff->threads_per_grid * (unsigned long long int)mystuff->stats.grid_count) < 1000000000ULL)
-            index += sprintf(buffer + index, "%6.2fM", (double)mystuff->threads_per_grid * (double)mystuff->stats.grid_count / 1000000.0);
+          if(((unsigned long long int)mystuff->stats.grid_size * (unsigned long long int)mystuff->stats.grid_count) < 1000000000ULL)
+            index += sprintf(buffer + index, "%6.2fM", (double)mystuff->stats.grid_size * (double)mystuff->stats.grid_count / 1000000.0);
           else
-            index += sprintf(buffer + index, "%6.2fG", (double)mystuff->threads_per_grid * (double)mystuff->stats.grid_count / 1000000000.0);
+            index += sprintf(buffer + index, "%6.2fG", (double)mystuff->stats.grid_size * (double)mystuff->stats.grid_count / 1000000000.0);
         }
       }
       else if(mystuff->stats.progressformat[i+1] == 'r') // FC rate
@@ -271,7 +272,7 @@ void print_status_line(mystuff_t *mystuff)
         if (mystuff->gpu_sieving == 1)
           val = (double)mystuff->stats.grid_count * mystuff->gpu_sieve_processing_size / ((double)mystuff->stats.class_time * 1000.0);
         else						// CPU sieving
-          val = (double)mystuff->threads_per_grid * (double)mystuff->stats.grid_count / ((double)mystuff->stats.class_time * 1000.0);
+          val = (double)mystuff->stats.grid_size * (double)mystuff->stats.grid_count / ((double)mystuff->stats.class_time * 1000.0);
 
         if(val <= 999.99f) index += sprintf(buffer + index, "%6.2f", val);
         else               index += sprintf(buffer + index, "%6.1f", val);
@@ -33,12 +33,13 @@ This is just the upper LIMIT of the SIEVE_SIZE, the actual sieve size depends
 on some other factors as well, but you don't have to worry about.
 
 If this #define is not set, an ini-file key SieveSizeLimit will be evaluated to
-set it. This allows for adjusting the SieveSize, but may be up to 3% slower
-than an equal SIEVE_SIZE_LIMIT #define.
+set it. This allows for adjusting the SieveSize. sieve.c has variants of the
+sieve for the common sizes (12 ... 512 kiB) which are as fast as an equal
+SIEVE_SIZE_LIMIT #define, other sizes may be up to 3% slower.
 
 */
 
-#define SIEVE_SIZE_LIMIT 36
+//#define SIEVE_SIZE_LIMIT 36
 
 
 /* EXTENDED_SELFTEST will add about 30k additional tests to the -st and -st2 tests */
@@ -53,6 +54,11 @@ than an equal SIEVE_SIZE_LIMIT #define.
 //#define VERBOSE_SIEVE_TIMING
 
 
+/* extract the survivors of the CPU sieve only with the portable table lookup,
+even if the CPU supports BMI, AVX2 or AVX-512 */
+//#define SIEVE_EXTRACT_SCALAR
+
+
 /* do some checks on the mod/div routines */
 //#define CHECKS_MODBASECASE
 
@@ -166,11 +172,45 @@ Needs to be less than SIEVE_PRIMES_MIN.*/
 #define SIEVE_SPLIT 250 /* DO NOT CHANGE! */
 
 
+/* the primes from 29 up to SIEVE_PATTERN_MAX are not crossed off bit by bit
+but removed from each segment by ANDing precomputed repeating word patterns.
+Above ~128 the pattern needs more memory operations than the bits it
+clears. */
+
+#define SIEVE_PATTERN_MAX 127
+
+
+/* SieveThreads in mfakto.ini sets the number of CPU threads sharing the work
+of the CPU sieve. Each thread sieves SIEVE_THREAD_SEGMENTS consecutive
+segments of SIEVE_SIZE bits at a time, more segments mean less
+synchronization but more memory per thread. */
+
+#define SIEVE_THREADS_MAX     32
+#define SIEVE_THREAD_SEGMENTS  4
+
+
+/* SieveProducerThread=1 moves the CPU sieve into its own thread which fills
+the k_tab buffers while the main thread submits them to the GPU. A thread
+waiting for the other one (no free buffer / next buffer not yet sieved)
+checks SIEVE_PRODUCER_SPIN times before it blocks until the other thread
+changes the buffer state. */
+
+#define SIEVE_PRODUCER_SPIN 1000
+
+
+/* BulkExponents in mfakto.ini: up to this many assignments of the same bit
+level are trial factored together in bulk mode (CPU sieve only). */
+
+#define BULK_EXPONENTS_MAX   128
+
+
 #ifdef CL_PERFORMANCE_INFO
 #define QUEUE commandQueuePrf
 #else
 #define QUEUE commandQueue
 #endif
+/* the queue for the GPU sieve kernels: separate only with GPUSieveBuffers > 1 */
+#define SIEVE_QUEUE (sieveQueue ? sieveQueue : QUEUE)
 /*
 The number of streams used by mfakto. No distinction between CPU and GPU streams anymore
 The actual configuration is done in mfakto.ini. This ini-file contains
@@ -182,6 +222,48 @@ The following lines define the min, default and max value.
 #define NUM_STREAMS_DEFAULT 3 /* DO NOT CHANGE! */
 #define NUM_STREAMS_MAX     10 /* DO NOT CHANGE! */
 
+/*
+StreamWaitSpin in mfakto.ini: microseconds to spin on the completion of a
+busy stream before sleeping until the OpenCL runtime reports it (CPU sieve).
+*/
+
+#define STREAM_WAIT_SPIN_DEFAULT 100
+#define STREAM_WAIT_SPIN_MAX     1000000
+
+/*
+GridAdjust in mfakto.ini: with the CPU sieve, the grid size is adjusted
+between GRID_ADJUST_MIN and GRID_ADJUST_MAX threads per grid (the k_tab
+buffers are allocated for GRID_ADJUST_MAX then) so that a grid takes GridTime
+ms, and the number of active streams so that QueueTime ms of GPU work are
+queued. With the GPU sieve, the GPU sieve size is adjusted between
+GPU_SIEVE_SIZE_MIN and GPU_SIEVE_SIZE_MAX M bits instead.
+The grid size is only changed if it differs by more than 1/GRID_ADJUST_STEP
+and never by more than a factor of 2 at once.
+*/
+
+#define GRID_ADJUST_MIN       65536
+#define GRID_ADJUST_MAX     2097152
+#define GRID_ADJUST_STEP          8
+#define GRID_TIME_DEFAULT        10
+#define GRID_TIME_MAX          1000
+#define QUEUE_TIME_DEFAULT       30
+#define QUEUE_TIME_MAX        10000
+
+/*
+The maximum number of OpenCL devices (or sub-devices, see SplitDevice in
+mfakto.ini) a single mfakto process drives, each one by its own thread.
+*/
+
+#define NUM_DEVICES_MAX     8
+
+/*
+EXP_PROGRAM_CACHE is the number of exponent-specialized kernel programs
+(ExponentKernels in mfakto.ini) kept in memory. Each one is a complete build
+of the kernel file, the least recently used one is released first.
+*/
+
+#define EXP_PROGRAM_CACHE   4
+
 // MORE_CLASSES and SIEVE_SIZE are used for CPU-sieving only. GPU-sieving uses a config setting
 /* set NUM_CLASSES and SIEVE_SIZE depending on MORE_CLASSES and SIEVE_SIZE_LIMIT
    MORE_CLASSES is required for mfakto's CPU sieve */
@@ -222,3 +304,13 @@ The following lines define the min, default and max value.
 #define GPU_SIEVE_PROCESS_SIZE_DEFAULT      16 /* Default is processing 16K bits */
 #define GPU_SIEVE_PROCESS_SIZE_MAX          32 /* Upper limit is 64K, since we store k values as "short". Shared memory requirements limit usable values */
 
+/*
+GPU_SIEVE_BUFFERS is the number of GPU sieve bit arrays (GPUSieveBuffers in mfakto.ini).
+With more than one, the sieve kernels run on their own command queue and fill the
+next bit array while the TF kernel still processes the current one.
+*/
+
+#define GPU_SIEVE_BUFFERS_MIN                1 /* one bit array: sieving and TF strictly alternate */
+#define GPU_SIEVE_BUFFERS_DEFAULT            2 /* double buffering */
+#define GPU_SIEVE_BUFFERS_MAX                4
+
@@ -317,6 +317,58 @@ enum ASSIGNMENT_ERRORS get_next_assignment(char *filename, unsigned int *exponen
 }
 
 
+/************************************************************************************************************
+ * Function name : get_bulk_assignments                                                                     *
+ *   													    *
+ *     INPUT  :	char *filename										    *
+ *		struct ASSIGNMENT *list	- room for max assignments					    *
+ *		int max											    *
+ *		int *count		- number of assignments returned in list			    *
+ *     OUTPUT :                                        							    *
+ *                                                                                                          *
+ *     the first valid assignment and up to max-1 further ones with the same bit_min (bulk mode), each     *
+ *     exponent only once                                                                                   *
+ *     0 - OK												    *
+ *     1 - get_bulk_assignments : cannot open file							    *
+ *     2 - get_bulk_assignments : no valid assignment found						    *
+ ************************************************************************************************************/
+enum ASSIGNMENT_ERRORS get_bulk_assignments(char *filename, struct ASSIGNMENT *list, int max, int *count, int verbosity)
+{
+  FILE *f_in;
+  enum PARSE_WARNINGS value;
+  char *tail;
+  LINE_BUFFER line;
+  int i;
+
+  *count = 0;
+  process_add_file(filename);
+  f_in = fopen_and_lock(filename, "r");
+  if(f_in == NULL)
+  {
+    printf("Can't open workfile %s\n", filename);
+    return CANT_OPEN_FILE;
+  }
+  while(*count < max)
+  {
+    value = parse_worktodo_line(f_in, &list[*count], &line, &tail);
+    if (END_OF_FILE == value)
+      break;
+    if (NO_WARNING != value)
+      continue;   // get_next_assignment() has already reported the invalid lines
+    if (!valid_assignment(list[*count].exponent, list[*count].bit_min, list[*count].bit_max, verbosity))
+      continue;
+    if ((*count > 0) && (list[*count].bit_min != list[0].bit_min))
+      continue;
+    for (i = 0; (i < *count) && (list[i].exponent != list[*count].exponent); i++);
+    if (i == *count)
+      (*count)++;
+  }
+  unlock_and_fclose(f_in);
+
+  return (*count > 0) ? OK : VALID_ASSIGNMENT_NOT_FOUND;
+}
+
+
 /************************************************************************************************************
  * Function name : clear_assignment                                                                         *
  *   													    *
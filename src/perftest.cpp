@@ -36,6 +36,8 @@ along with mfaktc (mfakto).  If not, see <http://www.gnu.org/licenses/>.
 #include "mfakto.h"
 #include "output.h"
 #include "gpusieve.h"
+#include "threads.h"
+#include "mem_alloc.h"
 #ifndef _MSC_VER
 #include <sys/time.h>
 #else
@@ -44,14 +46,14 @@ along with mfaktc (mfakto).  If not, see <http://www.gnu.org/licenses/>.
 #define localtime _localtime64
 #endif
 
-extern "C" mystuff_t            mystuff;
-extern "C" OpenCL_deviceinfo_t  deviceinfo;
-extern "C" kernel_info_t        kernel_info[];
-extern cl_command_queue         commandQueue, commandQueuePrf;
+extern "C" THREAD_LOCAL mystuff_t            mystuff;
+extern "C" THREAD_LOCAL OpenCL_deviceinfo_t  deviceinfo;
+extern "C" THREAD_LOCAL kernel_info_t        kernel_info[];
+extern THREAD_LOCAL cl_command_queue         commandQueue, commandQueuePrf, sieveQueue;
 extern cl_context               context;
 extern cl_device_id            *devices;
 extern cl_program               program;
-extern cl_uint                  new_class;
+extern THREAD_LOCAL cl_uint      new_class;
 extern int run_gs_kernel15(cl_kernel kernel, cl_uint numblocks, cl_uint shared_mem_required, int75 k_base, cl_uint8 b_in, cl_uint shiftcount);
 extern int run_gs_kernel32(cl_kernel kernel, cl_uint numblocks, cl_uint shared_mem_required, int96 k_base, int192 b_preinit, cl_uint shiftcount);
 extern int run_kernel15(cl_kernel l_kernel, cl_uint exp, int75 k_base, int stream, cl_uint8 b_in, cl_mem res, cl_int shiftcount, cl_int bin_max);
@@ -67,6 +69,7 @@ int init_perftest(int devicenumber)
 {
   cl_uint i;
   read_config(&mystuff); // to read VECTOR_SIZE and all defaults
+  mystuff.huge_pages = mem_set_hugepages(mystuff.huge_pages);
   mystuff.mode = MODE_PERFTEST;
   mystuff.gpu_sieving = 0;  // inintialize CPU-sieving
   mystuff.sieve_primes_min = 254;
@@ -74,6 +77,7 @@ int init_perftest(int devicenumber)
   mystuff.sieve_primes_max = 1000000;
   mystuff.more_classes = 1;
   mystuff.num_classes  = 4620;
+  sieve_set_threads(mystuff.sieve_threads);
 #ifdef SIEVE_SIZE_LIMIT
   mystuff.sieve_size = SIEVE_SIZE;
   sieve_init();
@@ -85,6 +89,7 @@ int init_perftest(int devicenumber)
   mystuff.threads_per_grid_max = 2097152;
   mystuff.sieve_primes_adjust = 0;
   mystuff.force_rebuild = 1; // always rebuild from scratch while doing this test
+  mystuff.zero_copy = 0;     // test_copy() uploads h_ktab[], test_copy_zero() has its own buffers
 
   init_CL(mystuff.num_streams, &devicenumber);
 //  i = (cl_uint)deviceinfo.maxThreadsPerBlock * deviceinfo.units * mystuff.vectorsize;
@@ -274,7 +279,7 @@ Sieved out:   63.63%  65.94%  67.95%  69.73%  71.31%  72.72%  74.00%  75.16%  76
   double time1;
   cl_ulong k = 0;
   cl_uint i;
-  printf("\n2. CPU-Sieve (output rate M/s)\n");
+  printf("\n2. CPU-Sieve (output rate M/s, %s bit extraction, * = sieve size with optimized code)\n", sieve_extract_name());
 
 #define MAX_NUM_SPS 30
 
@@ -298,6 +303,9 @@ Sieved out:   63.63%  65.94%  67.95%  69.73%  71.31%  72.72%  74.00%  75.16%  76
   if (nsp>MAX_NUM_SPS) nsp=MAX_NUM_SPS;
   double peak[MAX_NUM_SPS]={0.0}, Mps;
   double last_elem[MAX_NUM_SPS]={0.0};
+  unsigned long long int thread_cand[SIEVE_THREADS_MAX], thread_usecs[SIEVE_THREADS_MAX];
+  double total_cand[SIEVE_THREADS_MAX]={0.0}, total_usecs[SIEVE_THREADS_MAX]={0.0};
+  cl_uint t, num_threads = 0;
 
 #ifdef SIEVE_SIZE_LIMIT
   printf("Sieve size is fixed at compile time, cannot test with variable sizes. Just running 3 fixed tests.\n\n");
@@ -320,13 +328,13 @@ Sieved out:   63.63%  65.94%  67.95%  69.73%  71.31%  72.72%  74.00%  75.16%  76
 #ifdef SIEVE_SIZE_LIMIT
     if (j>=3) break; // quit after 3 equal loops if we can't dynamically set the sieve size anyway
     sieve_init_class(EXP, k+=1000000, 1000000);
-    printf("\n%6d kiB  ", SIEVE_SIZE/8192+1);
+    printf("\n%6d kiB* ", SIEVE_SIZE/8192+1);
 #else
     sieve_free();
     cl_uint tmp=m*ssizes[j];
     sieve_init(tmp, 1000000);
     sieve_init_class(EXP, k+=1000000, 1000000);
-    printf("\n%6d kiB  ", tmp/8192+1);
+    printf("\n%6d kiB%c ", tmp/8192+1, strcmp(sieve_segment_name(), "generic") ? '*' : ' ');
 #endif
 
     for(ii=0; ii<nsp; ii++)
@@ -348,6 +356,13 @@ Sieved out:   63.63%  65.94%  67.95%  69.73%  71.31%  72.72%  74.00%  75.16%  76
       }
       printf(" %7.1f", Mps);
     }
+    // collect the per-thread stats before the next sieve_init() resets them
+    num_threads = sieve_thread_stats(thread_cand, thread_usecs);
+    for (t=0; t<num_threads; t++)
+    {
+      total_cand[t]  += (double)thread_cand[t];
+      total_usecs[t] += (double)thread_usecs[t];
+    }
     if (mystuff.quit)
     {
       j++; // adjustment for later calculation: j= number of finished rows.
@@ -389,10 +404,157 @@ Sieved out:   63.63%  65.94%  67.95%  69.73%  71.31%  72.72%  74.00%  75.16%  76
     printf(" %7.1f", peak[ii]*(last_elem[ii]/(mystuff.threads_per_grid*j) -1));
   }
 
+  if (num_threads > 1)
+  {
+    printf("\n\nSieve threads (output rate while sieving, all SievePrimes):");
+    for (t=0; t<num_threads; t++)
+    {
+      printf("\n  thread %2u: %7.1f M/s (%.1f M candidates in %.1f ms)", t,
+          total_usecs[t] > 0.0 ? total_cand[t]/total_usecs[t] : 0.0, total_cand[t]/1e6, total_usecs[t]/1000.0);
+    }
+  }
+
+  // HugePages: the largest SievePrimes at its best sieve size once with all tables on normal pages and
+  // once on huge pages. The difference is mostly TLB misses while walking through primes[] and k_init[].
+  int hp_mode = mystuff.huge_pages ? (int)mystuff.huge_pages : mem_set_hugepages(MEM_HUGEPAGES_EXPLICIT);
+  if (!mystuff.quit && mem_set_hugepages(hp_mode) != MEM_HUGEPAGES_OFF)
+  {
+    double hp_Mps[2];
+    int hp;
+#ifdef SIEVE_SIZE_LIMIT
+    cl_uint hp_size = SIEVE_SIZE;
+#else
+    cl_uint hp_size = m*ssizes[peak_index[nsp-1]];
+#endif
+
+    printf("\n\nHuge pages (SievePrimes %u, SieveSizeLimit %u kiB):", sprimes[nsp-1], hp_size/8192+1);
+    for (hp=0; hp<2; hp++)
+    {
+      mem_set_hugepages(hp ? hp_mode : MEM_HUGEPAGES_OFF);
+      sieve_free();
+#ifdef SIEVE_SIZE_LIMIT
+      sieve_init();
+#else
+      sieve_init(hp_size, 1000000);
+#endif
+      sieve_init_class(EXP, k+=1000000, 1000000);
+      timer_init(&timer);
+      for (i=0; i<(cl_uint)(par*4); i++)
+      {
+        sieve_candidates(mystuff.threads_per_grid, mystuff.h_ktab[0], sprimes[nsp-1]);
+      }
+      time1 = (double)timer_diff(&timer);
+      hp_Mps[hp] = (double)(par*4*mystuff.threads_per_grid)/time1;
+      printf("\n  HugePages=%d: %7.1f M/s (%u buffers on huge pages)", hp ? hp_mode : 0, hp_Mps[hp], mem_hugepage_allocs());
+    }
+    printf("\n  speedup:     %+6.1f%%", (hp_Mps[1]/hp_Mps[0] - 1.0) * 100.0);
+  }
+  mem_set_hugepages(mystuff.huge_pages);
+
   printf("\n\n");
   return 0;
 }
 
+/* the zero-copy k_tabs (ZeroCopyKtab=1): the sieve writes into host memory
+   that the kernels read directly. Instead of the copy, each grid costs an
+   unmap (before the kernel) and a map (after it). SVM needs neither. */
+int test_copy_zero(cl_uint par)
+{
+  struct timeval timer;
+  double time1;
+  cl_uint i, j;
+  cl_int status;
+  size_t size = mystuff.threads_per_grid * sizeof(int);
+  cl_mem   d_buf[10];
+  cl_uint *h_buf[10];
+
+  printf("\n  Zero-copy k_tabs (ZeroCopyKtab=1), device %s unified host memory\n",
+      deviceinfo.host_unified ? "has" : "does not have");
+
+#ifdef CL_VERSION_2_0
+  if (deviceinfo.svm_caps & CL_DEVICE_SVM_FINE_GRAIN_BUFFER)
+  {
+    printf("  fine-grained SVM supported and used: no transfer at all\n");
+    return 0;
+  }
+#endif
+
+  for (i=0; i<10; i++)
+  {
+    d_buf[i] = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_ALLOC_HOST_PTR, size, NULL, &status);
+    if(status != CL_SUCCESS)
+    {
+      std::cout<<"Error " << status << " (" << ClErrorString(status) << "): clCreateBuffer (CL_MEM_ALLOC_HOST_PTR)\n";
+      return RET_ERROR;
+    }
+    h_buf[i] = (cl_uint *) clEnqueueMapBuffer(commandQueue, d_buf[i], CL_TRUE, CL_MAP_WRITE, 0, size, 0, NULL, NULL, &status);
+    if(status != CL_SUCCESS)
+    {
+      std::cout<<"Error " << status << " (" << ClErrorString(status) << "): clEnqueueMapBuffer\n";
+      return RET_ERROR;
+    }
+    memcpy(h_buf[i], mystuff.h_ktab[i], size); // same as the sieve writing into it
+  }
+
+  // throughput: what the stream pipeline does, unmap before the kernels, map after them
+  timer_init(&timer);
+  for (j=0; j<par; j++)
+  {
+    for (i=0; i<10; i++)
+    {
+      status = clEnqueueUnmapMemObject(commandQueue, d_buf[i], h_buf[i], 0, NULL, NULL);
+      if(status != CL_SUCCESS)
+      {
+        std::cout<<"Error " << status << " (" << ClErrorString(status) << "): clEnqueueUnmapMemObject\n";
+        return RET_ERROR;
+      }
+    }
+    for (i=0; i<10; i++)
+    {
+      h_buf[i] = (cl_uint *) clEnqueueMapBuffer(commandQueue, d_buf[i], CL_TRUE, CL_MAP_WRITE, 0, size, 0, NULL, NULL, &status);
+      if(status != CL_SUCCESS)
+      {
+        std::cout<<"Error " << status << " (" << ClErrorString(status) << "): clEnqueueMapBuffer\n";
+        return RET_ERROR;
+      }
+    }
+  }
+  time1 = (double)timer_diff(&timer);
+  printf("%8d MB in %6.1f ms (%6.1f MB/s) (real, unmap + map)\n",
+      (int)(j*10*size/1024/1024), time1/1000.0, (double)(j*10*size)/time1);
+
+  // latency: a single unmap/map cycle
+  time1 = 0.0;
+  for (j=0; j<par; j++)
+  {
+    for (i=0; i<10; i++)
+    {
+      timer_init(&timer);
+      status = clEnqueueUnmapMemObject(commandQueue, d_buf[i], h_buf[i], 0, NULL, NULL);
+      if(status == CL_SUCCESS)
+        h_buf[i] = (cl_uint *) clEnqueueMapBuffer(commandQueue, d_buf[i], CL_TRUE, CL_MAP_WRITE, 0, size, 0, NULL, NULL, &status);
+      time1 += (double)timer_diff(&timer);
+      if(status != CL_SUCCESS)
+      {
+        std::cout<<"Error " << status << " (" << ClErrorString(status) << "): clEnqueueUnmapMemObject/clEnqueueMapBuffer\n";
+        return RET_ERROR;
+      }
+    }
+  }
+  printf("%8.1f us per block (latency, unmap + map)\n", time1/(10*j));
+  if (!deviceinfo.host_unified)
+    printf("  (on this device the kernels read the k_tabs over the bus, compare the TF kernel speed as well)\n");
+
+  for (i=0; i<10; i++)
+  {
+    clEnqueueUnmapMemObject(commandQueue, d_buf[i], h_buf[i], 0, NULL, NULL);
+    clFinish(commandQueue);
+    clReleaseMemObject(d_buf[i]);
+  }
+
+  return 0;
+}
+
 /* test the performance of the memory copy to the device
    necessary for good performance, but not a lot that can be done
    about it, this is rather informational
@@ -587,8 +749,34 @@ int test_copy(cl_uint par)
   printf("\n  Standard copy, two queues:\n%8d MB in %6.1f ms (%6.1f MB/s) (real)\n",
       (int)(j*10*size/1024/1024), time1/1000.0, (double)(j*10*size)/time1);
 
+  time1 = 0.0;
 
-  return 0;
+  for (j=0; j<par; j++)
+  {
+    for (i=0; i<10; i++)
+    {
+      timer_init(&timer);
+      status = clEnqueueWriteBuffer(commandQueue,
+                  mystuff.d_ktab[i],
+                  CL_TRUE,
+                  0,
+                  size,
+                  mystuff.h_ktab[i],
+                  0,
+                  NULL,
+                  NULL);
+      time1 += (double)timer_diff(&timer);
+
+      if(status != CL_SUCCESS)
+      {
+            std::cout<<"Error " << status << " (" << ClErrorString(status) << "): Copying h_ktab(clEnqueueWriteBuffer)\n";
+            return RET_ERROR;
+      }
+    }
+  }
+  printf("\n  Standard copy, blocking (latency):\n%8.1f us per block\n", time1/(10*j));
+
+  return test_copy_zero(par);
 }
 
 int test_gpu_sieve(cl_uint par)
@@ -619,6 +807,7 @@ int test_gpu_sieve(cl_uint par)
     gpusieve_init_exponent(&mystuff);
     clFlush(commandQueue);
   }
+  if (sieveQueue) clFinish(sieveQueue);
   clFinish(commandQueue);
   time1 = (double)timer_diff(&timer);
 
@@ -630,6 +819,7 @@ int test_gpu_sieve(cl_uint par)
   {
     gpusieve_init_class(&mystuff, k); // does a flush on its own
   }
+  if (sieveQueue) clFinish(sieveQueue);
   clFinish(commandQueue);
   time1 = (double)timer_diff(&timer);
 
@@ -642,6 +832,7 @@ int test_gpu_sieve(cl_uint par)
     gpusieve(&mystuff, (cl_ulong)mystuff.gpu_sieve_size*256);
     clFlush(commandQueue);
   }
+  if (sieveQueue) clFinish(sieveQueue);
   clFinish(commandQueue);
   time1 = (double)timer_diff(&timer);
 
@@ -688,6 +879,7 @@ int test_gpu_sieve(cl_uint par)
     else             b_in.s[7]=1<<(ln2b-165);
   }
 
+  if (load_kernel(BARRETT69_MUL15_GS)) return RET_ERROR;
   timer_init(&timer);
   for (i=0; i<par; i++, k+=mystuff.gpu_sieve_size)
   {
@@ -727,6 +919,9 @@ int test_gpu_sieve(cl_uint par)
   if (nsp>MAX_NUM_SPS) nsp=MAX_NUM_SPS;
   double peak[MAX_NUM_SPS]={0.0}, Mps;
   double last_elem[MAX_NUM_SPS]={0.0};
+  unsigned long long int thread_cand[SIEVE_THREADS_MAX], thread_usecs[SIEVE_THREADS_MAX];
+  double total_cand[SIEVE_THREADS_MAX]={0.0}, total_usecs[SIEVE_THREADS_MAX]={0.0};
+  cl_uint t, num_threads = 0;
   mystuff.gpu_sieve_processing_size = 8 * 1024; // min of 8k to ensure the sieve sizes are always a multiple ==> will later be a loop
   int peak_index[MAX_NUM_SPS]={0};
   double gss_sum=0.0;
@@ -761,6 +956,7 @@ int test_gpu_sieve(cl_uint par)
         gpusieve_init_class(&mystuff, k); // does a flush on its own
         gpusieve(&mystuff, (cl_ulong)mystuff.gpu_sieve_size*256);
       }
+      if (sieveQueue) clFinish(sieveQueue);
       clFinish(commandQueue);
 
       time1 = (double)timer_diff(&timer);
@@ -803,6 +999,13 @@ int test_gpu_sieve(cl_uint par)
       }
       printf(" %7.1f", Mps);
     }
+    // collect the per-thread stats before the next sieve_init() resets them
+    num_threads = sieve_thread_stats(thread_cand, thread_usecs);
+    for (t=0; t<num_threads; t++)
+    {
+      total_cand[t]  += (double)thread_cand[t];
+      total_usecs[t] += (double)thread_usecs[t];
+    }
     if (mystuff.quit)
     {
       j++; // adjustment for later calculation: j= number of finished rows.
@@ -971,6 +1174,7 @@ int test_cpu_tf_kernels(cl_uint par)
   printf("\nexponent=%u ... calibrating\r", mystuff.exponent); fflush(stdout);
   // calibrate to the device so we have ~ 2..4 seconds per kernel (at default with par = 10)
   use_kernel = BARRETT79_MUL32;
+  if (load_kernel(use_kernel)) return RET_ERROR;
 
   timer_init(&timer);
   if ((use_kernel == _71BIT_MUL24) || (use_kernel == _63BIT_MUL24))
@@ -990,7 +1194,7 @@ int test_cpu_tf_kernels(cl_uint par)
     k_base.d4 =  k >> 60;
     status = run_kernel15(kernel_info[use_kernel].kernel, mystuff.exponent, k_base, num_test++ % mystuff.num_streams, b_in, mystuff.d_RES, shiftcount, mystuff.bit_max_stage-65);
   }
-  else if (((use_kernel >= BARRETT79_MUL32) && (use_kernel <= BARRETT87_MUL32)) || (use_kernel == MG62))
+  else if (((use_kernel >= BARRETT79_MUL32) && (use_kernel <= BARRETT87_MUL32)) || (use_kernel == MG62) || (use_kernel == MG96))
   {
     int96 k_base;
     k_base.d0 = (cl_uint) k;
@@ -1019,6 +1223,7 @@ int test_cpu_tf_kernels(cl_uint par)
   printf("k=%llu, %f GHz-days (assignment), %f GHz-days (per test): ", k, ghzd, ghzdt); fflush(stdout);
   for (use_kernel = _71BIT_MUL24; use_kernel < UNKNOWN_KERNEL; use_kernel++)
   {
+    if (load_kernel(use_kernel)) return RET_ERROR;  // not timed: waits for the build of its family
     new_class=1; // tell run_kernel to re-submit the one-time kernel arguments
     timer_init(&timer);
     for (i=0; i<num_loops; ++i)
@@ -1040,7 +1245,7 @@ int test_cpu_tf_kernels(cl_uint par)
         k_base.d4 =  k >> 60;
         status = run_kernel15(kernel_info[use_kernel].kernel, mystuff.exponent, k_base, num_test++ % mystuff.num_streams, b_in, mystuff.d_RES, shiftcount, mystuff.bit_max_stage-65);
       }
-      else if (((use_kernel >= BARRETT79_MUL32) && (use_kernel <= BARRETT87_MUL32)) || (use_kernel == MG62))
+      else if (((use_kernel >= BARRETT79_MUL32) && (use_kernel <= BARRETT87_MUL32)) || (use_kernel == MG62) || (use_kernel == MG96))
       {
         int96 k_base;
         k_base.d0 = (cl_uint) k;
@@ -1132,7 +1337,7 @@ int test_gpu_tf_kernels(cl_uint par)
   do
   {
     timer_init(&timer);
-    tf_class_opencl (k+use_class, k+use_class+num_fcs*mystuff.num_classes, &mystuff, BARRETT79_MUL32_GS);
+    tf_class_opencl (k+use_class, k+use_class+num_fcs*mystuff.num_classes, &mystuff, BARRETT79_MUL32_GS, 0);
     time1 = (double)timer_diff(&timer);
 //  printf("%llu FCs, %f ms\n", num_fcs, time1/1000.0);
     num_fcs <<=1;
@@ -1145,7 +1350,7 @@ int test_gpu_tf_kernels(cl_uint par)
   for (use_kernel = BARRETT79_MUL32_GS; use_kernel < UNKNOWN_GS_KERNEL; use_kernel++)
   {
     timer_init(&timer);
-    tf_class_opencl (k+use_class, k+use_class+num_fcs*mystuff.num_classes, &mystuff, (GPUKernels)use_kernel);
+    tf_class_opencl (k+use_class, k+use_class+num_fcs*mystuff.num_classes, &mystuff, (GPUKernels)use_kernel, 0);
     time1 = (double)timer_diff(&timer);
     putchar('.'); fflush(stdout);
     insert_time(time1, time2, use_kernel, idxs, use_kernel - BARRETT79_MUL32_GS);
@@ -25,8 +25,10 @@ along with mfaktc (mfakto).  If not, see <http://www.gnu.org/licenses/>.
 
 #include "params.h"
 #include "my_types.h"
+#include "threads.h"
+#include "sieve.h"
 
-extern kernel_info_t   kernel_info[];
+extern THREAD_LOCAL kernel_info_t kernel_info[];
 extern GPU_type        gpu_types[];
 static int inifile_unavailable = 0;
 
@@ -256,15 +258,20 @@ int read_config(mystuff_t *mystuff)
 #else
     if(my_read_int(mystuff->inifile, "SieveSizeLimit", &i))
     {
-      printf("WARNING: Cannot read SieveSizeLimit from inifile, using default value (32)\n");
-      i=32;
+      printf("WARNING: Cannot read SieveSizeLimit from inifile, using default value (0)\n");
+      i=0;
     }
-    else if(i <= 13*17*19*23/8192)
+    else if((i != 0) && (i <= 13*17*19*23/8192))
     {
-      printf("WARNING: SieveSizeLimit must be > %d, using default value (32)\n", 13*17*19*23/8192);
-      i=32;
+      printf("WARNING: SieveSizeLimit must be 0 or > %d, using default value (0)\n", 13*17*19*23/8192);
+      i=0;
     }
-    if(mystuff->verbosity >= 1)printf("  SieveSizeLimit            %d kiB\n", i);
+    if(i == 0)
+    {
+      i = sieve_size_limit_auto();
+      if(mystuff->verbosity >= 1)printf("  SieveSizeLimit            %d kiB (auto)\n", i);
+    }
+    else if(mystuff->verbosity >= 1)printf("  SieveSizeLimit            %d kiB\n", i);
     mystuff->sieve_size = ((i<<13) - (i<<13) % (13*17*19*23));
     if(mystuff->verbosity >= 1)printf("  SieveSize                 %d bits\n", mystuff->sieve_size);
 #endif
@@ -292,6 +299,74 @@ int read_config(mystuff_t *mystuff)
     if(mystuff->verbosity >= 1)printf("  NumStreams                %d\n",i);
     mystuff->num_streams = i;
 
+  /*****************************************************************************/
+
+    if(my_read_int(mystuff->inifile, "StreamWaitSpin", &i))
+    {
+      printf("WARNING: Cannot read StreamWaitSpin from inifile, using default value (%d)\n",STREAM_WAIT_SPIN_DEFAULT);
+      i=STREAM_WAIT_SPIN_DEFAULT;
+    }
+    else
+    {
+      if(i>STREAM_WAIT_SPIN_MAX)
+      {
+        printf("WARNING: Read StreamWaitSpin=%d from inifile, using max value (%d)\n",i,STREAM_WAIT_SPIN_MAX);
+        i=STREAM_WAIT_SPIN_MAX;
+      }
+      else if(i<0)
+      {
+        printf("WARNING: Read StreamWaitSpin=%d from inifile, using min value (0)\n",i);
+        i=0;
+      }
+    }
+    if(mystuff->verbosity >= 1)printf("  StreamWaitSpin            %d\n",i);
+    mystuff->wait_spin = i;
+
+  /*****************************************************************************/
+
+    if(my_read_int(mystuff->inifile, "ZeroCopyKtab", &i))
+    {
+      printf("WARNING: Cannot read ZeroCopyKtab from inifile, using default value (0)\n");
+      i = 0;
+    }
+    else if((i < 0) || (i > 1))
+    {
+      printf("WARNING: ZeroCopyKtab must be 0 or 1, using default value (0)\n");
+      i = 0;
+    }
+    if(mystuff->verbosity >= 1)printf("  ZeroCopyKtab              %d\n",i);
+    mystuff->zero_copy = i;
+
+  /*****************************************************************************/
+
+    if(my_read_int(mystuff->inifile, "CopyQueue", &i))
+    {
+      printf("WARNING: Cannot read CopyQueue from inifile, using default value (0)\n");
+      i = 0;
+    }
+    else if((i < 0) || (i > 1))
+    {
+      printf("WARNING: CopyQueue must be 0 or 1, using default value (0)\n");
+      i = 0;
+    }
+    if(mystuff->verbosity >= 1)printf("  CopyQueue                 %d\n",i);
+    mystuff->copy_queue = i;
+
+  /*****************************************************************************/
+
+    if(my_read_int(mystuff->inifile, "SplitDevice", &i))
+    {
+      printf("WARNING: Cannot read SplitDevice from inifile, using default value (0)\n");
+      i = 0;
+    }
+    else if((i < 0) || (i > NUM_DEVICES_MAX))
+    {
+      printf("WARNING: SplitDevice must be between 0 and %d, using default value (0)\n", NUM_DEVICES_MAX);
+      i = 0;
+    }
+    if(mystuff->verbosity >= 1)printf("  SplitDevice               %d\n",i);
+    mystuff->split_device = i;
+
   /*****************************************************************************/
 
   /* CPU streams not used by mfakto
@@ -343,6 +418,50 @@ int read_config(mystuff_t *mystuff)
     else if(i == 3)  mystuff->threads_per_grid_max = 1048576;
     else             mystuff->threads_per_grid_max = 2097152;
 
+  /*****************************************************************************/
+
+    if(my_read_int(mystuff->inifile, "GridAdjust", &i))
+    {
+      printf("WARNING: Cannot read GridAdjust from inifile, using default value (0)\n");
+      i = 0;
+    }
+    else if(i != 0 && i != 1)
+    {
+      printf("WARNING: GridAdjust must be 0 or 1, using default value (0)\n");
+      i = 0;
+    }
+    if(mystuff->verbosity >= 1)printf("  GridAdjust                %d\n",i);
+    mystuff->grid_adjust = i;
+
+    if(mystuff->grid_adjust)
+    {
+      if(my_read_int(mystuff->inifile, "GridTime", &i))
+      {
+        printf("WARNING: Cannot read GridTime from inifile, using default value (%d)\n", GRID_TIME_DEFAULT);
+        i = GRID_TIME_DEFAULT;
+      }
+      else if((i < 1) || (i > GRID_TIME_MAX))
+      {
+        printf("WARNING: GridTime must be between 1 and %d, using default value (%d)\n", GRID_TIME_MAX, GRID_TIME_DEFAULT);
+        i = GRID_TIME_DEFAULT;
+      }
+      if(mystuff->verbosity >= 1)printf("  GridTime                  %dms\n",i);
+      mystuff->grid_time = i;
+
+      if(my_read_int(mystuff->inifile, "QueueTime", &i))
+      {
+        printf("WARNING: Cannot read QueueTime from inifile, using default value (%d)\n", QUEUE_TIME_DEFAULT);
+        i = QUEUE_TIME_DEFAULT;
+      }
+      else if((i < 1) || (i > QUEUE_TIME_MAX))
+      {
+        printf("WARNING: QueueTime must be between 1 and %d, using default value (%d)\n", QUEUE_TIME_MAX, QUEUE_TIME_DEFAULT);
+        i = QUEUE_TIME_DEFAULT;
+      }
+      if(mystuff->verbosity >= 1)printf("  QueueTime                 %dms\n",i);
+      mystuff->queue_time = i;
+    }
+
   /*****************************************************************************/
 
     if(my_read_ulong(mystuff->inifile, "SieveCPUMask", &ul))
@@ -358,6 +477,62 @@ int read_config(mystuff_t *mystuff)
   
     mystuff->cpu_mask = ul;
   /*****************************************************************************/
+
+    if(my_read_int(mystuff->inifile, "SieveThreads", &i))
+    {
+      printf("WARNING: Cannot read SieveThreads from inifile, using default value (1)\n");
+      i = 1;
+    }
+    else if((i < 1) || (i > SIEVE_THREADS_MAX))
+    {
+      printf("WARNING: SieveThreads must be between 1 and %d, using default value (1)\n", SIEVE_THREADS_MAX);
+      i = 1;
+    }
+    if(mystuff->verbosity >= 1)printf("  SieveThreads              %d\n",i);
+    mystuff->sieve_threads = i;
+  /*****************************************************************************/
+
+    if(my_read_int(mystuff->inifile, "SieveProducerThread", &i))
+    {
+      printf("WARNING: Cannot read SieveProducerThread from inifile, using default value (1)\n");
+      i = 1;
+    }
+    else if((i < 0) || (i > 1))
+    {
+      printf("WARNING: SieveProducerThread must be 0 or 1, using default value (1)\n");
+      i = 1;
+    }
+    if(mystuff->verbosity >= 1)printf("  SieveProducerThread       %d\n",i);
+    mystuff->sieve_producer = i;
+  /*****************************************************************************/
+
+    if(my_read_int(mystuff->inifile, "HugePages", &i))
+    {
+      printf("WARNING: Cannot read HugePages from inifile, using default value (1)\n");
+      i = 1;
+    }
+    else if((i < 0) || (i > 2))
+    {
+      printf("WARNING: HugePages must be between 0 and 2, using default value (1)\n");
+      i = 1;
+    }
+    if(mystuff->verbosity >= 1)printf("  HugePages                 %d\n",i);
+    mystuff->huge_pages = i;
+  /*****************************************************************************/
+
+    if(my_read_int(mystuff->inifile, "BulkExponents", &i))
+    {
+      printf("WARNING: Cannot read BulkExponents from inifile, using default value (0)\n");
+      i = 0;
+    }
+    else if((i < 0) || (i > BULK_EXPONENTS_MAX))
+    {
+      printf("WARNING: BulkExponents must be between 0 and %d, using default value (0)\n", BULK_EXPONENTS_MAX);
+      i = 0;
+    }
+    if(mystuff->verbosity >= 1)printf("  BulkExponents             %d\n",i);
+    mystuff->bulk_exponents = i;
+  /*****************************************************************************/
   /* not used in mfakto (yet)
     if(my_read_int(mystuff->inifile, "AllowSleep", &i))
     {
@@ -487,6 +662,67 @@ int read_config(mystuff_t *mystuff)
 
     /*****************************************************************************/
 
+    if(my_read_int(mystuff->inifile, "GPUSieveBuffers", &i))
+    {
+      printf("WARNING: Cannot read GPUSieveBuffers from inifile, using default value (%d)\n",GPU_SIEVE_BUFFERS_DEFAULT);
+      i = GPU_SIEVE_BUFFERS_DEFAULT;
+    }
+    else
+    {
+      if(i > GPU_SIEVE_BUFFERS_MAX)
+      {
+        printf("WARNING: Read GPUSieveBuffers=%d from inifile, using max value (%d)\n",i,GPU_SIEVE_BUFFERS_MAX);
+        i = GPU_SIEVE_BUFFERS_MAX;
+      }
+      else if(i < GPU_SIEVE_BUFFERS_MIN)
+      {
+        printf("WARNING: Read GPUSieveBuffers=%d from inifile, using min value (%d)\n",i,GPU_SIEVE_BUFFERS_MIN);
+        i = GPU_SIEVE_BUFFERS_MIN;
+      }
+    }
+    if(mystuff->verbosity >= 1)printf("  GPUSieveBuffers           %d\n",i);
+    mystuff->gpu_sieve_buffers = i;
+
+    /*****************************************************************************/
+
+    if(my_read_int(mystuff->inifile, "GPUSieveHost", &i))
+    {
+      printf("WARNING: Cannot read GPUSieveHost from inifile, using default value (0)\n");
+      i = 0;
+    }
+    else if((i < 0) || (i > 2))
+    {
+      printf("WARNING: GPUSieveHost must be 0, 1 or 2, using default value (0)\n");
+      i = 0;
+    }
+    if(mystuff->verbosity >= 1)printf("  GPUSieveHost              %d\n",i);
+    mystuff->gpu_sieve_host = i;
+
+    /*****************************************************************************/
+
+    if(my_read_int(mystuff->inifile, "GPUSieveHostThreads", &i))
+    {
+      printf("WARNING: Cannot read GPUSieveHostThreads from inifile, using default value (0)\n");
+      i = 0;
+    }
+    else if((i < 0) || (i > SIEVE_THREADS_MAX))
+    {
+      printf("WARNING: GPUSieveHostThreads must be between 0 and %d, using default value (0)\n", SIEVE_THREADS_MAX);
+      i = 0;
+    }
+    if(mystuff->verbosity >= 1)printf("  GPUSieveHostThreads       %d\n",i);
+    mystuff->gpu_sieve_host_threads = i;
+
+    /*****************************************************************************/
+
+    if(my_read_string(mystuff->inifile, "GPUSieveCacheFile", mystuff->gpu_sieve_cachefile, 50))
+    {
+      mystuff->gpu_sieve_cachefile[0] = '\0';
+    }
+    if(mystuff->verbosity >= 1)printf("  GPUSieveCacheFile         %s\n", mystuff->gpu_sieve_cachefile);
+
+    /*****************************************************************************/
+
     if(my_read_int(mystuff->inifile, "FlushInterval", &i))
     {
       printf("WARNING: Cannot read FlushInterval from inifile, using default value 0\n");
@@ -766,6 +1002,25 @@ int read_config(mystuff_t *mystuff)
 
   /*****************************************************************************/
 
+  if(my_read_int(mystuff->inifile, "ExponentKernels", &i))
+  {
+    printf("WARNING: Cannot read ExponentKernels from inifile, set to 0 by default\n");
+    i=0;
+  }
+  else if(i != 0 && i != 1)
+  {
+    printf("WARNING: ExponentKernels must be 0 or 1, set to 0 by default\n");
+    i=0;
+  }
+  if(mystuff->verbosity >= 1)
+  {
+    if(i == 0)printf("  ExponentKernels           no\n");
+    else      printf("  ExponentKernels           yes\n");
+  }
+  mystuff->exponent_kernels = i;
+
+  /*****************************************************************************/
+
   if(my_read_string(mystuff->inifile, "OCLCompileOptions", mystuff->CompileOptions, 150))
   {
     mystuff->CompileOptions[0]='\0';
@@ -787,6 +1042,18 @@ int read_config(mystuff_t *mystuff)
     printf("  UseBinfile                %s\n", mystuff->binfile);
   }
 
+  /*****************************************************************************/
+
+  if(my_read_string(mystuff->inifile, "KernelCacheDir", mystuff->kernel_cache_dir, 50))
+  {
+    mystuff->kernel_cache_dir[0] = '\0';
+  }
+
+  if(mystuff->verbosity >= 1)
+  {
+    printf("  KernelCacheDir            %s\n", mystuff->kernel_cache_dir);
+  }
+
   /*****************************************************************************/
   return 0;
 }
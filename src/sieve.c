@@ -22,18 +22,28 @@ along with mfaktc (mfakto).  If not, see <http://www.gnu.org/licenses/>.
 #include <string.h>
 
 #include "params.h"
-#ifdef VERBOSE_SIEVE_TIMING
 #include "timer.h"
-#endif
 #include "compatibility.h"
 #include "gpusieve.h"
+#include "threads.h"
+#include "sieve.h"
+#include "mem_alloc.h"
+
+#if !defined SIEVE_EXTRACT_SCALAR && defined __GNUC__ && (defined __x86_64__ || defined __i386__)
+#include <immintrin.h>
+#elif !defined SIEVE_EXTRACT_SCALAR && defined _MSC_VER
+#include <intrin.h>
+#endif
 
 void printArray(const char * Name, const unsigned int * Data, const unsigned int len, unsigned int hex);
+int sieve_euclid_modified(int j, int n, int r);
 
-/* yeah, I like global variables :) */
-static unsigned int *sieve, *sieve_base, *primes;
+/* yeah, I like global variables :)
+The tables below are built by sieve_init() and only read afterwards, they are
+shared by all sieve contexts. Everything that changes while sieving is in
+sieve_ctx_t. */
+static unsigned int *primes, primes_max;
 static unsigned int  mask0[32], mask1[32];
-static int *k_init, last_sieve;
 
 #ifdef SIEVE_SIZE_LIMIT
 #define SIEVE_BYTES (4+((SIEVE_SIZE) >> 3))
@@ -53,6 +63,180 @@ the position of the set bits
 for 0 <= n < 256 */
 static unsigned int sieve_table[256][9];
 
+/* bucket sieve for the large primes (primes[bucket_first] and above are >=
+SIEVE_SIZE): those hit a segment at most once, so instead of visiting each of
+them for every segment, the next hit of each prime is filed into the bucket of
+the segment it falls into. A segment only processes the entries of its own
+bucket. The buckets are lists of blocks taken from a preallocated pool. */
+#define SIEVE_BUCKET_SIZE 1024 /* entries per bucket block */
+
+typedef struct _sieve_bucket_entry_t
+{
+  unsigned int p;
+  unsigned int offset;                 /* bit to clear in the segment of this bucket */
+  unsigned int skip;                   /* workers only: gap between two chunks % p */
+  unsigned int segment;                /* segment of the hit, may be farther away than the buckets reach */
+} sieve_bucket_entry_t;
+
+typedef struct _sieve_bucket_block_t
+{
+  struct _sieve_bucket_block_t *next;
+  unsigned int count;
+  sieve_bucket_entry_t entry[SIEVE_BUCKET_SIZE];
+} sieve_bucket_block_t;
+
+typedef struct _sieve_buckets_t
+{
+  sieve_bucket_block_t **bucket;       /* num_buckets lists, newest block first */
+  sieve_bucket_block_t  *free_blocks;
+  sieve_bucket_block_t  *blocks;
+  unsigned int num_buckets;
+  unsigned int segment;                /* number of segments sieved in this class */
+  unsigned int limit;                  /* primes[bucket_first] ... primes[limit-1] are in the buckets */
+  unsigned int chunk_bits;             /* workers only: bits per chunk of consecutive segments */
+  unsigned int worker;
+} sieve_buckets_t;
+
+static unsigned int    bucket_first;
+
+/* offsets (next bit to clear) of the sieve primes. The medium primes
+primes[SIEVE_SPLIT] ... primes[bucket_first-1], which are walked once per
+segment, are stored interleaved with their offsets so the walk reads a single
+stream. Primes below 65536 (and their offsets, < p) fit in 16 bits each, which
+halves the size of this part. k[] holds the offsets of the other primes, its
+entries SIEVE_SPLIT ... bucket_first-1 are unused. */
+typedef struct _sieve_pk16_t
+{
+  unsigned short p, k;
+} sieve_pk16_t;
+
+typedef struct _sieve_pk32_t
+{
+  unsigned int p;
+  int          k;
+} sieve_pk32_t;
+
+typedef struct _sieve_offsets_t
+{
+  int          *k;
+  sieve_pk16_t *pk16;                  /* primes[SIEVE_SPLIT] ... primes[pk16_end-1] */
+  sieve_pk32_t *pk32;                  /* primes[pk16_end] ... primes[bucket_first-1] */
+} sieve_offsets_t;
+
+static unsigned int    pk16_end;       /* SIEVE_SPLIT <= pk16_end <= bucket_first */
+
+/* pattern presieve for the small primes primes[SIEVE_PATTERN_FIRST] ...
+primes[pattern_end-1] (29 ... SIEVE_PATTERN_MAX): the bits cleared by a prime
+p repeat every p words. words[n] has bit b cleared if (32*n + b) % p == 0, so
+a segment whose first bit to clear is j starts at word
+((p - j) * inv32) % p of the pattern, inv32 being the inverse of 32 mod p.
+The pattern is repeated up to at least SIEVE_PATTERN_WORDS words to allow long
+runs in the inner loop. The patterns are independent of exponent and class. */
+#ifdef MORE_CLASSES
+#define SIEVE_PATTERN_FIRST 8 /* 29, 13 ... 23 are in sieve_base */
+#else
+#define SIEVE_PATTERN_FIRST 7 /* 23, 11 ... 19 are in sieve_base */
+#endif
+#define SIEVE_PATTERN_COUNT 32 /* enough for SIEVE_PATTERN_MAX < 151 */
+#define SIEVE_PATTERN_WORDS 256
+
+typedef struct _sieve_pattern_t
+{
+  unsigned int *words;
+  unsigned int  length;                /* multiple of p, >= SIEVE_PATTERN_WORDS */
+  unsigned int  inv32;                 /* 32^-1 mod p */
+  unsigned int  size_mod;              /* SIEVE_SIZE % p */
+} sieve_pattern_t;
+
+static sieve_pattern_t sieve_pattern[SIEVE_PATTERN_COUNT];
+static unsigned int   *sieve_pattern_words;
+static unsigned int    pattern_end;
+
+/* class_step[i] = -1/NUM_CLASSES mod primes[i] is the change of k_init[i]
+from one class to the next, see sieve_ctx_init_class() */
+static unsigned int   *class_step;
+
+/* multi-threaded sieve (SieveThreads > 1): each worker sieves
+SIEVE_THREAD_SEGMENTS consecutive segments per round with its own sieve and
+k_init buffers, worker n starting n*SIEVE_THREAD_SEGMENTS segments after
+worker 0. The survivors of each worker are stored relative to the start of its
+first segment and handed out in order by sieve_candidates(). Worker 0 runs on
+the calling thread. */
+typedef struct _sieve_worker_t
+{
+  sieve_ctx_t  *ctx;
+  unsigned int *sieve;
+  sieve_offsets_t k_init;              /* like k_init, but for the next segment of this worker */
+  sieve_buckets_t buckets;
+  unsigned int *ktab;                  /* survivors of the current round */
+  unsigned int  ktab_count;
+  unsigned long long int ktab_base;    /* position of ktab[0]=0 within the class */
+  unsigned long long int candidates;   /* statistics for the perftest */
+  unsigned long long int usecs;
+  thread_t      thread;
+} sieve_worker_t;
+
+static unsigned int    num_workers = 1;
+static unsigned int   *chunk_mod;      /* (SIEVE_THREAD_SEGMENTS * SIEVE_SIZE) % primes[i] */
+static unsigned int   *skip_mod;       /* ((num_workers-1) * SIEVE_THREAD_SEGMENTS * SIEVE_SIZE) % primes[i] */
+
+/* a sieve context holds the state of one class of one exponent. Different
+contexts can be used concurrently from different threads, a single context
+must only be used by one thread at a time. */
+struct _sieve_ctx_t
+{
+  unsigned int   *sieve, *sieve_base;
+  sieve_offsets_t k_init;
+  int             last_sieve;
+  sieve_buckets_t buckets;             /* single-threaded only */
+  unsigned int   *class_k0;            /* k_init[i] of k_start = class_base for exponent class_exp, valid for i < class_limit */
+  unsigned int    class_exp, class_limit;
+  unsigned long long int class_base;
+  sieve_worker_t *workers;             /* SieveThreads > 1 only */
+  unsigned int    round_sieve_limit, cur_worker, cur_pos;
+  unsigned long long int next_round_base, origin;
+  thread_mutex_t  worker_mutex;
+  thread_cond_t   worker_start, worker_done;
+  unsigned int    worker_round, workers_busy, workers_quit;
+  unsigned int    threads_started;     /* workers[1 ... threads_started] are running */
+};
+
+static sieve_ctx_t    *sieve_default;  /* context of sieve_init() ... sieve_free() */
+
+static int sieve_offsets_alloc(sieve_offsets_t *o)
+/* returns 0 on success, the primes are filled in */
+{
+  unsigned int i, n16 = pk16_end - SIEVE_SPLIT;
+
+  o->k    = mem_alloc(primes_max * sizeof(int), 1);
+  o->pk16 = mem_alloc(((n16 + 1) & ~1) * sizeof(sieve_pk16_t) + (bucket_first - pk16_end) * sizeof(sieve_pk32_t), 1);
+  if ((o->k == NULL) || (o->pk16 == NULL)) return 1;
+  o->pk32 = (sieve_pk32_t *)(o->pk16 + ((n16 + 1) & ~1));
+  for(i=SIEVE_SPLIT;i<pk16_end;i++)     o->pk16[i-SIEVE_SPLIT].p = (unsigned short)primes[i];
+  for(i=pk16_end;i<bucket_first;i++)    o->pk32[i-pk16_end].p    = primes[i];
+  return 0;
+}
+
+static void sieve_offsets_free(sieve_offsets_t *o)
+{
+  mem_free(o->k);    o->k=NULL;
+  mem_free(o->pk16); o->pk16=NULL;
+}
+
+static __inline int sieve_get_k(const sieve_offsets_t *o, unsigned int i)
+{
+  if ((i < SIEVE_SPLIT) || (i >= bucket_first)) return o->k[i];
+  if (i < pk16_end)                             return o->pk16[i-SIEVE_SPLIT].k;
+  return o->pk32[i-pk16_end].k;
+}
+
+static __inline void sieve_set_k(sieve_offsets_t *o, unsigned int i, int k)
+{
+  if ((i < SIEVE_SPLIT) || (i >= bucket_first)) o->k[i] = k;
+  else if (i < pk16_end)                        o->pk16[i-SIEVE_SPLIT].k = (unsigned short)k;
+  else                                          o->pk32[i-pk16_end].k = k;
+}
+
 static __inline unsigned int sieve_get_bit(unsigned int *array,unsigned int bit)
 {
   unsigned int chunk;
@@ -79,6 +263,589 @@ static __inline void sieve_clear_bit(unsigned int *array,unsigned int bit)
 //#define sieve_clear_bit(ARRAY,BIT) asm("btrl  %0, %1" : /* no output */ : "r" (BIT), "m" (*ARRAY) : "memory", "cc" )
 //#define sieve_clear_bit(ARRAY,BIT) ARRAY[BIT>>5]&=mask0[BIT&0x1F]
 
+static int bucket_alloc(sieve_buckets_t *b, unsigned int max_global, unsigned int chunk_bits, unsigned int worker)
+{
+  unsigned int i, num_blocks;
+
+  b->num_buckets = 2;
+  if (max_global > bucket_first) b->num_buckets += primes[max_global-1] / SIEVE_SIZE;
+  num_blocks = 2 * b->num_buckets + 1;
+  if (max_global > bucket_first) num_blocks += (max_global - bucket_first) / SIEVE_BUCKET_SIZE;
+
+  b->bucket = calloc(b->num_buckets, sizeof(sieve_bucket_block_t *));
+  b->blocks = mem_alloc(num_blocks * sizeof(sieve_bucket_block_t), 1);
+  if ((b->bucket == NULL) || (b->blocks == NULL)) return 1;
+
+  b->free_blocks = NULL;
+  for(i=0;i<num_blocks;i++)
+  {
+    b->blocks[i].next = b->free_blocks;
+    b->free_blocks = &(b->blocks[i]);
+  }
+  b->segment    = 0;
+  b->limit      = 0;
+  b->chunk_bits = chunk_bits;
+  b->worker     = worker;
+  return 0;
+}
+
+static void bucket_free(sieve_buckets_t *b)
+{
+  if (b->bucket) free(b->bucket); b->bucket=NULL;
+  mem_free(b->blocks); b->blocks=NULL;
+}
+
+static __inline void bucket_put(sieve_buckets_t *b, unsigned int seg, unsigned int p, unsigned int k, unsigned int skip, unsigned int target)
+/* files a hit in segment target into the bucket of target, or into the
+farthest bucket if target is out of reach from segment seg */
+{
+  sieve_bucket_block_t *blk;
+  sieve_bucket_entry_t *e;
+  unsigned int n;
+
+  if (target - seg < b->num_buckets) n = target % b->num_buckets;
+  else                               n = (seg + b->num_buckets - 1) % b->num_buckets;
+  blk = b->bucket[n];
+  if ((blk == NULL) || (blk->count == SIEVE_BUCKET_SIZE))
+  {
+    blk = b->free_blocks;
+    b->free_blocks = blk->next;
+    blk->next  = b->bucket[n];
+    blk->count = 0;
+    b->bucket[n] = blk;
+  }
+  e = &(blk->entry[blk->count++]);
+  e->p       = p;
+  e->offset  = k;
+  e->skip    = skip;
+  e->segment = target;
+}
+
+static __inline void bucket_add(sieve_buckets_t *b, unsigned int seg, unsigned int p, unsigned int k, unsigned int skip)
+/* files the next hit of p, k bits after the start of segment seg of this
+sieve. Workers skip the chunks of the other workers, depending on how p and
+the chunks line up this may skip many chunks. */
+{
+  unsigned int n, target = seg;
+
+  if (b->chunk_bits)
+  {
+    n = b->chunk_bits - (seg % SIEVE_THREAD_SEGMENTS) * SIEVE_SIZE; /* bits until the end of this chunk */
+    if (k >= n)
+    {
+      target += SIEVE_THREAD_SEGMENTS - (seg % SIEVE_THREAD_SEGMENTS);
+      k -= n;
+      k = (k >= skip) ? k - skip : k + p - skip;
+      while (k >= b->chunk_bits)
+      {
+        target += SIEVE_THREAD_SEGMENTS;
+        k -= b->chunk_bits;
+        k = (k >= skip) ? k - skip : k + p - skip;
+      }
+    }
+  }
+  target += k / SIEVE_SIZE;
+  bucket_put(b, seg, p, k % SIEVE_SIZE, skip, target);
+}
+
+static void bucket_fill(sieve_buckets_t *b, const int *k_class, unsigned int sieve_limit)
+/* (re)starts the bucket sieve at the current segment, using the offsets of
+the class start in k_class */
+{
+  sieve_bucket_block_t *blk;
+  unsigned long long int pos;
+  unsigned int i, n, p, k, r, skip = 0;
+
+  for(n=0;n<b->num_buckets;n++)
+  {
+    while(b->bucket[n])
+    {
+      blk = b->bucket[n];
+      b->bucket[n] = blk->next;
+      blk->next = b->free_blocks;
+      b->free_blocks = blk;
+    }
+  }
+
+  /* position of the current segment within the class */
+  if (b->chunk_bits)
+  {
+    pos = (unsigned long long int)(b->segment / SIEVE_THREAD_SEGMENTS) * num_workers + b->worker;
+    pos = pos * SIEVE_THREAD_SEGMENTS + (b->segment % SIEVE_THREAD_SEGMENTS);
+  }
+  else pos = b->segment;
+  pos *= SIEVE_SIZE;
+
+  for(i=bucket_first;i<sieve_limit;i++)
+  {
+    p = primes[i];
+    k = k_class[i];
+    if (pos)
+    {
+      r = (unsigned int)(pos % p);
+      k = (k >= r) ? k - r : k + p - r;
+    }
+    if (b->chunk_bits) skip = skip_mod[i];
+    bucket_add(b, b->segment, p, k, skip);
+  }
+  b->limit = sieve_limit;
+}
+
+static __inline void bucket_sieve(sieve_buckets_t *b, unsigned int *array)
+/* clears the bits of the current segment's bucket and files the next hits */
+{
+  sieve_bucket_block_t *blk, *next;
+  sieve_bucket_entry_t *e, *e_end;
+  unsigned int seg = b->segment, n = seg % b->num_buckets;
+
+  blk = b->bucket[n];
+  b->bucket[n] = NULL;
+  while (blk)
+  {
+    for (e = blk->entry, e_end = e + blk->count; e < e_end; e++)
+    {
+      if (e->segment == seg)
+      {
+        sieve_clear_bit(array, e->offset);
+        bucket_add(b, seg, e->p, e->offset + e->p, e->skip);
+      }
+      else bucket_put(b, seg, e->p, e->offset, e->skip, e->segment);
+    }
+    next = blk->next;
+    blk->next = b->free_blocks;
+    b->free_blocks = blk;
+    blk = next;
+  }
+}
+
+static __inline void sieve_pattern_and(unsigned int *array, unsigned int words, const sieve_pattern_t *pat1, unsigned int pos1,
+                                                                                 const sieve_pattern_t *pat2, unsigned int pos2)
+/* ANDs two repeating patterns, starting at words[pos1] and words[pos2], into
+array[0] ... array[words-1]. The runs are plain loops the compiler can
+vectorize. */
+{
+  unsigned int *a=array, *a_end=array+words, run, n;
+  const unsigned int *w1=pat1->words+pos1, *w1_end=pat1->words+pat1->length;
+  const unsigned int *w2=pat2->words+pos2, *w2_end=pat2->words+pat2->length;
+
+  while(a<a_end)
+  {
+    run=(unsigned int)(a_end-a);
+    if(run > (unsigned int)(w1_end-w1)) run=(unsigned int)(w1_end-w1);
+    if(run > (unsigned int)(w2_end-w2)) run=(unsigned int)(w2_end-w2);
+    for(n=0;n<run;n++) a[n] &= w1[n] & w2[n];
+    a+=run;
+    w1+=run;
+    w2+=run;
+    if(w1==w1_end) w1=pat1->words;
+    if(w2==w2_end) w2=pat2->words;
+  }
+}
+
+/* sieve_segment(): with SIEVE_SIZE_LIMIT there is a single sieve size known at
+compile time. Otherwise sieve_segment_any() handles any sieve size and
+sieve_init() replaces it by one of the variants for the sieve sizes of
+sieve_segment_sizes[] if the sieve size matches one of them exactly. They
+cover SieveSizeLimit 12 ... 512 kiB; read_config() rounds the size down to a
+multiple of 13*17*19*23 bits only, so the multiples without a variant (7, 9,
+11-15, ... times) use sieve_segment_any(), main() prints a notice then. */
+#ifdef SIEVE_SIZE_LIMIT
+#define SEGMENT_NAME sieve_segment
+#define SEGMENT_SIZE SIEVE_SIZE
+#include "sieve_segment.h"
+#else
+#define SEGMENT_NAME sieve_segment_any
+#define SEGMENT_SIZE sieve_size
+#include "sieve_segment.h"
+#define SEGMENT_NAME sieve_segment_1
+#define SEGMENT_SIZE (1*13*17*19*23)
+#include "sieve_segment.h"
+#define SEGMENT_NAME sieve_segment_2
+#define SEGMENT_SIZE (2*13*17*19*23)
+#include "sieve_segment.h"
+#define SEGMENT_NAME sieve_segment_3
+#define SEGMENT_SIZE (3*13*17*19*23)
+#include "sieve_segment.h"
+#define SEGMENT_NAME sieve_segment_4
+#define SEGMENT_SIZE (4*13*17*19*23)
+#include "sieve_segment.h"
+#define SEGMENT_NAME sieve_segment_5
+#define SEGMENT_SIZE (5*13*17*19*23)
+#include "sieve_segment.h"
+#define SEGMENT_NAME sieve_segment_6
+#define SEGMENT_SIZE (6*13*17*19*23)
+#include "sieve_segment.h"
+#define SEGMENT_NAME sieve_segment_8
+#define SEGMENT_SIZE (8*13*17*19*23)
+#include "sieve_segment.h"
+#define SEGMENT_NAME sieve_segment_10
+#define SEGMENT_SIZE (10*13*17*19*23)
+#include "sieve_segment.h"
+#define SEGMENT_NAME sieve_segment_16
+#define SEGMENT_SIZE (16*13*17*19*23)
+#include "sieve_segment.h"
+#define SEGMENT_NAME sieve_segment_21
+#define SEGMENT_SIZE (21*13*17*19*23)
+#include "sieve_segment.h"
+#define SEGMENT_NAME sieve_segment_32
+#define SEGMENT_SIZE (32*13*17*19*23)
+#include "sieve_segment.h"
+#define SEGMENT_NAME sieve_segment_43
+#define SEGMENT_SIZE (43*13*17*19*23)
+#include "sieve_segment.h"
+
+typedef void (*sieve_segment_t)(sieve_ctx_t *ctx, unsigned int *array, sieve_offsets_t *o, unsigned int sieve_limit, sieve_buckets_t *b);
+
+static const struct
+{
+  unsigned int    size;                /* bits */
+  sieve_segment_t func;
+} sieve_segment_sizes[] =
+{
+  {  1*13*17*19*23, sieve_segment_1 },
+  {  2*13*17*19*23, sieve_segment_2 },
+  {  3*13*17*19*23, sieve_segment_3 },
+  {  4*13*17*19*23, sieve_segment_4 },
+  {  5*13*17*19*23, sieve_segment_5 },
+  {  6*13*17*19*23, sieve_segment_6 },
+  {  8*13*17*19*23, sieve_segment_8 },
+  { 10*13*17*19*23, sieve_segment_10 },
+  { 16*13*17*19*23, sieve_segment_16 },
+  { 21*13*17*19*23, sieve_segment_21 },
+  { 32*13*17*19*23, sieve_segment_32 },
+  { 43*13*17*19*23, sieve_segment_43 }
+};
+
+static sieve_segment_t sieve_segment = sieve_segment_any;
+#endif
+
+/* extraction of the survivors: the bits of array[] starting at bit i (a
+multiple of 32) are appended as (bit position + offset) to ktab[*k...], one
+32-bit word at a time, until i_end is reached or *k >= k_max. Returns the
+position of the first bit not extracted. All variants may write ahead but never
+beyond ktab[*k+31], *k being the value at the start of the last word.
+sieve_init() selects the fastest variant the CPU supports (CPUID). */
+typedef unsigned int (*sieve_extract_func_t)(const unsigned int *array, unsigned int i, unsigned int i_end,
+                                             unsigned int *ktab, unsigned int *k, unsigned int k_max, unsigned int offset);
+
+#if !defined SIEVE_EXTRACT_SCALAR && defined __GNUC__ && (defined __x86_64__ || defined __i386__)
+  #define SIEVE_EXTRACT_X86
+  #define SIEVE_TARGET(x) __attribute__((target(x)))
+  #define SIEVE_CTZ(x) __builtin_ctz(x)
+#elif !defined SIEVE_EXTRACT_SCALAR && defined _MSC_VER && (defined _M_X64 || defined _M_IX86)
+  #define SIEVE_EXTRACT_X86
+  #define SIEVE_TARGET(x)
+  #define SIEVE_CTZ(x) _tzcnt_u32(x)
+#endif
+#if defined SIEVE_EXTRACT_X86 && (defined __GNUC__ || _MSC_VER >= 1910) /* AVX-512 intrinsics need VS2017 */
+  #define SIEVE_EXTRACT_AVX512
+#endif
+
+//#define SIEVER_OLD_METHOD
+static unsigned int sieve_extract_table(const unsigned int *array, unsigned int i, unsigned int i_end,
+                                        unsigned int *ktab, unsigned int *k, unsigned int k_max, unsigned int offset)
+/* portable variant: table lookup per byte */
+{
+  unsigned int s, p, ic, kk=*k, *sieve_table_;
+
+  for(;i<i_end && kk<k_max;i+=32)
+  {
+    ic=i+offset;
+    s=array[i>>5];
+#ifdef SIEVER_OLD_METHOD
+    for(p=0;p<32;p+=8)
+    {
+      unsigned int j;
+      sieve_table_=sieve_table[(s>>p)&0xFF];
+      for(j=0;j<sieve_table_[8];j++) ktab[kk++]=ic+sieve_table_[j];
+      ic+=8;
+    }
+#else
+    for(p=0;p<32;p+=8)
+    {
+      sieve_table_=sieve_table[(s>>p)&0xFF];
+      ktab[kk  ]=ic+sieve_table_[0];
+      ktab[kk+1]=ic+sieve_table_[1];
+      ktab[kk+2]=ic+sieve_table_[2];
+      ktab[kk+3]=ic+sieve_table_[3];
+      if(sieve_table_[8]>4)
+      {
+        ktab[kk+4]=ic+sieve_table_[4];
+        ktab[kk+5]=ic+sieve_table_[5];
+        ktab[kk+6]=ic+sieve_table_[6];
+        ktab[kk+7]=ic+sieve_table_[7];
+      }
+      kk+=sieve_table_[8];
+      ic+=8;
+    }
+#endif
+  }
+  *k=kk;
+  return i;
+}
+
+#ifdef SIEVE_EXTRACT_X86
+SIEVE_TARGET("bmi")
+static unsigned int sieve_extract_bmi(const unsigned int *array, unsigned int i, unsigned int i_end,
+                                      unsigned int *ktab, unsigned int *k, unsigned int k_max, unsigned int offset)
+/* BMI1: one tzcnt/blsr pair per survivor */
+{
+  unsigned int s, ic, kk=*k;
+
+  for(;i<i_end && kk<k_max;i+=32)
+  {
+    ic=i+offset;
+    s=array[i>>5];
+    while(s)
+    {
+      ktab[kk++]=ic+SIEVE_CTZ(s);
+      s&=s-1;
+    }
+  }
+  *k=kk;
+  return i;
+}
+
+SIEVE_TARGET("avx2")
+static unsigned int sieve_extract_avx2(const unsigned int *array, unsigned int i, unsigned int i_end,
+                                       unsigned int *ktab, unsigned int *k, unsigned int k_max, unsigned int offset)
+/* AVX2: the 8 positions of a byte are added to the base in one vector and
+stored at once, the count of set bits advances the output */
+{
+  unsigned int s, p, kk=*k;
+  __m256i base, eight=_mm256_set1_epi32(8);
+
+  for(;i<i_end && kk<k_max;i+=32)
+  {
+    base=_mm256_set1_epi32((int)(i+offset));
+    s=array[i>>5];
+    for(p=0;p<32;p+=8)
+    {
+      const unsigned int *t=sieve_table[(s>>p)&0xFF];
+      _mm256_storeu_si256((__m256i *)(ktab+kk), _mm256_add_epi32(base, _mm256_loadu_si256((const __m256i *)t)));
+      kk+=t[8];
+      base=_mm256_add_epi32(base, eight);
+    }
+  }
+  *k=kk;
+  return i;
+}
+
+#ifdef SIEVE_EXTRACT_AVX512
+SIEVE_TARGET("avx512f,popcnt")
+static unsigned int sieve_extract_avx512(const unsigned int *array, unsigned int i, unsigned int i_end,
+                                         unsigned int *ktab, unsigned int *k, unsigned int k_max, unsigned int offset)
+/* AVX-512: vpcompressd packs the positions of the set bits of 16 bits at a
+time. Compressing into a register and storing all 16 lanes is much faster than
+the masked compress-store on most CPUs. */
+{
+  unsigned int s, kk=*k;
+  __m512i pos, sixteen=_mm512_set1_epi32(16);
+  const __m512i lanes=_mm512_setr_epi32(0,1,2,3,4,5,6,7,8,9,10,11,12,13,14,15);
+
+  for(;i<i_end && kk<k_max;i+=32)
+  {
+    pos=_mm512_add_epi32(_mm512_set1_epi32((int)(i+offset)), lanes);
+    s=array[i>>5];
+    _mm512_storeu_si512((void *)(ktab+kk), _mm512_maskz_compress_epi32((__mmask16)(s&0xFFFF), pos));
+    kk+=_mm_popcnt_u32(s&0xFFFF);
+    pos=_mm512_add_epi32(pos, sixteen);
+    _mm512_storeu_si512((void *)(ktab+kk), _mm512_maskz_compress_epi32((__mmask16)(s>>16), pos));
+    kk+=_mm_popcnt_u32(s>>16);
+  }
+  *k=kk;
+  return i;
+}
+#endif /* SIEVE_EXTRACT_AVX512 */
+
+#ifdef _MSC_VER
+static int sieve_cpu_has(int leaf7_ebx_bit, int need_zmm)
+/* CPUID leaf 7 feature bit plus OS support for the AVX (and AVX-512) state */
+{
+  int regs[4];
+  unsigned long long xcr0;
+
+  __cpuid(regs, 0);
+  if(regs[0] < 7) return 0;
+  __cpuid(regs, 1);
+  if(leaf7_ebx_bit != 3) /* everything but BMI1 needs AVX state */
+  {
+    if(!(regs[2] & (1<<27))) return 0; /* OSXSAVE */
+    xcr0 = _xgetbv(0);
+    if((xcr0 & 0x06) != 0x06) return 0;
+    if(need_zmm && ((xcr0 & 0xE0) != 0xE0)) return 0;
+  }
+  __cpuidex(regs, 7, 0);
+  return (regs[1] >> leaf7_ebx_bit) & 1;
+}
+#define SIEVE_CPU_BMI    sieve_cpu_has(3, 0)
+#define SIEVE_CPU_AVX2   sieve_cpu_has(5, 0)
+#define SIEVE_CPU_AVX512 sieve_cpu_has(16, 1)
+#else
+#define SIEVE_CPU_BMI    __builtin_cpu_supports("bmi")
+#define SIEVE_CPU_AVX2   __builtin_cpu_supports("avx2")
+#define SIEVE_CPU_AVX512 __builtin_cpu_supports("avx512f")
+#endif
+#endif /* SIEVE_EXTRACT_X86 */
+
+static sieve_extract_func_t sieve_extract_words = sieve_extract_table;
+static const char          *sieve_extract_method = "table";
+
+static void sieve_select_extract(void)
+{
+  sieve_extract_words  = sieve_extract_table;
+  sieve_extract_method = "table";
+#ifdef SIEVE_EXTRACT_X86
+#ifdef __GNUC__
+  __builtin_cpu_init();
+#endif
+#ifdef SIEVE_EXTRACT_AVX512
+  if(SIEVE_CPU_AVX512)
+  {
+    sieve_extract_words  = sieve_extract_avx512;
+    sieve_extract_method = "AVX-512";
+    return;
+  }
+#endif
+  if(SIEVE_CPU_AVX2)
+  {
+    sieve_extract_words  = sieve_extract_avx2;
+    sieve_extract_method = "AVX2";
+    return;
+  }
+  if(SIEVE_CPU_BMI)
+  {
+    sieve_extract_words  = sieve_extract_bmi;
+    sieve_extract_method = "BMI";
+  }
+#endif
+}
+
+static __inline unsigned int sieve_extract(unsigned int *array, unsigned int *ktab, unsigned int k, unsigned int offset)
+/* appends all survivors of a completely sieved segment to ktab[k...] and
+returns the new number of entries. */
+{
+  unsigned int i;
+
+  i=sieve_extract_words(array, 0, SIEVE_SIZE_FF, ktab, &k, 0xFFFFFFFF, offset);
+  for(;i<SIEVE_SIZE;i++)
+  {
+    if(sieve_get_bit(array,i))ktab[k++]=i+offset;
+  }
+  return k;
+}
+
+static void sieve_worker_round(sieve_worker_t *w)
+/* sieve the next SIEVE_THREAD_SEGMENTS segments of this worker, then skip
+the segments handled by the other workers */
+{
+  struct timeval timer;
+  unsigned int i, n, k=0, sieve_limit=w->ctx->round_sieve_limit;
+  int j;
+
+  timer_init(&timer);
+  for(n=0;n<SIEVE_THREAD_SEGMENTS;n++)
+  {
+    sieve_segment(w->ctx, w->sieve, &(w->k_init), sieve_limit, &(w->buckets));
+    k = sieve_extract(w->sieve, w->ktab, k, n*SIEVE_SIZE);
+  }
+  w->ktab_count = k;
+
+  n = (sieve_limit < bucket_first) ? sieve_limit : bucket_first;
+#ifdef MORE_CLASSES
+  for(i=7;i<n;i++)
+#else
+  for(i=6;i<n;i++)
+#endif
+  {
+    j=sieve_get_k(&(w->k_init), i)-(int)skip_mod[i];
+    if(j<0)j+=primes[i];
+    sieve_set_k(&(w->k_init), i, j);
+  }
+  w->candidates += k;
+  w->usecs += timer_diff(&timer);
+}
+
+static THREAD_FUNC(sieve_worker_thread)
+{
+  sieve_worker_t *w = (sieve_worker_t *) arg;
+  sieve_ctx_t *ctx = w->ctx;
+  unsigned int round = 0;
+
+  thread_mutex_lock(&ctx->worker_mutex);
+  for(;;)
+  {
+    while(ctx->worker_round == round && !ctx->workers_quit) thread_cond_wait(&ctx->worker_start, &ctx->worker_mutex);
+    if(ctx->workers_quit) break;
+    round = ctx->worker_round;
+    thread_mutex_unlock(&ctx->worker_mutex);
+
+    sieve_worker_round(w);
+
+    thread_mutex_lock(&ctx->worker_mutex);
+    if(--ctx->workers_busy == 0) thread_cond_signal(&ctx->worker_done);
+  }
+  thread_mutex_unlock(&ctx->worker_mutex);
+  THREAD_RETURN;
+}
+
+static void sieve_run_round(sieve_ctx_t *ctx, unsigned int sieve_limit)
+/* let all workers sieve their next SIEVE_THREAD_SEGMENTS segments */
+{
+  unsigned int n;
+
+  ctx->round_sieve_limit = sieve_limit;
+  for(n=0;n<num_workers;n++)
+  {
+    ctx->workers[n].ktab_base = ctx->next_round_base + (unsigned long long int)n * SIEVE_THREAD_SEGMENTS * SIEVE_SIZE;
+  }
+  ctx->next_round_base += (unsigned long long int)num_workers * SIEVE_THREAD_SEGMENTS * SIEVE_SIZE;
+
+  thread_mutex_lock(&ctx->worker_mutex);
+  ctx->workers_busy = num_workers - 1;
+  ctx->worker_round++;
+  thread_cond_broadcast(&ctx->worker_start);
+  thread_mutex_unlock(&ctx->worker_mutex);
+
+  sieve_worker_round(&ctx->workers[0]);
+
+  thread_mutex_lock(&ctx->worker_mutex);
+  while(ctx->workers_busy > 0) thread_cond_wait(&ctx->worker_done, &ctx->worker_mutex);
+  thread_mutex_unlock(&ctx->worker_mutex);
+}
+
+static void sieve_candidates_mt(sieve_ctx_t *ctx, unsigned int ktab_size, unsigned int *ktab, unsigned int sieve_limit)
+/* same output as the single-threaded sieve_ctx_candidates() */
+{
+  unsigned int i, k=0, n, offset, *src;
+  sieve_worker_t *w;
+
+  while(k<ktab_size)
+  {
+    if(ctx->cur_worker >= num_workers)
+    {
+      sieve_run_round(ctx, sieve_limit);
+      ctx->cur_worker = 0;
+      ctx->cur_pos = 0;
+    }
+    w = &ctx->workers[ctx->cur_worker];
+    n = w->ktab_count - ctx->cur_pos;
+    if(n > ktab_size - k) n = ktab_size - k;
+    /* unsigned wrap-around is fine here, the result is always >= 0 */
+    offset = (unsigned int)(w->ktab_base - ctx->origin);
+    src = w->ktab + ctx->cur_pos;
+    for(i=0;i<n;i++) ktab[k+i] = src[i] + offset;
+    k += n;
+    ctx->cur_pos += n;
+    if(ctx->cur_pos >= w->ktab_count)
+    {
+      ctx->cur_worker++;
+      ctx->cur_pos = 0;
+    }
+  }
+  ctx->origin += (unsigned long long int)ktab[ktab_size-1] + 1;
+}
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -89,7 +856,7 @@ void sieve_init()
 void sieve_init(unsigned int ssize, unsigned int max_global)
 #endif
 {
-  unsigned int i,j;
+  unsigned int i,j,*ptr;
 #ifdef SIEVE_SIZE_LIMIT
   const unsigned int max_global = SIEVE_PRIMES_MAX;
 #else
@@ -97,6 +864,12 @@ void sieve_init(unsigned int ssize, unsigned int max_global)
   sieve_bytes = 4 + (ssize >> 3);
   sieve_words = sieve_bytes >> 2;
   sieve_size_ff = ssize & 0xFFFFFFE0;
+
+  sieve_segment = sieve_segment_any;
+  for(i=0;i<sizeof(sieve_segment_sizes)/sizeof(sieve_segment_sizes[0]);i++)
+  {
+    if(sieve_segment_sizes[i].size == ssize) sieve_segment = sieve_segment_sizes[i].func;
+  }
 #endif
 
   for(i=0;i<32;i++)
@@ -104,12 +877,11 @@ void sieve_init(unsigned int ssize, unsigned int max_global)
     mask1[i]=1<<i;
     mask0[i]=0xFFFFFFFF-mask1[i];
   }
-  sieve      = malloc(SIEVE_BYTES);
-  sieve_base = malloc(SIEVE_BYTES);
-  primes     = malloc((1+max_global) * sizeof(unsigned int));
-  k_init     = malloc(max_global * sizeof(int));
+  primes_max = max_global;
+  primes     = mem_alloc((1+max_global) * sizeof(unsigned int), 1);
+  class_step = mem_alloc(max_global * sizeof(unsigned int), 1);
 
-  if ((sieve == NULL) || (sieve_base == NULL) || (primes == NULL) || (k_init == NULL))
+  if ((primes == NULL) || (class_step == NULL))
   {
     fprintf(stderr, "ERROR: out of memory\n");
     exit(1); // TODO: add and evaluate return value for this function
@@ -133,14 +905,246 @@ void sieve_init(unsigned int ssize, unsigned int max_global)
       }
     }
   }
+
+#ifdef MORE_CLASSES
+  for(i=4;i<max_global;i++)
+#else
+  for(i=3;i<max_global;i++)
+#endif
+  {
+    class_step[i] = sieve_euclid_modified(NUM_CLASSES % primes[i], primes[i], primes[i] - 1);
+  }
+
+  sieve_select_extract();
+
+  pattern_end = SIEVE_PATTERN_FIRST;
+  while((pattern_end < SIEVE_PATTERN_FIRST + SIEVE_PATTERN_COUNT) && (primes[pattern_end] <= SIEVE_PATTERN_MAX)) pattern_end++;
+  j = 0;
+  for(i=SIEVE_PATTERN_FIRST;i<pattern_end;i++)
+  {
+    sieve_pattern[i-SIEVE_PATTERN_FIRST].length = primes[i] * ((SIEVE_PATTERN_WORDS + primes[i] - 1) / primes[i]);
+    j += sieve_pattern[i-SIEVE_PATTERN_FIRST].length;
+  }
+  sieve_pattern_words = mem_alloc(j * sizeof(unsigned int), 0);
+  if (sieve_pattern_words == NULL)
+  {
+    fprintf(stderr, "ERROR: out of memory\n");
+    exit(1);
+  }
+  ptr = sieve_pattern_words;
+  for(i=SIEVE_PATTERN_FIRST;i<pattern_end;i++)
+  {
+    sieve_pattern_t *pattern = &sieve_pattern[i-SIEVE_PATTERN_FIRST];
+    unsigned int p = primes[i];
+
+    pattern->words = ptr;
+    for(j=0;j<pattern->length;j++) ptr[j] = 0xFFFFFFFF;
+    for(j=0;j<32*pattern->length;j+=p) sieve_clear_bit(ptr, j);
+    for(j=1;(32*j)%p != 1;j++);
+    pattern->inv32 = j;
+    pattern->size_mod = SIEVE_SIZE % p;
+    ptr += pattern->length;
+  }
+
+  bucket_first = SIEVE_SPLIT;
+  while((bucket_first < max_global) && (primes[bucket_first] < SIEVE_SIZE)) bucket_first++;
+  pk16_end = SIEVE_SPLIT;
+  while((pk16_end < bucket_first) && (primes[pk16_end] < 65536)) pk16_end++;
+
+  if(num_workers > 1)
+  {
+    chunk_mod = mem_alloc(max_global * sizeof(unsigned int), 1);
+    skip_mod  = mem_alloc(max_global * sizeof(unsigned int), 1);
+    if ((chunk_mod == NULL) || (skip_mod == NULL))
+    {
+      fprintf(stderr, "ERROR: out of memory\n");
+      exit(1);
+    }
+    for(i=0;i<max_global;i++)
+    {
+      chunk_mod[i] = (unsigned int)(((unsigned long long int)SIEVE_THREAD_SEGMENTS * SIEVE_SIZE) % primes[i]);
+      skip_mod[i]  = (unsigned int)(((unsigned long long int)(num_workers - 1) * SIEVE_THREAD_SEGMENTS * SIEVE_SIZE) % primes[i]);
+    }
+  }
+
+  sieve_default = sieve_ctx_create();
+  if (sieve_default == NULL)
+  {
+    fprintf(stderr, "ERROR: out of memory\n");
+    exit(1);
+  }
 }
 
 void sieve_free()
 {
-  if (sieve)      free(sieve);      sieve=NULL;
-  if (sieve_base) free(sieve_base); sieve_base=NULL;
-  if (primes)     free(primes);     primes=NULL;
-  if (k_init)     free(k_init);     k_init=NULL;
+  if (sieve_default) sieve_ctx_destroy(sieve_default); sieve_default=NULL;
+  mem_free(chunk_mod);  chunk_mod=NULL;
+  mem_free(skip_mod);   skip_mod=NULL;
+  mem_free(primes);     primes=NULL;
+  mem_free(sieve_pattern_words); sieve_pattern_words=NULL;
+  mem_free(class_step); class_step=NULL;
+}
+
+sieve_ctx_t *sieve_ctx_create()
+/* creates a new sieve context using the tables of sieve_init(), with
+SieveThreads threads of its own. Returns NULL if out of memory. */
+{
+  sieve_ctx_t *ctx;
+  unsigned int i;
+
+  ctx = calloc(1, sizeof(sieve_ctx_t));
+  if (ctx == NULL) return NULL;
+
+  ctx->sieve      = mem_alloc(SIEVE_BYTES, 0);
+  ctx->sieve_base = mem_alloc(SIEVE_BYTES, 0);
+  ctx->class_k0   = mem_alloc(primes_max * sizeof(unsigned int), 1);
+  if ((ctx->sieve == NULL) || (ctx->sieve_base == NULL) || sieve_offsets_alloc(&ctx->k_init) || (ctx->class_k0 == NULL))
+  {
+    sieve_ctx_destroy(ctx);
+    return NULL;
+  }
+
+  if(num_workers == 1)
+  {
+    if(bucket_alloc(&ctx->buckets, primes_max, 0, 0))
+    {
+      sieve_ctx_destroy(ctx);
+      return NULL;
+    }
+    return ctx;
+  }
+
+  ctx->workers = calloc(num_workers, sizeof(sieve_worker_t));
+  if (ctx->workers == NULL)
+  {
+    sieve_ctx_destroy(ctx);
+    return NULL;
+  }
+  thread_mutex_init(&ctx->worker_mutex);
+  thread_cond_init(&ctx->worker_start);
+  thread_cond_init(&ctx->worker_done);
+  ctx->cur_worker = num_workers;
+
+  for(i=0;i<num_workers;i++)
+  {
+    ctx->workers[i].ctx    = ctx;
+    ctx->workers[i].sieve  = mem_alloc(SIEVE_BYTES, 0);
+    ctx->workers[i].ktab   = mem_alloc((SIEVE_THREAD_SEGMENTS * SIEVE_SIZE + 8) * sizeof(unsigned int), 0);
+    if ((ctx->workers[i].sieve == NULL) || sieve_offsets_alloc(&(ctx->workers[i].k_init)) || (ctx->workers[i].ktab == NULL) ||
+        bucket_alloc(&(ctx->workers[i].buckets), primes_max, SIEVE_THREAD_SEGMENTS * SIEVE_SIZE, i))
+    {
+      sieve_ctx_destroy(ctx);
+      return NULL;
+    }
+  }
+
+  for(i=1;i<num_workers;i++)
+  {
+    if (thread_create(&ctx->workers[i].thread, sieve_worker_thread, &ctx->workers[i]))
+    {
+      fprintf(stderr, "ERROR: could not start sieve thread %u\n", i);
+      sieve_ctx_destroy(ctx);
+      return NULL;
+    }
+    ctx->threads_started = i;
+  }
+  return ctx;
+}
+
+void sieve_ctx_destroy(sieve_ctx_t *ctx)
+/* stops the threads of the context and frees it */
+{
+  unsigned int i;
+
+  if (ctx->workers)
+  {
+    thread_mutex_lock(&ctx->worker_mutex);
+    ctx->workers_quit = 1;
+    thread_cond_broadcast(&ctx->worker_start);
+    thread_mutex_unlock(&ctx->worker_mutex);
+    for(i=1;i<=ctx->threads_started;i++) thread_join(ctx->workers[i].thread);
+    for(i=0;i<num_workers;i++)
+    {
+      mem_free(ctx->workers[i].sieve);
+      sieve_offsets_free(&(ctx->workers[i].k_init));
+      mem_free(ctx->workers[i].ktab);
+      bucket_free(&(ctx->workers[i].buckets));
+    }
+    thread_cond_destroy(&ctx->worker_done);
+    thread_cond_destroy(&ctx->worker_start);
+    thread_mutex_destroy(&ctx->worker_mutex);
+    free(ctx->workers);
+  }
+  bucket_free(&ctx->buckets);
+  mem_free(ctx->sieve);
+  mem_free(ctx->sieve_base);
+  sieve_offsets_free(&ctx->k_init);
+  mem_free(ctx->class_k0);
+  free(ctx);
+}
+
+unsigned int sieve_set_threads(unsigned int num_threads)
+/* sets the number of threads used by sieve_candidates(). Needs to be called
+before sieve_init(). Returns the number of threads that will be used. */
+{
+  if(num_threads < 1) num_threads = 1;
+  if(num_threads > SIEVE_THREADS_MAX) num_threads = SIEVE_THREADS_MAX;
+  num_workers = num_threads;
+  return num_workers;
+}
+
+unsigned int sieve_thread_stats(unsigned long long int *candidates, unsigned long long int *usecs)
+/* copies the number of candidates and the sieving time of each sieve thread
+of the default context since the last call into the arrays (SIEVE_THREADS_MAX elements) and returns
+the number of sieve threads */
+{
+  unsigned int i;
+
+  if((sieve_default == NULL) || (sieve_default->workers == NULL)) return 0;
+  for(i=0;i<num_workers;i++)
+  {
+    candidates[i] = sieve_default->workers[i].candidates;
+    usecs[i]      = sieve_default->workers[i].usecs;
+    sieve_default->workers[i].candidates = 0;
+    sieve_default->workers[i].usecs      = 0;
+  }
+  return num_workers;
+}
+
+const char *sieve_extract_name()
+/* returns the name of the bit extraction method selected by sieve_init() */
+{
+  return sieve_extract_method;
+}
+
+const char *sieve_segment_name()
+/* returns the kind of sieve_segment() selected by sieve_init(): "fixed" if
+the sieve size is a compile time constant, "generic" otherwise */
+{
+#ifdef SIEVE_SIZE_LIMIT
+  return "fixed";
+#else
+  return (sieve_segment == sieve_segment_any) ? "generic" : "fixed";
+#endif
+}
+
+unsigned int sieve_size_limit_auto()
+/* SieveSizeLimit=0: returns the SieveSizeLimit in kiB of the largest fixed
+sieve size up to the L1 data cache size plus 4 kiB (the perftest shows
+36 kiB as the best size for a 32 kiB L1 cache). 36 kiB if the cache size is
+unknown. */
+{
+  unsigned int l1_bits = thread_l1_cache_size() * 8, size = 0;
+#ifndef SIEVE_SIZE_LIMIT
+  unsigned int i;
+
+  for(i=0;i<sizeof(sieve_segment_sizes)/sizeof(sieve_segment_sizes[0]);i++)
+  {
+    if(sieve_segment_sizes[i].size <= l1_bits + 4*8192) size = sieve_segment_sizes[i].size;
+  }
+#endif
+  if(l1_bits == 0 || size == 0) return 36;
+  return size / 8192 + 1;               /* read_config() rounds this down to size again */
 }
 
 int sieve_euclid_modified(int j, int n, int r)
@@ -204,16 +1208,35 @@ j, n, r  <=  primes[200000] = 2750161 (22 bits) */
   return (int)tmp;
 }
 
-void sieve_init_class(unsigned int exp, unsigned long long int k_start, unsigned int sieve_limit)
+void sieve_ctx_init_class(sieve_ctx_t *ctx, unsigned int exp, unsigned long long int k_start, unsigned int sieve_limit)
 {
-  unsigned int i,j,k,p;
+  unsigned int i,j,k,p,c,first;
   unsigned int ii,jj;
+  unsigned long long int k_base;
+  long long int r;
+  double x;
 
-#ifdef MORE_CLASSES  
-  for(i=4;i<sieve_limit;i++)
+#ifdef MORE_CLASSES
+  first=4;
 #else
-  for(i=3;i<sieve_limit;i++)
-#endif  
+  first=3;
+#endif
+
+/* k_init[i] depends on the class only by a linear term:
+k_init(k_base + c) = k_init(k_base) - c / NUM_CLASSES (mod p)
+The expensive part (the modified euclidean algorithm) is done once per
+exponent and k_base (k_start rounded down to a multiple of NUM_CLASSES) and
+stored in class_k0[], each class needs just one multiply and mod per prime. */
+  k_base = k_start - (k_start % NUM_CLASSES);
+  c      = (unsigned int)(k_start % NUM_CLASSES);
+  if((exp != ctx->class_exp) || (k_base != ctx->class_base))
+  {
+    ctx->class_exp   = exp;
+    ctx->class_base  = k_base;
+    ctx->class_limit = first;
+  }
+
+  for(i=ctx->class_limit;i<sieve_limit;i++)
   {
     //unsigned long long int check;
 
@@ -240,11 +1263,11 @@ still a brute force trial&error method */
     // jj=(2ULL * (exp%p) * (NUM_CLASSES%p))%p;     // PERF: skip %p for NUM_CLASSES
 
     // skip 3 modulo's and the error checking: saves 10-20 CPU-ms per class
-    ii = (2ULL * (unsigned long long int)exp * (k_start%p))%p;
+    ii = (2ULL * (unsigned long long int)exp * (k_base%p))%p;
     jj = (9240ULL * (unsigned long long int)exp)%p;
 
     k = sieve_euclid_modified(jj, p, p-(1+ii));
-    k_init[i]=k;
+    ctx->class_k0[i]=k;
 
 // error checking
 /*    check = k_start + (unsigned long long int) k * NUM_CLASSES;
@@ -264,9 +1287,23 @@ still a brute force trial&error method */
       printf("  check= %" PRId64 "\n",check);
     } */
   }
+  if(ctx->class_limit < sieve_limit) ctx->class_limit = sieve_limit;
+
+/* class_k0[i] + class_step[i] * c < 2^37 is exact in a double, the quotient
+from the floating point division is off by at most one which is fixed below.
+This is faster than a 64 bit integer division. */
+  for(i=first;i<sieve_limit;i++)
+  {
+    p=primes[i];
+    x=(double)ctx->class_k0[i] + (double)class_step[i] * (double)c;
+    r=(long long int)x - (long long int)(x / (double)p) * p;
+    if(r < 0)r+=p;
+    else if(r >= p)r-=p;
+    sieve_set_k(&ctx->k_init, i, (int)r);
+  }
   
   // set all bits
-  for(i=0;i<SIEVE_WORDS;i++) sieve_base[i] = 0xFFFFFFFF;
+  for(i=0;i<SIEVE_WORDS;i++) ctx->sieve_base[i] = 0xFFFFFFFF;
 
 #ifdef MORE_CLASSES
 /* presieve 13, 17, 19 and 23 in sieve_base */
@@ -276,26 +1313,55 @@ still a brute force trial&error method */
   for(i=3;i<=6;i++)
 #endif
   {
-    j=k_init[i];
+    j=ctx->k_init.k[i];
     p=primes[i];
     while(j<SIEVE_SIZE)
     {
 //if((2 * (exp%p) * ((k_start+j*NUM_CLASSES)%p)) %p != (p-1))printf("EEEK: sieve: p=%d j=%d k=%" PRIu64 "\n",p,j,k_start+j*NUM_CLASSES);
-      sieve_clear_bit(sieve_base,j);
+      sieve_clear_bit(ctx->sieve_base,j);
       j+=p;
     }
 //    k_init[i]=j-SIEVE_SIZE;
   }
-  last_sieve = SIEVE_SIZE;
+  ctx->last_sieve = SIEVE_SIZE;
+  ctx->buckets.segment = 0;
+  ctx->buckets.limit   = 0;
+
+  if(ctx->workers)
+  {
+/* worker n starts n*SIEVE_THREAD_SEGMENTS segments after worker 0 */
+    jj = (sieve_limit < bucket_first) ? sieve_limit : bucket_first;
+    for(k=0;k<num_workers;k++)
+    {
+      ctx->workers[k].buckets.segment = 0;
+      ctx->workers[k].buckets.limit   = 0;
+#ifdef MORE_CLASSES
+      for(i=7;i<jj;i++)
+#else
+      for(i=6;i<jj;i++)
+#endif
+      {
+        if(k==0) j = sieve_get_k(&ctx->k_init, i);
+        else
+        {
+          j = sieve_get_k(&(ctx->workers[k-1].k_init), i);
+          j = (j >= chunk_mod[i]) ? j - chunk_mod[i] : j + primes[i] - chunk_mod[i];
+        }
+        sieve_set_k(&(ctx->workers[k].k_init), i, (int)j);
+      }
+    }
+    ctx->next_round_base = 0;
+    ctx->origin          = 0;
+    ctx->cur_worker      = num_workers;
+    ctx->cur_pos         = 0;
+  }
 }
 
 
-void sieve_candidates(unsigned int ktab_size, unsigned int *ktab, unsigned int sieve_limit)
+void sieve_ctx_candidates(sieve_ctx_t *ctx, unsigned int ktab_size, unsigned int *ktab, unsigned int sieve_limit)
 {
-  int i=-1,ii,j,p,c=0,ic;
-  unsigned int s,sieve_table_8,*sieve_table_,k=0;
-  unsigned int mask; //, index, index_max;
-  unsigned int *ptr, *ptr_max;
+  int i=-1,c=0;
+  unsigned int k=0;
   unsigned int ktab_size33 = ktab_size - 33;
 #ifdef VERBOSE_SIEVE_TIMING
   struct timeval timer;
@@ -308,9 +1374,15 @@ void sieve_candidates(unsigned int ktab_size, unsigned int *ktab, unsigned int s
   return;
 #endif  
 
-  if(last_sieve < (int)SIEVE_SIZE)
+  if(ctx->workers)
   {
-    i=last_sieve;
+    sieve_candidates_mt(ctx, ktab_size, ktab, sieve_limit);
+    return;
+  }
+
+  if(ctx->last_sieve < (int)SIEVE_SIZE)
+  {
+    i=ctx->last_sieve;
     c=-i;
     goto _ugly_goto_in_siever;
   }
@@ -322,68 +1394,8 @@ void sieve_candidates(unsigned int ktab_size, unsigned int *ktab, unsigned int s
   while(k<ktab_size)
   {
 //printf("sieve_candidates(): main loop start\n");
-    memcpy(sieve, sieve_base, SIEVE_BYTES);
-
-/*
-The first few primes in the sieve have their own code. Since they are small
-they have many iterations in the inner loop. At the cost of some
-initialisation we can avoid calls to sieve_clear_bit() which calculates
-chunk and bit position in chunk on each call.
-Every 32 iterations they hit the same bit position so we can make use of
-this behaviour and precompute them. :)
-*/
-#ifdef VERBOSE_SIEVE_TIMING
-  printf("Sieve base copied: %llu\n", timer_diff(&timer));
-#endif
-
-#ifdef MORE_CLASSES
-    for(i=7;i<SIEVE_SPLIT;i++)
-#else
-    for(i=6;i<SIEVE_SPLIT;i++)
-#endif
-    {
-      j=k_init[i];
-      p=primes[i];
-//printf("sieve: %d\n",p);
-      for(ii=0; ii<32; ii++)
-      {
-        mask = mask0[j & 0x1F];
-
-        ptr = &(sieve[j>>5]);
-        ptr_max = &(sieve[SIEVE_WORDS]);
-//        ptr_max is now always &(sieve[SIEVE_SIZE>>5])+1
-//        this may result in one more loop than necessary. Advancing ptr by one more p
-//        does not matter as k_init is calculated %p
-//        if( ((unsigned int)j & 0x1F) < (SIEVE_SIZE & 0x1F))ptr_max++;
-        while(ptr < ptr_max) /* inner loop, lets kick out some bits! */
-        {
-          *ptr &= mask;
-          ptr += p;
-        }
-        j+=p;
-      }
-      j = ((int)(ptr - sieve)<<5) + ((j-p) & 0x1F); /* D'oh! Pointer arithmetic... but it is faster! */
-      j -= SIEVE_SIZE;
-      k_init[i] = j % p;
-    }
-
-#ifdef VERBOSE_SIEVE_TIMING
-  printf("Sieve split: %llu\n", timer_diff(&timer));
-#endif
+    sieve_segment(ctx, ctx->sieve, &ctx->k_init, sieve_limit, &ctx->buckets);
 
-    for(i=SIEVE_SPLIT;i<(int)sieve_limit;i++)
-    {
-      j=k_init[i];
-      p=primes[i];
-//printf("sieve: %d\n",p);
-      while((unsigned int)j<SIEVE_SIZE)
-      {
-        sieve_clear_bit(sieve,j);
-        j+=p;
-      }
-      k_init[i]=j-SIEVE_SIZE;
-    }
-    
 #ifdef VERBOSE_SIEVE_TIMING
   printf("Sieve done: %llu\n", timer_diff(&timer));
 #endif
@@ -399,12 +1411,12 @@ this is going to fail if ktab has less than 32 elements! */
     for(i=0;((unsigned int)i<SIEVE_SIZE) && (i&0x1F);i++)
     {
 _ugly_goto_in_siever:
-      if(sieve_get_bit(sieve,i))
+      if(sieve_get_bit(ctx->sieve,i))
       {
         ktab[k++]=i+c;
         if(k >= ktab_size)
         {
-          last_sieve=i+1;
+          ctx->last_sieve=i+1;
 #ifdef VERBOSE_SIEVE_TIMING
           printf("Return 1   : %llu\n", timer_diff(&timer));
 #endif
@@ -422,89 +1434,7 @@ Get the bits out of the sieve until
 a) we're close the end of the sieve
 or
 b) ktab is nearly filled up */
-    for(;(unsigned int)i<SIEVE_SIZE_FF && k<ktab_size33;i+=32)	// thirty-three!!!
-    {
-      ic=i+c;
-      s=sieve[i>>5];
-//#define SIEVER_OLD_METHOD
-#ifdef SIEVER_OLD_METHOD
-      sieve_table_=sieve_table[ s     &0xFF];
-      for(p=0;p<sieve_table_[8];p++) ktab[k++]=ic   +sieve_table_[p];
-      
-      sieve_table_=sieve_table[(s>>8 )&0xFF];
-      for(p=0;p<sieve_table_[8];p++) ktab[k++]=ic +8+sieve_table_[p];
-      
-      sieve_table_=sieve_table[(s>>16)&0xFF];
-      for(p=0;p<sieve_table_[8];p++) ktab[k++]=ic+16+sieve_table_[p];
-      
-      sieve_table_=sieve_table[ s>>24      ];
-      for(p=0;p<sieve_table_[8];p++) ktab[k++]=ic+24+sieve_table_[p];
-
-#else // not SIEVER_OLD_METHOD
-      sieve_table_=sieve_table[ s     &0xFF];
-      sieve_table_8=sieve_table_[8];
-      ktab[k  ]=ic+sieve_table_[0];
-      ktab[k+1]=ic+sieve_table_[1];
-      ktab[k+2]=ic+sieve_table_[2];
-      ktab[k+3]=ic+sieve_table_[3];
-      if(sieve_table_8>4)
-      {
-        ktab[k+4]=ic+sieve_table_[4];
-        ktab[k+5]=ic+sieve_table_[5];
-        ktab[k+6]=ic+sieve_table_[6];
-        ktab[k+7]=ic+sieve_table_[7];
-      }
-      k+=sieve_table_8;
-      
-      sieve_table_=sieve_table[(s>>8 )&0xFF];
-      sieve_table_8=sieve_table_[8];
-      ic+=8;
-      ktab[k  ]=ic+sieve_table_[0];
-      ktab[k+1]=ic+sieve_table_[1];
-      ktab[k+2]=ic+sieve_table_[2];
-      ktab[k+3]=ic+sieve_table_[3];
-      if(sieve_table_8>4)
-      {
-        ktab[k+4]=ic+sieve_table_[4];
-        ktab[k+5]=ic+sieve_table_[5];
-        ktab[k+6]=ic+sieve_table_[6];
-        ktab[k+7]=ic+sieve_table_[7];
-      }
-      k+=sieve_table_8;
-      
-      sieve_table_=sieve_table[(s>>16)&0xFF];
-      sieve_table_8=sieve_table_[8];
-      ic+=8;
-      ktab[k  ]=ic+sieve_table_[0];
-      ktab[k+1]=ic+sieve_table_[1];
-      ktab[k+2]=ic+sieve_table_[2];
-      ktab[k+3]=ic+sieve_table_[3];
-      if(sieve_table_8>4)
-      {
-        ktab[k+4]=ic+sieve_table_[4];
-        ktab[k+5]=ic+sieve_table_[5];
-        ktab[k+6]=ic+sieve_table_[6];
-        ktab[k+7]=ic+sieve_table_[7];
-      }
-      k+=sieve_table_8;
-      
-      sieve_table_=sieve_table[ s>>24      ];
-      sieve_table_8=sieve_table_[8];
-      ic+=8;
-      ktab[k  ]=ic+sieve_table_[0];
-      ktab[k+1]=ic+sieve_table_[1];
-      ktab[k+2]=ic+sieve_table_[2];
-      ktab[k+3]=ic+sieve_table_[3];
-      if(sieve_table_8>4)
-      {
-        ktab[k+4]=ic+sieve_table_[4];
-        ktab[k+5]=ic+sieve_table_[5];
-        ktab[k+6]=ic+sieve_table_[6];
-        ktab[k+7]=ic+sieve_table_[7];
-      }
-      k+=sieve_table_8;
-#endif      
-    }
+    i=(int)sieve_extract_words(ctx->sieve, (unsigned int)i, SIEVE_SIZE_FF, ktab, &k, ktab_size33, (unsigned int)c);	// thirty-three!!!
 #ifdef VERBOSE_SIEVE_TIMING
   printf("Extract 2  : %llu\n", timer_diff(&timer));
 #endif
@@ -516,12 +1446,12 @@ or
 b) ktab is full */    
     for(;(unsigned int)i<SIEVE_SIZE;i++)
     {
-      if(sieve_get_bit(sieve,i))
+      if(sieve_get_bit(ctx->sieve,i))
       {
         ktab[k++]=i+c;
         if(k >= ktab_size)
         {
-          last_sieve=i+1;
+          ctx->last_sieve=i+1;
 #ifdef VERBOSE_SIEVE_TIMING
           printf("Return 2   : %llu\n", timer_diff(&timer));
 #endif
@@ -536,7 +1466,7 @@ b) ktab is full */
 #endif
 
   }
-  last_sieve=i;
+  ctx->last_sieve=i;
 #ifdef VERBOSE_SIEVE_TIMING
   printf("All done   : %llu\n", timer_diff(&timer));
 #endif
@@ -544,6 +1474,18 @@ b) ktab is full */
 }
 
 
+void sieve_init_class(unsigned int exp, unsigned long long int k_start, unsigned int sieve_limit)
+{
+  sieve_ctx_init_class(sieve_default, exp, k_start, sieve_limit);
+}
+
+
+void sieve_candidates(unsigned int ktab_size, unsigned int *ktab, unsigned int sieve_limit)
+{
+  sieve_ctx_candidates(sieve_default, ktab_size, ktab, sieve_limit);
+}
+
+
 unsigned int sieve_sieve_primes_max(unsigned int exp, unsigned int sieve_max)
 /* returns min(max_global, number of primes below exp) */
 {
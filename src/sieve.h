@@ -21,6 +21,9 @@ along with mfaktc (mfakto).  If not, see <http://www.gnu.org/licenses/>.
 extern "C" {
 #endif
 
+/* state of one sieve (class of an exponent), see sieve_ctx_create() */
+typedef struct _sieve_ctx_t sieve_ctx_t;
+
 #ifdef SIEVE_SIZE_LIMIT
 void sieve_init();
 #else
@@ -28,10 +31,21 @@ void sieve_init(unsigned int ssize, unsigned int max_global);
 #endif
 
 void sieve_free();
+unsigned int sieve_set_threads(unsigned int num_threads);
+unsigned int sieve_thread_stats(unsigned long long int *candidates, unsigned long long int *usecs);
+const char *sieve_extract_name();
+const char *sieve_segment_name();
+unsigned int sieve_size_limit_auto();
 void sieve_init_class(unsigned int exp, unsigned long long int k_start, unsigned int sieve_limit);
 void sieve_candidates(unsigned int ktab_size, unsigned int *ktab, unsigned int sieve_limit);
 unsigned int sieve_sieve_primes_max(unsigned int exp, unsigned int max_global);
 
+/* re-entrant interface, needs sieve_init() for the shared tables */
+sieve_ctx_t *sieve_ctx_create();
+void sieve_ctx_destroy(sieve_ctx_t *ctx);
+void sieve_ctx_init_class(sieve_ctx_t *ctx, unsigned int exp, unsigned long long int k_start, unsigned int sieve_limit);
+void sieve_ctx_candidates(sieve_ctx_t *ctx, unsigned int ktab_size, unsigned int *ktab, unsigned int sieve_limit);
+
 #ifdef __cplusplus
 }
 #endif
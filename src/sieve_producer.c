@@ -0,0 +1,227 @@
+/*
+This file is part of mfaktc (mfakto).
+Copyright (C) 2009 - 2014  Oliver Weihe (o.weihe@t-online.de)
+                           Bertram Franz (bertramf@gmx.net)
+
+mfaktc (mfakto) is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+mfaktc (mfakto) is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with mfaktc (mfakto).  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "params.h"
+#include "threads.h"
+#include "sieve.h"
+#include "sieve_producer.h"
+
+#define SLOT_FREE   0 /* the producer may (re)fill the buffer */
+#define SLOT_FILLED 1 /* sieved, owned by the submitter until released */
+
+#define WAITER_PRODUCER  0
+#define WAITER_SUBMITTER 1
+
+/* One thread per producer, it sieves one class at a time and sleeps in
+between. state[], finished, active, quit and shutdown are written by both
+threads and accessed with thread_atomic_load/store(), k_diff[i] is written by
+the producer before state[i] becomes SLOT_FILLED, the class parameters are
+written by the submitter while active is 0.
+A thread waiting for a change spins SIEVE_PRODUCER_SPIN times, then sets its
+waiting[] flag and blocks on cond. The other thread stores the change, and
+takes mutex to wake it only if a waiting[] flag is set: handing over a buffer
+takes no lock as long as neither thread has to sleep. A full fence between the
+store and the load on both sides ensures that at least one of them sees the
+other's store, so no wakeup is lost. */
+struct _sieve_producer_t
+{
+  sieve_ctx_t           *ctx;         /* NULL: the context of sieve_init() */
+  thread_t               thread;
+  unsigned int         **ktab;
+  unsigned int           num_buffers, first_buffer, ktab_size, sieve_limit;
+  unsigned long long int k_min, k_max;
+  unsigned long long int k_diff[NUM_STREAMS_MAX];
+  volatile unsigned int  state[NUM_STREAMS_MAX];
+  volatile unsigned int  finished;    /* all buffers of the class are filled */
+  volatile unsigned int  active;      /* a class is set up, cleared by the thread when it is done */
+  volatile unsigned int  quit;        /* abort the current class */
+  volatile unsigned int  shutdown;    /* end the thread */
+  volatile unsigned int  waiting[2];  /* WAITER_*: the thread is blocked (or about to block) on cond */
+  thread_mutex_t         mutex;
+  thread_cond_t          cond;
+};
+
+
+static void producer_wait(sieve_producer_t *p, unsigned int waiter, volatile unsigned int *ptr, unsigned int value, volatile unsigned int *done)
+/* returns once *ptr == value or *done is set (done may be NULL) */
+{
+  unsigned int i;
+
+  for(i=0;i<SIEVE_PRODUCER_SPIN;i++)
+  {
+    if((thread_atomic_load(ptr) == value) || (done && thread_atomic_load(done)))return;
+  }
+  thread_mutex_lock(&p->mutex);
+  thread_atomic_store(&p->waiting[waiter], 1);
+  thread_atomic_fence();
+  while((thread_atomic_load(ptr) != value) && !(done && thread_atomic_load(done)))
+  {
+    thread_cond_wait(&p->cond, &p->mutex);
+  }
+  thread_atomic_store(&p->waiting[waiter], 0);
+  thread_mutex_unlock(&p->mutex);
+}
+
+
+static void producer_signal(sieve_producer_t *p, volatile unsigned int *ptr, unsigned int value)
+/* sets a slot state or flag and wakes the other thread if it is blocked */
+{
+  thread_atomic_store(ptr, value);
+  thread_atomic_fence();
+  if(thread_atomic_load(&p->waiting[WAITER_PRODUCER]) || thread_atomic_load(&p->waiting[WAITER_SUBMITTER]))
+  {
+    thread_mutex_lock(&p->mutex);
+    thread_cond_broadcast(&p->cond);
+    thread_mutex_unlock(&p->mutex);
+  }
+}
+
+
+static void producer_run_class(sieve_producer_t *p)
+{
+  unsigned int slot = p->first_buffer, *ktab;
+  unsigned long long int k_min = p->k_min;
+
+  while(k_min <= p->k_max)
+  {
+    producer_wait(p, WAITER_PRODUCER, &p->state[slot], SLOT_FREE, &p->quit);
+    if(thread_atomic_load(&p->quit))return;
+
+    ktab = p->ktab[slot];
+    if(p->ctx) sieve_ctx_candidates(p->ctx, p->ktab_size, ktab, p->sieve_limit);
+    else       sieve_candidates(p->ktab_size, ktab, p->sieve_limit);
+    p->k_diff[slot]  = ktab[p->ktab_size-1]+1;
+    p->k_diff[slot] *= NUM_CLASSES; /* NUM_CLASSES because classes are mod NUM_CLASSES */
+    producer_signal(p, &p->state[slot], SLOT_FILLED);
+
+    k_min += p->k_diff[slot];
+    if(++slot == p->num_buffers) slot = 0;
+  }
+  producer_signal(p, &p->finished, 1);
+}
+
+
+static THREAD_FUNC(sieve_producer_thread)
+{
+  sieve_producer_t *p = (sieve_producer_t *)arg;
+
+  for(;;)
+  {
+    producer_wait(p, WAITER_PRODUCER, &p->active, 1, &p->shutdown);
+    if(thread_atomic_load(&p->shutdown)) THREAD_RETURN;
+
+    producer_run_class(p);
+    producer_signal(p, &p->active, 0);
+  }
+}
+
+
+sieve_producer_t *sieve_producer_create(sieve_ctx_t *ctx)
+/* creates a producer sieving with ctx (NULL: the context of sieve_init()) and
+starts its thread, which waits for sieve_producer_start(). Returns NULL if out
+of memory or the thread could not be started. */
+{
+  sieve_producer_t *p;
+
+  p = calloc(1, sizeof(sieve_producer_t));
+  if(p == NULL) return NULL;
+  p->ctx = ctx;
+  thread_mutex_init(&p->mutex);
+  thread_cond_init(&p->cond);
+  if(thread_create(&p->thread, sieve_producer_thread, p))
+  {
+    printf("ERROR: could not start the sieve producer thread\n");
+    thread_cond_destroy(&p->cond);
+    thread_mutex_destroy(&p->mutex);
+    free(p);
+    return NULL;
+  }
+  return p;
+}
+
+
+void sieve_producer_destroy(sieve_producer_t *p)
+/* ends the thread and frees the producer */
+{
+  if(p == NULL) return;
+  sieve_producer_stop(p);
+  producer_signal(p, &p->shutdown, 1);
+  thread_join(p->thread);
+  thread_cond_destroy(&p->cond);
+  thread_mutex_destroy(&p->mutex);
+  free(p);
+}
+
+
+int sieve_producer_start(sieve_producer_t *p, unsigned int **ktab, unsigned int num_buffers, unsigned int first_buffer,
+                         unsigned int ktab_size, unsigned int sieve_limit, unsigned long long int k_min, unsigned long long int k_max)
+/* hands the current class (see sieve_init_class()) to the thread, which
+sieves it into ktab[first_buffer], ktab[first_buffer+1], ... ktab[num_buffers-1],
+ktab[0], ... until the k's of the buffers pass k_max. Buffers still in use by
+the submitter (from the previous class) keep their state and are filled once
+released. Returns 0 on success. */
+{
+  sieve_producer_stop(p);
+
+  p->ktab         = ktab;
+  p->num_buffers  = num_buffers;
+  p->first_buffer = first_buffer;
+  p->ktab_size    = ktab_size;
+  p->sieve_limit  = sieve_limit;
+  p->k_min        = k_min;
+  p->k_max        = k_max;
+  thread_atomic_store(&p->finished, 0);
+  thread_atomic_store(&p->quit, 0);
+  producer_signal(p, &p->active, 1);
+  return 0;
+}
+
+
+int sieve_producer_get(sieve_producer_t *p, unsigned int index, unsigned long long int *k_diff)
+/* waits until ktab[index] is filled and returns the k range it covers
+(k_diff, the k_min of the next buffer minus the k_min of this one). Buffers
+must be taken in the order they are filled. Returns 0 on success, 1 if the
+producer has finished the class without filling this buffer. */
+{
+  producer_wait(p, WAITER_SUBMITTER, &p->state[index], SLOT_FILLED, &p->finished);
+  /* finished is set after the last buffer became SLOT_FILLED */
+  if(thread_atomic_load(&p->state[index]) != SLOT_FILLED)return 1;
+  *k_diff = p->k_diff[index];
+  return 0;
+}
+
+
+void sieve_producer_release(sieve_producer_t *p, unsigned int index)
+/* gives ktab[index] back to the producer once its kernel has finished */
+{
+  producer_signal(p, &p->state[index], SLOT_FREE);
+}
+
+
+void sieve_producer_stop(sieve_producer_t *p)
+/* waits until the thread has finished the current class, or aborts it */
+{
+  if(!thread_atomic_load(&p->active))return;
+
+  producer_signal(p, &p->quit, 1);
+  producer_wait(p, WAITER_SUBMITTER, &p->active, 0, NULL);
+}
@@ -0,0 +1,50 @@
+/*
+This file is part of mfaktc (mfakto).
+Copyright (C) 2009 - 2013  Oliver Weihe (o.weihe@t-online.de)
+                           Bertram Franz (bertramf@gmx.net)
+
+mfaktc (mfakto) is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+mfaktc (mfakto) is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with mfaktc (mfakto).  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* sieve producer thread: fills the k_tab buffers of one class in the
+   background while the caller (the submitter) uploads them and runs the
+   kernels. The buffers are used round-robin, each has its own state (free /
+   filled) which the two threads hand over with atomic stores; the mutex is
+   only taken when one of them has to sleep. Each device thread has its own
+   producer, its thread runs from sieve_producer_create() to
+   sieve_producer_destroy() and gets one class after the other. */
+
+#ifndef SIEVE_PRODUCER_H_
+#define SIEVE_PRODUCER_H_
+
+#include "sieve.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct _sieve_producer_t sieve_producer_t;
+
+sieve_producer_t *sieve_producer_create(sieve_ctx_t *ctx);
+void sieve_producer_destroy(sieve_producer_t *p);
+int  sieve_producer_start(sieve_producer_t *p, unsigned int **ktab, unsigned int num_buffers, unsigned int first_buffer,
+                          unsigned int ktab_size, unsigned int sieve_limit, unsigned long long int k_min, unsigned long long int k_max);
+int  sieve_producer_get(sieve_producer_t *p, unsigned int index, unsigned long long int *k_diff);
+void sieve_producer_release(sieve_producer_t *p, unsigned int index);
+void sieve_producer_stop(sieve_producer_t *p);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,144 @@
+/*
+This file is part of mfaktc (mfakto).
+Copyright (C) 2009 - 2014  Oliver Weihe (o.weihe@t-online.de)
+                           Bertram Franz (bertramf@gmx.net)
+
+mfaktc (mfakto) is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+mfaktc (mfakto) is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with mfaktc (mfakto).  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* sieve_segment() of sieve.c, included there once for each sieve size in
+sieve_segment_sizes[] with a constant SEGMENT_SIZE and once with the runtime
+sieve_size. The constant size lets the compiler unroll the pattern loop and
+compute the loop bounds at compile time, like a SIEVE_SIZE_LIMIT #define
+does.
+SEGMENT_NAME: name of the function
+SEGMENT_SIZE: sieve size in bits
+No include guard, both macros are undefined at the end. */
+
+#define SEGMENT_BYTES (4+((SEGMENT_SIZE) >> 3))
+#define SEGMENT_WORDS (SEGMENT_BYTES >> 2)
+
+static void SEGMENT_NAME(sieve_ctx_t *ctx, unsigned int *array, sieve_offsets_t *o, unsigned int sieve_limit, sieve_buckets_t *b)
+/* sieve one segment of SEGMENT_SIZE bits into array, the offsets in o are
+advanced to the next segment */
+{
+  int i,ii,j,p;
+  int *k_next=o->k;
+  unsigned int mask, medium_limit, n;
+  sieve_pk16_t *pk16;
+  sieve_pk32_t *pk32;
+  unsigned int *ptr, *ptr_max;
+  unsigned int pos[2];
+  sieve_pattern_t *pattern, *pat[2];
+
+  memcpy(array, ctx->sieve_base, SEGMENT_BYTES);
+
+/* primes 29 ... SIEVE_PATTERN_MAX: AND the precomputed patterns, two primes
+per pass. With an odd number of primes the last one is paired with itself. */
+  for(i=SIEVE_PATTERN_FIRST;i<(int)pattern_end;i+=2)
+  {
+    for(ii=0;ii<2;ii++)
+    {
+      pattern=&sieve_pattern[i+ii-SIEVE_PATTERN_FIRST];
+      if(i+ii<(int)pattern_end)
+      {
+        j=k_next[i+ii];
+        p=primes[i+ii];
+        pos[ii]=((unsigned int)(p-j)*pattern->inv32)%(unsigned int)p;
+        j-=(int)pattern->size_mod;
+        if(j<0)j+=p;
+        k_next[i+ii]=j;
+        pat[ii]=pattern;
+      }
+      else
+      {
+        pos[ii]=pos[0];
+        pat[ii]=pat[0];
+      }
+    }
+    sieve_pattern_and(array, SEGMENT_WORDS, pat[0], pos[0], pat[1], pos[1]);
+  }
+
+/*
+The next primes up to SIEVE_SPLIT have their own code. Since they are small
+they have many iterations in the inner loop. At the cost of some
+initialisation we can avoid calls to sieve_clear_bit() which calculates
+chunk and bit position in chunk on each call.
+Every 32 iterations they hit the same bit position so we can make use of
+this behaviour and precompute them. :)
+*/
+  for(i=pattern_end;i<SIEVE_SPLIT;i++)
+  {
+    j=k_next[i];
+    p=primes[i];
+//printf("sieve: %d\n",p);
+    for(ii=0; ii<32; ii++)
+    {
+      mask = mask0[j & 0x1F];
+
+      ptr = &(array[j>>5]);
+      ptr_max = &(array[SEGMENT_WORDS]);
+//      ptr_max is now always &(array[SEGMENT_SIZE>>5])+1
+//      this may result in one more loop than necessary. Advancing ptr by one more p
+//      does not matter as k_init is calculated %p
+//      if( ((unsigned int)j & 0x1F) < (SEGMENT_SIZE & 0x1F))ptr_max++;
+      while(ptr < ptr_max) /* inner loop, lets kick out some bits! */
+      {
+        *ptr &= mask;
+        ptr += p;
+      }
+      j+=p;
+    }
+    j = ((int)(ptr - array)<<5) + ((j-p) & 0x1F); /* D'oh! Pointer arithmetic... but it is faster! */
+    j -= SEGMENT_SIZE;
+    k_next[i] = j % p;
+  }
+
+  medium_limit = (sieve_limit < bucket_first) ? sieve_limit : bucket_first;
+  n = (medium_limit < pk16_end) ? medium_limit : pk16_end;
+  for(pk16=o->pk16;pk16<o->pk16+((int)n-SIEVE_SPLIT);pk16++)
+  {
+    j=pk16->k;
+    p=pk16->p;
+    while((unsigned int)j<SEGMENT_SIZE)
+    {
+      sieve_clear_bit(array,j);
+      j+=p;
+    }
+    pk16->k=(unsigned short)(j-SEGMENT_SIZE);
+  }
+  for(pk32=o->pk32;pk32<o->pk32+((int)medium_limit-(int)pk16_end);pk32++)
+  {
+    j=pk32->k;
+    p=(int)pk32->p;
+    while((unsigned int)j<SEGMENT_SIZE)
+    {
+      sieve_clear_bit(array,j);
+      j+=p;
+    }
+    pk32->k=j-SEGMENT_SIZE;
+  }
+
+  if(sieve_limit > bucket_first)
+  {
+    if(b->limit != sieve_limit) bucket_fill(b, ctx->k_init.k, sieve_limit);
+    bucket_sieve(b, array);
+  }
+  b->segment++;
+}
+
+#undef SEGMENT_WORDS
+#undef SEGMENT_BYTES
+#undef SEGMENT_SIZE
+#undef SEGMENT_NAME
@@ -0,0 +1,203 @@
+/*
+This file is part of mfaktc (mfakto).
+Copyright (C) 2009 - 2014  Oliver Weihe (o.weihe@t-online.de)
+                           Bertram Franz (bertramf@gmx.net)
+
+mfaktc (mfakto) is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+mfaktc (mfakto) is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with mfaktc (mfakto).  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include "threads.h"
+
+#if !(defined _MSC_VER || __MINGW32__)
+  #include <unistd.h>
+#endif
+
+int thread_create(thread_t *thread, thread_func_t func, void *arg)
+/* returns 0 on success */
+{
+#if defined _MSC_VER || __MINGW32__
+  *thread = CreateThread(NULL, 0, func, arg, 0, NULL);
+  return (*thread == NULL);
+#else
+  return pthread_create(thread, NULL, func, arg);
+#endif
+}
+
+void thread_join(thread_t thread)
+{
+#if defined _MSC_VER || __MINGW32__
+  WaitForSingleObject(thread, INFINITE);
+  CloseHandle(thread);
+#else
+  pthread_join(thread, NULL);
+#endif
+}
+
+void thread_mutex_init(thread_mutex_t *mutex)
+{
+#if defined _MSC_VER || __MINGW32__
+  InitializeCriticalSection(mutex);
+#else
+  pthread_mutex_init(mutex, NULL);
+#endif
+}
+
+void thread_mutex_destroy(thread_mutex_t *mutex)
+{
+#if defined _MSC_VER || __MINGW32__
+  DeleteCriticalSection(mutex);
+#else
+  pthread_mutex_destroy(mutex);
+#endif
+}
+
+void thread_mutex_lock(thread_mutex_t *mutex)
+{
+#if defined _MSC_VER || __MINGW32__
+  EnterCriticalSection(mutex);
+#else
+  pthread_mutex_lock(mutex);
+#endif
+}
+
+void thread_mutex_unlock(thread_mutex_t *mutex)
+{
+#if defined _MSC_VER || __MINGW32__
+  LeaveCriticalSection(mutex);
+#else
+  pthread_mutex_unlock(mutex);
+#endif
+}
+
+void thread_cond_init(thread_cond_t *cond)
+{
+#if defined _MSC_VER || __MINGW32__
+  InitializeConditionVariable(cond);
+#else
+  pthread_cond_init(cond, NULL);
+#endif
+}
+
+void thread_cond_destroy(thread_cond_t *cond)
+{
+#if defined _MSC_VER || __MINGW32__
+  (void) cond; // nothing to do for Win32 condition variables
+#else
+  pthread_cond_destroy(cond);
+#endif
+}
+
+void thread_cond_wait(thread_cond_t *cond, thread_mutex_t *mutex)
+{
+#if defined _MSC_VER || __MINGW32__
+  SleepConditionVariableCS(cond, mutex, INFINITE);
+#else
+  pthread_cond_wait(cond, mutex);
+#endif
+}
+
+void thread_cond_signal(thread_cond_t *cond)
+{
+#if defined _MSC_VER || __MINGW32__
+  WakeConditionVariable(cond);
+#else
+  pthread_cond_signal(cond);
+#endif
+}
+
+void thread_cond_broadcast(thread_cond_t *cond)
+{
+#if defined _MSC_VER || __MINGW32__
+  WakeAllConditionVariable(cond);
+#else
+  pthread_cond_broadcast(cond);
+#endif
+}
+
+unsigned int thread_num_cpus()
+/* returns the number of logical CPUs of this system, at least 1 */
+{
+  long n;
+#if defined _MSC_VER || __MINGW32__
+  SYSTEM_INFO si;
+  GetSystemInfo(&si);
+  n = (long) si.dwNumberOfProcessors;
+#else
+  n = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+  return (n < 1) ? 1 : (unsigned int) n;
+}
+
+unsigned int thread_l1_cache_size()
+/* returns the size of the L1 data cache of one CPU core in bytes, 0 if unknown */
+{
+#if defined _MSC_VER || __MINGW32__
+  SYSTEM_LOGICAL_PROCESSOR_INFORMATION info[256];
+  DWORD len = sizeof(info), i;
+
+  if (!GetLogicalProcessorInformation(info, &len)) return 0;
+  for (i = 0; i < len / sizeof(info[0]); i++)
+  {
+    if (info[i].Relationship == RelationCache && info[i].Cache.Level == 1 &&
+        (info[i].Cache.Type == CacheData || info[i].Cache.Type == CacheUnified))
+      return (unsigned int) info[i].Cache.Size;
+  }
+  return 0;
+#else
+  long n = -1;
+  FILE *f;
+
+#ifdef _SC_LEVEL1_DCACHE_SIZE
+  n = sysconf(_SC_LEVEL1_DCACHE_SIZE);
+#endif
+  if (n <= 0)
+  {
+    /* index0 is the L1 data cache on x86 Linux, the file contains e.g. "32K" */
+    f = fopen("/sys/devices/system/cpu/cpu0/cache/index0/size", "r");
+    if (f == NULL) return 0;
+    if (fscanf(f, "%ld", &n) != 1) n = 0;
+    fclose(f);
+    n *= 1024;
+  }
+  return (n < 1) ? 0 : (unsigned int) n;
+#endif
+}
+
+unsigned int thread_atomic_load(volatile unsigned int *ptr)
+{
+#if defined _MSC_VER || __MINGW32__
+  return (unsigned int) InterlockedCompareExchange((volatile LONG *)ptr, 0, 0);
+#else
+  return __atomic_load_n(ptr, __ATOMIC_ACQUIRE);
+#endif
+}
+
+void thread_atomic_store(volatile unsigned int *ptr, unsigned int value)
+{
+#if defined _MSC_VER || __MINGW32__
+  InterlockedExchange((volatile LONG *)ptr, (LONG) value);
+#else
+  __atomic_store_n(ptr, value, __ATOMIC_RELEASE);
+#endif
+}
+
+void thread_atomic_fence(void)
+{
+#if defined _MSC_VER || __MINGW32__
+  MemoryBarrier();
+#else
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+#endif
+}
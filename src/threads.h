@@ -0,0 +1,83 @@
+/*
+This file is part of mfaktc (mfakto).
+Copyright (C) 2009 - 2014  Oliver Weihe (o.weihe@t-online.de)
+                           Bertram Franz (bertramf@gmx.net)
+
+mfaktc (mfakto) is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+mfaktc (mfakto) is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with mfaktc (mfakto).  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* minimal portable wrapper around the native thread API:
+   Win32 threads on Windows, pthreads everywhere else */
+
+#ifndef THREADS_H_
+#define THREADS_H_
+
+#if defined _MSC_VER || __MINGW32__
+  #include <Windows.h>
+  typedef HANDLE             thread_t;
+  typedef CRITICAL_SECTION   thread_mutex_t;
+  typedef CONDITION_VARIABLE thread_cond_t;
+  typedef DWORD (WINAPI *thread_func_t)(LPVOID arg);
+  #define THREAD_FUNC(name) DWORD WINAPI name(LPVOID arg)
+  #define THREAD_RETURN return 0
+#else
+  #include <pthread.h>
+  typedef pthread_t          thread_t;
+  typedef pthread_mutex_t    thread_mutex_t;
+  typedef pthread_cond_t     thread_cond_t;
+  typedef void *(*thread_func_t)(void *arg);
+  #define THREAD_FUNC(name) void *name(void *arg)
+  #define THREAD_RETURN return NULL
+#endif
+
+/* storage class for the state of one OpenCL device (queue, kernels, buffers):
+   with several devices, each one is driven by its own thread */
+#if defined _MSC_VER
+  #define THREAD_LOCAL __declspec(thread)
+#else
+  #define THREAD_LOCAL __thread
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int  thread_create(thread_t *thread, thread_func_t func, void *arg);
+void thread_join(thread_t thread);
+
+void thread_mutex_init(thread_mutex_t *mutex);
+void thread_mutex_destroy(thread_mutex_t *mutex);
+void thread_mutex_lock(thread_mutex_t *mutex);
+void thread_mutex_unlock(thread_mutex_t *mutex);
+
+void thread_cond_init(thread_cond_t *cond);
+void thread_cond_destroy(thread_cond_t *cond);
+void thread_cond_wait(thread_cond_t *cond, thread_mutex_t *mutex);
+void thread_cond_signal(thread_cond_t *cond);
+void thread_cond_broadcast(thread_cond_t *cond);
+
+unsigned int thread_num_cpus();
+unsigned int thread_l1_cache_size();
+
+/* load with acquire / store with release semantics, for flags and counters
+   shared between two threads without a mutex */
+unsigned int thread_atomic_load(volatile unsigned int *ptr);
+void thread_atomic_store(volatile unsigned int *ptr, unsigned int value);
+/* full memory barrier: a store before it is visible before any load after it */
+void thread_atomic_fence(void);
+
+#ifdef __cplusplus
+}
+#endif
+#endif